@@ -141,8 +141,22 @@ VideoFrameQueue::VideoFrameQueue(ConnectionData cData, const StreamInfo *si,
 {
 }
 
+Frame* VideoFrameQueue::getRear()
+{
+    Frame *frame = AVFramedQueue::getRear();
+    InterleavedVideoFrame *vFrame = dynamic_cast<InterleavedVideoFrame*>(frame);
+
+    if (vFrame){
+        vFrame->detachBuffer();
+    }
+
+    return frame;
+}
+
 bool VideoFrameQueue::setup()
 {
+    std::shared_ptr<FrameBufferPool> pool;
+
     switch(streamInfo->video.codec) {
         case H264:
         case H265:
@@ -163,7 +177,8 @@ bool VideoFrameQueue::setup()
             }
             for (unsigned i=0; i<max; i++) {
                 frames[i] = InterleavedVideoFrame::createNew(streamInfo->video.codec,
-                        DEFAULT_WIDTH, DEFAULT_HEIGHT, streamInfo->video.pixelFormat);
+                        DEFAULT_WIDTH, DEFAULT_HEIGHT, streamInfo->video.pixelFormat, pool);
+                pool = dynamic_cast<InterleavedVideoFrame*>(frames[i])->getBufferPool();
             }
             break;
         default:
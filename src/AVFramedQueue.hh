@@ -106,6 +106,12 @@ public:
     static VideoFrameQueue* createNew(ConnectionData cData, const StreamInfo *si,
             unsigned maxFrames);
 
+    /**
+    * See FrameQueue::getRear. Buffers still shared with frames of other queues
+    * are detached before handing the frame to the writer.
+    */
+    virtual Frame *getRear();
+
 protected:
     VideoFrameQueue(ConnectionData cData, const StreamInfo *si, unsigned maxFrames);
 
@@ -22,11 +22,65 @@
 
 #include "AudioCircularBuffer.hh"
 #include "Utils.hh"
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <algorithm>
 
 #define MAX_DEVIATION_SAMPLES 64
 
+static size_t nextPowerOfTwo(size_t value)
+{
+    size_t p = 1;
+
+    while (p < value) {
+        p <<= 1;
+    }
+
+    return p;
+}
+
+static float readSample(const unsigned char *plane, unsigned i, SampleFmt fmt)
+{
+    switch (fmt) {
+        case U8P:
+            return plane[i];
+        case S16P:
+            return ((const int16_t*) plane)[i];
+        default:
+            return ((const float*) plane)[i];
+    }
+}
+
+static inline void storeSample(float value, uint8_t &dst) {dst = (uint8_t) lrintf(value);}
+static inline void storeSample(float value, int16_t &dst) {dst = (int16_t) lrintf(value);}
+static inline void storeSample(float value, float &dst) {dst = value;}
+
+/*! Linear interpolation of the input at phase, phase + step... while the position is
+    inside the input. Position -1 is the last sample of the previous input (last). */
+template <typename T>
+static unsigned interpolate(const T *in, unsigned inSamples, T *out, float last, double phase, double step)
+{
+    unsigned n = 0;
+    double pos = phase;
+    double frac;
+    float prev;
+    float next;
+    int i;
+
+    while (pos <= (double) inSamples - 1) {
+        i = (int) std::floor(pos);
+        frac = pos - i;
+        prev = i < 0 ? last : in[i];
+        next = i + 1 < (int) inSamples ? in[i + 1] : prev;
+        storeSample(prev + (next - prev)*frac, out[n++]);
+        pos += step;
+    }
+
+    return n;
+}
+
 AudioCircularBuffer* AudioCircularBuffer::createNew(struct ConnectionData cData, unsigned ch, unsigned sRate, unsigned maxSamples, SampleFmt sFmt)
 {
     AudioCircularBuffer* b = new AudioCircularBuffer(cData, ch, sRate, maxSamples, sFmt);
@@ -41,9 +95,11 @@ AudioCircularBuffer* AudioCircularBuffer::createNew(struct ConnectionData cData,
 }
 
 AudioCircularBuffer::AudioCircularBuffer(struct ConnectionData cData, unsigned ch, unsigned sRate, unsigned maxSamples, SampleFmt sFmt)
-: FrameQueue(cData), channels(ch), sampleRate(sRate), bytesPerSample(0), chMaxSamples(maxSamples), channelMaxLength(0), 
-sampleFormat(sFmt), fillNewFrame(true), inputFrame(NULL), outputFrame(NULL), dummyFrame(NULL), 
-synchronized(false), setupSuccess(false), tsDeviationThreshold(0), elements(0)
+: FrameQueue(cData), channels(ch), sampleRate(sRate), bytesPerSample(0), chMaxSamples(maxSamples), ringLength(0), ringMask(0),
+sampleFormat(sFmt), fillNewFrame(true), levelMetering(false), frontBytes(0), inputFrame(NULL), outputFrame(NULL), dummyFrame(NULL), 
+writePos(0), readPos(0), syncTimestamp(0), syncPos(0), synchronized(false), setupSuccess(false), syncSeq(0), sharedSyncTs(0),
+sharedSyncPos(0), orgTime(0), adaptive(false), targetBytes(0), primed(false), jitter(0), avgFill(0), driftSamples(0),
+driftPhase(0), lastInTs(0), driftFrame(NULL), tsDeviationThreshold(0)
 {
 
 }
@@ -52,46 +108,139 @@ AudioCircularBuffer::~AudioCircularBuffer()
 {
     if (setupSuccess) {
 
-        for (unsigned i=0; i<channels; i++) {
-            delete[] data[i];
-        }        
+        for (auto d : data) {
+            delete[] d;
+        }
         
         delete inputFrame;
         delete outputFrame;
+        delete dummyFrame;
+        delete driftFrame;
     }
 }
 
 Frame* AudioCircularBuffer::getRear()
 {
+    unsigned char *first[MAX_CHANNELS];
+    unsigned char *second[MAX_CHANNELS];
+    unsigned firstSamples;
+    unsigned samples = inputFrame->getMaxSamples();
+
+    //NOTE: the writer fills the ring directly when a whole frame fits before its end
+    if (reserveRear(samples, first, firstSamples, second) && firstSamples == samples) {
+        inputFrame->setPlanes(first);
+    } else {
+        inputFrame->resetPlanes();
+    }
+
     return inputFrame;
 }
 
 Frame* AudioCircularBuffer::getFront()
 {
     std::chrono::microseconds ts;
-    unsigned frontSampleIdx;
-
-    std::lock_guard<std::mutex> guard(mtx);
+    unsigned char *first[MAX_CHANNELS];
+    unsigned char *second[MAX_CHANNELS];
+    unsigned firstSamples;
+    unsigned samples;
+    size_t firstBytes;
+    size_t pending;
 
     if (!fillNewFrame) {
         return outputFrame;
     }
 
-    frontSampleIdx = front/bytesPerSample;
-    ts = std::chrono::microseconds(frontSampleIdx*std::micro::den/sampleRate) + syncTimestamp;
-    outputFrame->setPresentationTime(ts);
+    samples = outputFrame->getSamples();
 
-    if (!popFront(outputFrame->getPlanarDataBuf(), outputFrame->getSamples())) {
+    if (!peekFront(samples, first, firstSamples, second, ts)) {
         utils::debugMsg("There is not enough data to fill a frame. Impossible to get new frame!");
         return NULL;
     }
 
-    outputFrame->setOriginTime(orgTime - std::chrono::microseconds(elements*std::micro::den/(bytesPerSample*sampleRate)));
+    if (firstSamples == samples) {
+        outputFrame->setPlanes(first);
+    } else {
+        //NOTE: the frame wraps around the end of the ring, so it cannot be a view
+        outputFrame->resetPlanes();
+        firstBytes = firstSamples*bytesPerSample;
+
+        for (unsigned i=0; i<channels; i++) {
+            memcpy(outputFrame->getPlanarDataBuf()[i], first[i], firstBytes);
+            memcpy(outputFrame->getPlanarDataBuf()[i] + firstBytes, second[i], (samples - firstSamples)*bytesPerSample);
+        }
+    }
+
+    outputFrame->setPresentationTime(ts);
+
+    if (levelMetering) {
+        outputFrame->computeLevel();
+    }
+
+    frontBytes = samples*bytesPerSample;
+    pending = writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_relaxed) - frontBytes;
+    outputFrame->setOriginTime(std::chrono::system_clock::time_point(
+        std::chrono::system_clock::duration(orgTime.load(std::memory_order_relaxed))) -
+        std::chrono::microseconds(pending*std::micro::den/(bytesPerSample*sampleRate)));
     
     fillNewFrame = false;
     return outputFrame;
 }
 
+bool AudioCircularBuffer::peekFront(unsigned samples, unsigned char **first, unsigned &firstSamples,
+                                    unsigned char **second, std::chrono::microseconds &ts)
+{
+    std::chrono::microseconds sTs;
+    size_t sPos;
+    size_t r;
+    size_t w;
+    size_t bytes = samples*bytesPerSample;
+    size_t rMod;
+    size_t firstBytes;
+
+    //NOTE: sync is read before the write position, so sPos is never ahead of w
+    readSync(sTs, sPos);
+    w = writePos.load(std::memory_order_acquire);
+    r = readPos.load(std::memory_order_relaxed);
+
+    if (r < sPos) {
+        //NOTE: the writer flushed the buffer, samples before sPos are discarded
+        r = sPos;
+        readPos.store(r, std::memory_order_release);
+    }
+
+    if (w - r < bytes) {
+        primed = false;
+        return false;
+    }
+
+    //NOTE: after an underrun the reader waits for the jitter target, so it does not underrun again
+    if (adaptive.load(std::memory_order_relaxed) && !primed) {
+        if (w - r < bytes + targetBytes.load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        primed = true;
+    }
+
+    rMod = r & ringMask;
+    firstBytes = std::min(bytes, ringLength - rMod);
+
+    for (unsigned i=0; i<channels; i++) {
+        first[i] = data[i] + rMod;
+        second[i] = data[i];
+    }
+
+    firstSamples = firstBytes/bytesPerSample;
+    ts = std::chrono::microseconds((r - sPos)/bytesPerSample*std::micro::den/sampleRate) + sTs;
+
+    return true;
+}
+
+void AudioCircularBuffer::consumeFront(unsigned samples)
+{
+    readPos.store(readPos.load(std::memory_order_relaxed) + samples*bytesPerSample, std::memory_order_release);
+}
+
 //TODO it should return a vector of filter ids
 std::vector<int> AudioCircularBuffer::addFrame()
 {
@@ -99,26 +248,44 @@ std::vector<int> AudioCircularBuffer::addFrame()
     std::chrono::microseconds rearTs;
     std::chrono::microseconds deviation;
     std::vector<int> ret;
+    unsigned char *view[MAX_CHANNELS];
     unsigned paddingSamples;
-    unsigned rearSampleIdx;
+    int64_t threshold;
+    int64_t rearSamples;
+    size_t frameBytes;
+    size_t w;
+    double ratio = 1;
+    bool adaptiveMode = adaptive.load(std::memory_order_relaxed);
 
     inTs = inputFrame->getPresentationTime();
+    frameBytes = inputFrame->getSamples()*bytesPerSample;
+    w = writePos.load(std::memory_order_relaxed);
 
     if (!synchronized) {
-        syncTimestamp = inTs;
+        publishSync(inTs, w);
         synchronized = true;
+        driftSamples = 0;
+        driftPhase = 0;
+        avgFill = targetBytes.load(std::memory_order_relaxed)/bytesPerSample;
     }
 
-    rearSampleIdx = rear/bytesPerSample;
-    rearTs = std::chrono::microseconds(rearSampleIdx*std::micro::den/sampleRate) + syncTimestamp;
+    //NOTE: rear timestamp in the input timeline, stretched frames do not change it
+    rearSamples = (w - syncPos)/bytesPerSample - llround(driftSamples);
+    rearTs = std::chrono::microseconds(rearSamples*std::micro::den/sampleRate) + syncTimestamp;
     deviation = inTs - rearTs;
+    threshold = tsDeviationThreshold;
 
-    if (deviation.count() < -tsDeviationThreshold) {
+    if (adaptiveMode) {
+        updateJitter(inTs, inputFrame->getOriginTime());
+        threshold = std::max(threshold, (int64_t) (JITTER_TARGET_FACTOR*jitter*std::micro::den/sampleRate));
+    }
+
+    if (deviation.count() < -threshold) {
         utils::warningMsg("[AudioCircularBuffer] Timestamp from the past, discarding entire frame");
         return ret;
     }
 
-    if (deviation.count() > tsDeviationThreshold) {
+    if (deviation.count() > threshold) {
         utils::warningMsg("[AudioCircularBuffer] Deviation exceeded, introducing silence");
 
         paddingSamples = (deviation.count()*sampleRate)/std::micro::den;
@@ -129,20 +296,50 @@ std::vector<int> AudioCircularBuffer::addFrame()
             return ret;
         }
 
+        //NOTE: samples written in place must be moved after the padding
+        if (!inputFrame->ownsPlanes()) {
+            std::copy(inputFrame->getPlanarDataBuf(), inputFrame->getPlanarDataBuf() + channels, view);
+            inputFrame->resetPlanes();
+
+            for (unsigned i=0; i<channels; i++) {
+                memcpy(inputFrame->getPlanarDataBuf()[i], view[i], frameBytes);
+            }
+        }
+
         if(!pushBack(dummyFrame->getPlanarDataBuf(), paddingSamples)) {
             utils::warningMsg("[AudioCircularBuffer] Cannot push padding");
             return ret;
         }
+
+    } else if (adaptiveMode) {
+        //NOTE: jitter, the input timeline is realigned without touching the samples
+        driftSamples -= (double) deviation.count()*sampleRate/std::micro::den;
+        ratio = getDriftRatio();
     }
 
-    if(!pushBack(inputFrame->getPlanarDataBuf(), inputFrame->getSamples())) {
+    //NOTE: published by the write position store in pushBack
+    orgTime.store(inputFrame->getOriginTime().time_since_epoch().count(), std::memory_order_relaxed);
+
+    if (ratio != 1) {
+        if (!pushStretched(inputFrame->getPlanarDataBuf(), inputFrame->getSamples(), ratio)) {
+            utils::warningMsg("[AudioCircularBuffer] Cannot push frame");
+            return ret;
+        }
+    } else if (!inputFrame->ownsPlanes() && inputFrame->getSamples() <= inputFrame->getMaxSamples()) {
+        //NOTE: samples are already in the ring, getRear reserved the space
+        commitRear(inputFrame->getSamples());
+    } else if(!pushBack(inputFrame->getPlanarDataBuf(), inputFrame->getSamples())) {
         utils::warningMsg("[AudioCircularBuffer] Cannot push frame");
         return ret;
     }
-    
-    std::lock_guard<std::mutex> guard(mtx);
-    
-    orgTime = inputFrame->getOriginTime();
+
+    if (ratio == 1 && inputFrame->getSamples() > 0) {
+        driftPhase = 0;
+
+        for (unsigned i=0; i<channels; i++) {
+            lastSamples[i] = readSample(inputFrame->getPlanarDataBuf()[i], inputFrame->getSamples() - 1, sampleFormat);
+        }
+    }
     
     for (auto& r : connectionData.readers){
         ret.push_back(r.rFilterId);
@@ -151,21 +348,84 @@ std::vector<int> AudioCircularBuffer::addFrame()
     return ret;
 }
 
+void AudioCircularBuffer::updateJitter(std::chrono::microseconds inTs, std::chrono::system_clock::time_point arrival)
+{
+    std::chrono::microseconds transit;
+
+    if (arrival.time_since_epoch().count() == 0) {
+        return;
+    }
+
+    if (lastArrival.time_since_epoch().count() != 0) {
+        //NOTE: interarrival time minus timestamp increment, RFC 3550 section 6.4.1
+        transit = std::chrono::duration_cast<std::chrono::microseconds>(arrival - lastArrival) - (inTs - lastInTs);
+        jitter += (std::abs(transit.count())*sampleRate/(double) std::micro::den - jitter)/JITTER_HISTORY;
+        targetBytes.store(std::min((size_t) (JITTER_TARGET_FACTOR*jitter)*bytesPerSample, ringLength/2),
+                          std::memory_order_relaxed);
+    }
+
+    lastArrival = arrival;
+    lastInTs = inTs;
+}
+
+double AudioCircularBuffer::getDriftRatio()
+{
+    double error;
+
+    avgFill += (getUsedBytes()/bytesPerSample - avgFill)/FILL_HISTORY;
+    error = avgFill - targetBytes.load(std::memory_order_relaxed)/bytesPerSample;
+
+    //NOTE: the fill oscillates by a reader frame between reads
+    if (std::abs(error) < outputFrame->getSamples()) {
+        return 1;
+    }
+
+    //NOTE: a fill error is corrected in about one second
+    return 1 - std::max(-MAX_DRIFT_CORRECTION, std::min(MAX_DRIFT_CORRECTION, error/sampleRate));
+}
+
 int AudioCircularBuffer::removeFrame()
 {
+    if (!fillNewFrame) {
+        consumeFront(frontBytes/bytesPerSample);
+    }
+
     fillNewFrame = true;
     return connectionData.wFilterId;
 }
 
 void AudioCircularBuffer::doFlush()
 {
-    std::lock_guard<std::mutex> guard(mtx);
-    rear = 0;
-    front = 0;
-    elements = 0;
+    //NOTE: the reader discards the buffered samples when it sees the new sync position
+    publishSync(syncTimestamp, writePos.load(std::memory_order_relaxed));
     synchronized = false;
 }
 
+void AudioCircularBuffer::publishSync(std::chrono::microseconds ts, size_t pos)
+{
+    unsigned seq = syncSeq.load(std::memory_order_relaxed);
+
+    syncTimestamp = ts;
+    syncPos = pos;
+
+    syncSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    sharedSyncTs.store(ts.count(), std::memory_order_relaxed);
+    sharedSyncPos.store(pos, std::memory_order_relaxed);
+    syncSeq.store(seq + 2, std::memory_order_release);
+}
+
+void AudioCircularBuffer::readSync(std::chrono::microseconds &ts, size_t &pos) const
+{
+    unsigned seq;
+
+    do {
+        seq = syncSeq.load(std::memory_order_acquire);
+        ts = std::chrono::microseconds(sharedSyncTs.load(std::memory_order_relaxed));
+        pos = sharedSyncPos.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != syncSeq.load(std::memory_order_relaxed));
+}
 
 Frame* AudioCircularBuffer::forceGetRear()
 {
@@ -179,7 +439,7 @@ Frame* AudioCircularBuffer::forceGetFront()
 
 bool AudioCircularBuffer::setup()
 {
-    if (channels <= 0 || sampleRate <= 0 || chMaxSamples <= 0) {
+    if (channels <= 0 || channels > MAX_CHANNELS || sampleRate <= 0 || chMaxSamples <= 0) {
         return false;
     }
 
@@ -199,16 +459,20 @@ bool AudioCircularBuffer::setup()
             return false;
     }
 
-    channelMaxLength = chMaxSamples*(sampleRate/1000) * bytesPerSample;
+    ringLength = nextPowerOfTwo(chMaxSamples*(sampleRate/1000)) * bytesPerSample;
+    ringMask = ringLength - 1;
 
     for (unsigned i=0; i<channels; i++) {
-        data[i] = new unsigned char [channelMaxLength]();
+        data.push_back(new unsigned char [ringLength]());
     }
 
     inputFrame = PlanarAudioFrame::createNew(channels, sampleRate, AudioFrame::getMaxSamples(sampleRate), PCM, sampleFormat);
     outputFrame = PlanarAudioFrame::createNew(channels, sampleRate, AudioFrame::getMaxSamples(sampleRate), PCM, sampleFormat);
     dummyFrame = PlanarAudioFrame::createNew(channels, sampleRate, AudioFrame::getMaxSamples(sampleRate), PCM, sampleFormat);
     dummyFrame->fillWithValue(0);
+    //NOTE: stretched frames are slightly longer than the input ones
+    driftFrame = PlanarAudioFrame::createNew(channels, sampleRate, 2*AudioFrame::getMaxSamples(sampleRate), PCM, sampleFormat);
+    lastSamples.assign(channels, 0);
 
     outputFrame->setSamples(AudioFrame::getDefaultSamples(sampleRate));
     outputFrame->setLength(AudioFrame::getDefaultSamples(sampleRate)*bytesPerSample);
@@ -220,86 +484,67 @@ bool AudioCircularBuffer::setup()
 }
 
 
-bool AudioCircularBuffer::pushBack(unsigned char **buffer, int samplesRequested)
+bool AudioCircularBuffer::reserveRear(unsigned samples, unsigned char **first, unsigned &firstSamples,
+                                      unsigned char **second)
 {
-    unsigned bytesRequested = samplesRequested * bytesPerSample;
-    unsigned rearMod;
-    int firstCopiedBytes;
+    size_t bytes = samples*bytesPerSample;
+    size_t w = writePos.load(std::memory_order_relaxed);
+    size_t wMod;
 
-    if (bytesRequested > (channelMaxLength - elements)) {
+    //NOTE: the real read position is used, the reader may still be reading flushed samples
+    if (bytes > ringLength - (w - readPos.load(std::memory_order_acquire))) {
         return false;
     }
 
-    rearMod = rear % channelMaxLength;
-
-    if ((rearMod + bytesRequested) < channelMaxLength) {
+    wMod = w & ringMask;
 
-        for (unsigned i=0; i<channels; i++) {
-            memcpy(data[i] + rearMod, buffer[i], bytesRequested);
-        }
-
-    } else {
-
-        firstCopiedBytes = channelMaxLength - rearMod;
-        
-        for (unsigned i=0; i<channels;  i++) {
-            memcpy(data[i] + rearMod, buffer[i], firstCopiedBytes);
-            memcpy(data[i], buffer[i] + firstCopiedBytes, bytesRequested - firstCopiedBytes);
-        }
+    for (unsigned i=0; i<channels; i++) {
+        first[i] = data[i] + wMod;
+        second[i] = data[i];
     }
 
-    elements += bytesRequested;
-    rear += bytesRequested;
+    firstSamples = std::min(bytes, ringLength - wMod)/bytesPerSample;
     return true;
 }
 
-bool AudioCircularBuffer::popFront(unsigned char **buffer, unsigned samplesRequested)
+void AudioCircularBuffer::commitRear(unsigned samples)
 {
-    unsigned bytesRequested = samplesRequested * bytesPerSample;
+    writePos.store(writePos.load(std::memory_order_relaxed) + samples*bytesPerSample, std::memory_order_release);
+}
 
-    if (elements < bytesRequested) {
+bool AudioCircularBuffer::pushBack(unsigned char **buffer, int samplesRequested)
+{
+    unsigned char *first[MAX_CHANNELS];
+    unsigned char *second[MAX_CHANNELS];
+    unsigned firstSamples;
+    size_t firstCopiedBytes;
+
+    if (!reserveRear(samplesRequested, first, firstSamples, second)) {
         return false;
     }
 
-    fillOutputBuffers(buffer, bytesRequested);
+    firstCopiedBytes = firstSamples*bytesPerSample;
+
+    for (unsigned i=0; i<channels; i++) {
+        memcpy(first[i], buffer[i], firstCopiedBytes);
+        memcpy(second[i], buffer[i] + firstCopiedBytes, (samplesRequested - firstSamples)*bytesPerSample);
+    }
 
+    commitRear(samplesRequested);
     return true;
 }
 
-void AudioCircularBuffer::fillOutputBuffers(unsigned char **buffer, int bytesRequested)
+size_t AudioCircularBuffer::getUsedBytes() const
 {
-    int firstCopiedBytes = 0;
-    unsigned frontMod;
-
-    frontMod = front % channelMaxLength;
-
-    if (frontMod + bytesRequested < channelMaxLength) {
-        for (unsigned i=0; i<channels; i++) {
-            memcpy(buffer[i], data[i] + frontMod, bytesRequested);
-        }
-
-    } else {
-        firstCopiedBytes = channelMaxLength - frontMod;
-
-        for (unsigned i=0; i<channels;  i++) {
-            memcpy(buffer[i], data[i] + frontMod, firstCopiedBytes);
-            memcpy(buffer[i] + firstCopiedBytes, data[i], bytesRequested - firstCopiedBytes);
-        }
-    }
+    size_t w = writePos.load(std::memory_order_acquire);
+    size_t r = std::max(readPos.load(std::memory_order_acquire), sharedSyncPos.load(std::memory_order_relaxed));
 
-    elements -= bytesRequested;
-    front += bytesRequested;
+    return w > r ? w - r : 0;
 }
 
 int AudioCircularBuffer::getFreeSamples()
 {
-    int freeBytes = channelMaxLength - elements;
-
-    if (freeBytes == 0) {
-        return freeBytes;
-    }
-
-    return (freeBytes/bytesPerSample);
+    return (ringLength - (writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_acquire)))/bytesPerSample;
 }
 
 bool AudioCircularBuffer::forcePushBack(unsigned char **buffer, int samplesRequested)
@@ -315,6 +560,38 @@ bool AudioCircularBuffer::forcePushBack(unsigned char **buffer, int samplesReque
     return true;
 }
 
+bool AudioCircularBuffer::pushStretched(unsigned char **buffer, unsigned samples, double ratio)
+{
+    unsigned char **out = driftFrame->getPlanarDataBuf();
+    double step = 1/ratio;
+    unsigned outSamples = 0;
+
+    if (samples == 0 || (samples + 1)*ratio > driftFrame->getMaxSamples()) {
+        return false;
+    }
+
+    for (unsigned i=0; i<channels; i++) {
+        switch (sampleFormat) {
+            case U8P:
+                outSamples = interpolate((uint8_t*) buffer[i], samples, (uint8_t*) out[i], lastSamples[i], driftPhase, step);
+                break;
+            case S16P:
+                outSamples = interpolate((int16_t*) buffer[i], samples, (int16_t*) out[i], lastSamples[i], driftPhase, step);
+                break;
+            default:
+                outSamples = interpolate((float*) buffer[i], samples, (float*) out[i], lastSamples[i], driftPhase, step);
+                break;
+        }
+
+        lastSamples[i] = readSample(buffer[i], samples - 1, sampleFormat);
+    }
+
+    driftPhase += outSamples*step - samples;
+    driftSamples += (double) outSamples - samples;
+
+    return pushBack(out, outSamples);
+}
+
 void AudioCircularBuffer::setOutputFrameSamples(int samples) 
 {
     outputFrame->setSamples(samples);
@@ -323,11 +600,10 @@ void AudioCircularBuffer::setOutputFrameSamples(int samples)
 
 unsigned AudioCircularBuffer::getElements() const
 {
-    return elements/(outputFrame->getSamples()*bytesPerSample);
+    return getUsedBytes()/(outputFrame->getSamples()*bytesPerSample);
 }
 
 bool AudioCircularBuffer::isFull() const
 {
-    return ((float) elements)/chMaxSamples >= FULL_THRESHOLD;
+    return ((float) getUsedBytes())/chMaxSamples >= FULL_THRESHOLD;
 }
-
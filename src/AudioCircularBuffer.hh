@@ -26,10 +26,24 @@
 #include "Types.hh"
 #include "FrameQueue.hh"
 #include "AudioFrame.hh"
-#include <mutex>
+#include <atomic>
 
 #define DEFAULT_BUFFER_SIZE 32768 //samples (~600ms at 48KHz)
 
+//NOTE: adaptive alignment parameters, see AudioCircularBuffer::setAdaptiveAlignment
+#define JITTER_HISTORY 16 //arrivals, as the RFC 3550 interarrival jitter estimator
+#define JITTER_TARGET_FACTOR 4 //target fill in mean jitter deviations
+#define FILL_HISTORY 32 //arrivals
+#define MAX_DRIFT_CORRECTION 0.005 //rate deviation, inaudible
+
+/*! Single producer/single consumer ring of planar audio samples. The writer
+    thread pushes frames through getRear/addFrame and the reader thread gets
+    fixed size frames through getFront/removeFrame (or peekFront/consumeFront),
+    without any lock: read and write positions are monotonic byte counters
+    published with acquire/release semantics. Ring length is a power of two,
+    so positions are wrapped with a mask. Input and output frames are views of
+    the ring memory unless they wrap around its end, so producers (i.e. the
+    audio decoder) write their samples straight into the ring. */
 
  class AudioCircularBuffer : public FrameQueue {
 
@@ -38,6 +52,27 @@ public:
     ~AudioCircularBuffer();
     void setOutputFrameSamples(int samples); 
 
+    /**
+    * Enables computing the level of the output frames, see AudioFrame::getLevel
+    * @param enable level metering
+    */
+    void setLevelMetering(bool enable) {levelMetering = enable;};
+
+    /**
+    * Enables adaptive alignment. The arrival jitter of input frames (origin time
+    * against presentation time) is tracked and the reader waits, after an underrun,
+    * until the buffer holds the fill it needs. Timestamp deviations below the jitter
+    * are absorbed, and clock drift is corrected by stretching input frames slightly
+    * to keep the fill at its target, instead of padding or dropping samples.
+    * @param enable adaptive alignment
+    */
+    void setAdaptiveAlignment(bool enable) {adaptive = enable;};
+
+    /**
+    * @return fill the reader waits for after an underrun, in samples per channel
+    */
+    unsigned getTargetSamples() const {return targetBytes.load(std::memory_order_relaxed)/bytesPerSample;};
+
     /**
     * See FrameQueue::getRear
     */
@@ -61,6 +96,47 @@ public:
     
     void doFlush();
     
+    /**
+    * Gives direct access to the oldest samples, which are split in two spans when
+    * they wrap around the end of the ring: the first one starts at the read position
+    * and the second one at the beginning of the ring. Samples stay valid until
+    * they are consumed. Only the reader thread can call it.
+    * @param samples per channel to access
+    * @param first planes of the first span, one per channel
+    * @param firstSamples samples of the first span, the rest are in the second one
+    * @param second planes of the second span, one per channel
+    * @param ts presentation time of the first sample
+    * @return false if there are not enough samples
+    */
+    bool peekFront(unsigned samples, unsigned char **first, unsigned &firstSamples,
+                   unsigned char **second, std::chrono::microseconds &ts);
+
+    /**
+    * Releases the oldest samples, previously accessed with peekFront
+    * @param samples per channel to release
+    */
+    void consumeFront(unsigned samples);
+
+    /**
+    * Gives direct access to the free space after the newest samples, split in two
+    * spans when it wraps around the end of the ring like in peekFront. Written
+    * samples are not visible to the reader until they are committed. Only the
+    * writer thread can call it.
+    * @param samples per channel to reserve
+    * @param first planes of the first span, one per channel
+    * @param firstSamples samples of the first span, the rest are in the second one
+    * @param second planes of the second span, one per channel
+    * @return false if there is not enough free space
+    */
+    bool reserveRear(unsigned samples, unsigned char **first, unsigned &firstSamples,
+                     unsigned char **second);
+
+    /**
+    * Publishes samples previously written through reserveRear
+    * @param samples per channel to publish
+    */
+    void commitRear(unsigned samples);
+
     /**
     * See FrameQueue::forceGetRear
     */
@@ -82,6 +158,12 @@ public:
      * @return max number of samples.
      */
     unsigned getChannelMaxSamples() {return chMaxSamples;};
+
+    /**
+     * returns the sample rate of the buffered samples.
+     * @return sample rate.
+     */
+    unsigned getSampleRate() const {return sampleRate;};
     
     /**
     * See FrameQueue::getElements
@@ -99,33 +181,66 @@ private:
 
     bool pushBack(unsigned char **buffer, int samplesRequested);
     bool forcePushBack(unsigned char **buffer, int samplesRequested);
-    bool popFront(unsigned char **buffer, unsigned samplesRequested);
-    void fillOutputBuffers(unsigned char **buffer, int bytesRequested);
+    bool pushStretched(unsigned char **buffer, unsigned samples, double ratio);
+    void updateJitter(std::chrono::microseconds inTs, std::chrono::system_clock::time_point arrival);
+    double getDriftRatio();
+    void publishSync(std::chrono::microseconds ts, size_t pos);
+    void readSync(std::chrono::microseconds &ts, size_t &pos) const;
+    size_t getUsedBytes() const;
     bool setup();
 
     unsigned channels;
     unsigned sampleRate;
     unsigned bytesPerSample;
     unsigned chMaxSamples;
-    unsigned channelMaxLength;
-    unsigned char *data[MAX_CHANNELS];
+    size_t ringLength;
+    size_t ringMask;
+    std::vector<unsigned char*> data;
     SampleFmt sampleFormat;
     bool fillNewFrame;
+    bool levelMetering;
+    size_t frontBytes;
 
     PlanarAudioFrame* inputFrame;
     PlanarAudioFrame* outputFrame;
     PlanarAudioFrame* dummyFrame;
 
+    //NOTE: byte counters, writePos is only modified by the writer and readPos by the reader
+    std::atomic<size_t> writePos;
+    std::atomic<size_t> readPos;
+
+    //NOTE: writer side synchronization, samples from syncPos on are timestamped from syncTimestamp
     std::chrono::microseconds syncTimestamp;
+    size_t syncPos;
     bool synchronized;
     bool setupSuccess;
-    
-    std::chrono::system_clock::time_point orgTime;
 
-    int tsDeviationThreshold;
-    std::mutex mtx;
+    //NOTE: synchronization shared with the reader through a sequence lock. The reader
+    //skips the samples before sharedSyncPos, so flushing does not need to touch readPos
+    std::atomic<unsigned> syncSeq;
+    std::atomic<int64_t> sharedSyncTs;
+    std::atomic<size_t> sharedSyncPos;
+
+    std::atomic<int64_t> orgTime;
+
+    //NOTE: adaptive alignment, targetBytes is shared and primed is reader side
+    std::atomic<bool> adaptive;
+    std::atomic<size_t> targetBytes;
+    bool primed;
+
+    //NOTE: adaptive alignment writer side, in samples. driftSamples is the difference between
+    //the samples pushed and the input ones since the last sync, driftPhase is the position of
+    //the next stretched sample relative to the next input one
+    double jitter;
+    double avgFill;
+    double driftSamples;
+    double driftPhase;
+    std::vector<float> lastSamples;
+    std::chrono::microseconds lastInTs;
+    std::chrono::system_clock::time_point lastArrival;
+    PlanarAudioFrame* driftFrame;
 
-    unsigned elements;
+    int tsDeviationThreshold;
 };
 
 #endif
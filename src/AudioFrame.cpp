@@ -24,6 +24,10 @@
 #include <iostream>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
 #include "Utils.hh"
 
 int AudioFrame::getMaxSamples(int sampleRate)
@@ -38,7 +42,7 @@ int AudioFrame::getDefaultSamples(int sampleRate)
 
 
 AudioFrame::AudioFrame(int ch, int sRate, int maxSmpls, ACodecType codec, SampleFmt sFmt) : 
-Frame(), channels(ch), sampleRate(sRate), samples(0), maxSamples(maxSmpls), fCodec(codec), sampleFmt(sFmt)
+Frame(), channels(ch), sampleRate(sRate), samples(0), maxSamples(maxSmpls), level(-1), fCodec(codec), sampleFmt(sFmt)
 {
     bytesPerSample = utils::getBytesPerSampleFromFormat(sFmt);
 }
@@ -61,14 +65,21 @@ InterleavedAudioFrame* InterleavedAudioFrame::createNew(int ch, int sRate, int m
         return NULL;
     }
 
+    if (ch <= 0 || ch > MAX_CHANNELS) {
+        utils::errorMsg("[InterleavedAudioFrame] Channels must be between 1 and " + std::to_string(MAX_CHANNELS));
+        return NULL;
+    }
+
     return new InterleavedAudioFrame(ch, sRate, maxSamples, codec, sFmt);
 }
 
 InterleavedAudioFrame::InterleavedAudioFrame(int ch, int sRate, int maxSamples, ACodecType codec, SampleFmt sFmt)
 : AudioFrame(ch, sRate, maxSamples, codec, sFmt)
 {
-    bufferMaxLen = bytesPerSample * maxSamples * MAX_CHANNELS;
+    //NOTE: never smaller than a stereo frame, coded frames may not know their channels
+    bufferMaxLen = bytesPerSample * maxSamples * std::max(ch, DEFAULT_CHANNELS);
     frameBuff = new unsigned char [bufferMaxLen]();
+    bufferLen = 0;
 }
 
 InterleavedAudioFrame::~InterleavedAudioFrame() 
@@ -76,9 +87,30 @@ InterleavedAudioFrame::~InterleavedAudioFrame()
     delete[] frameBuff;
 }
 
+void InterleavedAudioFrame::setChannels(int ch)
+{
+    unsigned newMaxLen = bytesPerSample * maxSamples * ch;
+    unsigned char *newBuff;
+
+    if (ch <= 0 || ch > MAX_CHANNELS) {
+        utils::errorMsg("[InterleavedAudioFrame] Channels must be between 1 and " + std::to_string(MAX_CHANNELS));
+        return;
+    }
+
+    if (newMaxLen > bufferMaxLen) {
+        newBuff = new unsigned char [newMaxLen]();
+        memcpy(newBuff, frameBuff, std::min(bufferLen, bufferMaxLen));
+        delete[] frameBuff;
+        frameBuff = newBuff;
+        bufferMaxLen = newMaxLen;
+    }
+
+    channels = ch;
+}
+
 void InterleavedAudioFrame::fillWithValue(int value)
 {
-    memset(frameBuff, value, bufferMaxLen*channels);
+    memset(frameBuff, value, bufferMaxLen);
 }    
 
 
@@ -94,6 +126,11 @@ PlanarAudioFrame* PlanarAudioFrame::createNew(int ch, int sRate, int maxSamples,
         return NULL;
     }
 
+    if (ch <= 0 || ch > MAX_CHANNELS) {
+        utils::errorMsg("[PlanarAudioFrame] Channels must be between 1 and " + std::to_string(MAX_CHANNELS));
+        return NULL;
+    }
+
     return new PlanarAudioFrame(ch, sRate, maxSamples, codec, sFmt);
 }
 
@@ -101,22 +138,98 @@ PlanarAudioFrame::PlanarAudioFrame(int ch, int sRate, int maxSamples, ACodecType
 : AudioFrame(ch, sRate, maxSamples, codec, sFmt)
 {
     bufferMaxLen = bytesPerSample * maxSamples;
+    bufferLen = 0;
 
-    for (int i=0; i<MAX_CHANNELS; i++) {
-        frameBuff[i] = new unsigned char [bufferMaxLen]();
+    //NOTE: never less planes than a stereo frame
+    for (int i=0; i<std::max(ch, DEFAULT_CHANNELS); i++) {
+        frameBuff.push_back(new unsigned char [bufferMaxLen]());
+        planes.push_back(frameBuff.back());
     }
 }
 
 PlanarAudioFrame::~PlanarAudioFrame()
 {
-    for (int i = 0; i < MAX_CHANNELS; i++) {
-        delete[] frameBuff[i];
+    for (auto b : frameBuff) {
+        delete[] b;
     }
 }
 
+void PlanarAudioFrame::setChannels(int ch)
+{
+    if (ch <= 0 || ch > MAX_CHANNELS) {
+        utils::errorMsg("[PlanarAudioFrame] Channels must be between 1 and " + std::to_string(MAX_CHANNELS));
+        return;
+    }
+
+    //NOTE: views only point to the planes of their channels, new ones would be the frame buffers
+    if (!ownsPlanes() && (unsigned) ch != channels) {
+        utils::errorMsg("[PlanarAudioFrame] Channels of a view cannot be changed");
+        return;
+    }
+
+    while (frameBuff.size() < (unsigned) ch) {
+        frameBuff.push_back(new unsigned char [bufferMaxLen]());
+        planes.push_back(frameBuff.back());
+    }
+
+    channels = ch;
+}
+
 void PlanarAudioFrame::fillWithValue(int value)
 {
     for (unsigned i = 0; i < channels; i++) {
         memset(frameBuff[i], value, bufferMaxLen);
     }
-} 
\ No newline at end of file
+
+    resetPlanes();
+} 
+
+void PlanarAudioFrame::setPlanes(unsigned char **p)
+{
+    for (unsigned i = 0; i < channels; i++) {
+        planes[i] = p[i];
+    }
+}
+
+void PlanarAudioFrame::resetPlanes()
+{
+    planes = frameBuff;
+}
+
+void PlanarAudioFrame::computeLevel()
+{
+    int peak = 0;
+    float fPeak = 0;
+
+    //NOTE: plain loops over contiguous planes, compilers vectorize them
+    for (unsigned i = 0; i < channels; i++) {
+        switch (sampleFmt) {
+            case U8P:
+                for (unsigned j = 0; j < samples; j++) {
+                    peak = std::max(peak, std::abs(planes[i][j] - 128));
+                }
+                break;
+            case S16P:
+                for (unsigned j = 0; j < samples; j++) {
+                    peak = std::max(peak, std::abs((int) ((int16_t*) planes[i])[j]));
+                }
+                break;
+            case FLTP:
+                for (unsigned j = 0; j < samples; j++) {
+                    fPeak = std::max(fPeak, std::fabs(((float*) planes[i])[j]));
+                }
+                break;
+            default:
+                level = -1;
+                return;
+        }
+    }
+
+    if (sampleFmt == U8P) {
+        fPeak = peak / 128.0f;
+    } else if (sampleFmt == S16P) {
+        fPeak = peak / 32768.0f;
+    }
+
+    level = fPeak;
+}
@@ -28,7 +28,10 @@
 #include <string>
 
 #define DEFAULT_CHANNELS 2
-#define MAX_CHANNELS 2
+//NOTE: it can be overridden at build time (i.e. CPPFLAGS=-DMAX_CHANNELS=32)
+#ifndef MAX_CHANNELS
+#define MAX_CHANNELS 16
+#endif
 #define DEFAULT_SAMPLE_RATE 48000
 #define MAX_FRAME_TIME 100 //ms
 #define DEFAULT_FRAME_TIME 20000 //us
@@ -37,9 +40,13 @@ class AudioFrame : public Frame {
     
     public:
         AudioFrame(int ch, int sRate, int maxSmpls, ACodecType codec, SampleFmt sFmt);
-        AudioFrame() {};
+        AudioFrame() : level(-1) {};
 
-        void setChannels(int ch) {channels = ch;};
+        /**
+        * Sets the channels of the frame, buffers grow when needed
+        * @param ch channels, up to MAX_CHANNELS
+        */
+        virtual void setChannels(int ch) {channels = ch;};
         void setSampleRate(int sRate) {sampleRate = sRate;};
         void setSampleFormat(SampleFmt sFmt) {sampleFmt = sFmt;};
         void setCodec(ACodecType cType) {fCodec = cType;};
@@ -55,9 +62,15 @@ class AudioFrame : public Frame {
         static int getMaxSamples(int sampleRate);
         static int getDefaultSamples(int sampleRate);
         std::chrono::nanoseconds getDuration() const;
+        /**
+        * Peak absolute sample value of the frame in [0, 1], negative when it is not computed
+        */
+        float getLevel() {return level;};
+        void setLevel(float l) {level = l;};
               
     protected:
         unsigned channels, sampleRate, samples, maxSamples, bytesPerSample;
+        float level;
         ACodecType fCodec;
         SampleFmt sampleFmt;
 };
@@ -73,6 +86,7 @@ class InterleavedAudioFrame : public AudioFrame {
         unsigned int getMaxLength() {return bufferMaxLen;};
         bool isPlanar() {return false;};
         void setLength(unsigned int length) {bufferLen = length;};
+        void setChannels(int ch);
         void fillWithValue(int value);
 
     protected:
@@ -90,16 +104,41 @@ class PlanarAudioFrame : public AudioFrame {
         ~PlanarAudioFrame();
 
         unsigned char *getDataBuf() {return NULL;};
-        unsigned char** getPlanarDataBuf() {return frameBuff;};
+        unsigned char** getPlanarDataBuf() {return planes.data();};
         unsigned int getLength() {return bufferLen;};
         unsigned int getMaxLength() {return bufferMaxLen;};
         bool isPlanar() {return true;};
         void setLength(unsigned int length) {bufferLen = length;};
+        /**
+        * Sets the channels of the frame, views (see setPlanes) keep theirs
+        * @param ch channels, up to MAX_CHANNELS
+        */
+        void setChannels(int ch);
         void fillWithValue(int value);
+        /**
+        * Computes the frame level, see AudioFrame::getLevel
+        */
+        void computeLevel();
+        /**
+        * Makes the frame a view of external planes (i.e. AudioCircularBuffer ring memory)
+        * instead of its own buffers. Planes must outlive the view.
+        * @param p planes, one per channel
+        */
+        void setPlanes(unsigned char **p);
+        /**
+        * Makes the frame use its own buffers again
+        */
+        void resetPlanes();
+        /**
+        * @return true if the frame data is in its own buffers
+        */
+        bool ownsPlanes() {return planes[0] == frameBuff[0];};
 
     private:
         PlanarAudioFrame(int ch, int sRate, int maxSamples, ACodecType codec, SampleFmt sFmt);
-        unsigned char* frameBuff[MAX_CHANNELS];
+        //NOTE: one plane per channel, planes may point to external buffers
+        std::vector<unsigned char*> frameBuff;
+        std::vector<unsigned char*> planes;
         unsigned int bufferLen;
         unsigned int bufferMaxLen;
 };
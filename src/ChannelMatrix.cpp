@@ -0,0 +1,167 @@
+/*
+ *  ChannelMatrix.cpp - Channel layout conversion matrices
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ChannelMatrix.hh"
+
+#include <cmath>
+#include <algorithm>
+
+#define MINUS_3DB 0.7071068f
+
+enum Speaker {FL, FR, FC, LFE, BL, BR, SL, SR, NO_SPEAKER};
+
+static const Speaker monoLayout[] = {FC};
+static const Speaker stereoLayout[] = {FL, FR};
+static const Speaker surround51Layout[] = {FL, FR, FC, LFE, SL, SR};
+static const Speaker surround71Layout[] = {FL, FR, FC, LFE, BL, BR, SL, SR};
+
+static const Speaker* getLayout(unsigned channels)
+{
+    switch (channels) {
+        case 1:
+            return monoLayout;
+        case 2:
+            return stereoLayout;
+        case 6:
+            return surround51Layout;
+        case 8:
+            return surround71Layout;
+        default:
+            return NULL;
+    }
+}
+
+static int findSpeaker(const Speaker* layout, unsigned channels, Speaker s)
+{
+    for (unsigned i = 0; i < channels; i++) {
+        if (layout[i] == s) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*! Adds the input channel 'in' to the output speaker s, folding it into the
+    nearest output speakers when s is not in the output layout */
+static void addSpeaker(std::vector<float> &matrix, const Speaker* layout, unsigned outChannels,
+                       unsigned inChannels, unsigned in, Speaker s, float coef)
+{
+    int out = findSpeaker(layout, outChannels, s);
+
+    if (out >= 0) {
+        matrix[out*inChannels + in] += coef;
+        return;
+    }
+
+    switch (s) {
+        case FC:
+            addSpeaker(matrix, layout, outChannels, inChannels, in, FL, coef*MINUS_3DB);
+            addSpeaker(matrix, layout, outChannels, inChannels, in, FR, coef*MINUS_3DB);
+            break;
+        case FL:
+        case FR:
+            addSpeaker(matrix, layout, outChannels, inChannels, in, FC, coef*MINUS_3DB);
+            break;
+        case BL:
+        case SL:
+            if (findSpeaker(layout, outChannels, s == BL ? SL : BL) >= 0) {
+                addSpeaker(matrix, layout, outChannels, inChannels, in, s == BL ? SL : BL, coef);
+            } else {
+                addSpeaker(matrix, layout, outChannels, inChannels, in, FL, coef*MINUS_3DB);
+            }
+            break;
+        case BR:
+        case SR:
+            if (findSpeaker(layout, outChannels, s == BR ? SR : BR) >= 0) {
+                addSpeaker(matrix, layout, outChannels, inChannels, in, s == BR ? SR : BR, coef);
+            } else {
+                addSpeaker(matrix, layout, outChannels, inChannels, in, FR, coef*MINUS_3DB);
+            }
+            break;
+        default:
+            //NOTE: LFE is dropped
+            break;
+    }
+}
+
+namespace channelmatrix
+{
+    bool getMatrix(unsigned inChannels, unsigned outChannels, std::vector<float> &matrix)
+    {
+        const Speaker* inLayout = getLayout(inChannels);
+        const Speaker* outLayout = getLayout(outChannels);
+        const Speaker surrounds[] = {BL, SL, BR, SR};
+        unsigned leftSurrounds = 0;
+        float maxSum = 0;
+        float sum;
+
+        if (inChannels == 0 || outChannels == 0) {
+            return false;
+        }
+
+        matrix.assign(outChannels*inChannels, 0);
+
+        if (!inLayout || !outLayout) {
+            for (unsigned i = 0; i < std::min(inChannels, outChannels); i++) {
+                matrix[i*inChannels + i] = 1;
+            }
+
+            return true;
+        }
+
+        for (unsigned i = 0; i < inChannels; i++) {
+            addSpeaker(matrix, outLayout, outChannels, inChannels, i, inLayout[i], 1);
+        }
+
+        //NOTE: stereo upmix, fronts feed the surrounds keeping their power
+        if (inChannels == 2 && outChannels > 2) {
+            leftSurrounds = (findSpeaker(outLayout, outChannels, BL) >= 0) +
+                            (findSpeaker(outLayout, outChannels, SL) >= 0);
+
+            for (unsigned k = 0; k < 4 && leftSurrounds > 0; k++) {
+                int out = findSpeaker(outLayout, outChannels, surrounds[k]);
+
+                if (out >= 0) {
+                    matrix[out*inChannels + (k < 2 ? 0 : 1)] = MINUS_3DB/std::sqrt((float) leftSurrounds);
+                }
+            }
+        }
+
+        for (unsigned o = 0; o < outChannels; o++) {
+            sum = 0;
+
+            for (unsigned i = 0; i < inChannels; i++) {
+                sum += std::fabs(matrix[o*inChannels + i]);
+            }
+
+            maxSum = std::max(maxSum, sum);
+        }
+
+        if (maxSum > 1) {
+            for (auto &c : matrix) {
+                c /= maxSum;
+            }
+        }
+
+        return true;
+    }
+}
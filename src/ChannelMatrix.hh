@@ -0,0 +1,49 @@
+/*
+ *  ChannelMatrix.hh - Channel layout conversion matrices
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _CHANNEL_MATRIX_HH
+#define _CHANNEL_MATRIX_HH
+
+#include <vector>
+
+/*! Down and upmix matrices between the default channel layouts: mono, stereo,
+    5.1 (FL FR FC LFE SL SR) and 7.1 (FL FR FC LFE BL BR SL SR), the libav
+    order. Matrices are row major, one row of input coefficients per output
+    channel, so applying them is a gain-and-add of whole planes per non zero
+    coefficient, which vectorizes as the mixing kernels do. */
+
+namespace channelmatrix
+{
+    /**
+    * Builds the matrix converting inChannels to outChannels. Speakers missing in the
+    * output are folded into the nearest ones (ITU-R BS.775 coefficients), the LFE is
+    * dropped when downmixing and stereo fronts feed the surrounds when upmixing.
+    * Rows are normalized so a full scale input does not clip. Other layouts map
+    * each channel to the same index.
+    * @param inChannels input channels
+    * @param outChannels output channels
+    * @param matrix outChannels x inChannels coefficients
+    * @return false if the channel counts are not valid
+    */
+    bool getMatrix(unsigned inChannels, unsigned outChannels, std::vector<float> &matrix);
+}
+
+#endif
@@ -105,6 +105,9 @@ bool Controller::listenSocket()
     clilen = sizeof(cli_addr);
     struct timeval tv;
     int ret;
+
+    //NOTE: this is the controller loop, congestion feedback is sent from here
+    pipeMngrInstance->updateRateControl();
     
     listen(listeningSocket,5);
     
@@ -241,6 +244,8 @@ void Controller::initializeEventMap()
                                             std::placeholders::_1, std::placeholders::_2);
     eventMap["stop"] = std::bind(&PipelineManager::stopEvent, pipeMngrInstance,
                                             std::placeholders::_1, std::placeholders::_2);
+    eventMap["rateControl"] = std::bind(&PipelineManager::rateControlEvent, pipeMngrInstance,
+                                            std::placeholders::_1, std::placeholders::_2);
 
 }
 
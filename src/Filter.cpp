@@ -31,7 +31,8 @@
 
 BaseFilter::BaseFilter(unsigned readersNum, unsigned writersNum, FilterRole fRole_, bool periodic): 
     Runnable(periodic), maxReaders(readersNum), maxWriters(writersNum),  frameTime(std::chrono::microseconds(0)), 
-    syncMargin(std::chrono::microseconds(DEFAULT_SYNC_MARGIN)), fRole(fRole_), syncTs(std::chrono::microseconds(0)), sync(false)
+    syncMargin(std::chrono::microseconds(DEFAULT_SYNC_MARGIN)), fRole(fRole_), syncTs(std::chrono::microseconds(0)), sync(false), 
+    idleTime(std::chrono::microseconds(0))
 {
 }
 
@@ -93,6 +94,17 @@ size_t BaseFilter::getLostBlocs (int rId)
     return r->getLostBlocs();
 }
 
+size_t BaseFilter::getQueueElements (int rId)
+{
+    std::shared_ptr<Reader> r = getReader(rId);
+
+    if (!r) {
+        return 0;
+    }
+
+    return r->getQueueElements();
+}
+
 bool BaseFilter::isRConnected (int rId) 
 {
     std::lock_guard<std::mutex> guard(mtx);
@@ -506,19 +518,50 @@ std::vector<int> BaseFilter::regularProcessFrame(int& ret)
     if (!demandOriginFrames(oFrames, newFrames) || !demandDestinationFrames(dFrames)){
         ret = WAIT;
         removeFrames(newFrames);
-        return enabledJobs;
+        return writePendingOutput();
     }
 
     runDoProcessFrame(oFrames, dFrames, newFrames);
     
     //TODO: manage ret value
     enabledJobs = addFrames(dFrames);
+
+    for (auto id : writePendingOutput()) {
+        if (std::find(enabledJobs.begin(), enabledJobs.end(), id) == enabledJobs.end()) {
+            enabledJobs.push_back(id);
+        }
+    }
     
     removeFrames(newFrames);
 
     return enabledJobs;
 }
 
+std::vector<int> BaseFilter::writePendingOutput()
+{
+    std::vector<int> enabledJobs;
+
+    while (hasPendingOutput()) {
+        std::map<int, Frame*> noFrames;
+        std::map<int, Frame*> pendingFrames;
+        std::vector<int> pendingJobs;
+
+        if (!demandDestinationFrames(pendingFrames) || !runDoProcessFrame(noFrames, pendingFrames, std::vector<int>())) {
+            break;
+        }
+
+        pendingJobs = addFrames(pendingFrames);
+
+        for (auto id : pendingJobs) {
+            if (std::find(enabledJobs.begin(), enabledJobs.end(), id) == enabledJobs.end()) {
+                enabledJobs.push_back(id);
+            }
+        }
+    }
+
+    return enabledJobs;
+}
+
 std::vector<int> BaseFilter::serverProcessFrame(int& ret)
 {
     std::vector<int> enabledJobs;
@@ -528,16 +571,22 @@ std::vector<int> BaseFilter::serverProcessFrame(int& ret)
     
     processEvent();
     
-    demandOriginFrames(oFrames, newFrames);
+    if (!isInputPaused()) {
+        demandOriginFrames(oFrames, newFrames);
+    }
+
     demandDestinationFrames(dFrames);
 
-    runDoProcessFrame(oFrames, dFrames, newFrames);
+    //NOTE: runs without new input nor output are delayed by the idle time
+    if (runDoProcessFrame(oFrames, dFrames, newFrames) || !newFrames.empty()) {
+        ret = 0;
+    } else {
+        ret = idleTime.count();
+    }
 
     enabledJobs = addFrames(dFrames);
     removeFrames(newFrames);
     
-    ret = 0;
-    
     return enabledJobs;
 }
 
@@ -734,7 +783,13 @@ OneToOneFilter::OneToOneFilter(FilterRole fRole_, bool periodic) :
 
 bool OneToOneFilter::runDoProcessFrame(std::map<int, Frame*> &oFrames, std::map<int, Frame*> &dFrames, std::vector<int> /*newFrames*/)
 {
-    if (!doProcessFrame(oFrames.begin()->second, dFrames.begin()->second)) {
+    //NOTE: server filters are also run when their reader or writer are not connected,
+    //without reader the origin frame is NULL so they can flush their pending output
+    if (dFrames.empty()) {
+        return false;
+    }
+
+    if (!doProcessFrame(oFrames.empty() ? NULL : oFrames.begin()->second, dFrames.begin()->second)) {
         return false;
     }
     
@@ -190,6 +190,12 @@ public:
      * @return the losts blocs of the reader
      */
     size_t getLostBlocs (int rId);
+    /**
+     * get queue elements
+     * @param readerId of the reader
+     * @return the frames waiting in the queue of the reader
+     */
+    size_t getQueueElements (int rId);
 
 protected:
     BaseFilter(unsigned readersNum = MAX_READERS, unsigned writersNum = MAX_WRITERS, FilterRole fRole_ = REGULAR, bool periodic = false);
@@ -222,11 +228,20 @@ protected:
     std::map<std::string, std::function<bool(Jzon::Node* params)> > eventMap;
 
     virtual bool runDoProcessFrame(std::map<int, Frame*> &oFrames, std::map<int, Frame*> &dFrames, std::vector<int> newFrames) = 0;
+    //NOTE: output not bound to any input frame (i.e. encoder backlogs), regular filters write it in the 
+    //same run calling runDoProcessFrame without origin frames, even if there was no new input
+    virtual bool hasPendingOutput() {return false;};
+    //NOTE: server filters with a full backlog leave their input in the readers, so previous
+    //filters find their queues full instead of the backlog growing without limit
+    virtual bool isInputPaused() {return false;};
 
     void setSyncTs(std::chrono::microseconds ts){syncTs = ts;};
     std::chrono::microseconds getSyncTs(){return syncTs;};
     
     void setSync(bool sync_){sync = sync_;};
+
+    //NOTE: delay of server filter runs which neither had new input nor produced output
+    void setIdleTime(std::chrono::microseconds time){idleTime = time;};
     
 protected:
     std::map<int, std::shared_ptr<Reader>> readers;
@@ -243,6 +258,7 @@ private:
     bool connect(BaseFilter *R, int writerID, int readerID);
     std::vector<int> regularProcessFrame(int& ret);
     std::vector<int> serverProcessFrame(int& ret);
+    std::vector<int> writePendingOutput();
 
     std::shared_ptr<Reader> setReader(int readerID, FrameQueue* queue);
     bool setWriter(int writerID);
@@ -261,6 +277,7 @@ private:
     std::chrono::microseconds syncTs;
     
     bool sync;
+    std::chrono::microseconds idleTime;
 };
 
 class OneToOneFilter : public BaseFilter {
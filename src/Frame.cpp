@@ -27,6 +27,7 @@ Frame::Frame()
 {
     originTime = std::chrono::system_clock::now();
     consumed = false;
+    hasDecodeTime = false;
 }
 
 void Frame::setPresentationTime(std::chrono::microseconds pTime)
@@ -34,6 +35,12 @@ void Frame::setPresentationTime(std::chrono::microseconds pTime)
     presentationTime = pTime;
 }
 
+void Frame::setDecodeTime(std::chrono::microseconds dTime)
+{
+    decodeTime = dTime;
+    hasDecodeTime = true;
+}
+
 void Frame::setOriginTime(std::chrono::system_clock::time_point orgTime)
 {
     originTime = orgTime;
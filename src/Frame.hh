@@ -46,6 +46,13 @@ public:
     */
     void setPresentationTime(std::chrono::microseconds pTime);
 
+    /**
+    * Set frame decoding time, only needed when frames are not decoded in presentation 
+    * order (i.e. B-frames)
+    * @param dTime decoding time
+    */
+    void setDecodeTime(std::chrono::microseconds dTime);
+
     /**
     * Sets a new origin frame time from input time point
     * @param system_clock::time_point to set as origin
@@ -60,6 +67,12 @@ public:
 
     std::chrono::microseconds getPresentationTime() const {return presentationTime;};
 
+    /**
+    * Gets frame decoding time
+    * @return decoding time, which is the presentation time if it has never been set
+    */
+    std::chrono::microseconds getDecodeTime() const {return hasDecodeTime ? decodeTime : presentationTime;};
+
     /**
     * Gets origin frame time point
     * @return system_clock::time_point frame origin time
@@ -122,6 +135,8 @@ public:
 
 protected:
     std::chrono::microseconds presentationTime;
+    std::chrono::microseconds decodeTime;
+    bool hasDecodeTime;
     std::chrono::system_clock::time_point originTime;
     size_t sequenceNumber;
     bool consumed;
@@ -0,0 +1,134 @@
+/*
+ *  ParallelWorkers.cpp - Persistent threads running indexed tasks concurrently
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ParallelWorkers.hh"
+
+ParallelWorkers::ParallelWorkers() : jobTasks(0), pending(0), generation(0), running(true)
+{
+}
+
+ParallelWorkers::~ParallelWorkers()
+{
+    stop();
+}
+
+void ParallelWorkers::start(unsigned tasks)
+{
+    std::lock_guard<std::mutex> guard(mtx);
+
+    if (!running){
+        return;
+    }
+
+    //NOTE: task 0 runs on the caller thread
+    while (workers.size() + 1 < tasks){
+        workers.push_back(std::thread(&ParallelWorkers::work, this, workers.size() + 1, generation));
+    }
+}
+
+void ParallelWorkers::run(unsigned tasks, std::function<void(unsigned)> task)
+{
+    if (tasks == 0){
+        return;
+    }
+
+    if (tasks == 1){
+        task(0);
+        return;
+    }
+
+    start(tasks);
+
+    std::unique_lock<std::mutex> guard(mtx);
+
+    //NOTE: stopped workers do not take tasks anymore, run them on the caller thread
+    if (!running){
+        guard.unlock();
+
+        for (unsigned i = 0; i < tasks; i++){
+            task(i);
+        }
+
+        return;
+    }
+
+    job = task;
+    jobTasks = tasks;
+    pending = tasks - 1;
+    generation++;
+    guard.unlock();
+
+    startCheck.notify_all();
+
+    task(0);
+
+    guard.lock();
+    doneCheck.wait(guard, [this]{return pending == 0;});
+    job = nullptr;
+}
+
+void ParallelWorkers::stop()
+{
+    std::unique_lock<std::mutex> guard(mtx);
+    running = false;
+    guard.unlock();
+
+    startCheck.notify_all();
+
+    for (std::thread &worker : workers){
+        if (worker.joinable()){
+            worker.join();
+        }
+    }
+
+    workers.clear();
+}
+
+void ParallelWorkers::work(unsigned index, unsigned seen)
+{
+    std::function<void(unsigned)> task;
+    std::unique_lock<std::mutex> guard(mtx);
+
+    while (true){
+        startCheck.wait(guard, [&]{return !running || generation != seen;});
+
+        if (!running){
+            break;
+        }
+
+        seen = generation;
+
+        if (index >= jobTasks){
+            continue;
+        }
+
+        task = job;
+        guard.unlock();
+
+        task(index);
+
+        guard.lock();
+
+        if (--pending == 0){
+            doneCheck.notify_all();
+        }
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ *  ParallelWorkers.hh - Persistent threads running indexed tasks concurrently
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _PARALLEL_WORKERS_HH
+#define _PARALLEL_WORKERS_HH
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/*! Fork-join helper for filters splitting each frame in concurrent tasks
+    (i.e. resampler slices or ladder renditions). Threads are created once and
+    wait on a condition variable between frames, so the per frame cost is a
+    notification instead of a thread creation. Task i always runs on the same
+    thread, task 0 on the caller one. */
+
+class ParallelWorkers {
+
+public:
+    ParallelWorkers();
+    ~ParallelWorkers();
+
+    /**
+    * Starts the threads needed to run the given number of concurrent tasks.
+    * Running threads are kept, so it only creates threads the first time.
+    * @param tasks maximum number of tasks run at once
+    */
+    void start(unsigned tasks);
+
+    /**
+    * Runs task(0) to task(tasks - 1) concurrently and returns when all of them are done
+    * @param tasks number of tasks, extra threads are started if needed
+    * @param task function called with the task index
+    */
+    void run(unsigned tasks, std::function<void(unsigned)> task);
+
+    /**
+    * Stops and joins all the threads, later runs execute the tasks one after
+    * the other on the caller thread
+    */
+    void stop();
+
+    size_t getThreads() const {return workers.size();};
+
+private:
+    void work(unsigned index, unsigned seen);
+
+    std::vector<std::thread>        workers;
+    std::mutex                      mtx;
+    std::condition_variable         startCheck;
+    std::condition_variable         doneCheck;
+    std::function<void(unsigned)>   job;
+    unsigned                        jobTasks;
+    unsigned                        pending;
+    unsigned                        generation;
+    bool                            running;
+};
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ *  PcmKernels.cpp - PCM sample format and layout conversion
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "PcmKernels.hh"
+#include "AudioFrame.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//NOTE: samples converted at once when the layout changes, fits in L1 with all the channels
+#define PCM_BLOCK 256
+
+enum SampleType {U8_SAMPLES, S16_SAMPLES, FLT_SAMPLES};
+
+static bool getSampleType(SampleFmt fmt, SampleType &type, bool &planar)
+{
+    switch (fmt) {
+        case U8:
+        case U8P:
+            type = U8_SAMPLES;
+            break;
+        case S16:
+        case S16P:
+            type = S16_SAMPLES;
+            break;
+        case FLT:
+        case FLTP:
+            type = FLT_SAMPLES;
+            break;
+        default:
+            return false;
+    }
+
+    planar = fmt == U8P || fmt == S16P || fmt == FLTP;
+    return true;
+}
+
+static unsigned getTypeBytes(SampleType type)
+{
+    return type == U8_SAMPLES ? 1 : (type == S16_SAMPLES ? 2 : 4);
+}
+
+static inline int16_t fltToS16Sample(float s)
+{
+    return (int16_t) std::min(std::max(lrintf(s * 32768.0f), -32768L), 32767L);
+}
+
+//NOTE: samples may be at any byte offset (i.e. interleaved frames or block buffers),
+//scalar loops load and store them through memcpy
+static inline float loadFlt(const unsigned char *src)
+{
+    float s;
+    memcpy(&s, src, sizeof(float));
+    return s;
+}
+
+static inline int16_t loadS16(const unsigned char *src)
+{
+    int16_t s;
+    memcpy(&s, src, sizeof(int16_t));
+    return s;
+}
+
+static inline void storeFlt(unsigned char *dst, float s)
+{
+    memcpy(dst, &s, sizeof(float));
+}
+
+static inline void storeS16(unsigned char *dst, int16_t s)
+{
+    memcpy(dst, &s, sizeof(int16_t));
+}
+
+static void s16ToFlt(const unsigned char *src, unsigned char *dst, unsigned samples)
+{
+    unsigned i = 0;
+
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+
+    for (; i + 8 <= samples; i += 8) {
+        __m128i s = _mm_loadu_si128((const __m128i*) (src + i * 2));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+        _mm_storeu_ps((float*) (dst + i * 4), _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps((float*) (dst + i * 4 + 16), _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#endif
+
+    for (; i < samples; i++) {
+        storeFlt(dst + i * 4, loadS16(src + i * 2) / 32768.0f);
+    }
+}
+
+static void fltToS16(const unsigned char *src, unsigned char *dst, unsigned samples)
+{
+    unsigned i = 0;
+
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 minusOne = _mm_set1_ps(-1.0f);
+
+    //NOTE: clipping before scaling keeps values in the int32 range, packs saturates 32768
+    for (; i + 8 <= samples; i += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps((const float*) (src + i * 4)), minusOne), one);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps((const float*) (src + i * 4 + 16)), minusOne), one);
+        __m128i ia = _mm_cvtps_epi32(_mm_mul_ps(a, scale));
+        __m128i ib = _mm_cvtps_epi32(_mm_mul_ps(b, scale));
+        _mm_storeu_si128((__m128i*) (dst + i * 2), _mm_packs_epi32(ia, ib));
+    }
+#endif
+
+    for (; i < samples; i++) {
+        storeS16(dst + i * 2, fltToS16Sample(std::min(std::max(loadFlt(src + i * 4), -1.0f), 1.0f)));
+    }
+}
+
+/*! Contiguous samples of one channel */
+static void convertSpan(const unsigned char *src, SampleType srcType, unsigned char *dst,
+                        SampleType dstType, unsigned samples)
+{
+    if (srcType == dstType) {
+        memcpy(dst, src, samples * getTypeBytes(srcType));
+        return;
+    }
+
+    if (srcType == S16_SAMPLES && dstType == FLT_SAMPLES) {
+        s16ToFlt(src, dst, samples);
+        return;
+    }
+
+    if (srcType == FLT_SAMPLES && dstType == S16_SAMPLES) {
+        fltToS16(src, dst, samples);
+        return;
+    }
+
+    //NOTE: U8 conversions are unusual, plain loops
+    for (unsigned i = 0; i < samples; i++) {
+        float s;
+
+        switch (srcType) {
+            case U8_SAMPLES:
+                s = (src[i] - 128) / 128.0f;
+                break;
+            case S16_SAMPLES:
+                s = loadS16(src + i * 2) / 32768.0f;
+                break;
+            default:
+                s = std::min(std::max(loadFlt(src + i * 4), -1.0f), 1.0f);
+                break;
+        }
+
+        switch (dstType) {
+            case U8_SAMPLES:
+                dst[i] = (unsigned char) std::min(std::max(lrintf(s * 128.0f) + 128, 0L), 255L);
+                break;
+            case S16_SAMPLES:
+                storeS16(dst + i * 2, fltToS16Sample(s));
+                break;
+            default:
+                storeFlt(dst + i * 4, s);
+                break;
+        }
+    }
+}
+
+static void deinterleave(const unsigned char *src, unsigned bytes, unsigned channels,
+                         unsigned char **dst, unsigned samples)
+{
+    unsigned i = 0;
+
+#ifdef __SSE2__
+    if (channels == 2 && bytes == 2) {
+        int16_t *l = (int16_t*) dst[0];
+        int16_t *r = (int16_t*) dst[1];
+
+        for (; i + 8 <= samples; i += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i*) (src + i * 4));
+            __m128i b = _mm_loadu_si128((const __m128i*) (src + i * 4 + 16));
+            __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+            __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+            _mm_storeu_si128((__m128i*) (l + i), _mm_packs_epi32(la, lb));
+            _mm_storeu_si128((__m128i*) (r + i), _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+        }
+    } else if (channels == 2 && bytes == 4) {
+        float *l = (float*) dst[0];
+        float *r = (float*) dst[1];
+
+        for (; i + 4 <= samples; i += 4) {
+            __m128 a = _mm_loadu_ps((const float*) (src + i * 8));
+            __m128 b = _mm_loadu_ps((const float*) (src + i * 8 + 16));
+            _mm_storeu_ps(l + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(r + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+    }
+#endif
+
+    for (; i < samples; i++) {
+        for (unsigned c = 0; c < channels; c++) {
+            memcpy(dst[c] + i * bytes, src + (i * channels + c) * bytes, bytes);
+        }
+    }
+}
+
+static void interleave(const unsigned char * const *src, unsigned bytes, unsigned channels,
+                       unsigned char *dst, unsigned samples)
+{
+    unsigned i = 0;
+
+#ifdef __SSE2__
+    if (channels == 2 && bytes == 2) {
+        for (; i + 8 <= samples; i += 8) {
+            __m128i l = _mm_loadu_si128((const __m128i*) (src[0] + i * 2));
+            __m128i r = _mm_loadu_si128((const __m128i*) (src[1] + i * 2));
+            _mm_storeu_si128((__m128i*) (dst + i * 4), _mm_unpacklo_epi16(l, r));
+            _mm_storeu_si128((__m128i*) (dst + i * 4 + 16), _mm_unpackhi_epi16(l, r));
+        }
+    } else if (channels == 2 && bytes == 4) {
+        for (; i + 4 <= samples; i += 4) {
+            __m128 l = _mm_loadu_ps((const float*) (src[0] + i * 4));
+            __m128 r = _mm_loadu_ps((const float*) (src[1] + i * 4));
+            _mm_storeu_ps((float*) (dst + i * 8), _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps((float*) (dst + i * 8 + 16), _mm_unpackhi_ps(l, r));
+        }
+    }
+#endif
+
+    for (; i < samples; i++) {
+        for (unsigned c = 0; c < channels; c++) {
+            memcpy(dst + (i * channels + c) * bytes, src[c] + i * bytes, bytes);
+        }
+    }
+}
+
+namespace pcmkernels
+{
+    bool isSupported(SampleFmt srcFmt, SampleFmt dstFmt)
+    {
+        SampleType type;
+        bool planar;
+
+        return getSampleType(srcFmt, type, planar) && getSampleType(dstFmt, type, planar);
+    }
+
+    bool convert(const unsigned char * const *src, SampleFmt srcFmt, unsigned char **dst,
+                 SampleFmt dstFmt, unsigned channels, unsigned samples)
+    {
+        SampleType srcType, dstType;
+        bool srcPlanar, dstPlanar;
+        unsigned srcBytes, dstBytes;
+        unsigned char srcBlock[MAX_CHANNELS][PCM_BLOCK * 4];
+        unsigned char dstBlock[MAX_CHANNELS][PCM_BLOCK * 4];
+        const unsigned char *srcPlanes[MAX_CHANNELS];
+        unsigned char *dstPlanes[MAX_CHANNELS];
+        unsigned char *blockPlanes[MAX_CHANNELS];
+        unsigned n;
+
+        if (!getSampleType(srcFmt, srcType, srcPlanar) || !getSampleType(dstFmt, dstType, dstPlanar) ||
+            channels == 0 || channels > MAX_CHANNELS) {
+            return false;
+        }
+
+        srcBytes = getTypeBytes(srcType);
+        dstBytes = getTypeBytes(dstType);
+
+        if (srcType == dstType) {
+            if (srcPlanar && dstPlanar) {
+                for (unsigned c = 0; c < channels; c++) {
+                    memcpy(dst[c], src[c], samples * srcBytes);
+                }
+            } else if (!srcPlanar && !dstPlanar) {
+                memcpy(dst[0], src[0], samples * channels * srcBytes);
+            } else if (dstPlanar) {
+                deinterleave(src[0], srcBytes, channels, dst, samples);
+            } else {
+                interleave(src, srcBytes, channels, dst[0], samples);
+            }
+
+            return true;
+        }
+
+        if (srcPlanar && dstPlanar) {
+            for (unsigned c = 0; c < channels; c++) {
+                convertSpan(src[c], srcType, dst[c], dstType, samples);
+            }
+
+            return true;
+        }
+
+        //NOTE: format and layout change, blocks are unpacked, converted and packed
+        for (unsigned done = 0; done < samples; done += n) {
+            n = std::min(samples - done, (unsigned) PCM_BLOCK);
+
+            for (unsigned c = 0; c < channels; c++) {
+                blockPlanes[c] = srcBlock[c];
+                srcPlanes[c] = srcPlanar ? src[c] + done * srcBytes : srcBlock[c];
+                dstPlanes[c] = dstPlanar ? dst[c] + done * dstBytes : dstBlock[c];
+            }
+
+            if (!srcPlanar) {
+                deinterleave(src[0] + done * channels * srcBytes, srcBytes, channels, blockPlanes, n);
+            }
+
+            for (unsigned c = 0; c < channels; c++) {
+                convertSpan(srcPlanes[c], srcType, dstPlanes[c], dstType, n);
+            }
+
+            if (!dstPlanar) {
+                interleave(dstPlanes, dstBytes, channels, dst[0] + done * channels * dstBytes, n);
+            }
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ *  PcmKernels.hh - PCM sample format and layout conversion
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _PCM_KERNELS_HH
+#define _PCM_KERNELS_HH
+
+#include "Types.hh"
+
+/*! Conversion of PCM samples between sample formats (U8, S16 and float) and
+    layouts (planar or interleaved) when the sample rate and the channels do
+    not change, which covers most decoder outputs and encoder inputs without
+    going through libswresample. Stereo packing/unpacking and S16/float
+    conversion are vectorized (SSE2), other cases use scalar loops. */
+
+namespace pcmkernels
+{
+    /**
+    * @param srcFmt source sample format
+    * @param dstFmt destination sample format
+    * @return true if convert supports the conversion
+    */
+    bool isSupported(SampleFmt srcFmt, SampleFmt dstFmt);
+
+    /**
+    * Converts samples keeping their rate and channels. Float samples are clipped
+    * to [-1, 1] when converted to integer formats.
+    * @param src source planes, or the buffer of interleaved formats
+    * @param srcFmt source sample format
+    * @param dst destination planes, or the buffer of interleaved formats
+    * @param dstFmt destination sample format
+    * @param channels number of channels, up to MAX_CHANNELS
+    * @param samples number of samples per channel
+    * @return false if the conversion is not supported
+    */
+    bool convert(const unsigned char * const *src, SampleFmt srcFmt, unsigned char **dst,
+                 SampleFmt dstFmt, unsigned channels, unsigned samples);
+}
+
+#endif
@@ -27,6 +27,9 @@
 #include "modules/audioDecoder/AudioDecoderLibav.hh"
 #include "modules/audioMixer/AudioMixer.hh"
 #include "modules/videoEncoder/VideoEncoderX264.hh"
+#include "modules/videoEncoder/VideoEncoderLadder.hh"
+#include "modules/videoEncoder/VideoEncoderChunked.hh"
+#include "modules/audioEncoder/AudioEncoderMulti.hh"
 #include "modules/videoDecoder/VideoDecoderLibav.hh"
 #include "modules/videoMixer/VideoMixer.hh"
 #include "modules/videoSplitter/VideoSplitter.hh"
@@ -37,6 +40,8 @@
 #include "modules/dasher/Dasher.hh"
 #include "modules/sharedMemory/SharedMemory.hh"
 
+#include <algorithm>
+
 #define WORKER_DELETE_SLEEPING_TIME 1000 //us
 
 PipelineManager::PipelineManager(const unsigned thds) : threads(thds)
@@ -85,6 +90,7 @@ bool PipelineManager::stop()
     }
 
     paths.clear();
+    rateControlledPaths.clear();
     utils::infoMsg("Paths deleted");
 
     for (auto it : filters) {
@@ -159,6 +165,15 @@ bool PipelineManager::createFilter(int id, FilterType type)
         case VIDEO_SPLITTER:
             filter = VideoSplitter::createNew();
             break;            
+        case VIDEO_ENCODER_LADDER:
+            filter = new VideoEncoderLadder();
+            break;
+        case VIDEO_ENCODER_CHUNKED:
+            filter = new VideoEncoderChunked();
+            break;
+        case AUDIO_ENCODER_MULTI:
+            filter = new AudioEncoderMulti();
+            break;
         //TODO include sharedMemory filter
         default:
             utils::errorMsg("Unknown filter type");
@@ -380,6 +395,7 @@ bool PipelineManager::removePath(int id)
     }
 
     paths.erase(id);
+    rateControlledPaths.erase(id);
 
     return true;
 }
@@ -603,3 +619,153 @@ void PipelineManager::stopEvent(Jzon::Node* params, Jzon::Object &outputNode)
 
     outputNode.Add("error", Jzon::null);
 }
+
+void PipelineManager::rateControlEvent(Jzon::Node* params, Jzon::Object &outputNode)
+{
+    int id;
+    bool enable;
+    int minBitrate = 0;
+    int maxBitrate = 0;
+    Path* path;
+    VideoEncoderX264or5* encoder;
+
+    if (!params || !params->Has("pathId") || !params->Has("enable")) {
+        outputNode.Add("error", "Error configuring rate control. Invalid JSON format...");
+        return;
+    }
+
+    id = params->Get("pathId").ToInt();
+    enable = params->Get("enable").ToBool();
+
+    if (params->Has("minBitrate")) {
+        minBitrate = params->Get("minBitrate").ToInt();
+    }
+
+    if (params->Has("maxBitrate")) {
+        maxBitrate = params->Get("maxBitrate").ToInt();
+    }
+
+    path = getPath(id);
+
+    if (!path) {
+        outputNode.Add("error", "Error configuring rate control. Path does not exist...");
+        return;
+    }
+
+    encoder = getPathEncoder(path);
+
+    if (!encoder) {
+        outputNode.Add("error", "Error configuring rate control. There is no video encoder in the path...");
+        return;
+    }
+
+    if (enable && minBitrate <= 0) {
+        outputNode.Add("error", "Error configuring rate control. Invalid minimum bitrate...");
+        return;
+    }
+
+    encoder->configRateControl(enable, minBitrate, maxBitrate);
+
+    if (enable) {
+        rateControlledPaths.insert(id);
+    } else {
+        rateControlledPaths.erase(id);
+    }
+
+    outputNode.Add("error", Jzon::null);
+}
+
+void PipelineManager::updateRateControl()
+{
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+
+    if (rateControlledPaths.empty() || 
+        now - lastRateFeedback < std::chrono::milliseconds(RATE_FEEDBACK_INTERVAL)) {
+        return;
+    }
+
+    lastRateFeedback = now;
+
+    for (auto it = rateControlledPaths.begin(); it != rateControlledPaths.end();) {
+        Path* path = getPath(*it);
+        BaseFilter* dst = path ? getFilter(path->getDestinationFilterID()) : NULL;
+        VideoEncoderX264or5* encoder = path ? getPathEncoder(path) : NULL;
+        size_t lostBlocs = 0;
+
+        if (!dst || !encoder) {
+            it = rateControlledPaths.erase(it);
+            continue;
+        }
+
+        //NOTE: lost blocs are accounted as in getStateEvent, the encoder looks for increments
+        lostBlocs += dst->getLostBlocs(path->getDstReaderID());
+        for (auto fId : path->getFilters()) {
+            BaseFilter* f = getFilter(fId);
+            if (f) {
+                lostBlocs += f->getLostBlocs(DEFAULT_ID);
+            }
+        }
+
+        encoder->congestionFeedback(getPathLoss(path), dst->getQueueElements(path->getDstReaderID()), lostBlocs);
+        ++it;
+    }
+}
+
+VideoEncoderX264or5* PipelineManager::getPathEncoder(Path* path)
+{
+    VideoEncoderX264or5* encoder;
+    std::vector<int> pFilters = path->getFilters();
+
+    //NOTE: the encoder closest to the destination is the one feeding the transmission
+    for (auto it = pFilters.rbegin(); it != pFilters.rend(); ++it) {
+        if ((encoder = dynamic_cast<VideoEncoderX264or5*>(getFilter(*it)))) {
+            return encoder;
+        }
+    }
+
+    return dynamic_cast<VideoEncoderX264or5*>(getFilter(path->getOriginFilterID()));
+}
+
+double PipelineManager::getPathLoss(Path* path)
+{
+    SinkManager* sink;
+    Jzon::Object state;
+    double loss = 0;
+
+    sink = dynamic_cast<SinkManager*>(getFilter(path->getDestinationFilterID()));
+
+    if (!sink) {
+        return 0;
+    }
+
+    //NOTE: connections are handled by the sink thread, their stats are 
+    //read from its state, which is built under the filter lock
+    sink->getState(state);
+
+    if (!state.Has("sessions") || !state.Get("sessions").IsArray()) {
+        return 0;
+    }
+
+    Jzon::Array sessions = state.Get("sessions").AsArray();
+
+    for (Jzon::Array::iterator session = sessions.begin(); session != sessions.end(); ++session) {
+        bool pathSession = false;
+        Jzon::Array readers = (*session).Get("readers").AsArray();
+        Jzon::Array stats = (*session).Get("subsessionsStats").AsArray();
+
+        for (Jzon::Array::iterator reader = readers.begin(); reader != readers.end(); ++reader) {
+            pathSession |= (*reader).ToInt() == path->getDstReaderID();
+        }
+
+        if (!pathSession) {
+            continue;
+        }
+
+        //NOTE: RTCP receiver reports carry the fraction lost in 1/256 units
+        for (Jzon::Array::iterator stat = stats.begin(); stat != stats.end(); ++stat) {
+            loss = std::max(loss, (*stat).Get("packetLossRatio").ToInt() * 100.0 / 256);
+        }
+    }
+
+    return loss;
+}
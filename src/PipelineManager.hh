@@ -30,6 +30,12 @@
 #include "WorkersPool.hh"
 
 #include <map>
+#include <set>
+#include <chrono>
+
+#define RATE_FEEDBACK_INTERVAL 500 //ms
+
+class VideoEncoderX264or5;
 
 /*! PipelineManager class is a singleton class that presents the relation
     between the data flow, control and execution layers. It has all related
@@ -155,6 +161,19 @@ public:
     */
     void stopEvent(Jzon::Node* params, Jzon::Object &outputNode);
 
+    /**
+    * Sets outputNode jzon object with the results of enabling or disabling the rate 
+    * control of the video encoder of a path
+    */
+    void rateControlEvent(Jzon::Node* params, Jzon::Object &outputNode);
+
+    /**
+    * Feeds the congestion signals of each rate controlled path (receivers packet loss,
+    * transmission queue depth and lost blocs) back to its video encoder. It is meant 
+    * to be called periodically, feedback is sent every RATE_FEEDBACK_INTERVAL
+    */
+    void updateRateControl();
+
 private:
     PipelineManager(unsigned threads = 0);
     ~PipelineManager();
@@ -164,6 +183,8 @@ private:
     bool handleGrouping(int orgFId, int dstFId, int orgWId, int dstRId);
     bool validCData(ConnectionData cData, int orgFId, int dstFId);
     bool deleteRelatedPaths(int filterId);
+    VideoEncoderX264or5* getPathEncoder(Path* path);
+    double getPathLoss(Path* path);
 
     static PipelineManager* pipeMngrInstance;
     const unsigned threads;
@@ -171,6 +192,9 @@ private:
     std::map<int, Path*> paths;
     std::map<int, BaseFilter*> filters;
     WorkersPool *pool;
+
+    std::set<int> rateControlledPaths;
+    std::chrono::system_clock::time_point lastRateFeedback;
 };
 
 #endif
@@ -0,0 +1,289 @@
+/*
+ *  Resampler.cpp - Polyphase audio resampler
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Resampler.hh"
+#include "PcmKernels.hh"
+#include "AudioFrame.hh"
+#include "Utils.hh"
+
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct QualityParams {
+    unsigned taps;
+    double beta;
+    double rolloff;
+};
+
+//NOTE: indexed by ResamplerQuality, taps are multiple of 4 for the vectorized dot product
+static const QualityParams qualityParams[] = {
+    {16, 6.0, 0.85},
+    {32, 8.0, 0.92},
+    {64, 10.0, 0.96}
+};
+
+static unsigned gcd(unsigned a, unsigned b)
+{
+    while (b != 0) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static double besselI0(double x)
+{
+    double sum = 1;
+    double term = 1;
+
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+
+    return sum;
+}
+
+static inline float dotProduct(const float *x, const float *h, unsigned taps)
+{
+    unsigned k = 0;
+    float sum = 0;
+
+#ifdef __SSE2__
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    float partial[4];
+
+    for (; k + 8 <= taps; k += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(h + k)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + k + 4), _mm_loadu_ps(h + k + 4)));
+    }
+
+    _mm_storeu_ps(partial, _mm_add_ps(acc0, acc1));
+    sum = partial[0] + partial[1] + partial[2] + partial[3];
+#endif
+
+    for (; k < taps; k++) {
+        sum += x[k] * h[k];
+    }
+
+    return sum;
+}
+
+Resampler* Resampler::createNew(unsigned channels, unsigned inRate, unsigned outRate, ResamplerQuality quality)
+{
+    unsigned d;
+    unsigned l;
+    unsigned m;
+
+    if (channels == 0 || channels > MAX_CHANNELS || inRate == 0 || outRate == 0) {
+        utils::errorMsg("[Resampler] Invalid channels or sample rates");
+        return NULL;
+    }
+
+    d = gcd(inRate, outRate);
+    l = outRate / d;
+    m = inRate / d;
+
+    if (l > RESAMPLER_MAX_PHASES) {
+        utils::warningMsg("[Resampler] Rate ratio " + std::to_string(l) + "/" + std::to_string(m) + " not supported");
+        return NULL;
+    }
+
+    return new Resampler(channels, inRate, outRate, quality, l, m, getFilterBank(l, m, quality));
+}
+
+Resampler::Resampler(unsigned ch, unsigned iRate, unsigned oRate, ResamplerQuality q,
+                     unsigned l, unsigned m, std::shared_ptr<const FilterBank> b) :
+channels(ch), inRate(iRate), outRate(oRate), quality(q), upFactor(l), downFactor(m), bank(b),
+history(ch), available(0), base(0), phase(0), outBuffers(ch)
+{
+    reset();
+}
+
+std::shared_ptr<const Resampler::FilterBank> Resampler::getFilterBank(unsigned l, unsigned m, ResamplerQuality q)
+{
+    static std::map<std::tuple<unsigned, unsigned, int>, std::shared_ptr<const FilterBank>> banks;
+    static std::mutex banksMtx;
+
+    std::lock_guard<std::mutex> guard(banksMtx);
+    std::tuple<unsigned, unsigned, int> key(l, m, q);
+    const QualityParams &params = qualityParams[q];
+    double halfTaps = params.taps / 2;
+    double cutoff = std::min(1.0, (double) l / m) * params.rolloff;
+    double norm = besselI0(params.beta);
+    double sum;
+    double x;
+    double w;
+    std::shared_ptr<FilterBank> bank;
+
+    if (banks.count(key) > 0) {
+        return banks[key];
+    }
+
+    bank = std::make_shared<FilterBank>();
+    bank->phases = l;
+    bank->taps = params.taps;
+    bank->coefs.resize(l * params.taps);
+
+    for (unsigned p = 0; p < l; p++) {
+        float *row = &bank->coefs[p * params.taps];
+        sum = 0;
+
+        for (unsigned k = 0; k < params.taps; k++) {
+            //NOTE: distance from tap k to the output instant, in input samples
+            x = halfTaps - 1 - k + (double) p / l;
+            w = std::fabs(x) < halfTaps ? besselI0(params.beta * std::sqrt(1 - (x / halfTaps) * (x / halfTaps))) / norm : 0;
+            row[k] = cutoff * (x == 0 ? 1 : std::sin(M_PI * cutoff * x) / (M_PI * cutoff * x)) * w;
+            sum += row[k];
+        }
+
+        //NOTE: unity DC gain in every phase
+        for (unsigned k = 0; k < params.taps; k++) {
+            row[k] /= sum;
+        }
+    }
+
+    banks[key] = bank;
+    return bank;
+}
+
+void Resampler::reset()
+{
+    //NOTE: half window of silence, so the first output sample is the first input one
+    available = bank->taps / 2 - 1;
+    base = 0;
+    phase = 0;
+
+    for (auto &h : history) {
+        h.assign(std::max((size_t) bank->taps, h.size()), 0);
+    }
+}
+
+std::chrono::microseconds Resampler::getDelay() const
+{
+    return std::chrono::microseconds(bank->taps / 2 * std::micro::den / inRate);
+}
+
+int Resampler::process(const unsigned char * const *in, SampleFmt inFmt, unsigned inSamples,
+                       unsigned char **out, SampleFmt outFmt, unsigned maxOutSamples,
+                       std::chrono::microseconds &offset)
+{
+    unsigned char *histPlanes[MAX_CHANNELS];
+    unsigned char *outPlanes[MAX_CHANNELS];
+    unsigned taps = bank->taps;
+    unsigned appendPos = available;
+    double firstTime;
+    unsigned consumed;
+    unsigned n = 0;
+
+    if (!pcmkernels::isSupported(inFmt, FLTP) || !pcmkernels::isSupported(FLTP, outFmt)) {
+        return -1;
+    }
+
+    for (unsigned c = 0; c < channels; c++) {
+        if (history[c].size() < available + inSamples) {
+            history[c].resize(available + inSamples);
+        }
+
+        histPlanes[c] = (unsigned char*) (history[c].data() + available);
+
+        if (outFmt == FLTP) {
+            outPlanes[c] = out[c];
+        } else {
+            outBuffers[c].resize(std::max((size_t) maxOutSamples, outBuffers[c].size()));
+            outPlanes[c] = (unsigned char*) outBuffers[c].data();
+        }
+    }
+
+    pcmkernels::convert(in, inFmt, histPlanes, FLTP, channels, inSamples);
+    available += inSamples;
+
+    firstTime = base + taps / 2 - 1 + (double) phase / upFactor;
+    offset = std::chrono::microseconds((int64_t) std::floor((firstTime - appendPos) * std::micro::den / inRate + 0.5));
+
+    for (; n < maxOutSamples && base + taps <= available; n++) {
+        const float *h = &bank->coefs[phase * taps];
+
+        for (unsigned c = 0; c < channels; c++) {
+            ((float*) outPlanes[c])[n] = dotProduct(history[c].data() + base, h, taps);
+        }
+
+        phase += downFactor;
+        base += phase / upFactor;
+        phase %= upFactor;
+    }
+
+    if (outFmt != FLTP) {
+        pcmkernels::convert(outPlanes, FLTP, out, outFmt, channels, n);
+    }
+
+    //NOTE: consumed samples are dropped, the window start becomes the history start. When
+    //downsampling it may be past the last sample, the rest is skipped from the next block
+    consumed = std::min(base, available);
+
+    for (unsigned c = 0; c < channels; c++) {
+        memmove(history[c].data(), history[c].data() + consumed, (available - consumed) * sizeof(float));
+    }
+
+    available -= consumed;
+    base -= consumed;
+
+    return n;
+}
+
+ResamplerQuality Resampler::getQualityFromString(std::string name)
+{
+    if (name == "low") {
+        return RQ_LOW;
+    }
+
+    if (name == "high") {
+        return RQ_HIGH;
+    }
+
+    return RQ_MEDIUM;
+}
+
+std::string Resampler::getQualityAsString(ResamplerQuality q)
+{
+    switch (q) {
+        case RQ_LOW:
+            return "low";
+        case RQ_HIGH:
+            return "high";
+        default:
+            return "medium";
+    }
+}
@@ -0,0 +1,132 @@
+/*
+ *  Resampler.hh - Polyphase audio resampler
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _RESAMPLER_HH
+#define _RESAMPLER_HH
+
+#include "Types.hh"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+//NOTE: rates are reduced to L/M, ratios needing more phases fall back to libswresample
+#define RESAMPLER_MAX_PHASES 1024
+
+/*! Quality/latency trade-off: taps of each filter phase (16, 32 or 64) */
+enum ResamplerQuality {RQ_LOW, RQ_MEDIUM, RQ_HIGH};
+
+/*! Polyphase resampler of planar float samples. The input rate is multiplied
+    by L and divided by M (L/M is the reduced rate ratio) with a Kaiser
+    windowed sinc filter split in L phases. Filter banks are computed once per
+    ratio and quality and shared by all the resamplers, so 44.1k inputs of
+    every mixer channel use the same table. The inner loop is a dot product
+    vectorized with SSE2. The algorithmic delay is fixed to half the taps,
+    in input samples, and process reports the exact time of each output block. */
+
+class Resampler {
+
+public:
+    /**
+    * Creates a resampler
+    * @param channels number of channels
+    * @param inRate input sample rate
+    * @param outRate output sample rate
+    * @param quality taps of the filter
+    * @return NULL if the ratio is not supported
+    */
+    static Resampler* createNew(unsigned channels, unsigned inRate, unsigned outRate,
+                                ResamplerQuality quality = RQ_MEDIUM);
+
+    /**
+    * Resamples a block of samples. Input samples which cannot be output yet are
+    * kept for the next block.
+    * @param in input planes, or the buffer of interleaved formats
+    * @param inFmt input sample format
+    * @param inSamples input samples per channel
+    * @param out output planes, or the buffer of interleaved formats
+    * @param outFmt output sample format
+    * @param maxOutSamples output capacity per channel
+    * @param offset time of the first output sample relative to the first input one
+    * @return output samples per channel, -1 if the formats are not supported
+    */
+    int process(const unsigned char * const *in, SampleFmt inFmt, unsigned inSamples,
+                unsigned char **out, SampleFmt outFmt, unsigned maxOutSamples,
+                std::chrono::microseconds &offset);
+
+    /**
+    * Drops the buffered samples
+    */
+    void reset();
+
+    /**
+    * @return algorithmic delay, half the filter taps at the input rate
+    */
+    std::chrono::microseconds getDelay() const;
+
+    unsigned getChannels() const {return channels;};
+    unsigned getInputRate() const {return inRate;};
+    unsigned getOutputRate() const {return outRate;};
+    ResamplerQuality getQuality() const {return quality;};
+
+    /**
+    * @param name quality name (low, medium or high)
+    * @return quality, RQ_MEDIUM if the name is not valid
+    */
+    static ResamplerQuality getQualityFromString(std::string name);
+
+    /**
+    * @param q quality
+    * @return quality name
+    */
+    static std::string getQualityAsString(ResamplerQuality q);
+
+private:
+    struct FilterBank {
+        unsigned phases;
+        unsigned taps;
+        //NOTE: phases x taps coefficients, row p interpolates at p/phases after the center tap
+        std::vector<float> coefs;
+    };
+
+    Resampler(unsigned ch, unsigned iRate, unsigned oRate, ResamplerQuality q,
+              unsigned l, unsigned m, std::shared_ptr<const FilterBank> b);
+
+    static std::shared_ptr<const FilterBank> getFilterBank(unsigned l, unsigned m, ResamplerQuality q);
+
+    unsigned channels;
+    unsigned inRate;
+    unsigned outRate;
+    ResamplerQuality quality;
+    unsigned upFactor;
+    unsigned downFactor;
+    std::shared_ptr<const FilterBank> bank;
+
+    //NOTE: input samples not consumed yet, base is the first one of the next output window
+    std::vector<std::vector<float>> history;
+    unsigned available;
+    unsigned base;
+    unsigned phase;
+    std::vector<std::vector<float>> outBuffers;
+};
+
+#endif
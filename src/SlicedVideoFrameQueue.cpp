@@ -115,6 +115,12 @@ bool SlicedVideoFrameQueue::setup(unsigned maxSliceSize)
         return false;
     }
 
+    //NOTE: flushed slices are pushed keeping the input frame timing for the rest of its slices
+    inputFrame->setFlushCallback([this](){
+        pushBackSliceGroup(inputFrame->getSlices(), inputFrame->getSliceNum());
+        inputFrame->clear();
+    });
+
     for (unsigned i=0; i < max; i++) {
         frames[i] = InterleavedVideoFrame::createNew(streamInfo->video.codec, maxSliceSize);
 
@@ -143,6 +149,7 @@ void SlicedVideoFrameQueue::pushBackSliceGroup(Slice* slices, int sliceNum)
         memcpy(vFrame->getDataBuf(), slices[i].getData(), slices[i].getDataSize());
         vFrame->setLength(slices[i].getDataSize());
         vFrame->setPresentationTime(inputFrame->getPresentationTime());
+        vFrame->setDecodeTime(inputFrame->getDecodeTime());
         vFrame->setOriginTime(inputFrame->getOriginTime());
         vFrame->setSize(inputFrame->getWidth(), inputFrame->getHeight());
         innerAddFrame();
@@ -277,6 +277,15 @@ namespace utils
             case VIDEO_SPLITTER:
                 stringType = "videoSplitter";
                 break;
+            case VIDEO_ENCODER_LADDER:
+                stringType = "videoEncoderLadder";
+                break;
+            case VIDEO_ENCODER_CHUNKED:
+                stringType = "videoEncoderChunked";
+                break;
+            case AUDIO_ENCODER_MULTI:
+                stringType = "audioEncoderMulti";
+                break;
             case DASHER:
                 stringType = "dasher";
                 break;                
@@ -321,6 +330,12 @@ namespace utils
            fType = DEMUXER;
         }  else if (stringFilterType.compare("videoSplitter") == 0) {
            fType = VIDEO_SPLITTER;
+        }  else if (stringFilterType.compare("videoEncoderLadder") == 0) {
+           fType = VIDEO_ENCODER_LADDER;
+        }  else if (stringFilterType.compare("videoEncoderChunked") == 0) {
+           fType = VIDEO_ENCODER_CHUNKED;
+        }  else if (stringFilterType.compare("audioEncoderMulti") == 0) {
+           fType = AUDIO_ENCODER_MULTI;
         }  else {
            fType = FT_NONE;
         }
@@ -23,6 +23,7 @@
 
  #include "VideoFrame.hh"
  #include <string.h>
+ #include <stdlib.h>
 
 VideoFrame::VideoFrame(VCodecType codec_) : 
 Frame(), codec(codec_), width(0), height(0), pixelFormat(P_NONE)
@@ -52,6 +53,67 @@ void VideoFrame::setPixelFormat(PixType pixelFormat)
     this->pixelFormat = pixelFormat;
 }
 
+//////////////////////////////////////////////////
+//FRAME BUFFER POOL METHODS IMPLEMENTATION       //
+//////////////////////////////////////////////////
+
+std::shared_ptr<FrameBufferPool> FrameBufferPool::createNew(unsigned bufferSize)
+{
+    return std::shared_ptr<FrameBufferPool>(new FrameBufferPool(bufferSize));
+}
+
+FrameBufferPool::FrameBufferPool(unsigned bufferSize) : bufferSize(bufferSize)
+{
+
+}
+
+FrameBufferPool::~FrameBufferPool()
+{
+    for (auto buffer : freeBuffers){
+        free(buffer);
+    }
+}
+
+std::shared_ptr<unsigned char> FrameBufferPool::getBuffer()
+{
+    std::weak_ptr<FrameBufferPool> self = shared_from_this();
+    unsigned char *buffer = NULL;
+
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        if (!freeBuffers.empty()){
+            buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+        }
+    }
+
+    if (!buffer){
+        void *mem = NULL;
+        if (posix_memalign(&mem, FRAME_BUFFER_ALIGN, bufferSize) != 0){
+            utils::errorMsg("[FrameBufferPool] Could not allocate frame buffer");
+            return std::shared_ptr<unsigned char>();
+        }
+        buffer = (unsigned char*) mem;
+        memset(buffer, 0, bufferSize);
+    }
+
+    //NOTE: buffers outliving its pool are just deleted
+    return std::shared_ptr<unsigned char>(buffer, [self](unsigned char *b){
+        std::shared_ptr<FrameBufferPool> pool = self.lock();
+        if (pool){
+            pool->releaseBuffer(b);
+        } else {
+            free(b);
+        }
+    });
+}
+
+void FrameBufferPool::releaseBuffer(unsigned char *buffer)
+{
+    std::lock_guard<std::mutex> guard(mtx);
+    freeBuffers.push_back(buffer);
+}
+
 //////////////////////////////////////////////////
 //INTERLEAVED VIDEO FRAME METHODS IMPLEMENTATION//
 //////////////////////////////////////////////////
@@ -61,20 +123,24 @@ InterleavedVideoFrame* InterleavedVideoFrame::createNew(VCodecType codec, unsign
     return new InterleavedVideoFrame(codec, maxLength);
 }
 
-InterleavedVideoFrame* InterleavedVideoFrame::createNew(VCodecType codec, int width, int height, PixType pixelFormat)
+InterleavedVideoFrame* InterleavedVideoFrame::createNew(VCodecType codec, int width, int height, PixType pixelFormat,
+                                                        std::shared_ptr<FrameBufferPool> pool)
 {
-    return new InterleavedVideoFrame(codec, width, height, pixelFormat);
+    return new InterleavedVideoFrame(codec, width, height, pixelFormat, pool);
 }
 
 InterleavedVideoFrame::InterleavedVideoFrame(VCodecType codec, unsigned int maxLength)
-: VideoFrame(codec), bufferLen(0)
+: VideoFrame(codec), bufferLen(0), bufferWidth(0), bufferHeight(0), viewX(0), viewY(0)
 {
     bufferMaxLen = maxLength;
-    frameBuff = new unsigned char [bufferMaxLen]();
+    pool = FrameBufferPool::createNew(bufferMaxLen);
+    frameBuff = pool->getBuffer();
 }
 
-InterleavedVideoFrame::InterleavedVideoFrame(VCodecType codec, int width, int height, PixType pixelFormat)
-: VideoFrame(codec, width, height, pixelFormat), bufferLen(0)
+InterleavedVideoFrame::InterleavedVideoFrame(VCodecType codec, int width, int height, PixType pixelFormat,
+                                             std::shared_ptr<FrameBufferPool> pool_)
+: VideoFrame(codec, width, height, pixelFormat), pool(pool_), bufferLen(0), 
+  bufferWidth(0), bufferHeight(0), viewX(0), viewY(0)
 {
     int bytesPerPixel;
 
@@ -94,12 +160,224 @@ InterleavedVideoFrame::InterleavedVideoFrame(VCodecType codec, int width, int he
     }
 
     bufferMaxLen = width * height * bytesPerPixel;
-    frameBuff = new unsigned char [bufferMaxLen]();
+
+    if (!pool || pool->getBufferSize() < bufferMaxLen){
+        pool = FrameBufferPool::createNew(bufferMaxLen);
+    }
+
+    bufferMaxLen = pool->getBufferSize();
+    frameBuff = pool->getBuffer();
 }
 
 InterleavedVideoFrame::~InterleavedVideoFrame()
 {
-    delete[] frameBuff;
+}
+
+void InterleavedVideoFrame::shareBuffer(InterleavedVideoFrame *frame)
+{
+    if (!frame || frame == this){
+        return;
+    }
+
+    frameBuff = frame->frameBuff;
+    bufferMaxLen = frame->bufferMaxLen;
+    bufferLen = frame->bufferLen;
+    bufferWidth = frame->bufferWidth;
+    bufferHeight = frame->bufferHeight;
+    viewX = frame->viewX;
+    viewY = frame->viewY;
+    setSize(frame->getWidth(), frame->getHeight());
+    setPixelFormat(frame->getPixelFormat());
+}
+
+bool InterleavedVideoFrame::shareBuffer(InterleavedVideoFrame *frame, int x, int y, int width, int height)
+{
+    int step[MAX_PLANES], xShift[MAX_PLANES], yShift[MAX_PLANES];
+    int planesNum, bWidth, bHeight;
+
+    if (!frame || frame == this || x < 0 || y < 0 || width <= 0 || height <= 0 ||
+            x + width > frame->getWidth() || y + height > frame->getHeight()){
+        return false;
+    }
+
+    planesNum = frame->getPlanesLayout(step, xShift, yShift);
+    if (planesNum == 0){
+        return false;
+    }
+
+    bWidth = frame->isView() ? frame->bufferWidth : frame->getWidth();
+    bHeight = frame->isView() ? frame->bufferHeight : frame->getHeight();
+    x += frame->viewX;
+    y += frame->viewY;
+
+    for (int p = 0; p < planesNum; p++){
+        if ((x >> xShift[p]) << xShift[p] != x || (y >> yShift[p]) << yShift[p] != y){
+            return false;
+        }
+    }
+
+    shareBuffer(frame);
+    setSize(width, height);
+
+    if (x == 0 && y == 0 && width == bWidth && height == bHeight){
+        bufferWidth = 0;
+        bufferHeight = 0;
+        viewX = 0;
+        viewY = 0;
+        return true;
+    }
+
+    bufferWidth = bWidth;
+    bufferHeight = bHeight;
+    viewX = x;
+    viewY = y;
+
+    bufferLen = getPictureLength(width, height);
+
+    return true;
+}
+
+bool InterleavedVideoFrame::attachBuffer(std::shared_ptr<unsigned char> buffer, int bWidth, int bHeight)
+{
+    if (!buffer || !pool || bWidth < getWidth() || bHeight < getHeight() ||
+            getPictureLength(bWidth, bHeight) > pool->getBufferSize()){
+        return false;
+    }
+
+    frameBuff = buffer;
+    bufferMaxLen = pool->getBufferSize();
+    bufferLen = getPictureLength(getWidth(), getHeight());
+    viewX = 0;
+    viewY = 0;
+
+    if (bWidth == getWidth() && bHeight == getHeight()){
+        bufferWidth = 0;
+        bufferHeight = 0;
+    } else {
+        bufferWidth = bWidth;
+        bufferHeight = bHeight;
+    }
+
+    return true;
+}
+
+unsigned InterleavedVideoFrame::getPictureLength(int width, int height)
+{
+    int step[MAX_PLANES], xShift[MAX_PLANES], yShift[MAX_PLANES];
+    int planesNum;
+    unsigned length = 0;
+
+    planesNum = getPlanesLayout(step, xShift, yShift);
+
+    for (int p = 0; p < planesNum; p++){
+        length += (-((-width) >> xShift[p])) * step[p] * (-((-height) >> yShift[p]));
+    }
+
+    return length;
+}
+
+void InterleavedVideoFrame::detachBuffer()
+{
+    bufferWidth = 0;
+    bufferHeight = 0;
+    viewX = 0;
+    viewY = 0;
+
+    if (!isBufferShared()){
+        return;
+    }
+
+    frameBuff = pool->getBuffer();
+    bufferMaxLen = pool->getBufferSize();
+}
+
+int InterleavedVideoFrame::getPlanesLayout(int step[MAX_PLANES], int xShift[MAX_PLANES], int yShift[MAX_PLANES])
+{
+    int planesNum = 1;
+
+    xShift[0] = 0;
+    yShift[0] = 0;
+
+    switch (getPixelFormat()) {
+        case RGB24:
+            step[0] = 3;
+            break;
+        case RGB32:
+            step[0] = 4;
+            break;
+        case YUYV422:
+            //NOTE: two pixels share the chroma samples
+            step[0] = 4;
+            xShift[0] = 1;
+            break;
+        case YUV420P:
+        case YUVJ420P:
+        case YUV422P:
+        case YUV444P:
+            planesNum = 3;
+            for (int p = 0; p < planesNum; p++){
+                step[p] = 1;
+                xShift[p] = p > 0 && getPixelFormat() != YUV444P ? 1 : 0;
+                yShift[p] = p > 0 && (getPixelFormat() == YUV420P || getPixelFormat() == YUVJ420P) ? 1 : 0;
+            }
+            break;
+        default:
+            planesNum = 0;
+            break;
+    }
+
+    return planesNum;
+}
+
+int InterleavedVideoFrame::getPlanes(unsigned char *planes[MAX_PLANES], int strides[MAX_PLANES])
+{
+    int step[MAX_PLANES], xShift[MAX_PLANES], yShift[MAX_PLANES];
+    int planesNum, bWidth, bHeight;
+    unsigned char *data = frameBuff.get();
+
+    planesNum = getPlanesLayout(step, xShift, yShift);
+    bWidth = isView() ? bufferWidth : getWidth();
+    bHeight = isView() ? bufferHeight : getHeight();
+
+    for (int p = 0; p < planesNum; p++){
+        strides[p] = (-((-bWidth) >> xShift[p])) * step[p];
+        planes[p] = data + (viewY >> yShift[p]) * strides[p] + (viewX >> xShift[p]) * step[p];
+        data += strides[p] * (-((-bHeight) >> yShift[p]));
+    }
+
+    for (int p = planesNum; p < MAX_PLANES; p++){
+        strides[p] = 0;
+        planes[p] = NULL;
+    }
+
+    return planesNum;
+}
+
+bool InterleavedVideoFrame::copyPicture(unsigned char *dst)
+{
+    int step[MAX_PLANES], xShift[MAX_PLANES], yShift[MAX_PLANES];
+    unsigned char *planes[MAX_PLANES];
+    int strides[MAX_PLANES];
+    int planesNum, lineSize, lines;
+
+    planesNum = getPlanes(planes, strides);
+    getPlanesLayout(step, xShift, yShift);
+
+    if (planesNum == 0){
+        return false;
+    }
+
+    for (int p = 0; p < planesNum; p++){
+        lineSize = (-((-getWidth()) >> xShift[p])) * step[p];
+        lines = -((-getHeight()) >> yShift[p]);
+
+        for (int l = 0; l < lines; l++){
+            memcpy(dst, planes[p] + l * strides[p], lineSize);
+            dst += lineSize;
+        }
+    }
+
+    return true;
 }
 
 /////////////////////////
@@ -140,6 +418,16 @@ bool SlicedVideoFrame::setSlice(unsigned char *data, unsigned size)
     return true;
 }
 
+bool SlicedVideoFrame::flushSlices()
+{
+    if (!flushCallback) {
+        return false;
+    }
+
+    flushCallback();
+    return true;
+}
+
 
 Slice::Slice() : data(NULL), dataSize(0)
 {
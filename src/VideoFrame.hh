@@ -24,12 +24,51 @@
 #ifndef _VIDEO_FRAME_HH
 #define _VIDEO_FRAME_HH
 
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "Frame.hh"
 #include "Types.hh"
 #include "Utils.hh"
 
 #define MAX_COPIED_SLICES 8
 #define MAX_SLICES 16
+#define MAX_PLANES 3
+#define FRAME_BUFFER_ALIGN 64
+
+/*! Pool of equally sized frame buffers. Buffers are handed out as refcounted pointers 
+    and they get back to the pool once the last frame referencing them releases them, 
+    so frames can share pictures without copying them. Buffers are FRAME_BUFFER_ALIGN 
+    aligned so SIMD code and libav can work on them directly. */
+class FrameBufferPool : public std::enable_shared_from_this<FrameBufferPool> {
+
+public:
+    /**
+    * Creates a new pool
+    * @param bufferSize size in bytes of each buffer of the pool
+    * @return shared pointer to the new pool
+    */
+    static std::shared_ptr<FrameBufferPool> createNew(unsigned bufferSize);
+    ~FrameBufferPool();
+
+    /**
+    * Gets a buffer not referenced by anyone else, allocating it if there is no free one
+    * @return refcounted buffer of getBufferSize() bytes
+    */
+    std::shared_ptr<unsigned char> getBuffer();
+
+    unsigned getBufferSize() const {return bufferSize;};
+
+private:
+    FrameBufferPool(unsigned bufferSize);
+    void releaseBuffer(unsigned char *buffer);
+
+    std::vector<unsigned char*> freeBuffers;
+    std::mutex mtx;
+    const unsigned bufferSize;
+};
 
 class VideoFrame : public Frame {
 
@@ -56,24 +95,113 @@ class InterleavedVideoFrame : public VideoFrame {
     
 public:
     static InterleavedVideoFrame* createNew(VCodecType codec, unsigned int maxLength);
-    static InterleavedVideoFrame* createNew(VCodecType codec, int width, int height, PixType pixelFormat);
+    static InterleavedVideoFrame* createNew(VCodecType codec, int width, int height, PixType pixelFormat,
+                                            std::shared_ptr<FrameBufferPool> pool = NULL);
     ~InterleavedVideoFrame();
 
     unsigned char **getPlanarDataBuf() {return NULL;};
-    unsigned char* getDataBuf() {return frameBuff;};
+    unsigned char* getDataBuf() {return frameBuff.get();};
     unsigned int getLength() {return bufferLen;};
     unsigned int getMaxLength() {return bufferMaxLen;};
     void setLength(unsigned int length) {bufferLen = length;};
     bool isPlanar() {return false;};
 
+    /**
+    * Makes this frame reference the buffer of another frame instead of copying it.
+    * Length, size and pixel format are taken from the other frame too.
+    * @param frame to share the buffer with
+    */
+    void shareBuffer(InterleavedVideoFrame *frame);
+
+    /**
+    * Makes this frame a view of a region of another frame instead of copying it.
+    * Lines of the view keep the stride of the whole picture, so consumers must
+    * access its pixels through getPlanes. Chroma subsampled formats require even
+    * x and y values.
+    * @param frame to share the buffer with
+    * @param x Upper left corner X position of the region
+    * @param y Upper left corner Y position of the region
+    * @param width of the region
+    * @param height of the region
+    * @return true if the region fits in the frame, false otherwise
+    */
+    bool shareBuffer(InterleavedVideoFrame *frame, int x, int y, int width, int height);
+
+    /**
+    * Makes this frame reference a buffer taken from its pool by someone else (i.e. 
+    * a decoder) that holds a picture of bufferWidth x bufferHeight, of which the 
+    * frame is the upper left region. Frame size and pixel format must be set before.
+    * @param buffer from the frame pool
+    * @param bufferWidth width of the picture in the buffer, defines the strides
+    * @param bufferHeight height of the picture in the buffer
+    * @return false if the picture does not fit in the frame pool buffers
+    */
+    bool attachBuffer(std::shared_ptr<unsigned char> buffer, int bufferWidth, int bufferHeight);
+
+    /**
+    * Drops the reference to a buffer that is shared with other frames, taking an
+    * unused one from the pool, and resets any view. It must be called before 
+    * writing into the frame.
+    */
+    void detachBuffer();
+
+    /**
+    * @return true if the frame is a region of a bigger picture
+    */
+    bool isView() const {return bufferWidth > 0;};
+
+    /**
+    * Gets the pointers to the planes of the picture and their strides in bytes,
+    * taking into account if the frame is a view.
+    * @param planes pointers to the first pixel of each plane
+    * @param strides bytes between the start of two consecutive lines of each plane
+    * @return number of planes or 0 if the pixel format is not supported
+    */
+    int getPlanes(unsigned char *planes[MAX_PLANES], int strides[MAX_PLANES]);
+
+    /**
+    * Gets how the planes of the pixel format are laid out. A plane of a picture of
+    * width w has -((-w) >> xShift) groups of step bytes per line.
+    * @param step bytes per pixel of each plane
+    * @param xShift horizontal subsampling of each plane as a power of 2
+    * @param yShift vertical subsampling of each plane as a power of 2
+    * @return number of planes or 0 if the pixel format is not supported
+    */
+    int getPlanesLayout(int step[MAX_PLANES], int xShift[MAX_PLANES], int yShift[MAX_PLANES]);
+
+    /**
+    * Copies the picture to a contiguous buffer, without padding between lines.
+    * @param dst buffer of at least getLength() bytes
+    * @return true if succeeded, false if the pixel format is not supported
+    */
+    bool copyPicture(unsigned char *dst);
+
+    /**
+    * @return true if the frame buffer is referenced by other frames
+    */
+    bool isBufferShared() const {return frameBuff.use_count() > 1;};
+
+    std::shared_ptr<FrameBufferPool> getBufferPool() const {return pool;};
+
 protected:
     InterleavedVideoFrame(VCodecType codec, unsigned int maxLength);
-    InterleavedVideoFrame(VCodecType codec, int width, int height, PixType pixelFormat);
+    InterleavedVideoFrame(VCodecType codec, int width, int height, PixType pixelFormat,
+                          std::shared_ptr<FrameBufferPool> pool = NULL);
 
 private:
-    unsigned char *frameBuff;
+    unsigned getPictureLength(int width, int height);
+
+    std::shared_ptr<FrameBufferPool> pool;
+    std::shared_ptr<unsigned char> frameBuff;
     unsigned int bufferLen;
     unsigned int bufferMaxLen;
+    
+    //NOTE: size of the whole picture stored in the buffer and region position when
+    //the frame is a view, bufferWidth is 0 otherwise
+    int bufferWidth;
+    int bufferHeight;
+    int viewX;
+    int viewY;
 };
 
 class Slice {
@@ -106,6 +234,19 @@ public:
     
     int getSliceNum() {return pointedSliceNum;};
 
+    /**
+    * Hands the slices set so far to the queue owning the frame, so readers can get 
+    * them while the rest of the picture is still being encoded. Slices data is copied.
+    * @return false if the frame does not belong to any queue
+    */
+    bool flushSlices();
+
+    /**
+    * Sets the function used by flushSlices, it is set by the owning queue
+    * @param callback function pushing the slices to the queue
+    */
+    void setFlushCallback(std::function<void()> callback) {flushCallback = callback;};
+
     unsigned char *getDataBuf() {return NULL;};
     unsigned char **getPlanarDataBuf() {return NULL;};
     unsigned int getLength() {return 0;};
@@ -119,6 +260,7 @@ private:
     Slice pointedSlices[MAX_SLICES];
 
     int pointedSliceNum;
+    std::function<void()> flushCallback;
 };
 
 
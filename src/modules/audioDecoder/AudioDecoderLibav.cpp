@@ -22,6 +22,8 @@
 
 #include "AudioDecoderLibav.hh"
 #include "../../AudioCircularBuffer.hh"
+#include "../../ChannelMatrix.hh"
+#include "../../PcmKernels.hh"
 #include "../../Utils.hh"
 #include <functional>
 #include <fstream>
@@ -55,6 +57,7 @@ AudioDecoderLibav::AudioDecoderLibav()
     codec = NULL;
     codecCtx = NULL;
     resampleCtx = NULL;
+    resampler = NULL;
     inFrame = NULL;
     av_init_packet(&pkt);
     pkt.data = NULL;
@@ -65,6 +68,8 @@ AudioDecoderLibav::AudioDecoderLibav()
     inSampleRate = 0;
     inFrame = av_frame_alloc();
     inLibavSampleFmt = AV_SAMPLE_FMT_NONE;
+    inSampleFmt = S_NONE;
+    resampleOffset = std::chrono::microseconds(0);
 
     initializeEventMap();
 
@@ -76,6 +81,7 @@ AudioDecoderLibav::~AudioDecoderLibav()
     avcodec_close(codecCtx);
     av_free(codecCtx);
     swr_free(&resampleCtx);
+    delete resampler;
     av_free(inFrame);
     av_packet_unref(&pkt);
 }
@@ -135,15 +141,17 @@ bool AudioDecoderLibav::doProcessFrame(Frame *org, Frame *dst)
     }
 
     dst->setConsumed(true);
-    dst->setPresentationTime(org->getPresentationTime());
+    dst->setPresentationTime(org->getPresentationTime() + resampleOffset);
     dst->setOriginTime(org->getOriginTime());
     dst->setSequenceNumber(org->getSequenceNumber());
     
     return true;
 }
 
-bool AudioDecoderLibav::configure0(SampleFmt sampleFormat, int channels, int sampleRate)
+bool AudioDecoderLibav::configure0(SampleFmt sampleFormat, int channels, int sampleRate,
+                                   ResamplerQuality quality)
 {
+    resamplerQuality = quality;
     outSampleFmt = sampleFormat;
     outChannels = channels;
     outSampleRate = sampleRate;
@@ -204,6 +212,8 @@ bool AudioDecoderLibav::inputConfig()
     }
 
     if (swr_is_initialized(resampleCtx) == 0) {
+        setChannelMatrix();
+
         if (swr_init(resampleCtx) < 0) {
             utils::errorMsg("Init context failure!");
             return false;
@@ -238,6 +248,8 @@ bool AudioDecoderLibav::outputConfig()
     }
 
     if (swr_is_initialized(resampleCtx) == 0) {
+        setChannelMatrix();
+
         if (swr_init(resampleCtx) < 0) {
             utils::errorMsg("Init context failure!");
             return false;
@@ -247,35 +259,81 @@ bool AudioDecoderLibav::outputConfig()
     return true;
 }
 
+void AudioDecoderLibav::setChannelMatrix()
+{
+    std::vector<float> matrix;
+    std::vector<double> coefs;
+
+    if (inChannels == outChannels || !channelmatrix::getMatrix(inChannels, outChannels, matrix)) {
+        return;
+    }
+
+    //NOTE: same coefficients as AudioMixer, libswresample applies them with its own SIMD code
+    coefs.assign(matrix.begin(), matrix.end());
+
+    if (swr_set_matrix(resampleCtx, coefs.data(), inChannels) < 0) {
+        utils::warningMsg("[DECODER] Cannot set channel matrix, using libswresample default one");
+    }
+}
+
+void AudioDecoderLibav::configResampler()
+{
+    //NOTE: channel changes are left to libswresample, which also applies the channel matrix
+    if (inSampleRate == outSampleRate || inChannels != outChannels ||
+        !pcmkernels::isSupported(inSampleFmt, FLTP) || !pcmkernels::isSupported(FLTP, outSampleFmt)) {
+        delete resampler;
+        resampler = NULL;
+        return;
+    }
+
+    if (resampler && resampler->getChannels() == inChannels && resampler->getInputRate() == inSampleRate &&
+        resampler->getOutputRate() == outSampleRate && resampler->getQuality() == resamplerQuality) {
+        return;
+    }
+
+    delete resampler;
+    resampler = Resampler::createNew(inChannels, inSampleRate, outSampleRate, resamplerQuality);
+}
+
 bool AudioDecoderLibav::resample(AVFrame* src, AudioFrame* dst)
 {
     int samples;
+    unsigned char **outBuff;
 
+    configResampler();
+
+    //NOTE: AudioCircularBuffer rear frames are views of the ring, so samples are written in place
     if (dst->isPlanar()) {
-        samples = swr_convert(
-                    resampleCtx,
-                    dst->getPlanarDataBuf(),
-                    dst->getMaxSamples(),
-                    (const uint8_t**)src->data,
-                    src->nb_samples
-                  );
+        outBuff = dst->getPlanarDataBuf();
+    } else {
+        auxBuff[0] = dst->getDataBuf();
+        outBuff = auxBuff;
+    }
+
+    //NOTE: libswresample is only needed to change the rate or the channels
+    if (inSampleRate == outSampleRate && inChannels == outChannels &&
+        pcmkernels::isSupported(inSampleFmt, outSampleFmt) && src->nb_samples <= (int) dst->getMaxSamples()) {
+
+        pcmkernels::convert((const unsigned char* const*) src->extended_data, inSampleFmt,
+                            outBuff, outSampleFmt, outChannels, src->nb_samples);
+        samples = src->nb_samples;
+        resampleOffset = std::chrono::microseconds(0);
+
+    } else if (resampler) {
+        samples = resampler->process((const unsigned char* const*) src->extended_data, inSampleFmt,
+                                     src->nb_samples, outBuff, outSampleFmt, dst->getMaxSamples(),
+                                     resampleOffset);
 
         if (samples < 0) {
             return false;
         }
 
-        dst->setLength(samples*bytesPerSample);
-        dst->setSamples(samples);
-
     } else {
-
-        auxBuff[0] = dst->getDataBuf();
-
         samples = swr_convert(
                     resampleCtx,
-                    (uint8_t**)auxBuff,
+                    outBuff,
                     dst->getMaxSamples(),
-                    (const uint8_t**)src->data,
+                    (const uint8_t**)src->extended_data,
                     src->nb_samples
                   );
 
@@ -283,10 +341,16 @@ bool AudioDecoderLibav::resample(AVFrame* src, AudioFrame* dst)
             return false;
         }
 
+        resampleOffset = std::chrono::microseconds(0);
+    }
+
+    if (dst->isPlanar()) {
+        dst->setLength(samples*bytesPerSample);
+    } else {
         dst->setLength(outChannels*samples*bytesPerSample);
-        dst->setSamples(samples);
     }
 
+    dst->setSamples(samples);
     return true;
 }
 
@@ -332,6 +396,7 @@ bool AudioDecoderLibav::configEvent(Jzon::Node* params)
     SampleFmt newSampleFmt = outSampleFmt;
     int newChannels = outChannels;
     int newSampleRate = outSampleRate;
+    ResamplerQuality newQuality = resamplerQuality;
 
     if (!params) {
         return false;
@@ -349,16 +414,22 @@ bool AudioDecoderLibav::configEvent(Jzon::Node* params)
         newSampleFmt = utils::getSampleFormatFromString(params->Get("sampleFormat").ToString());
     }
 
-    return configure0(newSampleFmt, newChannels, newSampleRate);
+    if (params->Has("resamplerQuality")) {
+        newQuality = Resampler::getQualityFromString(params->Get("resamplerQuality").ToString());
+    }
+
+    return configure0(newSampleFmt, newChannels, newSampleRate, newQuality);
 }
 
-bool AudioDecoderLibav::configure(SampleFmt sampleFormat, int channels, int sampleRate)
+bool AudioDecoderLibav::configure(SampleFmt sampleFormat, int channels, int sampleRate,
+                                  ResamplerQuality quality)
 {
     Jzon::Object root, params;
     root.Add("action", "configure");
     params.Add("sampleFormat", utils::getSampleFormatAsString(sampleFormat));
     params.Add("channels", channels);
     params.Add("sampleRate", sampleRate);
+    params.Add("resamplerQuality", Resampler::getQualityAsString(quality));
     root.Add("params", params);
 
     Event e(root, std::chrono::system_clock::now(), 0);
@@ -377,6 +448,7 @@ void AudioDecoderLibav::doGetState(Jzon::Object &filterNode)
     filterNode.Add("sampleRate", (int)outSampleRate);
     filterNode.Add("channels", (int)outChannels);
     filterNode.Add("sampleFormat", utils::getSampleFormatAsString(outSampleFmt));
+    filterNode.Add("resamplerQuality", Resampler::getQualityAsString(resamplerQuality));
 }
 
 bool AudioDecoderLibav::reconfigureDecoder(AudioFrame* frame)
@@ -31,6 +31,7 @@ extern "C" {
 #include "../../AudioFrame.hh"
 #include "../../FrameQueue.hh"
 #include "../../Filter.hh"
+#include "../../Resampler.hh"
 
 
 class AudioDecoderLibav : public OneToOneFilter {
@@ -38,16 +39,20 @@ class AudioDecoderLibav : public OneToOneFilter {
 public:
     AudioDecoderLibav();
     ~AudioDecoderLibav();
-    bool configure(SampleFmt sampleFormat, int channels, int sampleRate);
+    bool configure(SampleFmt sampleFormat, int channels, int sampleRate,
+                   ResamplerQuality quality = RQ_MEDIUM);
     
 protected:
     bool doProcessFrame(Frame *org, Frame *dst);
     FrameQueue* allocQueue(ConnectionData cData);
-    bool configure0(SampleFmt sampleFormat, int channels, int sampleRate);
+    bool configure0(SampleFmt sampleFormat, int channels, int sampleRate,
+                    ResamplerQuality quality = RQ_MEDIUM);
 
 private:
     void initializeEventMap();
     bool resample(AVFrame* src, AudioFrame* dst);
+    void setChannelMatrix();
+    void configResampler();
     void checkSampleFormat(int sampleFormat);
     bool inputConfig();
     bool outputConfig();
@@ -69,6 +74,7 @@ private:
     AVPacket            pkt;
     int                 gotFrame;
     SwrContext          *resampleCtx;
+    Resampler           *resampler;
     AVSampleFormat      inLibavSampleFmt;
     AVSampleFormat      outLibavSampleFmt;
 
@@ -80,6 +86,8 @@ private:
     unsigned inSampleRate;
     unsigned outSampleRate;
     unsigned bytesPerSample;
+    ResamplerQuality resamplerQuality;
+    std::chrono::microseconds resampleOffset;
     unsigned char *auxBuff[1];
 
 };
@@ -23,8 +23,15 @@
 #include "AudioEncoderLibav.hh"
 #include "../../AVFramedQueue.hh"
 #include "../../AudioCircularBuffer.hh"
+#include "../../PcmKernels.hh"
 #include "../../Utils.hh"
 
+#include <algorithm>
+#include <string.h>
+
+//NOTE: input samples the resamplers may keep from one frame to the next one
+#define RESAMPLING_MARGIN 64
+
 bool checkSampleFormat(AVCodec *codec, enum AVSampleFormat sampleFmt);
 bool checkSampleRateSupport(AVCodec *codec, int sampleRate);
 bool checkChannelLayoutSupport(AVCodec *codec, uint64_t channelLayout);
@@ -39,6 +46,11 @@ AudioEncoderLibav::AudioEncoderLibav() : OneToOneFilter(),
     codec = NULL;
     codecCtx = NULL;
     resampleCtx = NULL;
+    resampler = NULL;
+    resamplerQuality = RQ_MEDIUM;
+    inputBuffer = NULL;
+    fifoSamples = 0;
+    fifoTs = std::chrono::microseconds(0);
     libavFrame = av_frame_alloc();
     av_init_packet(&pkt);
     pkt.data = NULL;
@@ -63,6 +75,7 @@ AudioEncoderLibav::~AudioEncoderLibav()
     avcodec_close(codecCtx);
     av_free(codecCtx);
     swr_free(&resampleCtx);
+    delete resampler;
     av_free(libavFrame);
     av_packet_unref(&pkt);
 }
@@ -77,6 +90,8 @@ bool AudioEncoderLibav::doProcessFrame(Frame *org, Frame *dst)
     int ret, gotFrame, samples;
     AudioFrame* rawFrame;
     AudioFrame* codedFrame;
+    uint8_t *planes[MAX_CHANNELS];
+    std::chrono::microseconds pts;
 
     rawFrame = dynamic_cast<AudioFrame*>(org);
     codedFrame = dynamic_cast<AudioFrame*>(dst);
@@ -96,15 +111,39 @@ bool AudioEncoderLibav::doProcessFrame(Frame *org, Frame *dst)
     pkt.size = codedFrame->getMaxLength();
 
     //resample in order to adapt to encoder constraints
-    samples = resample(rawFrame, libavFrame);
+    samples = resample(rawFrame);
 
-    if (samples <= 0) {
+    if (samples < 0) {
         utils::errorMsg("Error encoding audio frame: resampling error");
         return false;
     }
 
+    //NOTE: resampled frames may be a bit shorter than the encoder ones, the
+    //encoder waits for the next input frame then
+    if (fifoSamples < samplesPerFrame) {
+        return false;
+    }
+
+    //NOTE: the encoder reads the samples from the FIFO
+    for (unsigned p = 0; p < fifo.size(); p++) {
+        planes[p] = fifo[p].data();
+
+        if (p < AV_NUM_DATA_POINTERS) {
+            libavFrame->data[p] = planes[p];
+        }
+    }
+
+    libavFrame->extended_data = planes;
+    libavFrame->nb_samples = samplesPerFrame;
+    libavFrame->linesize[0] = samplesPerFrame*utils::getBytesPerSampleFromFormat(outputStreamInfo->audio.sampleFormat)*
+                              (outputStreamInfo->audio.channels/fifo.size());
+
     ret = avcodec_encode_audio2(codecCtx, &pkt, libavFrame, &gotFrame);
 
+    libavFrame->extended_data = libavFrame->data;
+    pts = fifoTs;
+    trimFifo(samplesPerFrame);
+
     if (ret < 0) {
         utils::errorMsg("Error encoding audio frame");
         return false;
@@ -116,10 +155,10 @@ bool AudioEncoderLibav::doProcessFrame(Frame *org, Frame *dst)
     }
 
     codedFrame->setLength(pkt.size);
-    codedFrame->setSamples(samples);
+    codedFrame->setSamples(samplesPerFrame);
 
     dst->setConsumed(true);
-    dst->setPresentationTime(org->getPresentationTime());
+    dst->setPresentationTime(pts);
     dst->setOriginTime(org->getOriginTime());
     dst->setSequenceNumber(org->getSequenceNumber());
     
@@ -143,12 +182,40 @@ bool AudioEncoderLibav::specificReaderConfig(int /*readerID*/, FrameQueue* queue
         return false;
     }
 
-    b->setOutputFrameSamples(samplesPerFrame);
+    inputBuffer = b;
+    setInputFrameSamples();
 
     return true;
 }
 
-bool AudioEncoderLibav::configure0(ACodecType codec, int codedAudioChannels, int codedAudioSampleRate, int bitrate)
+void AudioEncoderLibav::setInputFrameSamples()
+{
+    if (!inputBuffer || outputStreamInfo->audio.sampleRate == 0) {
+        return;
+    }
+
+    //NOTE: input frames are not longer than the encoded ones once resampled, so
+    //each input frame is encoded in one frame at most and the FIFO does not grow
+    inputBuffer->setOutputFrameSamples(samplesPerFrame*inputBuffer->getSampleRate()/outputStreamInfo->audio.sampleRate);
+}
+
+void AudioEncoderLibav::trimFifo(unsigned samples)
+{
+    unsigned sampleBytes = utils::getBytesPerSampleFromFormat(outputStreamInfo->audio.sampleFormat)*
+                           (outputStreamInfo->audio.channels/fifo.size());
+
+    samples = std::min(samples, fifoSamples);
+
+    for (auto &plane : fifo) {
+        memmove(plane.data(), plane.data() + samples*sampleBytes, (fifoSamples - samples)*sampleBytes);
+    }
+
+    fifoSamples -= samples;
+    fifoTs += std::chrono::microseconds(samples*std::micro::den/outputStreamInfo->audio.sampleRate);
+}
+
+bool AudioEncoderLibav::configure0(ACodecType codec, int codedAudioChannels, int codedAudioSampleRate, int bitrate,
+                                   ResamplerQuality quality)
 {
     AVCodecID codecId;
 
@@ -162,6 +229,7 @@ bool AudioEncoderLibav::configure0(ACodecType codec, int codedAudioChannels, int
     outputStreamInfo->audio.channels = codedAudioChannels;
     outputStreamInfo->audio.sampleRate = codedAudioSampleRate;
     outputBitrate = bitrate;
+    resamplerQuality = quality;
 
     switch(getCodec()) {
         case PCM:
@@ -242,7 +310,7 @@ bool AudioEncoderLibav::codingConfig(AVCodecID codecId)
     if (codecCtx->frame_size != 0) {
         libavFrame->nb_samples = codecCtx->frame_size;
     } else {
-        libavFrame->nb_samples = AudioFrame::getDefaultSamples(inputSampleRate);
+        libavFrame->nb_samples = AudioFrame::getDefaultSamples(outputStreamInfo->audio.sampleRate);
     }
 
     libavFrame->format = codecCtx->sample_fmt;
@@ -251,16 +319,28 @@ bool AudioEncoderLibav::codingConfig(AVCodecID codecId)
 
     samplesPerFrame = libavFrame->nb_samples;
 
-    if (av_frame_get_buffer(libavFrame, 0) < 0) {
-        utils::errorMsg("Could not setup audio frame");
-        return false;
-    }
+    fifo.assign(av_sample_fmt_is_planar(internalLibavSampleFmt) ? outputStreamInfo->audio.channels : 1,
+                std::vector<unsigned char>());
+    fifoSamples = 0;
+    setInputFrameSamples();
 
     return true;
 }
 
 bool AudioEncoderLibav::resamplingConfig()
 {
+    delete resampler;
+    resampler = NULL;
+
+    //NOTE: rate only changes use the polyphase resampler, channel changes are left to libswresample
+    if (inputSampleRate != outputStreamInfo->audio.sampleRate &&
+        inputChannels == outputStreamInfo->audio.channels &&
+        pcmkernels::isSupported(inputSampleFmt, FLTP) &&
+        pcmkernels::isSupported(FLTP, outputStreamInfo->audio.sampleFormat)) {
+        resampler = Resampler::createNew(inputChannels, inputSampleRate,
+                                         outputStreamInfo->audio.sampleRate, resamplerQuality);
+    }
+
     resampleCtx = swr_alloc_set_opts
                   (
                     resampleCtx,
@@ -298,6 +378,7 @@ bool AudioEncoderLibav::reconfigure(AudioFrame* frame)
         inputSampleFmt = frame->getSampleFmt();
         inputChannels = frame->getChannels();
         inputSampleRate = frame->getSampleRate();
+        fifoSamples = 0;
 
         switch(inputSampleFmt) {
             case U8:
@@ -329,33 +410,63 @@ bool AudioEncoderLibav::reconfigure(AudioFrame* frame)
     return true;
 }
 
-int AudioEncoderLibav::resample(AudioFrame* src, AVFrame* dst)
+int AudioEncoderLibav::resample(AudioFrame* src)
 {
     int samples;
-    unsigned char *auxBuff;
+    unsigned char *auxBuff[1];
+    unsigned char **inBuff;
+    unsigned char *outBuff[MAX_CHANNELS];
+    unsigned sampleBytes = utils::getBytesPerSampleFromFormat(outputStreamInfo->audio.sampleFormat)*
+                           (outputStreamInfo->audio.channels/fifo.size());
+    //NOTE: resamplers may keep some input samples from one frame to the next one
+    unsigned maxSamples = (src->getSamples() + RESAMPLING_MARGIN)*outputStreamInfo->audio.sampleRate/inputSampleRate + 1;
+    std::chrono::microseconds offset(0);
 
     if (src->isPlanar()) {
-        samples = swr_convert(
-                    resampleCtx,
-                    dst->data,
-                    dst->nb_samples,
-                    (const uint8_t**)src->getPlanarDataBuf(),
-                    src->getSamples()
-                  );
-
+        inBuff = src->getPlanarDataBuf();
     } else {
-        auxBuff = src->getDataBuf();
+        auxBuff[0] = src->getDataBuf();
+        inBuff = auxBuff;
+    }
 
+    for (unsigned p = 0; p < fifo.size(); p++) {
+        if (fifo[p].size() < (fifoSamples + maxSamples)*sampleBytes) {
+            fifo[p].resize((fifoSamples + maxSamples)*sampleBytes);
+        }
+
+        outBuff[p] = fifo[p].data() + fifoSamples*sampleBytes;
+    }
+
+    //NOTE: libswresample is only needed to change the rate or the channels
+    if (inputSampleRate == outputStreamInfo->audio.sampleRate &&
+        inputChannels == outputStreamInfo->audio.channels &&
+        pcmkernels::isSupported(inputSampleFmt, outputStreamInfo->audio.sampleFormat)) {
+
+        pcmkernels::convert(inBuff, inputSampleFmt, outBuff,
+                            outputStreamInfo->audio.sampleFormat, inputChannels, src->getSamples());
+        samples = src->getSamples();
+    } else if (resampler) {
+        samples = resampler->process(inBuff, inputSampleFmt, src->getSamples(), outBuff,
+                                     outputStreamInfo->audio.sampleFormat, maxSamples, offset);
+    } else {
         samples = swr_convert(
                     resampleCtx,
-                    dst->data,
-                    dst->nb_samples,
-                    (const uint8_t**)auxBuff,
+                    outBuff,
+                    maxSamples,
+                    (const uint8_t**)inBuff,
                     src->getSamples()
                   );
+    }
+
+    if (samples < 0) {
+        return samples;
+    }
 
+    if (fifoSamples == 0) {
+        fifoTs = src->getPresentationTime() + offset;
     }
 
+    fifoSamples += samples;
     return samples;
 }
 
@@ -364,6 +475,7 @@ void AudioEncoderLibav::doGetState(Jzon::Object &filterNode)
     filterNode.Add("codec", utils::getAudioCodecAsString(getCodec()));
     filterNode.Add("sampleRate", (int)outputStreamInfo->audio.sampleRate);
     filterNode.Add("channels", (int)outputStreamInfo->audio.channels);
+    filterNode.Add("resamplerQuality", Resampler::getQualityAsString(resamplerQuality));
 }
 
 bool checkSampleFormat(AVCodec *codec, enum AVSampleFormat sampleFmt)
@@ -423,6 +535,7 @@ bool AudioEncoderLibav::configEvent(Jzon::Node* params)
     int codedAudioChannels;
     int codedAudioSampleRate;
     int bitrate;
+    ResamplerQuality quality;
 
     if (!params) {
         return false;
@@ -432,6 +545,7 @@ bool AudioEncoderLibav::configEvent(Jzon::Node* params)
     codedAudioChannels = outputStreamInfo->audio.channels;
     codedAudioSampleRate = outputStreamInfo->audio.sampleRate;
     bitrate = outputBitrate;
+    quality = resamplerQuality;
 
     if (params->Has("codec")) {
         codec = utils::getAudioCodecFromString(params->Get("codec").ToString());
@@ -449,7 +563,11 @@ bool AudioEncoderLibav::configEvent(Jzon::Node* params)
         bitrate = params->Get("bitrate").ToInt();
     }
 
-    return configure0(codec, codedAudioChannels, codedAudioSampleRate, bitrate);
+    if (params->Has("resamplerQuality")) {
+        quality = Resampler::getQualityFromString(params->Get("resamplerQuality").ToString());
+    }
+
+    return configure0(codec, codedAudioChannels, codedAudioSampleRate, bitrate, quality);
 }
 
 void AudioEncoderLibav::initializeEventMap()
@@ -457,7 +575,8 @@ void AudioEncoderLibav::initializeEventMap()
     eventMap["configure"] = std::bind(&AudioEncoderLibav::configEvent, this, std::placeholders::_1);
 }
 
-bool AudioEncoderLibav::configure(ACodecType codec, int codedAudioChannels, int codedAudioSampleRate, int bitrate)
+bool AudioEncoderLibav::configure(ACodecType codec, int codedAudioChannels, int codedAudioSampleRate, int bitrate,
+                                  ResamplerQuality quality)
 {
     Jzon::Object root, params;
     root.Add("action", "configure");
@@ -465,6 +584,7 @@ bool AudioEncoderLibav::configure(ACodecType codec, int codedAudioChannels, int
     params.Add("channels", codedAudioChannels);
     params.Add("sampleRate", codedAudioSampleRate);
     params.Add("bitrate", bitrate);
+    params.Add("resamplerQuality", Resampler::getQualityAsString(quality));
     root.Add("params", params);
 
     Event e(root, std::chrono::system_clock::now(), 0);
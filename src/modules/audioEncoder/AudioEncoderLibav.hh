@@ -24,6 +24,7 @@
 #define _AUDIO_ENCODER_LIBAV_HH
 
 #include <chrono>
+#include <vector>
 
 extern "C" {
     #include <libavcodec/avcodec.h>
@@ -32,9 +33,11 @@ extern "C" {
 
 #include "../../AudioFrame.hh"
 #include "../../FrameQueue.hh"
+#include "../../AudioCircularBuffer.hh"
 #include "../../Filter.hh"
 #include "../../Utils.hh"
 #include "../../StreamInfo.hh"
+#include "../../Resampler.hh"
 
 class AudioEncoderLibav : public OneToOneFilter {
 
@@ -42,7 +45,8 @@ public:
     AudioEncoderLibav();
     ~AudioEncoderLibav();
 
-    bool configure(ACodecType codec, int codedAudioChannels, int codedAudioSampleRate, int bitrate);
+    bool configure(ACodecType codec, int codedAudioChannels, int codedAudioSampleRate, int bitrate,
+                   ResamplerQuality quality = RQ_MEDIUM);
     unsigned getSamplesPerFrame(){ return samplesPerFrame;};
     ACodecType getCodec() {return outputStreamInfo->audio.codec;};
     
@@ -52,10 +56,12 @@ protected:
     bool specificReaderConfig(int /*readerID*/, FrameQueue* queue);
     bool specificReaderDelete(int /*readerID*/) {return true;};
 
-private:
-    bool configure0(ACodecType codec, int codedAudioChannels, int codedAudioSampleRate, int bitrate);
+    bool configure0(ACodecType codec, int codedAudioChannels, int codedAudioSampleRate, int bitrate,
+                    ResamplerQuality quality);
     void initializeEventMap();
-    int resample(AudioFrame* src, AVFrame* dst);
+    int resample(AudioFrame* src);
+    void setInputFrameSamples();
+    void trimFifo(unsigned samples);
     bool reconfigure(AudioFrame* frame);
     bool resamplingConfig();
     bool codingConfig(AVCodecID codecId); 
@@ -74,6 +80,13 @@ private:
     AVFrame             *libavFrame;
     AVPacket            pkt;
     SwrContext          *resampleCtx;
+    Resampler           *resampler;
+    ResamplerQuality    resamplerQuality;
+    AudioCircularBuffer *inputBuffer;
+    //NOTE: samples in the output format not encoded yet, one buffer per plane, from fifoTs on
+    std::vector<std::vector<unsigned char>> fifo;
+    unsigned            fifoSamples;
+    std::chrono::microseconds fifoTs;
     int                 gotFrame;
 
     unsigned            samplesPerFrame;
@@ -0,0 +1,743 @@
+/*
+ *  AudioEncoderMulti - Multi-codec libav-based audio encoder
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "AudioEncoderMulti.hh"
+#include "../../AVFramedQueue.hh"
+#include "../../PcmKernels.hh"
+
+#include <algorithm>
+#include <string.h>
+
+//NOTE: input samples the resamplers may keep from one frame to the next one
+#define CONVERSION_MARGIN 64
+
+//NOTE: defined in AudioEncoderLibav.cpp
+bool checkSampleFormat(AVCodec *codec, enum AVSampleFormat sampleFmt);
+bool checkSampleRateSupport(AVCodec *codec, int sampleRate);
+bool checkChannelLayoutSupport(AVCodec *codec, uint64_t channelLayout);
+
+static AVSampleFormat getLibavSampleFmt(SampleFmt fmt)
+{
+    switch (fmt) {
+        case U8:
+            return AV_SAMPLE_FMT_U8;
+        case S16:
+            return AV_SAMPLE_FMT_S16;
+        case FLT:
+            return AV_SAMPLE_FMT_FLT;
+        case U8P:
+            return AV_SAMPLE_FMT_U8P;
+        case S16P:
+            return AV_SAMPLE_FMT_S16P;
+        case FLTP:
+            return AV_SAMPLE_FMT_FLTP;
+        default:
+            return AV_SAMPLE_FMT_NONE;
+    }
+}
+
+//NOTE: same codec parameters as AudioEncoderLibav
+static AVCodecID getCodecParams(ACodecType codec, SampleFmt &sampleFmt)
+{
+    switch (codec) {
+        case PCM:
+            sampleFmt = S16;
+            return AV_CODEC_ID_PCM_S16BE;
+        case PCMU:
+            sampleFmt = S16;
+            return AV_CODEC_ID_PCM_MULAW;
+        case OPUS:
+            sampleFmt = S16;
+            return AV_CODEC_ID_OPUS;
+        case AAC:
+            sampleFmt = S16;
+            return AV_CODEC_ID_AAC;
+        case MP3:
+            sampleFmt = S16P;
+            return AV_CODEC_ID_MP3;
+        default:
+            sampleFmt = S_NONE;
+            return AV_CODEC_ID_NONE;
+    }
+}
+
+static bool isPlanarFmt(SampleFmt fmt)
+{
+    return fmt == U8P || fmt == S16P || fmt == FLTP;
+}
+
+AudioEncoderMulti::AudioEncoderMulti() :
+OneToManyFilter(MAX_AUDIO_ENCODER_STREAMS), inputBuffer(NULL), inSampleFmt(S_NONE), inChannels(0),
+inSampleRate(0), needsConfig(false), resamplerQuality(RQ_MEDIUM)
+{
+    avcodec_register_all();
+    fType = AUDIO_ENCODER_MULTI;
+    initializeEventMap();
+}
+
+AudioEncoderMulti::~AudioEncoderMulti()
+{
+    freeConversions();
+
+    for (auto it : streams){
+        freeStream(it.second);
+    }
+
+    streams.clear();
+}
+
+FrameQueue* AudioEncoderMulti::allocQueue(ConnectionData cData)
+{
+    if (streams.count(cData.writerId) <= 0 || !streams[cData.writerId]->enabled){
+        return NULL;
+    }
+
+    return AudioFrameQueue::createNew(cData, streams[cData.writerId]->streamInfo, DEFAULT_AUDIO_FRAMES);
+}
+
+bool AudioEncoderMulti::doProcessFrame(Frame *org, std::map<int, Frame *> &dstFrames)
+{
+    AudioFrame *rawFrame;
+    Stream *s;
+    bool processed = false;
+
+    rawFrame = dynamic_cast<AudioFrame*>(org);
+
+    if (!rawFrame){
+        utils::errorMsg("[AudioEncoderMulti] Origin frame MUST be an AudioFrame");
+        return false;
+    }
+
+    for (auto it : dstFrames){
+        it.second->setConsumed(false);
+    }
+
+    if (!reconfigure(rawFrame)){
+        utils::errorMsg("[AudioEncoderMulti] Reconfiguration failed");
+        return false;
+    }
+
+    //NOTE: each conversion runs once for all the streams sharing it
+    for (auto it : conversions){
+        if (!convert(it.second, rawFrame)){
+            utils::errorMsg("[AudioEncoderMulti] Could not convert input frame");
+            return false;
+        }
+    }
+
+    for (auto it : streams){
+        s = it.second;
+
+        if (!s->enabled || !s->conversion){
+            continue;
+        }
+
+        auto dst = dstFrames.find(it.first);
+
+        if (dst != dstFrames.end() && encodeStream(s, org, dst->second)){
+            dst->second->setConsumed(true);
+            processed = true;
+        }
+
+        if (s->conversion->fifoSamples - s->cursor > MAX_PENDING_AUDIO_FRAMES*s->frameSamples){
+            utils::warningMsg("[AudioEncoderMulti] Stream " + std::to_string(it.first) + " falls behind, dropping samples");
+            s->cursor = s->conversion->fifoSamples;
+        }
+    }
+
+    for (auto it : conversions){
+        trimConversion(it.second);
+    }
+
+    return processed;
+}
+
+bool AudioEncoderMulti::convert(Conversion *c, AudioFrame *frame)
+{
+    unsigned char *in[MAX_CHANNELS];
+    unsigned char *out[MAX_CHANNELS];
+    unsigned planes = isPlanarFmt(c->sampleFmt) ? c->channels : 1;
+    unsigned sampleBytes = utils::getBytesPerSampleFromFormat(c->sampleFmt)*(c->channels/planes);
+    unsigned maxSamples = (frame->getSamples() + CONVERSION_MARGIN)*c->sampleRate/inSampleRate + 1;
+    std::chrono::microseconds offset(0);
+    int samples;
+
+    if (frame->isPlanar()){
+        std::copy(frame->getPlanarDataBuf(), frame->getPlanarDataBuf() + inChannels, in);
+    } else {
+        in[0] = frame->getDataBuf();
+    }
+
+    for (unsigned p = 0; p < planes; p++){
+        if (c->fifo[p].size() < (c->fifoSamples + maxSamples)*sampleBytes){
+            c->fifo[p].resize((c->fifoSamples + maxSamples)*sampleBytes);
+        }
+
+        out[p] = c->fifo[p].data() + c->fifoSamples*sampleBytes;
+    }
+
+    if (c->resampler){
+        samples = c->resampler->process(in, inSampleFmt, frame->getSamples(), out, c->sampleFmt,
+                                        maxSamples, offset);
+    } else if (c->resampleCtx){
+        samples = swr_convert(c->resampleCtx, out, maxSamples, (const uint8_t**) in, frame->getSamples());
+    } else {
+        pcmkernels::convert(in, inSampleFmt, out, c->sampleFmt, c->channels, frame->getSamples());
+        samples = frame->getSamples();
+    }
+
+    if (samples < 0){
+        return false;
+    }
+
+    if (c->fifoSamples == 0){
+        c->fifoTs = frame->getPresentationTime() + offset;
+    }
+
+    c->fifoSamples += samples;
+    return true;
+}
+
+bool AudioEncoderMulti::encodeStream(Stream *s, Frame *org, Frame *dst)
+{
+    Conversion *c = s->conversion;
+    AudioFrame *codedFrame;
+    AVPacket pkt;
+    uint8_t *planes[MAX_CHANNELS];
+    unsigned planesNum = isPlanarFmt(c->sampleFmt) ? c->channels : 1;
+    unsigned sampleBytes = utils::getBytesPerSampleFromFormat(c->sampleFmt)*(c->channels/planesNum);
+    std::chrono::microseconds pts;
+    int gotFrame;
+    int ret;
+
+    codedFrame = dynamic_cast<AudioFrame*>(dst);
+
+    if (!codedFrame || !s->codecCtx){
+        utils::errorMsg("[AudioEncoderMulti] Could not encode stream. Target frame or encoder are NULL");
+        return false;
+    }
+
+    if (c->fifoSamples - s->cursor < s->frameSamples){
+        return false;
+    }
+
+    //NOTE: the encoder reads the samples from the conversion FIFO
+    for (unsigned p = 0; p < planesNum; p++){
+        planes[p] = c->fifo[p].data() + s->cursor*sampleBytes;
+
+        if (p < AV_NUM_DATA_POINTERS){
+            s->frame->data[p] = planes[p];
+        }
+    }
+
+    s->frame->extended_data = planes;
+    s->frame->linesize[0] = s->frameSamples*sampleBytes;
+    s->frame->nb_samples = s->frameSamples;
+
+    av_init_packet(&pkt);
+    pkt.data = codedFrame->getDataBuf();
+    pkt.size = codedFrame->getMaxLength();
+
+    ret = avcodec_encode_audio2(s->codecCtx, &pkt, s->frame, &gotFrame);
+
+    s->frame->extended_data = s->frame->data;
+    pts = c->fifoTs + std::chrono::microseconds(s->cursor*std::micro::den/c->sampleRate);
+    s->cursor += s->frameSamples;
+
+    if (ret < 0){
+        utils::errorMsg("[AudioEncoderMulti] Could not encode stream " + std::to_string(s->config.id));
+        return false;
+    }
+
+    if (!gotFrame){
+        return false;
+    }
+
+    codedFrame->setLength(pkt.size);
+    codedFrame->setSamples(s->frameSamples);
+
+    dst->setPresentationTime(pts);
+    dst->setOriginTime(org->getOriginTime());
+    dst->setSequenceNumber(org->getSequenceNumber());
+    s->encodedFrames++;
+
+    return true;
+}
+
+void AudioEncoderMulti::trimConversion(Conversion *c)
+{
+    unsigned planes = isPlanarFmt(c->sampleFmt) ? c->channels : 1;
+    unsigned sampleBytes = utils::getBytesPerSampleFromFormat(c->sampleFmt)*(c->channels/planes);
+    unsigned consumed = c->fifoSamples;
+
+    for (auto it : streams){
+        if (it.second->conversion == c){
+            consumed = std::min(consumed, it.second->cursor);
+        }
+    }
+
+    if (consumed == 0){
+        return;
+    }
+
+    for (unsigned p = 0; p < planes; p++){
+        memmove(c->fifo[p].data(), c->fifo[p].data() + consumed*sampleBytes, (c->fifoSamples - consumed)*sampleBytes);
+    }
+
+    for (auto it : streams){
+        if (it.second->conversion == c){
+            it.second->cursor -= consumed;
+        }
+    }
+
+    c->fifoSamples -= consumed;
+    c->fifoTs += std::chrono::microseconds(consumed*std::micro::den/c->sampleRate);
+}
+
+bool AudioEncoderMulti::reconfigure(AudioFrame *frame)
+{
+    ConversionKey key;
+    Conversion *c;
+
+    if (!needsConfig && frame->getSampleFmt() == inSampleFmt && frame->getChannels() == inChannels &&
+            frame->getSampleRate() == inSampleRate){
+        return true;
+    }
+
+    inSampleFmt = frame->getSampleFmt();
+    inChannels = frame->getChannels();
+    inSampleRate = frame->getSampleRate();
+
+    if (inChannels == 0 || inChannels > MAX_CHANNELS || inSampleRate == 0 || inSampleFmt == S_NONE){
+        utils::errorMsg("[AudioEncoderMulti] Input channels, sample rate or sample format not valid");
+        return false;
+    }
+
+    freeConversions();
+
+    for (auto it : streams){
+        if (!it.second->enabled){
+            continue;
+        }
+
+        key = ConversionKey(it.second->config.channels, it.second->config.sampleRate, it.second->sampleFmt);
+
+        if (conversions.count(key) <= 0){
+            c = new Conversion();
+            c->channels = it.second->config.channels;
+            c->sampleRate = it.second->config.sampleRate;
+            c->sampleFmt = it.second->sampleFmt;
+            c->libavSampleFmt = it.second->libavSampleFmt;
+            c->resampleCtx = NULL;
+            c->resampler = NULL;
+            c->fifo.resize(isPlanarFmt(c->sampleFmt) ? c->channels : 1);
+            c->fifoSamples = 0;
+            c->fifoTs = std::chrono::microseconds(0);
+            conversions[key] = c;
+
+            if (!configConversion(c)){
+                utils::errorMsg("[AudioEncoderMulti] Could not configure the conversion of stream " +
+                                std::to_string(it.first));
+                freeConversions();
+                return false;
+            }
+        }
+
+        it.second->conversion = conversions[key];
+        it.second->cursor = 0;
+    }
+
+    needsConfig = false;
+    return true;
+}
+
+bool AudioEncoderMulti::configConversion(Conversion *c)
+{
+    //NOTE: libswresample is only needed to change the channels or unsupported rate ratios
+    if (inSampleRate == c->sampleRate && inChannels == c->channels && pcmkernels::isSupported(inSampleFmt, c->sampleFmt)){
+        return true;
+    }
+
+    if (inChannels == c->channels && pcmkernels::isSupported(inSampleFmt, FLTP) &&
+            pcmkernels::isSupported(FLTP, c->sampleFmt)){
+        c->resampler = Resampler::createNew(inChannels, inSampleRate, c->sampleRate, resamplerQuality);
+
+        if (c->resampler){
+            return true;
+        }
+    }
+
+    c->resampleCtx = swr_alloc_set_opts(NULL,
+                                        av_get_default_channel_layout(c->channels), c->libavSampleFmt, c->sampleRate,
+                                        av_get_default_channel_layout(inChannels), getLibavSampleFmt(inSampleFmt),
+                                        inSampleRate, 0, NULL);
+
+    if (!c->resampleCtx){
+        return false;
+    }
+
+    return swr_init(c->resampleCtx) >= 0;
+}
+
+void AudioEncoderMulti::freeConversions()
+{
+    for (auto it : conversions){
+        delete it.second->resampler;
+        swr_free(&it.second->resampleCtx);
+        delete it.second;
+    }
+
+    conversions.clear();
+
+    for (auto it : streams){
+        it.second->conversion = NULL;
+        it.second->cursor = 0;
+    }
+}
+
+bool AudioEncoderMulti::openEncoder(Stream *s)
+{
+    AVCodec *codec;
+    AVCodecID codecId;
+
+    closeStream(s);
+
+    codecId = getCodecParams(s->config.codec, s->sampleFmt);
+    s->libavSampleFmt = getLibavSampleFmt(s->sampleFmt);
+    codec = avcodec_find_encoder(codecId);
+
+    if (!codec){
+        utils::errorMsg("[AudioEncoderMulti] Error finding encoder");
+        return false;
+    }
+
+    if (s->config.codec != PCMU && s->config.codec != PCM){
+        if (!checkSampleFormat(codec, s->libavSampleFmt)){
+            utils::errorMsg("[AudioEncoderMulti] Encoder does not support sample format");
+            return false;
+        }
+
+        if (!checkSampleRateSupport(codec, s->config.sampleRate)){
+            utils::errorMsg("[AudioEncoderMulti] Encoder does not support sample rate " +
+                            std::to_string(s->config.sampleRate));
+            return false;
+        }
+
+        if (!checkChannelLayoutSupport(codec, av_get_default_channel_layout(s->config.channels))){
+            utils::errorMsg("[AudioEncoderMulti] Encoder does not support channel layout");
+            return false;
+        }
+    }
+
+    s->codecCtx = avcodec_alloc_context3(codec);
+
+    if (!s->codecCtx){
+        utils::errorMsg("[AudioEncoderMulti] Error allocating codec context");
+        return false;
+    }
+
+    s->codecCtx->channels = s->config.channels;
+    s->codecCtx->channel_layout = av_get_default_channel_layout(s->config.channels);
+    s->codecCtx->sample_rate = s->config.sampleRate;
+    s->codecCtx->sample_fmt = s->libavSampleFmt;
+    s->codecCtx->bit_rate = s->config.bitrate;
+
+    if (avcodec_open2(s->codecCtx, codec, NULL) < 0){
+        utils::errorMsg("[AudioEncoderMulti] Could not open codec context");
+        avcodec_free_context(&s->codecCtx);
+        return false;
+    }
+
+    s->frameSamples = s->codecCtx->frame_size != 0 ? s->codecCtx->frame_size :
+                      AudioFrame::getDefaultSamples(s->config.sampleRate);
+
+    s->frame->format = s->codecCtx->sample_fmt;
+    s->frame->channel_layout = s->codecCtx->channel_layout;
+    s->frame->channels = s->config.channels;
+    s->frame->sample_rate = s->config.sampleRate;
+
+    s->streamInfo->audio.codec = s->config.codec;
+    s->streamInfo->setCodecDefaults();
+    s->streamInfo->audio.channels = s->config.channels;
+    s->streamInfo->audio.sampleRate = s->config.sampleRate;
+    s->streamInfo->audio.sampleFormat = s->sampleFmt;
+
+    s->needsConfig = false;
+    return true;
+}
+
+void AudioEncoderMulti::closeStream(Stream *s)
+{
+    if (s->codecCtx){
+        avcodec_close(s->codecCtx);
+        av_free(s->codecCtx);
+        s->codecCtx = NULL;
+    }
+
+    s->conversion = NULL;
+    s->cursor = 0;
+    s->needsConfig = true;
+}
+
+void AudioEncoderMulti::freeStream(Stream *s)
+{
+    closeStream(s);
+    av_frame_free(&s->frame);
+    delete s->streamInfo;
+    delete s;
+}
+
+void AudioEncoderMulti::setInputFrameSamples()
+{
+    std::chrono::microseconds frameTime(0);
+    std::chrono::microseconds streamFrameTime;
+
+    //NOTE: input frames are not longer than any encoded frame, so every stream
+    //encodes one frame at most for each input one
+    for (auto it : streams){
+        if (!it.second->enabled || it.second->needsConfig){
+            continue;
+        }
+
+        streamFrameTime = std::chrono::microseconds(it.second->frameSamples*std::micro::den/it.second->config.sampleRate);
+
+        if (frameTime.count() == 0 || streamFrameTime < frameTime){
+            frameTime = streamFrameTime;
+        }
+    }
+
+    if (!inputBuffer || frameTime.count() == 0){
+        return;
+    }
+
+    inputBuffer->setOutputFrameSamples(frameTime.count()*inputBuffer->getSampleRate()/std::micro::den);
+}
+
+bool AudioEncoderMulti::specificReaderConfig(int /*readerID*/, FrameQueue* queue)
+{
+    inputBuffer = dynamic_cast<AudioCircularBuffer*>(queue);
+
+    if (!inputBuffer){
+        utils::errorMsg("[AudioEncoderMulti] Input queue must be an AudioCircularBuffer");
+        return false;
+    }
+
+    setInputFrameSamples();
+    return true;
+}
+
+bool AudioEncoderMulti::specificReaderDelete(int /*readerID*/)
+{
+    inputBuffer = NULL;
+    return true;
+}
+
+bool AudioEncoderMulti::specificWriterConfig(int writerID)
+{
+    Stream *s;
+
+    //NOTE: streams are configured before connecting their writers
+    if (streams.count(writerID) > 0){
+        return true;
+    }
+
+    if (streams.size() >= MAX_AUDIO_ENCODER_STREAMS){
+        utils::errorMsg("[AudioEncoderMulti] Too many streams");
+        return false;
+    }
+
+    s = new Stream();
+    s->config.id = writerID;
+    s->config.codec = AC_NONE;
+    s->config.channels = 0;
+    s->config.sampleRate = 0;
+    s->config.bitrate = 0;
+    s->enabled = false;
+    s->needsConfig = true;
+    s->streamInfo = new StreamInfo(AUDIO);
+    s->codecCtx = NULL;
+    s->frame = av_frame_alloc();
+    s->sampleFmt = S_NONE;
+    s->libavSampleFmt = AV_SAMPLE_FMT_NONE;
+    s->frameSamples = 0;
+    s->conversion = NULL;
+    s->cursor = 0;
+    s->encodedFrames = 0;
+
+    streams[writerID] = s;
+    return true;
+}
+
+bool AudioEncoderMulti::specificWriterDelete(int writerID)
+{
+    if (streams.count(writerID) <= 0){
+        utils::errorMsg("[AudioEncoderMulti] Unknown stream " + std::to_string(writerID));
+        return false;
+    }
+
+    freeStream(streams[writerID]);
+    streams.erase(writerID);
+    needsConfig = true;
+
+    return true;
+}
+
+bool AudioEncoderMulti::configure0(std::vector<AudioEncodingStream> streams_, ResamplerQuality quality)
+{
+    std::vector<int> ids;
+
+    if (streams_.size() > MAX_AUDIO_ENCODER_STREAMS){
+        utils::errorMsg("[AudioEncoderMulti] Error configuring: too many streams");
+        return false;
+    }
+
+    for (auto stream : streams_){
+        if (stream.codec == AC_NONE || stream.channels <= 0 || stream.channels > MAX_CHANNELS ||
+                stream.sampleRate <= 0 || stream.bitrate < 0 || std::count(ids.begin(), ids.end(), stream.id) > 0){
+            utils::errorMsg("[AudioEncoderMulti] Error configuring: invalid stream " + std::to_string(stream.id));
+            return false;
+        }
+
+        ids.push_back(stream.id);
+    }
+
+    resamplerQuality = quality;
+    freeConversions();
+
+    for (auto it : streams){
+        it.second->enabled = false;
+        closeStream(it.second);
+    }
+
+    for (auto stream : streams_){
+        if (!specificWriterConfig(stream.id)){
+            return false;
+        }
+
+        streams[stream.id]->config = stream;
+        streams[stream.id]->enabled = true;
+
+        if (!openEncoder(streams[stream.id])){
+            utils::errorMsg("[AudioEncoderMulti] Could not open the encoder of stream " + std::to_string(stream.id));
+            streams[stream.id]->enabled = false;
+            return false;
+        }
+    }
+
+    setInputFrameSamples();
+    needsConfig = true;
+    return true;
+}
+
+bool AudioEncoderMulti::configEvent(Jzon::Node* params)
+{
+    std::vector<AudioEncodingStream> newStreams;
+    ResamplerQuality quality = resamplerQuality;
+
+    if (!params) {
+        return false;
+    }
+
+    if (params->Has("streams") && params->Get("streams").IsArray()) {
+        Jzon::Array jsonStreams = params->Get("streams").AsArray();
+
+        for (Jzon::Array::iterator it = jsonStreams.begin(); it != jsonStreams.end(); ++it) {
+            AudioEncodingStream stream;
+
+            if (!(*it).Has("id") || !(*it).Has("codec") || !(*it).Has("channels") ||
+                    !(*it).Has("sampleRate") || !(*it).Has("bitrate")) {
+                utils::errorMsg("[AudioEncoderMulti] Streams need id, codec, channels, sampleRate and bitrate");
+                return false;
+            }
+
+            stream.id = (*it).Get("id").ToInt();
+            stream.codec = utils::getAudioCodecFromString((*it).Get("codec").ToString());
+            stream.channels = (*it).Get("channels").ToInt();
+            stream.sampleRate = (*it).Get("sampleRate").ToInt();
+            stream.bitrate = (*it).Get("bitrate").ToInt();
+            newStreams.push_back(stream);
+        }
+    } else {
+        for (auto it : streams){
+            if (it.second->enabled){
+                newStreams.push_back(it.second->config);
+            }
+        }
+    }
+
+    if (params->Has("resamplerQuality")) {
+        quality = Resampler::getQualityFromString(params->Get("resamplerQuality").ToString());
+    }
+
+    return configure0(newStreams, quality);
+}
+
+void AudioEncoderMulti::initializeEventMap()
+{
+    eventMap["configure"] = std::bind(&AudioEncoderMulti::configEvent, this, std::placeholders::_1);
+}
+
+void AudioEncoderMulti::doGetState(Jzon::Object &filterNode)
+{
+    Jzon::Array jsonStreams;
+
+    for (auto it : streams){
+        Jzon::Object stream;
+        stream.Add("id", it.first);
+        stream.Add("codec", utils::getAudioCodecAsString(it.second->config.codec));
+        stream.Add("channels", it.second->config.channels);
+        stream.Add("sampleRate", it.second->config.sampleRate);
+        stream.Add("bitrate", it.second->config.bitrate);
+        stream.Add("enabled", it.second->enabled);
+        stream.Add("frameSamples", (int) it.second->frameSamples);
+        stream.Add("encodedFrames", (int) it.second->encodedFrames);
+        jsonStreams.Add(stream);
+    }
+
+    filterNode.Add("resamplerQuality", Resampler::getQualityAsString(resamplerQuality));
+    filterNode.Add("conversions", (int) conversions.size());
+    filterNode.Add("streams", jsonStreams);
+}
+
+bool AudioEncoderMulti::configure(std::vector<AudioEncodingStream> streams, ResamplerQuality quality)
+{
+    Jzon::Object root, params;
+    Jzon::Array jsonStreams;
+
+    for (auto stream : streams){
+        Jzon::Object jsonStream;
+        jsonStream.Add("id", stream.id);
+        jsonStream.Add("codec", utils::getAudioCodecAsString(stream.codec));
+        jsonStream.Add("channels", stream.channels);
+        jsonStream.Add("sampleRate", stream.sampleRate);
+        jsonStream.Add("bitrate", stream.bitrate);
+        jsonStreams.Add(jsonStream);
+    }
+
+    root.Add("action", "configure");
+    params.Add("streams", jsonStreams);
+    params.Add("resamplerQuality", Resampler::getQualityAsString(quality));
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e);
+    return true;
+}
@@ -0,0 +1,154 @@
+/*
+ *  AudioEncoderMulti - Multi-codec libav-based audio encoder
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _AUDIO_ENCODER_MULTI_HH
+#define _AUDIO_ENCODER_MULTI_HH
+
+#include <chrono>
+#include <map>
+#include <tuple>
+#include <vector>
+
+extern "C" {
+    #include <libavcodec/avcodec.h>
+    #include <libswresample/swresample.h>
+}
+
+#include "../../AudioFrame.hh"
+#include "../../AudioCircularBuffer.hh"
+#include "../../FrameQueue.hh"
+#include "../../Filter.hh"
+#include "../../Utils.hh"
+#include "../../StreamInfo.hh"
+#include "../../Resampler.hh"
+
+#define MAX_AUDIO_ENCODER_STREAMS 8
+//NOTE: converted samples a stream can fall behind before the oldest ones are dropped
+#define MAX_PENDING_AUDIO_FRAMES 4
+
+/*! Encoded stream. Its id is the id of the writer which outputs it */
+struct AudioEncodingStream {
+    int id;
+    ACodecType codec;
+    int channels;
+    int sampleRate;
+    int bitrate;
+};
+
+/*! Audio encoder producing several encoded streams (i.e. Opus for WebRTC, AAC
+    for DASH and G.711 for SIP) from a single PCM input. Streams whose codecs
+    take the same channels, sample rate and sample format share a conversion:
+    the input is converted and resampled once for all of them into a sample
+    FIFO, and each stream encodes its own frame size from it, without copying
+    the samples. Each stream is output through the writer with its id. */
+
+class AudioEncoderMulti : public OneToManyFilter {
+
+public:
+    /**
+    * Class constructor
+    */
+    AudioEncoderMulti();
+
+    /**
+    * Class destructor
+    */
+    ~AudioEncoderMulti();
+
+    /**
+    * Configures all the streams. Listed streams are created or reconfigured,
+    * the others are disabled.
+    * @param streams encoded streams, ids are the writer ids
+    * @param quality quality of the shared resamplers
+    */
+    bool configure(std::vector<AudioEncodingStream> streams, ResamplerQuality quality = RQ_MEDIUM);
+
+protected:
+    FrameQueue *allocQueue(ConnectionData cData);
+    bool doProcessFrame(Frame *org, std::map<int, Frame *> &dstFrames);
+    void doGetState(Jzon::Object &filterNode);
+    bool configure0(std::vector<AudioEncodingStream> streams_, ResamplerQuality quality);
+    bool specificWriterConfig(int writerID);
+    bool specificWriterDelete(int writerID);
+
+private:
+    //NOTE: output channels, sample rate and sample format
+    typedef std::tuple<unsigned, unsigned, SampleFmt> ConversionKey;
+
+    struct Conversion {
+        unsigned channels;
+        unsigned sampleRate;
+        SampleFmt sampleFmt;
+        AVSampleFormat libavSampleFmt;
+        SwrContext *resampleCtx;
+        Resampler *resampler;
+        //NOTE: one buffer per plane, samples from fifoTs on
+        std::vector<std::vector<unsigned char>> fifo;
+        unsigned fifoSamples;
+        std::chrono::microseconds fifoTs;
+    };
+
+    struct Stream {
+        AudioEncodingStream config;
+        bool enabled;
+        bool needsConfig;
+        StreamInfo *streamInfo;
+        AVCodecContext *codecCtx;
+        AVFrame *frame;
+        SampleFmt sampleFmt;
+        AVSampleFormat libavSampleFmt;
+        unsigned frameSamples;
+        Conversion *conversion;
+        //NOTE: first sample of the conversion FIFO not encoded yet
+        unsigned cursor;
+        unsigned encodedFrames;
+    };
+
+    void initializeEventMap();
+    bool configEvent(Jzon::Node* params);
+
+    bool reconfigure(AudioFrame *frame);
+    bool openEncoder(Stream *s);
+    bool configConversion(Conversion *c);
+    bool convert(Conversion *c, AudioFrame *frame);
+    bool encodeStream(Stream *s, Frame *org, Frame *dst);
+    void trimConversion(Conversion *c);
+    void setInputFrameSamples();
+    void freeConversions();
+    void closeStream(Stream *s);
+    void freeStream(Stream *s);
+
+    bool specificReaderConfig(int readerID, FrameQueue* queue);
+    bool specificReaderDelete(int readerID);
+
+    std::map<int, Stream*> streams;
+    std::map<ConversionKey, Conversion*> conversions;
+    AudioCircularBuffer *inputBuffer;
+
+    SampleFmt inSampleFmt;
+    unsigned inChannels;
+    unsigned inSampleRate;
+    bool needsConfig;
+
+    ResamplerQuality resamplerQuality;
+};
+
+#endif
@@ -23,37 +23,70 @@
 #define BPS 2
 
 #include "AudioMixer.hh"
+#include "MixKernels.hh"
+#include "../../ChannelMatrix.hh"
 #include "../../AudioCircularBuffer.hh"
 #include "../../Utils.hh"
 #include <iostream>
 #include <utility>
 #include <cmath>
+#include <algorithm>
+#include <deque>
 #include <string.h>
 
 AudioMixer::AudioMixer(int inputChannels) : 
 ManyToOneFilter(inputChannels), channels(DEFAULT_CHANNELS),
 sampleRate(DEFAULT_SAMPLE_RATE), sampleFormat(FLTP), maxMixingChannels(inputChannels),
-front(0), rear(0), masterGain(DEFAULT_MASTER_GAIN), th(COMPRESSION_THRESHOLD),
-syncTs(std::chrono::microseconds(-1))
+outputConnected(false), front(0), rear(0), masterGain(DEFAULT_MASTER_GAIN), th(COMPRESSION_THRESHOLD),
+syncTs(std::chrono::microseconds(-1)), adaptiveAlignment(false), skippedFrames(0)
 {
     fType = AUDIO_MIXER;
     inputFrameSamples = AudioFrame::getDefaultSamples(sampleRate);
     outputSamples = inputFrameSamples;
     mixBufferMaxSamples = inputFrameSamples*5;
     mixingThreshold = inputFrameSamples*3;
+    limiterGain = 1;
+    limiterLookahead = LIMITER_LOOKAHEAD*sampleRate/1000;
+    limiterAttack = 1 - std::exp(-4.0f/limiterLookahead);
+    limiterRelease = 1 - std::exp(-1000.0f/(LIMITER_RELEASE*sampleRate));
 
-    for (int i = 0; i < MAX_CHANNELS; i++) {
-        mixBuffers[i] = new float[mixBufferMaxSamples]();
-    }
-
+    setMixChannels(channels);
     initializeEventMap();
 }
 
 AudioMixer::~AudioMixer() 
 {
-    for (int i = 0; i < MAX_CHANNELS; i++) {
-        delete mixBuffers[i];
+    for (auto b : mixBuffers) {
+        delete[] b;
+    }
+}
+
+void AudioMixer::setMixChannels(int mixChannels)
+{
+    for (auto b : mixBuffers) {
+        delete[] b;
+    }
+
+    mixBuffers.clear();
+    remixMatrices.clear();
+    channels = mixChannels;
+
+    for (int i = 0; i < channels; i++) {
+        mixBuffers.push_back(new float[mixBufferMaxSamples]());
+    }
+
+    front = 0;
+    rear = 0;
+    syncTs = std::chrono::microseconds(-1);
+}
+
+const std::vector<float>& AudioMixer::getRemixMatrix(unsigned inChannels)
+{
+    if (remixMatrices.count(inChannels) == 0) {
+        channelmatrix::getMatrix(inChannels, channels, remixMatrices[inChannels]);
     }
+
+    return remixMatrices[inChannels];
 }
 
 FrameQueue *AudioMixer::allocQueue(ConnectionData cData) 
@@ -101,19 +134,26 @@ bool AudioMixer::doProcessFrame(std::map<int, Frame*> &orgFrames, Frame *dst, st
 bool AudioMixer::pushToBuffer(int mixChId, AudioFrame* frame) 
 {
     unsigned char* b;
-    float* mixBuff;
-    float fSample;
     SampleFmt fmt;
     unsigned nOfSamples;
     int bytesPerSample;
     unsigned absolutePosition;
     unsigned bufferIdx;
+    unsigned firstSpan;
     unsigned freeSpaceInMixBuffer;
+    unsigned inChannels;
+    float gain;
+    float coef;
 
-    bytesPerSample = utils::getBytesPerSampleFromFormat(sampleFormat);
     fmt = frame->getSampleFmt();
+    bytesPerSample = utils::getBytesPerSampleFromFormat(fmt);
     nOfSamples = frame->getSamples();
 
+    if (fmt != S16P && fmt != FLTP) {
+        utils::errorMsg("[AudioMixer] Only S16P and FLTP sample formats are supported");
+        return false;
+    }
+
     freeSpaceInMixBuffer = mixBufferMaxSamples - (rear - front);
 
     if (freeSpaceInMixBuffer < nOfSamples) {
@@ -140,48 +180,150 @@ bool AudioMixer::pushToBuffer(int mixChId, AudioFrame* frame)
         absolutePosition = front;
     }
 
-    for (int i = 0; i < channels; i++) {
+    if (absolutePosition + nOfSamples > rear) {
+        rear = absolutePosition + nOfSamples;
+    }
 
-        b = frame->getPlanarDataBuf()[i];
-        bufferIdx = absolutePosition % mixBufferMaxSamples;
-        mixBuff = mixBuffers[i];
+    gain = gains[mixChId]*masterGain;
 
-        for (unsigned j = 0; j < nOfSamples; j++) {
+    //NOTE: silent and muted frames only move the mixing buffer rear
+    if (!updateActivity(mixChId, frame) || gain == 0) {
+        skippedFrames++;
+        return true;
+    }
 
-            if (!bytesToFloat(b + j*bytesPerSample, fSample, fmt)) {
-                utils::errorMsg("[AudioMixer] Error converting samples from bytes to float");
-                return false;
-            }
+    bufferIdx = absolutePosition % mixBufferMaxSamples;
+    //NOTE: samples are mixed in two spans when they wrap around the mixing buffer
+    firstSpan = std::min(nOfSamples, mixBufferMaxSamples - bufferIdx);
 
-            mixSample(fSample, mixBuff, bufferIdx, gains[mixChId]);
-            bufferIdx = (bufferIdx + 1) % mixBufferMaxSamples;
+    inChannels = frame->getChannels();
+
+    if (inChannels == (unsigned) channels) {
+        for (int i = 0; i < channels; i++) {
+            b = frame->getPlanarDataBuf()[i];
+            mixSpan(b, mixBuffers[i] + bufferIdx, firstSpan, gain, fmt);
+            mixSpan(b + firstSpan*bytesPerSample, mixBuffers[i], nOfSamples - firstSpan, gain, fmt);
         }
+
+        return true;
     }
 
-    if (absolutePosition + nOfSamples > rear) {
-        rear = absolutePosition + nOfSamples;
+    const std::vector<float> &matrix = getRemixMatrix(inChannels);
+
+    //NOTE: each input plane is accumulated in every output channel it feeds
+    for (int o = 0; o < channels; o++) {
+        for (unsigned i = 0; i < inChannels; i++) {
+            coef = matrix[o*inChannels + i];
+
+            if (coef == 0) {
+                continue;
+            }
+
+            b = frame->getPlanarDataBuf()[i];
+            mixSpan(b, mixBuffers[o] + bufferIdx, firstSpan, gain*coef, fmt);
+            mixSpan(b + firstSpan*bytesPerSample, mixBuffers[o], nOfSamples - firstSpan, gain*coef, fmt);
+        }
     }
 
     return true;
 }
 
-void AudioMixer::mixSample(float sample, float* mixBuff, int bufferIdx, float gain)
+bool AudioMixer::updateActivity(int mixChId, AudioFrame* frame)
+{
+    ChannelActivity &ch = activity[mixChId];
+    float level = frame->getLevel();
+
+    ch.level = level;
+
+    //NOTE: frames without level are considered active
+    if (level < 0 || level >= SILENCE_LEVEL) {
+        ch.lastActive = frame->getPresentationTime();
+        ch.talking = true;
+        return true;
+    }
+
+    ch.talking = frame->getPresentationTime() - ch.lastActive < std::chrono::milliseconds(TALKER_HANGOVER);
+    return ch.talking;
+}
+
+void AudioMixer::mixSpan(unsigned char const* samples, float* mixBuff, unsigned nOfSamples, float gain, SampleFmt fmt)
+{
+    if (fmt == S16P) {
+        mixkernels::mixS16(samples, mixBuff, nOfSamples, gain);
+    } else {
+        mixkernels::mixFlt(samples, mixBuff, nOfSamples, gain);
+    }
+}
+
+void AudioMixer::computeLimiterGains(unsigned pos, unsigned lookahead)
+{
+    unsigned windowSamples = outputSamples + lookahead;
+    unsigned firstSpan = std::min(windowSamples, mixBufferMaxSamples - pos);
+    float slope = (1-th)/(2-th);
+    std::deque<unsigned> window;
+    float peak;
+    float target;
+
+    limiterPeaks.assign(windowSamples, 0);
+    limiterGains.resize(outputSamples);
+
+    //NOTE: channels are linked, all of them get the gain required by the loudest one
+    for (int i = 0; i < channels; i++) {
+        mixkernels::peaks(mixBuffers[i] + pos, limiterPeaks.data(), firstSpan);
+        mixkernels::peaks(mixBuffers[i], limiterPeaks.data() + firstSpan, windowSamples - firstSpan);
+    }
+
+    //NOTE: the required gain maps peaks over the threshold to the soft knee curve
+    for (auto &p : limiterPeaks) {
+        peak = p;
+        p = 1;
+
+        if (peak > th) {
+            p = std::min(th + slope*(peak - th), LIMITER_CEILING) / peak;
+        }
+    }
+
+    //NOTE: the target gain of each sample is the lowest required gain of the lookahead 
+    //window, so the attack starts before the peak. Window minimum is kept with a deque
+    for (unsigned i = 0; i < windowSamples; i++) {
+        while (!window.empty() && limiterPeaks[window.back()] >= limiterPeaks[i]) {
+            window.pop_back();
+        }
+
+        window.push_back(i);
+
+        if (i < lookahead) {
+            continue;
+        }
+
+        if (window.front() < i - lookahead) {
+            window.pop_front();
+        }
+
+        target = limiterPeaks[window.front()];
+        limiterGain += (target - limiterGain) * (target < limiterGain ? limiterAttack : limiterRelease);
+        limiterGains[i - lookahead] = limiterGain;
+    }
+}
+
+void AudioMixer::extractSpan(float* mixBuff, unsigned char* samples, unsigned nOfSamples)
 {
-    mixBuff[bufferIdx] += sample*gain*masterGain;
+    if (sampleFormat == S16P) {
+        mixkernels::toS16(mixBuff, samples, nOfSamples);
+    } else {
+        mixkernels::toFlt(mixBuff, samples, nOfSamples);
+    }
 
-    if (mixBuff[bufferIdx] > th) {
-        mixBuff[bufferIdx] = ((1-th)/(2-th))*mixBuff[bufferIdx] + th/(2-th);
-    } else if (mixBuff[bufferIdx] < -th) {
-        mixBuff[bufferIdx] = ((1-th)/(2-th))*mixBuff[bufferIdx] - th/(2-th);
-    } 
+    memset(mixBuff, 0, nOfSamples*sizeof(float));
 }
 
 bool AudioMixer::extractMixedFrame(AudioFrame* frame)
 {
     unsigned mixedElements = rear - front;
     unsigned pos;
+    unsigned firstSpan;
+    unsigned lookahead;
     unsigned char* b;
-    float *mixB;
     std::chrono::microseconds ts;
     unsigned bytesPerSample;
 
@@ -196,21 +338,18 @@ bool AudioMixer::extractMixedFrame(AudioFrame* frame)
         return false;
     }
 
-    for (int i = 0; i < channels; i++) {
-
-        b = frame->getPlanarDataBuf()[i];
-        pos = front % mixBufferMaxSamples;
-        mixB = mixBuffers[i];
-
-        for (unsigned j = 0; j < outputSamples; j++) {
+    pos = front % mixBufferMaxSamples;
+    firstSpan = std::min(outputSamples, mixBufferMaxSamples - pos);
+    lookahead = std::min(limiterLookahead, mixedElements - outputSamples);
 
-            if (!floatToBytes(b + j*bytesPerSample, mixB[(pos+j)%mixBufferMaxSamples], sampleFormat)) {
-                utils::errorMsg("[AudioMixer] Error converting samples from bytes to float");
-                return false;
-            }
+    computeLimiterGains(pos, lookahead);
 
-            mixB[(pos+j)%mixBufferMaxSamples] = 0;
-        }
+    for (int i = 0; i < channels; i++) {
+        b = frame->getPlanarDataBuf()[i];
+        mixkernels::applyGains(mixBuffers[i] + pos, limiterGains.data(), firstSpan, LIMITER_CEILING);
+        mixkernels::applyGains(mixBuffers[i], limiterGains.data() + firstSpan, outputSamples - firstSpan, LIMITER_CEILING);
+        extractSpan(mixBuffers[i] + pos, b, firstSpan);
+        extractSpan(mixBuffers[i], b + firstSpan*bytesPerSample, outputSamples - firstSpan);
     }
 
     ts = std::chrono::microseconds(front * std::micro::den/sampleRate) + syncTs;
@@ -275,14 +414,21 @@ bool AudioMixer::specificReaderConfig(int readerID, FrameQueue* queue)
     }
 
     inBuffer->setOutputFrameSamples(inputFrameSamples);
+    inBuffer->setLevelMetering(true);
+    inBuffer->setAdaptiveAlignment(adaptiveAlignment);
+    inputBuffers[readerID] = inBuffer;
 
     gains[readerID] = DEFAULT_CHANNEL_GAIN;
+    activity[readerID] = {0, std::chrono::microseconds(0), false};
 
     return true;
 }
 
 bool AudioMixer::specificReaderDelete(int readerID)
 {
+    activity.erase(readerID);
+    inputBuffers.erase(readerID);
+
     if (gains.count(readerID) > 0){
         gains.erase(readerID);
         return true;
@@ -394,6 +540,48 @@ bool AudioMixer::muteMasterEvent(Jzon::Node* params)
     return true;
 }
 
+bool AudioMixer::configEvent(Jzon::Node* params)
+{
+    int newChannels;
+
+    if (!params || !params->Has("channels")) {
+        return false;
+    }
+
+    newChannels = params->Get("channels").ToInt();
+
+    if (newChannels <= 0 || newChannels > MAX_CHANNELS) {
+        utils::errorMsg("[AudioMixer] Channels must be between 1 and " + std::to_string(MAX_CHANNELS));
+        return false;
+    }
+
+    if (outputConnected) {
+        utils::errorMsg("[AudioMixer] Mix channels cannot be changed once the output is connected");
+        return false;
+    }
+
+    if (newChannels != channels) {
+        setMixChannels(newChannels);
+    }
+
+    return true;
+}
+
+bool AudioMixer::adaptiveAlignmentEvent(Jzon::Node* params)
+{
+    if (!params || !params->Has("enable")) {
+        return false;
+    }
+
+    adaptiveAlignment = params->Get("enable").ToBool();
+
+    for (auto it : inputBuffers) {
+        it.second->setAdaptiveAlignment(adaptiveAlignment);
+    }
+
+    return true;
+}
+
 bool AudioMixer::changeChannelGain(int id, float value)
 {
     Jzon::Object root, params;
@@ -453,6 +641,30 @@ bool AudioMixer::muteMaster()
     return true;
 }
 
+bool AudioMixer::configure(int mixChannels)
+{
+    Jzon::Object root, params;
+    root.Add("action", "configure");
+    params.Add("channels", mixChannels);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e); 
+    return true;
+}
+
+bool AudioMixer::setAdaptiveAlignment(bool enable)
+{
+    Jzon::Object root, params;
+    root.Add("action", "adaptiveAlignment");
+    params.Add("enable", enable);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e); 
+    return true;
+}
+
 void AudioMixer::initializeEventMap()
 {
     eventMap["changeChannelGain"] = std::bind(&AudioMixer::changeChannelVolumeEvent,
@@ -469,24 +681,58 @@ void AudioMixer::initializeEventMap()
 
     eventMap["muteMaster"] = std::bind(&AudioMixer::muteMasterEvent, this,
                                         std::placeholders::_1);
+
+    eventMap["configure"] = std::bind(&AudioMixer::configEvent, this,
+                                       std::placeholders::_1);
+
+    eventMap["adaptiveAlignment"] = std::bind(&AudioMixer::adaptiveAlignmentEvent, this,
+                                               std::placeholders::_1);
 }
 
 void AudioMixer::doGetState(Jzon::Object &filterNode)
 {
     Jzon::Array jsonGains;
+    Jzon::Array jsonTalkers;
+    std::vector<std::pair<float, int>> talkers;
 
     filterNode.Add("channels", channels);
     filterNode.Add("sampleRate", sampleRate);
     filterNode.Add("sampleFormat", utils::getSampleFormatAsString(sampleFormat));
     filterNode.Add("maxChannels", maxMixingChannels);
     filterNode.Add("masterGain", masterGain);
+    filterNode.Add("limiterGain", limiterGain);
+    filterNode.Add("adaptiveAlignment", adaptiveAlignment);
 
     for (auto it : gains) {
         Jzon::Object gain;
         gain.Add("id", it.first);
         gain.Add("gain", it.second);
+
+        if (adaptiveAlignment && inputBuffers.count(it.first) > 0) {
+            gain.Add("targetDelay", (int) (inputBuffers[it.first]->getTargetSamples()*1000/sampleRate));
+        }
+
         jsonGains.Add(gain);
     }
 
     filterNode.Add("gains", jsonGains);
+
+    for (auto it : activity) {
+        if (it.second.talking && gains.count(it.first) > 0 && gains[it.first] > 0) {
+            talkers.push_back(std::make_pair(it.second.level, it.first));
+        }
+    }
+
+    //NOTE: loudest talkers first
+    std::sort(talkers.rbegin(), talkers.rend());
+
+    for (auto it : talkers) {
+        Jzon::Object talker;
+        talker.Add("id", it.second);
+        talker.Add("level", it.first > 0 ? 20*std::log10(it.first) : -100.0f);
+        jsonTalkers.Add(talker);
+    }
+
+    filterNode.Add("activeTalkers", jsonTalkers);
+    filterNode.Add("skippedFrames", (int) skippedFrames);
 }
\ No newline at end of file
@@ -26,14 +26,30 @@
 #include "../../Frame.hh"
 #include "../../Filter.hh"
 #include "../../AudioFrame.hh"
+#include "../../AudioCircularBuffer.hh"
+
+#include <vector>
 
 #define COMPRESSION_THRESHOLD 0.6
 #define DEFAULT_MASTER_GAIN 0.6
 #define DEFAULT_CHANNEL_GAIN 1.0
 #define AMIXER_MAX_CHANNELS 16
+#define LIMITER_LOOKAHEAD 5 //ms
+#define LIMITER_RELEASE 50 //ms
+#define LIMITER_CEILING 1.0f
+//NOTE: frames whose peak is below SILENCE_LEVEL (-50 dBFS) are not mixed once 
+//TALKER_HANGOVER has elapsed since the channel was last over it
+#define SILENCE_LEVEL 0.00316f
+#define TALKER_HANGOVER 500 //ms
 
 /*! Filter that mixes different audio frames in one frame. Each mixing channel is 
 *   identified by and Id which coincides with the reader associated to it. 
+*   Inputs are accumulated linearly and the mix is compressed once when it is 
+*   extracted, by a look-ahead limiter following the soft knee over COMPRESSION_THRESHOLD,
+*   so the result does not depend on the order inputs arrive. Silent or muted 
+*   inputs are not mixed, input buffers measure the level of each frame.
+*   Inputs with a different channel layout than the mix (i.e. 5.1 sources in a
+*   stereo mix) are down or upmixed while they are accumulated, see ChannelMatrix.
 */
 
 class AudioMixer : public ManyToOneFilter {
@@ -113,6 +129,22 @@ public:
     */ 
     bool muteMaster();
 
+    /**
+    * Sets the channels of the mix, it must be done before connecting the output
+    * @param mixChannels channels of the mix and the output, up to MAX_CHANNELS
+    * @return always true
+    */ 
+    bool configure(int mixChannels);
+
+    /**
+    * Enables or disables the adaptive alignment of the inputs, which size their
+    * buffering to the arrival jitter and correct clock drift without gaps
+    * (see AudioCircularBuffer::setAdaptiveAlignment)
+    * @param enable adaptive alignment
+    * @return always true
+    */
+    bool setAdaptiveAlignment(bool enable);
+
 protected:
     
     void doGetState(Jzon::Object &filterNode);
@@ -124,7 +156,12 @@ private:
     bool pushToBuffer(int mixChId, AudioFrame* frame);
     bool fillChannel(std::queue<float> &buffer, int nOfSamples, unsigned char* data, SampleFmt fmt); 
     bool extractMixedFrame(AudioFrame* frame);
-    void mixSample(float sample, float* mixBuff, int bufferIdx, float gain);
+    void mixSpan(unsigned char const* samples, float* mixBuff, unsigned nOfSamples, float gain, SampleFmt fmt);
+    void extractSpan(float* mixBuff, unsigned char* samples, unsigned nOfSamples);
+    void computeLimiterGains(unsigned pos, unsigned lookahead);
+    bool updateActivity(int mixChId, AudioFrame* frame);
+    const std::vector<float>& getRemixMatrix(unsigned inChannels);
+    void setMixChannels(int mixChannels);
     bool setChannelGain(int id, float value);
     
     bool specificReaderConfig(int readerID, FrameQueue* queue);
@@ -135,16 +172,19 @@ private:
     bool soloChannelEvent(Jzon::Node* params);
     bool changeMasterVolumeEvent(Jzon::Node* params);
     bool muteMasterEvent(Jzon::Node* params);
+    bool configEvent(Jzon::Node* params);
+    bool adaptiveAlignmentEvent(Jzon::Node* params);
     
-    //NOTE: There is no need of specific writer configuration
-    bool specificWriterConfig(int /*writerID*/) {return true;};
-    bool specificWriterDelete(int /*writerID*/) {return true;};
+    //NOTE: writers are only tracked to lock the mix channels
+    bool specificWriterConfig(int /*writerID*/) {outputConnected = true; return true;};
+    bool specificWriterDelete(int /*writerID*/) {outputConnected = false; return true;};
 
     int channels;
     int sampleRate;
     int inputFrameSamples;
     SampleFmt sampleFormat;
     int maxMixingChannels;
+    bool outputConnected;
     unsigned front;
     unsigned rear;
 
@@ -153,12 +193,32 @@ private:
 
     std::map<int, float> gains;
     std::chrono::microseconds syncTs;
-    float* mixBuffers[MAX_CHANNELS];
+    std::vector<float*> mixBuffers;
+    //NOTE: remix matrices by input channels
+    std::map<unsigned, std::vector<float>> remixMatrices;
+    std::map<int, AudioCircularBuffer*> inputBuffers;
+    bool adaptiveAlignment;
 
     unsigned mixBufferMaxSamples;
     unsigned outputSamples;
     unsigned mixingThreshold;
 
+    struct ChannelActivity {
+        float level;
+        std::chrono::microseconds lastActive;
+        bool talking;
+    };
+
+    std::map<int, ChannelActivity> activity;
+    unsigned skippedFrames;
+
+    float limiterGain;
+    float limiterAttack;
+    float limiterRelease;
+    unsigned limiterLookahead;
+    std::vector<float> limiterPeaks;
+    std::vector<float> limiterGains;
+
 
 };
 
@@ -0,0 +1,152 @@
+/*
+ *  MixKernels.cpp - Audio block mixing kernels
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "MixKernels.hh"
+
+#include <cmath>
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static inline float s16ToFloat(const unsigned char *b)
+{
+    return (short) (b[0] | b[1] << 8) / 32768.0f;
+}
+
+namespace mixkernels
+{
+    void mixS16(const unsigned char *src, float *dst, unsigned samples, float gain)
+    {
+        unsigned i = 0;
+
+#ifdef __SSE2__
+        const __m128 vScale = _mm_set1_ps(gain / 32768.0f);
+
+        for (; i + 8 <= samples; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*) (src + i * 2));
+            __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+            __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(lo, vScale)));
+            _mm_storeu_ps(dst + i + 4, _mm_add_ps(_mm_loadu_ps(dst + i + 4), _mm_mul_ps(hi, vScale)));
+        }
+#endif
+
+        for (; i < samples; i++) {
+            dst[i] += s16ToFloat(src + i * 2) * gain;
+        }
+    }
+
+    void mixFlt(const unsigned char *src, float *dst, unsigned samples, float gain)
+    {
+        float sample;
+        unsigned i = 0;
+
+#ifdef __SSE2__
+        const __m128 vGain = _mm_set1_ps(gain);
+
+        for (; i + 4 <= samples; i += 4) {
+            __m128 s = _mm_loadu_ps((const float*) (src + i * 4));
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(s, vGain)));
+        }
+#endif
+
+        for (; i < samples; i++) {
+            memcpy(&sample, src + i * 4, sizeof(float));
+            dst[i] += sample * gain;
+        }
+    }
+
+    void peaks(const float *src, float *peaks, unsigned samples)
+    {
+        unsigned i = 0;
+
+#ifdef __SSE2__
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+        for (; i + 4 <= samples; i += 4) {
+            __m128 ax = _mm_and_ps(_mm_loadu_ps(src + i), absMask);
+            _mm_storeu_ps(peaks + i, _mm_max_ps(_mm_loadu_ps(peaks + i), ax));
+        }
+#endif
+
+        for (; i < samples; i++) {
+            peaks[i] = std::max(peaks[i], std::fabs(src[i]));
+        }
+    }
+
+    void applyGains(float *src, const float *gains, unsigned samples, float ceiling)
+    {
+        unsigned i = 0;
+
+#ifdef __SSE2__
+        const __m128 vMax = _mm_set1_ps(ceiling);
+        const __m128 vMin = _mm_set1_ps(-ceiling);
+
+        for (; i + 4 <= samples; i += 4) {
+            __m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), _mm_loadu_ps(gains + i));
+            _mm_storeu_ps(src + i, _mm_min_ps(_mm_max_ps(v, vMin), vMax));
+        }
+#endif
+
+        for (; i < samples; i++) {
+            src[i] = std::min(std::max(src[i] * gains[i], -ceiling), ceiling);
+        }
+    }
+
+    void toS16(const float *src, unsigned char *dst, unsigned samples)
+    {
+        short value;
+        unsigned i = 0;
+
+#ifdef __SSE2__
+        const __m128 vOne = _mm_set1_ps(1.0f);
+        const __m128 vMinusOne = _mm_set1_ps(-1.0f);
+        const __m128 vScale = _mm_set1_ps(32768.0f);
+
+        //NOTE: 1.0 scales to 32768, which the saturating pack turns into 32767. Samples are 
+        //rounded to nearest as in PcmKernels, so mixing and conversion output match
+        for (; i + 8 <= samples; i += 8) {
+            __m128 s0 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), vMinusOne), vOne);
+            __m128 s1 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), vMinusOne), vOne);
+            __m128i v0 = _mm_cvtps_epi32(_mm_mul_ps(s0, vScale));
+            __m128i v1 = _mm_cvtps_epi32(_mm_mul_ps(s1, vScale));
+
+            _mm_storeu_si128((__m128i*) (dst + i * 2), _mm_packs_epi32(v0, v1));
+        }
+#endif
+
+        for (; i < samples; i++) {
+            value = (short) std::min(lrintf(std::min(std::max(src[i], -1.0f), 1.0f) * 32768.0f), 32767L);
+            dst[i * 2] = value & 0xFF;
+            dst[i * 2 + 1] = (value >> 8) & 0xFF;
+        }
+    }
+
+    void toFlt(const float *src, unsigned char *dst, unsigned samples)
+    {
+        memcpy(dst, src, samples * sizeof(float));
+    }
+}
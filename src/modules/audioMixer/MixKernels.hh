@@ -0,0 +1,78 @@
+/*
+ *  MixKernels.hh - Audio block mixing kernels
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _MIX_KERNELS_HH
+#define _MIX_KERNELS_HH
+
+/*! Mixing of planar audio blocks into float accumulation buffers. Kernels work
+    on contiguous spans, so callers using ring buffers split them at the wrap.
+    Samples are S16 (little endian) or float, source and destination pointers
+    do not need to be aligned. */
+
+namespace mixkernels
+{
+    /**
+    * Adds gain * src to dst
+    * @param src S16 samples
+    * @param dst accumulated samples
+    * @param samples number of samples
+    * @param gain applied to src
+    */
+    void mixS16(const unsigned char *src, float *dst, unsigned samples, float gain);
+
+    /**
+    * Same as mixS16 for float samples
+    */
+    void mixFlt(const unsigned char *src, float *dst, unsigned samples, float gain);
+
+    /**
+    * Keeps in peaks the highest absolute value of each sample, so calling it for
+    * each channel gives the peaks of all the channels
+    * @param src accumulated samples
+    * @param peaks peak of each sample
+    * @param samples number of samples
+    */
+    void peaks(const float *src, float *peaks, unsigned samples);
+
+    /**
+    * Multiplies each sample by its gain and clips the result to [-ceiling, ceiling]
+    * @param src accumulated samples, modified in place
+    * @param gains gain of each sample
+    * @param samples number of samples
+    * @param ceiling highest absolute output value
+    */
+    void applyGains(float *src, const float *gains, unsigned samples, float ceiling);
+
+    /**
+    * Converts accumulated samples to S16, clipping them to [-1, 1] and rounding to nearest
+    * @param src accumulated samples
+    * @param dst S16 samples
+    * @param samples number of samples
+    */
+    void toS16(const float *src, unsigned char *dst, unsigned samples);
+
+    /**
+    * Copies accumulated samples as float samples
+    */
+    void toFlt(const float *src, unsigned char *dst, unsigned samples);
+}
+
+#endif
@@ -118,17 +118,18 @@ bool DashVideoSegmenter::generateInitSegment(DashSegment* segment)
 unsigned DashVideoSegmenter::customGenerateSegment(unsigned char *segBuffer, std::chrono::microseconds nextFrameTs, 
                                                     uint64_t &segTimestamp, uint32_t &segDuration, bool force)
 {
-    size_t timeBasePts;
+    size_t timeBaseDts;
 
-    timeBasePts = microsToTimeBase(nextFrameTs);
+    timeBaseDts = microsToTimeBase(nextFrameTs);
 
-    return generate_video_segment(isPreviousFrameIntra(), timeBasePts, segBuffer, &dashContext, &segTimestamp, &segDuration);
+    return generate_video_segment(isPreviousFrameIntra(), timeBaseDts, segBuffer, &dashContext, &segTimestamp, &segDuration);
 }
 
 bool DashVideoSegmenter::appendFrameToDashSegment(Frame* frame)
 {
     size_t addSampleReturn;
     size_t timeBasePts;
+    size_t timeBaseDts;
 
     if (!frame || !frame->getDataBuf() || frame->getLength() <= 0 || !dashContext) {
         utils::errorMsg("Error appeding frame to segment: frame not valid");
@@ -136,9 +137,10 @@ bool DashVideoSegmenter::appendFrameToDashSegment(Frame* frame)
     }
     
     timeBasePts = microsToTimeBase(frame->getPresentationTime());
+    timeBaseDts = microsToTimeBase(frame->getDecodeTime());
 
     addSampleReturn = add_video_sample(frame->getDataBuf(), frame->getLength(), timeBasePts, 
-                                        timeBasePts, sequenceNumber, isPreviousFrameIntra(), &dashContext);
+                                        timeBaseDts, sequenceNumber, isPreviousFrameIntra(), &dashContext);
 
     if (addSampleReturn != I2OK) {
         utils::errorMsg("Error adding video sample. Code error: " + std::to_string(addSampleReturn));
@@ -149,7 +151,8 @@ bool DashVideoSegmenter::appendFrameToDashSegment(Frame* frame)
 }
 
 bool DashVideoSegmenter::appendNalToFrame(VideoFrame* frame, unsigned char* nalData, unsigned nalDataLength, 
-                                           unsigned nalWidth, unsigned nalHeight, std::chrono::microseconds ts)
+                                           unsigned nalWidth, unsigned nalHeight, std::chrono::microseconds ts,
+                                           std::chrono::microseconds dts)
 {
     if (frame->getLength() + nalDataLength + AVCC_HEADER_BYTES_MINUS_ONE + 1 > frame->getMaxLength()) {
         utils::errorMsg("[DashVideoSegmenter::appendNalToFrame] Nal exceeds frame max length");
@@ -167,6 +170,7 @@ bool DashVideoSegmenter::appendNalToFrame(VideoFrame* frame, unsigned char* nalD
     
     frame->setSize(nalWidth, nalHeight);
     frame->setPresentationTime(ts);
+    frame->setDecodeTime(dts);
     return true;
 }
 
@@ -102,7 +102,8 @@ bool Dasher::doProcessFrame(std::map<int, Frame*> &orgFrames, std::vector<int> n
         }
         
         if (timestampOffset.count() == 0){
-            timestampOffset = orgFrames[id]->getPresentationTime();
+            //NOTE: with B-frames the first frame is decoded before being presented
+            timestampOffset = std::min(orgFrames[id]->getPresentationTime(), orgFrames[id]->getDecodeTime());
             for(auto seg : segmenters){
                 seg.second->setOffset(timestampOffset);
             }
@@ -629,7 +630,7 @@ bool DashSegmenter::generateSegment(DashSegment* segment, Frame* frame, bool for
     }
 
     if (frame) {
-        frameTs = frame->getPresentationTime();
+        frameTs = frame->getDecodeTime();
     }
 
     segmentSize = customGenerateSegment(segment->getDataBuffer(), frameTs, segTimestamp, segDuration, force);
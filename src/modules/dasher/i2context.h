@@ -56,7 +56,7 @@ typedef struct {
     uint64_t        presentation_timestamp;
     unsigned        key:1;//Flags mp4parser.com
     uint32_t        index;
-    uint64_t        decode_timestamp;//Not properly used, be careful if using B-Frames
+    uint64_t        decode_timestamp;
 } mdat_sample;
 
 typedef struct {
@@ -80,6 +80,7 @@ typedef struct {
     uint16_t        height;
     uint32_t        frame_rate;
     uint64_t        earliest_presentation_time;
+    uint64_t        earliest_decode_time;
     uint32_t        sequence_number;
     uint32_t        current_video_duration;
     i2ctx_sample    *ctxsample;
@@ -82,6 +82,7 @@ void video_context_initializer(i2ctx **context, uint32_t media_type) {
     ctxVideo->height = 0;
     ctxVideo->time_base = 0;
     ctxVideo->earliest_presentation_time = 0;
+    ctxVideo->earliest_decode_time = 0;
     ctxVideo->sequence_number = 0;
     ctxVideo->current_video_duration = 0;
     ctxVideo->video_type = media_type;
@@ -92,6 +93,7 @@ void video_context_initializer(i2ctx **context, uint32_t media_type) {
 void context_refresh(i2ctx **context, uint32_t media_type) {
     if ((media_type == VIDEO_TYPE_AVC) || (media_type == VIDEO_TYPE_HEVC)) {
         (*context)->ctxvideo->earliest_presentation_time = 0;
+        (*context)->ctxvideo->earliest_decode_time = 0;
         (*context)->ctxvideo->sequence_number = 0;
         (*context)->ctxvideo->current_video_duration = 0;
         (*context)->ctxvideo->segment_data_size = 0;
@@ -296,7 +298,7 @@ uint32_t init_audio_handler(byte *input_data, uint32_t size_input, byte *output_
     return initAudio;
 }
 
-uint32_t generate_video_segment(uint8_t nextFrameIsIntra, uint32_t nextFramePts, byte *output_data, 
+uint32_t generate_video_segment(uint8_t nextFrameIsIntra, uint32_t nextFrameDts, byte *output_data, 
                                  i2ctx **context, uint64_t* segmentTimestamp, uint32_t* segmentDuration)
 {
     uint32_t segDataLength;
@@ -327,7 +329,7 @@ uint32_t generate_video_segment(uint8_t nextFrameIsIntra, uint32_t nextFramePts,
         return segDataLength;
     }
 
-    lastSampleDuration = nextFramePts - (*context)->ctxvideo->ctxsample->mdat[sampleIdx].presentation_timestamp;
+    lastSampleDuration = nextFrameDts - (*context)->ctxvideo->ctxsample->mdat[sampleIdx].decode_timestamp;
 
     if ((nextFrameIsIntra == TRUE) && ((((*context)->duration - lastSampleDuration)) <= ((*context)->ctxvideo->current_video_duration + lastSampleDuration))) {
         (*context)->ctxvideo->ctxsample->mdat[sampleIdx].duration = lastSampleDuration;
@@ -448,10 +450,12 @@ uint32_t add_video_sample(byte *input_data, uint32_t input_data_length, uint64_t
 
     if (ctxSample->mdat_sample_length == 0) {
         (*context)->ctxvideo->earliest_presentation_time = pts;
+        (*context)->ctxvideo->earliest_decode_time = dts;
         (*context)->ctxvideo->sequence_number = seqNumber;
         (*context)->ctxvideo->current_video_duration = 0;
     } else {
-        sample_duration = pts - ctxSample->mdat[samp_len-1].presentation_timestamp;
+        // Samples are stored in decoding order, so durations are decoding time deltas
+        sample_duration = dts - ctxSample->mdat[samp_len-1].decode_timestamp;
         ctxSample->mdat[samp_len-1].duration = sample_duration;
         (*context)->ctxvideo->current_video_duration += sample_duration;
     }
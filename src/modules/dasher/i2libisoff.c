@@ -1851,24 +1851,24 @@ uint32_t write_tfhd(byte *data, uint32_t media_type, i2ctx *context) {
 
 uint32_t write_tfdt(byte *data, uint32_t media_type, i2ctx *context) {
     uint32_t count, version, size, hton_size;
-    uint64_t earliest_presentation_time, hton_earliest_presentation_time;
+    uint64_t base_media_decode_time, hton_base_media_decode_time;
 
     i2ctx_video *ctxVideo = context->ctxvideo;
     i2ctx_audio *ctxAudio = context->ctxaudio;
-    earliest_presentation_time = 0;
+    base_media_decode_time = 0;
 
     if ((media_type == VIDEO_TYPE_AVC) || (media_type == VIDEO_TYPE_HEVC)) {
-        earliest_presentation_time = ctxVideo->earliest_presentation_time;
+        base_media_decode_time = ctxVideo->earliest_decode_time;
     }
     else if (media_type == AUDIO_TYPE) {
-        earliest_presentation_time = ctxAudio->earliest_presentation_time;
+        base_media_decode_time = ctxAudio->earliest_presentation_time;
     }
 
     count = 0;
     version = 1;
 
     // Size
-    size = sizeof(size) + BOX_TYPE_SIZE + sizeof(version) + sizeof(earliest_presentation_time);
+    size = sizeof(size) + BOX_TYPE_SIZE + sizeof(version) + sizeof(base_media_decode_time);
     hton_size = htonl(size);
     memcpy(data + count, &hton_size, sizeof(size));
     count+= sizeof(size);
@@ -1882,9 +1882,9 @@ uint32_t write_tfdt(byte *data, uint32_t media_type, i2ctx *context) {
     count+= sizeof(version);
     
     // baseMediaDecodeTime
-    hton_earliest_presentation_time = htonl_64(earliest_presentation_time);
-    memcpy(data + count, &hton_earliest_presentation_time, sizeof(earliest_presentation_time));
-    count+= sizeof(earliest_presentation_time);
+    hton_base_media_decode_time = htonl_64(base_media_decode_time);
+    memcpy(data + count, &hton_base_media_decode_time, sizeof(base_media_decode_time));
+    count+= sizeof(base_media_decode_time);
 
     return count;
 }
@@ -95,7 +95,8 @@ SharedMemory::~SharedMemory()
 bool SharedMemory::doProcessFrame(Frame *org, Frame *dst)
 {
     InterleavedVideoFrame* vframe = dynamic_cast<InterleavedVideoFrame*>(org);
-    copyOrgToDstFrame(vframe,dynamic_cast<InterleavedVideoFrame*>(dst));
+    InterleavedVideoFrame* dstFrame = dynamic_cast<InterleavedVideoFrame*>(dst);
+    copyOrgToDstFrame(vframe, dstFrame);
 
     if(!isWritable()){
         if(vframe->getCodec() == H264){
@@ -120,7 +121,8 @@ bool SharedMemory::doProcessFrame(Frame *org, Frame *dst)
             break;
         case RAW:
             writeFramePayload(vframe);
-            writeSharedMemoryRAW(vframe->getDataBuf(), vframe->getLength());
+            //NOTE: dst frame holds a contiguous copy even if org is a view
+            writeSharedMemoryRAW(dstFrame->getDataBuf(), dstFrame->getLength());
             break;
         default:
             utils::errorMsg("SharedMemory::error - only RAW and H264 frames are shareable");
@@ -165,7 +167,11 @@ void SharedMemory::copyOrgToDstFrame(InterleavedVideoFrame*org, InterleavedVideo
     dst->setOriginTime(org->getOriginTime());
     dst->setSequenceNumber(org->getSequenceNumber());
 
-    memcpy(dst->getDataBuf(), org->getDataBuf(),org->getLength());
+    if (org->isView()){
+        org->copyPicture(dst->getDataBuf());
+    } else {
+        memcpy(dst->getDataBuf(), org->getDataBuf(),org->getLength());
+    }
 }
 
 void SharedMemory::writeSharedMemoryH264()
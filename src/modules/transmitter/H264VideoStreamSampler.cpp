@@ -34,6 +34,8 @@ H264VideoStreamSampler* H264VideoStreamSampler::createNew(UsageEnvironment& env,
 ::H264VideoStreamSampler(UsageEnvironment& env, FramedSource* inputSource, bool annexB)
   : H264or5VideoStreamFramer(264, env, inputSource, False/*don't create a parser*/, False),
   offset(0), totalFrameSize(0), fAnnexB(annexB), fWidth(0), fHeight(0) {
+    auPresentationTime.tv_sec = 0;
+    auPresentationTime.tv_usec = 0;
 }
 
 H264VideoStreamSampler::~H264VideoStreamSampler() {
@@ -91,6 +93,12 @@ void H264VideoStreamSampler
         saveCopyOfPPS(NALstartPtr, frameSize);
     }
 
+    //NOTE: the AUD closing the access unit belongs to the next one, which may
+    //have a lower presentation time when there are B-frames
+    if (offset == 0) {
+        auPresentationTime = presentationTime;
+    }
+
     offset += frameSize + NAL_START_SIZE;
     totalFrameSize = offset;
 
@@ -98,7 +106,7 @@ void H264VideoStreamSampler
         fPictureEndMarker = True;
         fFrameSize = offset - frameSize - NAL_START_SIZE;
         fNumTruncatedBytes = numTruncatedBytes;
-        fPresentationTime = presentationTime;
+        fPresentationTime = auPresentationTime;
         fDurationInMicroseconds = durationInMicroseconds;
 
         if (numTruncatedBytes > 0) {
@@ -63,6 +63,7 @@ private:
     unsigned int fWidth;
     unsigned int fHeight;
     double fFrameRate;
+    struct timeval auPresentationTime;
 };
 
 #endif
@@ -650,12 +650,12 @@ void SinkManager::doGetState(Jzon::Object &filterNode)
         Jzon::Array jsonReaders;
         Jzon::Object jsonConnection;
         Jzon::Array jsonSubsessionsStats;
-        Jzon::Object jsonSubsessionStat;
 
         if ((rtspConn = dynamic_cast<RTSPConnection*>(it.second))){
             jsonConnection.Add("name", rtspConn->getName());
             jsonConnection.Add("uri", rtspConn->getURI());
             for (auto iter : it.second->getConnectionRTCPInstanceMap()) {
+                Jzon::Object jsonSubsessionStat;
                 jsonSubsessionStat.Add("SSRC", std::to_string(iter.second->getSSRC()));
                 jsonSubsessionStat.Add("avgBitrateInKbps", (float)iter.second->getAvgBitrate());
                 jsonSubsessionStat.Add("minBitrateInKbps", (float)iter.second->getMinBitrate());
@@ -676,6 +676,7 @@ void SinkManager::doGetState(Jzon::Object &filterNode)
             jsonConnection.Add("ip", rtpConn->getIP());
             jsonConnection.Add("port", std::to_string(rtpConn->getPort()));
             for (auto iter : it.second->getConnectionRTCPInstanceMap()) {
+                Jzon::Object jsonSubsessionStat;
                 jsonSubsessionStat.Add("SSRC", std::to_string(iter.second->getSSRC()));
                 jsonSubsessionStat.Add("avgBitrateInKbps", (float)iter.second->getAvgBitrate());
                 jsonSubsessionStat.Add("minBitrateInKbps", (float)iter.second->getMinBitrate());
@@ -0,0 +1,156 @@
+/*
+ *  NalUnits.cpp - Coded video frames parsing
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "NalUnits.hh"
+
+#define H264_NALU_TYPE_MASK 0x1F
+#define H264_NALU_REF_MASK 0x60
+#define H264_NON_IDR 1
+#define H264_IDR 5
+#define H265_NALU_TYPE(b) (((b) >> 1) & 0x3F)
+#define H265_FIRST_NON_VCL 32
+#define H265_FIRST_IRAP 16
+#define H265_LAST_IRAP 23
+#define H265_LAST_SUBLAYER_NON_REF 14
+#define H264_SLICE_I 2
+#define H264_SLICE_SI 4
+
+namespace nalunits
+{
+    std::vector<std::pair<unsigned char*, unsigned>> splitNals(unsigned char *data, unsigned size)
+    {
+        std::vector<std::pair<unsigned char*, unsigned>> nals;
+        int nalStart = -1;
+
+        if (size < 4 || data[0] != 0 || data[1] != 0 || 
+                !(data[2] == 1 || (data[2] == 0 && data[3] == 1))) {
+            if (size > 0) {
+                nals.push_back(std::make_pair(data, size));
+            }
+            return nals;
+        }
+
+        for (unsigned i = 0; i + 2 < size; i++) {
+            if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+                if (nalStart >= 0) {
+                    nals.push_back(std::make_pair(data + nalStart, i - nalStart));
+                }
+                nalStart = i + 3;
+                i += 2;
+            }
+        }
+
+        if (nalStart >= 0 && (unsigned) nalStart < size) {
+            nals.push_back(std::make_pair(data + nalStart, size - nalStart));
+        }
+
+        return nals;
+    }
+
+    unsigned readExpGolomb(const unsigned char *data, unsigned size, unsigned &bit)
+    {
+        unsigned zeros = 0;
+        uint64_t value = 0;
+        uint64_t code;
+
+        while (bit < size * 8 && !((data[bit / 8] >> (7 - bit % 8)) & 1)) {
+            if (++zeros > 31) {
+                return 0;
+            }
+            bit++;
+        }
+
+        //NOTE: the code does not fit in the data
+        if (bit + zeros >= size * 8) {
+            bit = size * 8;
+            return 0;
+        }
+
+        bit++;
+
+        for (unsigned i = 0; i < zeros; i++, bit++) {
+            value = (value << 1) | ((data[bit / 8] >> (7 - bit % 8)) & 1);
+        }
+
+        code = ((uint64_t) 1 << zeros) - 1 + value;
+
+        if (code > UINT32_MAX) {
+            return 0;
+        }
+
+        return code;
+    }
+
+    PacketContent getPacketContent(VCodecType codec, unsigned char *data, unsigned size)
+    {
+        PacketContent content = {false, false, false};
+
+        if (codec == VP8) {
+            //NOTE: VP8 frame tag starts with the inverse keyframe flag
+            content.vcl = size > 0;
+            content.intra = size > 0 && !(data[0] & 0x01);
+            content.reference = true;
+            return content;
+        }
+
+        if (codec == MJPEG) {
+            content.vcl = content.intra = content.reference = size > 0;
+            return content;
+        }
+
+        for (auto nal : splitNals(data, size)) {
+            if (codec == H264) {
+                unsigned char type = nal.first[0] & H264_NALU_TYPE_MASK;
+                unsigned bit = 0;
+
+                if (type != H264_NON_IDR && type != H264_IDR) {
+                    continue;
+                }
+
+                content.vcl = true;
+                content.reference |= (nal.first[0] & H264_NALU_REF_MASK) != 0;
+
+                if (type == H264_IDR) {
+                    content.intra = true;
+                    continue;
+                }
+
+                //NOTE: slice header starts with first_mb_in_slice and slice_type
+                readExpGolomb(nal.first + 1, nal.second - 1, bit);
+                unsigned sliceType = readExpGolomb(nal.first + 1, nal.second - 1, bit) % 5;
+                content.intra |= sliceType == H264_SLICE_I || sliceType == H264_SLICE_SI;
+
+            } else if (codec == H265) {
+                unsigned char type = H265_NALU_TYPE(nal.first[0]);
+
+                if (type >= H265_FIRST_NON_VCL) {
+                    continue;
+                }
+
+                content.vcl = true;
+                content.intra |= type >= H265_FIRST_IRAP && type <= H265_LAST_IRAP;
+                content.reference |= !(type <= H265_LAST_SUBLAYER_NON_REF && type % 2 == 0);
+            }
+        }
+
+        return content;
+    }
+}
@@ -0,0 +1,74 @@
+/*
+ *  NalUnits.hh - Coded video frames parsing
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _NAL_UNITS_HH
+#define _NAL_UNITS_HH
+
+#include <stdint.h>
+#include <vector>
+#include <utility>
+
+#include "../../Types.hh"
+
+/*! Parsing of coded frames headers, used to find out which frames can be
+    skipped before decoding them. */
+
+namespace nalunits
+{
+    /*! What a coded frame contains, at least one VCL NAL unit must be found for
+        the other fields to be meaningful */
+    struct PacketContent {
+        bool vcl;
+        bool intra;
+        bool reference;
+    };
+
+    /**
+    * Splits a coded frame in NAL units. Frames may hold a single NAL unit without
+    * start code or several NAL units with start codes
+    * @param data coded frame
+    * @param size coded frame length in bytes
+    * @return first byte and length of each NAL unit, without start codes
+    */
+    std::vector<std::pair<unsigned char*, unsigned>> splitNals(unsigned char *data, unsigned size);
+
+    /**
+    * Reads an unsigned exp-Golomb code. Malformed codes (more than 31 leading zeros,
+    * values not fitting in 32 bits or cut by the end of the data) return 0
+    * @param data buffer to read from
+    * @param size buffer length in bytes
+    * @param bit position of the code in bits, it is moved past the code
+    * @return decoded value
+    */
+    unsigned readExpGolomb(const unsigned char *data, unsigned size, unsigned &bit);
+
+    /**
+    * Classifies the NAL units of a coded frame
+    * @param codec of the frame, H264 and H265 are parsed, VP8 and MJPEG frames are
+    * only checked for keyframes
+    * @param data coded frame
+    * @param size coded frame length in bytes
+    * @return see PacketContent
+    */
+    PacketContent getPacketContent(VCodecType codec, unsigned char *data, unsigned size);
+}
+
+#endif
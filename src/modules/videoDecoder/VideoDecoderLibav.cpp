@@ -22,6 +22,7 @@
  */
 
 #include "VideoDecoderLibav.hh"
+#include "NalUnits.hh"
 #include "../../AVFramedQueue.hh"
 #include "../../Utils.hh"
 
@@ -40,6 +41,7 @@ VideoDecoderLibav::VideoDecoderLibav() : OneToOneFilter()
     outputStreamInfo = new StreamInfo (VIDEO);
     outputStreamInfo->video.codec = RAW;
     outputStreamInfo->video.pixelFormat = RGB24;
+    inputInfo = NULL;
 
     frame = av_frame_alloc();
     frameCopy = av_frame_alloc();
@@ -48,14 +50,36 @@ VideoDecoderLibav::VideoDecoderLibav() : OneToOneFilter()
     psi.inputHeight = 0;
 
     psi.fCodec = VC_NONE;
+
+    directFrames = 0;
+    copiedFrames = 0;
+
+    threads = DEFAULT_DECODER_THREADS;
+    frameThreading = false;
+    packetCount = 0;
+    streamEnded = false;
+    addedLatency = std::chrono::microseconds(0);
+
+    decodingMode = ALL_FRAMES;
+    outputFps = 0;
+    lastOutputTime = std::chrono::microseconds(-1);
+    discardedPackets = 0;
+    discardedFrames = 0;
+
+    initializeEventMap();
 }
 
 VideoDecoderLibav::~VideoDecoderLibav()
 {
     avcodec_close(codecCtx);
     av_free(codecCtx);
-    av_free(frame);
-    av_free(frameCopy);
+
+    for (auto queued : queuedPictures) {
+        av_frame_free(&queued.picture);
+    }
+
+    av_frame_free(&frame);
+    av_frame_free(&frameCopy);
     av_packet_unref(&pkt);
 
     delete outputStreamInfo;
@@ -70,17 +94,54 @@ FrameQueue* VideoDecoderLibav::allocQueue(ConnectionData cData)
 bool VideoDecoderLibav::doProcessFrame(Frame *org, Frame *dst)
 {
     int len, gotFrame = 0;
-    VideoFrame* vDecodedFrame = dynamic_cast<VideoFrame*>(dst);
     VideoFrame* vCodedFrame = dynamic_cast<VideoFrame*>(org);
+    InterleavedVideoFrame* iDecodedFrame = dynamic_cast<InterleavedVideoFrame*>(dst);
+    PendingPacket packet;
+    QueuedPicture queued;
+
+    {
+        std::lock_guard<std::mutex> guard(buffersMtx);
+        outputPool = iDecodedFrame ? iDecodedFrame->getBufferPool() : NULL;
+    }
+
+    //NOTE: the reader is deleted from another thread, so the decoder is drained in the next run
+    if (streamEnded.exchange(false) && codecCtx) {
+        drainDecoder();
+        avcodec_flush_buffers(codecCtx);
+    }
+
+    //NOTE: runs without new input write the queued pictures in order
+    if (!vCodedFrame) {
+        if (queuedPictures.empty()) {
+            return false;
+        }
+
+        queued = queuedPictures.front();
+        queuedPictures.pop_front();
+
+        av_frame_unref(frame);
+        av_frame_move_ref(frame, queued.picture);
+        av_frame_free(&queued.picture);
+
+        return writePicture(dst, queued.timing);
+    }
     
     if (!reconfigure(vCodedFrame->getCodec())){
         return false;
     }
        
+    if (discardPacket(org)){
+        discardedPackets++;
+        return false;
+    }
+       
     pkt.size = org->getLength();
     pkt.data = org->getDataBuf();
+    pushPendingPacket(org);
    
     while (pkt.size > 0) {
+        //NOTE: the previous picture reference is dropped, so its direct buffer can return to the pool
+        av_frame_unref(frame);
         len = avcodec_decode_video2(codecCtx, frame, &gotFrame, &pkt);
 
         if(len < 0) {
@@ -90,15 +151,20 @@ bool VideoDecoderLibav::doProcessFrame(Frame *org, Frame *dst)
         }
 
         if (gotFrame) {
-            if (toBuffer(vDecodedFrame, vCodedFrame)) {
-                
-                dst->setConsumed(true);
-                dst->setPresentationTime(org->getPresentationTime());
-                dst->setOriginTime(org->getOriginTime());
-                dst->setSequenceNumber(org->getSequenceNumber());
-                
-                return true;
+            //NOTE: with frame threading the picture may belong to a previous packet
+            if (!popPendingPacket(packet)) {
+                packet.pTime = org->getPresentationTime();
+                packet.oTime = org->getOriginTime();
+                packet.seqNum = org->getSequenceNumber();
+            }
+
+            //NOTE: pictures drained from the previous decoder go first
+            if (!queuedPictures.empty()) {
+                queuePicture(packet);
+                return false;
             }
+
+            return writePicture(dst, packet);
         }
         
         if (pkt.data){
@@ -110,6 +176,84 @@ bool VideoDecoderLibav::doProcessFrame(Frame *org, Frame *dst)
     return false;
 }
 
+bool VideoDecoderLibav::writePicture(Frame *dst, const PendingPacket &timing)
+{
+    if (!toBuffer(dynamic_cast<VideoFrame*>(dst))) {
+        return false;
+    }
+
+    dst->setPresentationTime(timing.pTime);
+    dst->setOriginTime(timing.oTime);
+    dst->setSequenceNumber(timing.seqNum);
+
+    if (exceedsOutputRate(timing.pTime)) {
+        discardedFrames++;
+        return false;
+    }
+
+    dst->setConsumed(true);
+    lastOutputTime = timing.pTime;
+    return true;
+}
+
+void VideoDecoderLibav::queuePicture(const PendingPacket &timing)
+{
+    QueuedPicture queued;
+
+    queued.picture = av_frame_clone(frame);
+    queued.timing = timing;
+
+    if (!queued.picture) {
+        utils::errorMsg("[VideoDecoderLibav] Could not queue decoded picture");
+        return;
+    }
+
+    queuedPictures.push_back(queued);
+}
+
+void VideoDecoderLibav::drainDecoder()
+{
+    AVPacket emptyPkt;
+    PendingPacket packet;
+    int gotFrame;
+
+    av_init_packet(&emptyPkt);
+    emptyPkt.data = NULL;
+    emptyPkt.size = 0;
+
+    //NOTE: with frame threading libavcodec holds up to one picture per thread, which 
+    //are output feeding it empty packets
+    do {
+        gotFrame = 0;
+        av_frame_unref(frame);
+
+        if (avcodec_decode_video2(codecCtx, frame, &gotFrame, &emptyPkt) < 0) {
+            break;
+        }
+
+        //NOTE: pictures of packets whose timing is lost cannot be placed in the stream
+        if (gotFrame && popPendingPacket(packet)) {
+            queuePicture(packet);
+        }
+    } while (gotFrame && queuedPictures.size() < MAX_PENDING_PACKETS);
+
+    av_frame_unref(frame);
+    pendingPackets.clear();
+}
+
+bool VideoDecoderLibav::specificReaderConfig(int /*readerID*/, FrameQueue* queue)
+{
+    inputInfo = queue ? queue->getStreamInfo() : NULL;
+    return true;
+}
+
+bool VideoDecoderLibav::specificReaderDelete(int /*readerID*/)
+{
+    inputInfo = NULL;
+    streamEnded = true;
+    return true;
+}
+
 bool VideoDecoderLibav::inputConfig()
 {   
     switch(psi.fCodec){
@@ -134,6 +278,8 @@ bool VideoDecoderLibav::inputConfig()
     }
 
     if (codecCtx != NULL) {
+        //NOTE: pictures still held by the decoding threads are output before closing it
+        drainDecoder();
         avcodec_close(codecCtx);
         av_free(codecCtx);
     }
@@ -154,16 +300,33 @@ bool VideoDecoderLibav::inputConfig()
         codecCtx->flags |= CODEC_FLAG_TRUNCATED;
     }
      
-    if (codec->capabilities & CODEC_CAP_SLICE_THREADS) {
-        codecCtx->thread_count = 0; 
+    if (frameThreading && (codec->capabilities & CODEC_CAP_FRAME_THREADS)) {
+        codecCtx->thread_count = threads;
+        codecCtx->thread_type = FF_THREAD_FRAME;
+        //NOTE: get_buffer2 is thread safe, so decoding threads can call it directly
+        codecCtx->thread_safe_callbacks = 1;
+    } else if (codec->capabilities & CODEC_CAP_SLICE_THREADS) {
+        codecCtx->thread_count = threads; 
         codecCtx->thread_type = FF_THREAD_SLICE;
     }
 
+    pendingPackets.clear();
+    applyDecodingMode();
+
     codecCtx->flags2 |= CODEC_FLAG2_CHUNKS;
 
-    FrameQueue *in_queue = getReader(DEFAULT_ID)->getQueue();
-    codecCtx->extradata = in_queue->getStreamInfo()->extradata;
-    codecCtx->extradata_size = in_queue->getStreamInfo()->extradata_size;
+    //NOTE: pictures are decoded straight into the output queue buffers. Decoded 
+    //frames must be refcounted, otherwise libavcodec hides their buffers
+    if (codec->capabilities & CODEC_CAP_DR1) {
+        codecCtx->opaque = this;
+        codecCtx->get_buffer2 = VideoDecoderLibav::getBuffer;
+        codecCtx->refcounted_frames = 1;
+    }
+
+    if (inputInfo) {
+        codecCtx->extradata = inputInfo->extradata;
+        codecCtx->extradata_size = inputInfo->extradata_size;
+    }
 
     AVDictionary* dictionary = NULL;
     if (avcodec_open2(codecCtx, codec, &dictionary) < 0)
@@ -175,10 +338,240 @@ bool VideoDecoderLibav::inputConfig()
     return true;
 }
 
-bool VideoDecoderLibav::toBuffer(VideoFrame *decodedFrame, VideoFrame *codedFrame)
+void VideoDecoderLibav::applyDecodingMode()
+{
+    if (!codecCtx) {
+        return;
+    }
+
+    //NOTE: skipping the loop filter trades some quality of the decoded references for speed
+    switch (decodingMode) {
+        case KEYFRAMES_ONLY:
+            codecCtx->skip_frame = AVDISCARD_NONINTRA;
+            codecCtx->skip_loop_filter = AVDISCARD_ALL;
+            break;
+        case REFERENCE_ONLY:
+            codecCtx->skip_frame = AVDISCARD_NONREF;
+            codecCtx->skip_loop_filter = AVDISCARD_ALL;
+            break;
+        default:
+            codecCtx->skip_frame = AVDISCARD_DEFAULT;
+            codecCtx->skip_loop_filter = AVDISCARD_DEFAULT;
+            break;
+    }
+}
+
+bool VideoDecoderLibav::discardPacket(Frame *org)
+{
+    nalunits::PacketContent content;
+
+    if (decodingMode == ALL_FRAMES) {
+        return false;
+    }
+
+    content = nalunits::getPacketContent(psi.fCodec, org->getDataBuf(), org->getLength());
+
+    //NOTE: parameter sets and other non VCL data are always needed
+    if (!content.vcl) {
+        return false;
+    }
+
+    if (decodingMode == KEYFRAMES_ONLY) {
+        //NOTE: intra frames do not depend on others, so they can be rate limited before decoding
+        return !content.intra || exceedsOutputRate(org->getPresentationTime());
+    }
+
+    return !content.reference;
+}
+
+bool VideoDecoderLibav::exceedsOutputRate(std::chrono::microseconds pTime)
+{
+    std::chrono::microseconds period;
+
+    if (outputFps <= 0 || lastOutputTime.count() < 0 || pTime < lastOutputTime) {
+        return false;
+    }
+
+    //NOTE: 10% of tolerance to absorb timestamps jitter
+    period = std::chrono::microseconds(std::micro::den * 9 / (10 * outputFps));
+
+    return pTime - lastOutputTime < period;
+}
+
+void VideoDecoderLibav::pushPendingPacket(Frame *org)
+{
+    PendingPacket packet;
+
+    packet.pTime = org->getPresentationTime();
+    packet.oTime = org->getOriginTime();
+    packet.seqNum = org->getSequenceNumber();
+    packet.decodingTime = std::chrono::system_clock::now();
+
+    //NOTE: packets whose picture never came out (i.e. decoding errors) are dropped
+    if (pendingPackets.size() >= MAX_PENDING_PACKETS) {
+        pendingPackets.erase(pendingPackets.begin());
+    }
+
+    pkt.pts = packetCount;
+    pendingPackets[packetCount++] = packet;
+}
+
+bool VideoDecoderLibav::popPendingPacket(PendingPacket &packet)
+{
+    std::chrono::microseconds latency;
+    auto it = pendingPackets.find(frame->pkt_pts);
+
+    if (it == pendingPackets.end()) {
+        return false;
+    }
+
+    packet = it->second;
+
+    latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now() - it->second.decodingTime);
+    addedLatency = (addedLatency * 7 + latency) / 8;
+
+    pendingPackets.erase(it);
+    return true;
+}
+
+int VideoDecoderLibav::getBuffer(AVCodecContext *ctx, AVFrame *pic, int flags)
+{
+    VideoDecoderLibav *decoder = (VideoDecoderLibav*) ctx->opaque;
+
+    if (decoder && decoder->getDirectBuffer(ctx, pic)){
+        return 0;
+    }
+
+    return avcodec_default_get_buffer2(ctx, pic, flags);
+}
+
+void VideoDecoderLibav::releaseBuffer(void *opaque, uint8_t */*data*/)
+{
+    DirectBuffer *dBuffer = (DirectBuffer*) opaque;
+
+    {
+        std::lock_guard<std::mutex> guard(dBuffer->decoder->buffersMtx);
+        dBuffer->decoder->directBuffers.erase(dBuffer);
+    }
+
+    delete dBuffer;
+}
+
+VideoDecoderLibav::DirectBuffer *VideoDecoderLibav::getDirectBuffer(AVCodecContext *ctx, AVFrame *pic)
+{
+    std::shared_ptr<FrameBufferPool> pool;
+    DirectBuffer *dBuffer;
+    int linesizeAlign[AV_NUM_DATA_POINTERS];
+    int width = pic->width;
+    int height = pic->height;
+    int size;
+
+    switch (pic->format) {
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P:
+        case AV_PIX_FMT_YUV422P:
+        case AV_PIX_FMT_YUV444P:
+        case AV_PIX_FMT_RGB24:
+        case AV_PIX_FMT_RGB32:
+            break;
+        default:
+            return NULL;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(buffersMtx);
+        pool = outputPool;
+    }
+
+    if (!pool){
+        return NULL;
+    }
+
+    avcodec_align_dimensions2(ctx, &width, &height, linesizeAlign);
+    width = FFALIGN(width, DECODER_WIDTH_ALIGN);
+
+    //NOTE: planes are laid out contiguously, as InterleavedVideoFrame expects them
+    size = av_image_get_buffer_size((AVPixelFormat) pic->format, width, height, 1);
+    if (size <= 0 || (unsigned) size + FRAME_BUFFER_ALIGN > pool->getBufferSize()){
+        return NULL;
+    }
+
+    dBuffer = new DirectBuffer();
+    dBuffer->buffer = pool->getBuffer();
+    dBuffer->width = width;
+    dBuffer->height = height;
+    dBuffer->decoder = this;
+
+    if (!dBuffer->buffer){
+        delete dBuffer;
+        return NULL;
+    }
+
+    pic->buf[0] = av_buffer_create(dBuffer->buffer.get(), size, VideoDecoderLibav::releaseBuffer, dBuffer, 0);
+    if (!pic->buf[0]){
+        delete dBuffer;
+        return NULL;
+    }
+
+    av_image_fill_arrays(pic->data, pic->linesize, dBuffer->buffer.get(), 
+                         (AVPixelFormat) pic->format, width, height, 1);
+    pic->extended_data = pic->data;
+
+    {
+        std::lock_guard<std::mutex> guard(buffersMtx);
+        directBuffers.insert(dBuffer);
+    }
+
+    return dBuffer;
+}
+
+bool VideoDecoderLibav::attachDecodedBuffer(InterleavedVideoFrame *decodedFrame)
+{
+    std::shared_ptr<unsigned char> buffer;
+    DirectBuffer *dBuffer;
+    int bWidth, bHeight;
+
+    if (!decodedFrame || !frame->buf[0]){
+        return false;
+    }
+
+    dBuffer = (DirectBuffer*) av_buffer_get_opaque(frame->buf[0]);
+
+    {
+        std::lock_guard<std::mutex> guard(buffersMtx);
+        if (directBuffers.count(dBuffer) == 0){
+            return false;
+        }
+
+        buffer = dBuffer->buffer;
+        bWidth = dBuffer->width;
+        bHeight = dBuffer->height;
+    }
+
+    //NOTE: cropped pictures do not start at the beginning of the buffer
+    if (frame->data[0] != buffer.get()){
+        return false;
+    }
+
+    decodedFrame->setSize(frame->width, frame->height);
+    decodedFrame->setPixelFormat(getPixelFormat((AVPixelFormat) frame->format));
+
+    return decodedFrame->attachBuffer(buffer, bWidth, bHeight);
+}
+
+bool VideoDecoderLibav::toBuffer(VideoFrame *decodedFrame)
 {
     int ret, length;
     
+    psi.inputWidth = frame->width;
+    psi.inputHeight = frame->height;
+
+    if (attachDecodedBuffer(dynamic_cast<InterleavedVideoFrame*>(decodedFrame))){
+        directFrames++;
+        return true;
+    }
+
     length = av_image_fill_arrays(frameCopy->data, frameCopy->linesize, decodedFrame->getDataBuf(), 
                             (AVPixelFormat) frame->format, frame->width, frame->height, 1); 
     if (length <= 0){
@@ -189,9 +582,6 @@ bool VideoDecoderLibav::toBuffer(VideoFrame *decodedFrame, VideoFrame *codedFram
     frameCopy->width = frame->width;
     frameCopy->height = frame->height;
     frameCopy->format = frame->format;
-    
-    psi.inputWidth = frame->width;
-    psi.inputHeight = frame->height;
 
     ret = av_frame_copy(frameCopy, frame);
     if (ret < 0){
@@ -202,6 +592,7 @@ bool VideoDecoderLibav::toBuffer(VideoFrame *decodedFrame, VideoFrame *codedFram
     decodedFrame->setLength(length);
     decodedFrame->setSize(frame->width, frame->height);
     decodedFrame->setPixelFormat(getPixelFormat((AVPixelFormat) frame->format));
+    copiedFrames++;
     
     return true;
 }
@@ -224,9 +615,138 @@ bool VideoDecoderLibav::reconfigure(VCodecType codec)
     return true;
 }
 
+bool VideoDecoderLibav::configure(int threads, bool frameThreading)
+{
+    Jzon::Object root, params;
+    root.Add("action", "configure");
+    params.Add("threads", threads);
+    params.Add("frameThreading", frameThreading);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e);
+    return true;
+}
+
+bool VideoDecoderLibav::configure0(int threads_, bool frameThreading_)
+{
+    if (threads_ < 0 || threads_ > MAX_DECODER_THREADS) {
+        utils::errorMsg("[VideoDecoderLibav] Invalid number of threads");
+        return false;
+    }
+
+    if (threads == threads_ && frameThreading == frameThreading_) {
+        return true;
+    }
+
+    threads = threads_;
+    frameThreading = frameThreading_;
+
+    //NOTE: threading cannot be changed on an open codec context
+    if (codecCtx && !inputConfig()) {
+        utils::errorMsg("[VideoDecoderLibav] Could not reopen the decoder");
+        return false;
+    }
+
+    return true;
+}
+
+bool VideoDecoderLibav::configEvent(Jzon::Node* params)
+{
+    int tmpThreads = threads;
+    bool tmpFrameThreading = frameThreading;
+
+    if (!params) {
+        return false;
+    }
+
+    if (params->Has("threads") && params->Get("threads").IsNumber()) {
+        tmpThreads = params->Get("threads").ToInt();
+    }
+
+    if (params->Has("frameThreading") && params->Get("frameThreading").IsBool()) {
+        tmpFrameThreading = params->Get("frameThreading").ToBool();
+    }
+
+    return configure0(tmpThreads, tmpFrameThreading);
+}
+
+bool VideoDecoderLibav::configDecodingMode(DecodingMode mode, int fps)
+{
+    Jzon::Object root, params;
+    root.Add("action", "decodingMode");
+
+    switch (mode) {
+        case KEYFRAMES_ONLY:
+            params.Add("mode", "keyframes");
+            break;
+        case REFERENCE_ONLY:
+            params.Add("mode", "reference");
+            break;
+        default:
+            params.Add("mode", "all");
+            break;
+    }
+
+    params.Add("fps", fps);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e);
+    return true;
+}
+
+bool VideoDecoderLibav::configDecodingMode0(DecodingMode mode, int fps)
+{
+    if (fps < 0) {
+        utils::errorMsg("[VideoDecoderLibav] Invalid output frame rate");
+        return false;
+    }
+
+    decodingMode = mode;
+    outputFps = fps;
+    lastOutputTime = std::chrono::microseconds(-1);
+    applyDecodingMode();
+
+    return true;
+}
+
+bool VideoDecoderLibav::decodingModeEvent(Jzon::Node* params)
+{
+    DecodingMode tmpMode = decodingMode;
+    int tmpFps = outputFps;
+    std::string mode;
+
+    if (!params) {
+        return false;
+    }
+
+    if (params->Has("mode") && params->Get("mode").IsString()) {
+        mode = params->Get("mode").ToString();
+
+        if (mode == "all") {
+            tmpMode = ALL_FRAMES;
+        } else if (mode == "keyframes") {
+            tmpMode = KEYFRAMES_ONLY;
+        } else if (mode == "reference") {
+            tmpMode = REFERENCE_ONLY;
+        } else {
+            utils::errorMsg("[VideoDecoderLibav] Unknown decoding mode " + mode);
+            return false;
+        }
+    }
+
+    if (params->Has("fps") && params->Get("fps").IsNumber()) {
+        tmpFps = params->Get("fps").ToInt();
+    }
+
+    return configDecodingMode0(tmpMode, tmpFps);
+}
+
 void VideoDecoderLibav::initializeEventMap()
 {
-	
+    eventMap["configure"] = std::bind(&VideoDecoderLibav::configEvent, this, std::placeholders::_1);
+    eventMap["decodingMode"] = std::bind(&VideoDecoderLibav::decodingModeEvent, this, std::placeholders::_1);
 }
 
 void VideoDecoderLibav::doGetState(Jzon::Object &filterNode)
@@ -238,6 +758,26 @@ void VideoDecoderLibav::doGetState(Jzon::Object &filterNode)
     jsonDecoderConfig.Add("height", std::to_string(psi.inputHeight));
 
     filterNode.Add("inputInfo", jsonDecoderConfig);
+    filterNode.Add("threads", threads);
+    filterNode.Add("threadingMode", frameThreading ? "frame" : "slice");
+    filterNode.Add("addedLatency", (int) addedLatency.count());
+    switch (decodingMode) {
+        case KEYFRAMES_ONLY:
+            filterNode.Add("decodingMode", "keyframes");
+            break;
+        case REFERENCE_ONLY:
+            filterNode.Add("decodingMode", "reference");
+            break;
+        default:
+            filterNode.Add("decodingMode", "all");
+            break;
+    }
+
+    filterNode.Add("outputFps", outputFps);
+    filterNode.Add("discardedPackets", (int) discardedPackets);
+    filterNode.Add("discardedFrames", (int) discardedFrames);
+    filterNode.Add("directFrames", (int) directFrames);
+    filterNode.Add("copiedFrames", (int) copiedFrames);
 }
 
 PixType getPixelFormat(AVPixelFormat format)
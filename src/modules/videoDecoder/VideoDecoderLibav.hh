@@ -29,30 +29,124 @@ extern "C" {
     #include <libavutil/imgutils.h>
 }
 
+#include <memory>
+#include <mutex>
+#include <set>
+#include <map>
+#include <deque>
+#include <atomic>
+#include <chrono>
+
 #include "../../VideoFrame.hh"
 #include "../../FrameQueue.hh"
 #include "../../Filter.hh"
 #include "../../StreamInfo.hh"
 
+//NOTE: decoded picture widths are rounded up to this value so every plane
+//stride is aligned as libavcodec requires
+#define DECODER_WIDTH_ALIGN 128
+
+//NOTE: 0 lets libavcodec choose the number of threads
+#define DEFAULT_DECODER_THREADS 0
+#define MAX_DECODER_THREADS 32
+#define MAX_PENDING_PACKETS 64
+
 
 class VideoDecoderLibav : public OneToOneFilter {
 
 public:
+    /*! ALL_FRAMES decodes every frame, KEYFRAMES_ONLY only decodes IDR/intra frames
+        and REFERENCE_ONLY skips non-reference frames and the loop filter. Skipped 
+        packets are discarded before reaching libavcodec when the codec allows it. */
+    enum DecodingMode {ALL_FRAMES, KEYFRAMES_ONLY, REFERENCE_ONLY};
+
     VideoDecoderLibav();
     ~VideoDecoderLibav();
-        
+
+    /**
+    * Configures decoder threading. It is applied when the decoder is (re)opened.
+    * @param threads number of decoding threads, 0 lets libavcodec choose
+    * @param frameThreading decodes several frames in parallel instead of the slices of 
+    * each frame, which scales with single slice streams at the cost of one frame of 
+    * delay per extra thread. Held frames are drained when the decoder is reopened or 
+    * its reader is deleted
+    */
+    bool configure(int threads, bool frameThreading);
+
+    /**
+    * Configures which frames are decoded, i.e. for previews and monitoring outputs
+    * @param mode see DecodingMode
+    * @param fps maximum output frame rate, 0 means no limit
+    */
+    bool configDecodingMode(DecodingMode mode, int fps = 0);
+
+protected:
+    /*! Pool buffer handed to libavcodec through get_buffer2. It is released
+        when libavcodec does not need it anymore as a reference, while the 
+        pipeline frame showing it keeps its own reference. */
+    struct DirectBuffer {
+        std::shared_ptr<unsigned char> buffer;
+        int width;
+        int height;
+        VideoDecoderLibav *decoder;
+    };
+
+    static int getBuffer(AVCodecContext *ctx, AVFrame *pic, int flags);
+    static void releaseBuffer(void *opaque, uint8_t *data);
+    DirectBuffer *getDirectBuffer(AVCodecContext *ctx, AVFrame *pic);
+    bool attachDecodedBuffer(InterleavedVideoFrame *decodedFrame);
+
+    /*! Timing of a packet sent to libavcodec, which may output its picture some 
+        packets later */
+    struct PendingPacket {
+        std::chrono::microseconds pTime;
+        std::chrono::system_clock::time_point oTime;
+        size_t seqNum;
+        std::chrono::system_clock::time_point decodingTime;
+    };
+
+    /*! Decoded picture waiting to be output, i.e. drained from a decoder that was 
+        reopened or flushed, or decoded after those */
+    struct QueuedPicture {
+        AVFrame *picture;
+        PendingPacket timing;
+    };
+
+    void pushPendingPacket(Frame *org);
+    bool popPendingPacket(PendingPacket &packet);
+    void drainDecoder();
+    void queuePicture(const PendingPacket &timing);
+    bool writePicture(Frame *dst, const PendingPacket &timing);
+    bool hasPendingOutput() {return !queuedPictures.empty() || streamEnded;};
+    bool doProcessFrame(Frame *org, Frame *dst);
+
+    AVFrame             *frame;
+    AVPacket            pkt;
+    std::shared_ptr<FrameBufferPool> outputPool;
+    std::set<DirectBuffer*> directBuffers;
+    std::mutex buffersMtx;
+    std::map<int64_t, PendingPacket> pendingPackets;
+    std::deque<QueuedPicture> queuedPictures;
+    std::atomic<bool> streamEnded;
+
 private:
+    bool configure0(int threads, bool frameThreading);
+    bool configEvent(Jzon::Node* params);
+    bool configDecodingMode0(DecodingMode mode, int fps);
+    bool decodingModeEvent(Jzon::Node* params);
+    void applyDecodingMode();
+    bool discardPacket(Frame *org);
+    bool exceedsOutputRate(std::chrono::microseconds pTime);
+
     void initializeEventMap();
     FrameQueue* allocQueue(ConnectionData cData);
-    bool doProcessFrame(Frame *org, Frame *dst);
-    bool toBuffer(VideoFrame *decodedFrame, VideoFrame *codedFrame);
+    bool toBuffer(VideoFrame *decodedFrame);
     bool reconfigure(VCodecType codec);
     bool inputConfig();
     void doGetState(Jzon::Object &filterNode);
 
-    //There is no need of specific reader configuration
-    bool specificReaderConfig(int /*readerID*/, FrameQueue* /*queue*/)  {return true;};
-    bool specificReaderDelete(int /*readerID*/) {return true;};
+    bool specificReaderConfig(int readerID, FrameQueue* queue);
+    bool specificReaderDelete(int readerID);
     
     //NOTE: There is no need of specific writer configuration
     bool specificWriterConfig(int /*writerID*/) {return true;};
@@ -60,13 +154,29 @@ private:
     
     AVCodec             *codec;
     AVCodecContext      *codecCtx;
-    AVFrame             *frame, *frameCopy;
-    AVPacket            pkt;
+    AVFrame             *frameCopy;
     AVCodecID           libavCodecId;
 
     
 
     StreamInfo *outputStreamInfo;
+    //NOTE: kept from the reader configuration, since the decoder may be reopened by events
+    //while the filter mutex is locked
+    const StreamInfo *inputInfo;
+
+    unsigned directFrames;
+    unsigned copiedFrames;
+
+    int threads;
+    bool frameThreading;
+    int64_t packetCount;
+    std::chrono::microseconds addedLatency;
+
+    DecodingMode decodingMode;
+    int outputFps;
+    std::chrono::microseconds lastOutputTime;
+    unsigned discardedPackets;
+    unsigned discardedFrames;
 
     struct InputStreamInfo {
             unsigned    inputWidth;
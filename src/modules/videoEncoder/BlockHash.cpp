@@ -0,0 +1,125 @@
+/*
+ *  BlockHash.cpp - Picture plane block hashing kernels
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "BlockHash.hh"
+
+#include <algorithm>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static inline uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb53fe63bc4f9ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*! Fletcher-like sums of 32 bit words keep the position of the data in the
+    hash, and a rotate-xor accumulator covers what sums may cancel out. Tail
+    bytes not filling a 16 byte vector are hashed with FNV-1a. The scalar path
+    computes the same four lanes as the SSE2 one, so hashes do not depend on
+    the build. */
+static uint64_t hashBlock(const unsigned char *src, int stride, int bytes, int lines)
+{
+    uint64_t h = FNV_OFFSET;
+    uint32_t words[12] = {0};
+    uint64_t lanes[6];
+    int vectorBytes = bytes / 16 * 16;
+
+#ifdef __SSE2__
+    __m128i sum = _mm_setzero_si128();
+    __m128i weighted = _mm_setzero_si128();
+    __m128i rotated = _mm_setzero_si128();
+
+    for (int y = 0; y < lines; y++){
+        const unsigned char *line = src + y * stride;
+
+        for (int x = 0; x < vectorBytes; x += 16){
+            __m128i v = _mm_loadu_si128((const __m128i*) (line + x));
+            sum = _mm_add_epi32(sum, v);
+            weighted = _mm_add_epi32(weighted, sum);
+            rotated = _mm_xor_si128(_mm_or_si128(_mm_slli_epi32(rotated, 5), _mm_srli_epi32(rotated, 27)), v);
+        }
+    }
+
+    _mm_storeu_si128((__m128i*) words, sum);
+    _mm_storeu_si128((__m128i*) (words + 4), weighted);
+    _mm_storeu_si128((__m128i*) (words + 8), rotated);
+#else
+    uint32_t *sum = words;
+    uint32_t *weighted = words + 4;
+    uint32_t *rotated = words + 8;
+
+    for (int y = 0; y < lines; y++){
+        const unsigned char *line = src + y * stride;
+
+        for (int x = 0; x < vectorBytes; x += 16){
+            for (int i = 0; i < 4; i++){
+                uint32_t v;
+                memcpy(&v, line + x + i * 4, sizeof(v));
+                sum[i] += v;
+                weighted[i] += sum[i];
+                rotated[i] = ((rotated[i] << 5) | (rotated[i] >> 27)) ^ v;
+            }
+        }
+    }
+#endif
+
+    memcpy(lanes, words, sizeof(lanes));
+
+    for (int i = 0; i < 6; i++){
+        h = mix(h ^ lanes[i]);
+    }
+
+    for (int y = 0; y < lines; y++){
+        const unsigned char *line = src + y * stride;
+
+        for (int x = vectorBytes; x < bytes; x++){
+            h = (h ^ line[x]) * FNV_PRIME;
+        }
+    }
+
+    return h;
+}
+
+namespace blockhash
+{
+    void hashPlane(const unsigned char *plane, int stride, int lineBytes, int lines,
+                   std::vector<uint64_t> &hashes)
+    {
+        for (int y = 0; y < lines; y += BLOCK_HASH_LINES){
+            for (int x = 0; x < lineBytes; x += BLOCK_HASH_BYTES){
+                hashes.push_back(hashBlock(plane + y * stride + x, stride,
+                                           std::min(BLOCK_HASH_BYTES, lineBytes - x),
+                                           std::min(BLOCK_HASH_LINES, lines - y)));
+            }
+        }
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ *  BlockHash.hh - Picture plane block hashing kernels
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _BLOCK_HASH_HH
+#define _BLOCK_HASH_HH
+
+#include <stdint.h>
+#include <vector>
+
+//NOTE: blocks are BLOCK_HASH_LINES lines of BLOCK_HASH_BYTES bytes, 
+//so a 1 byte per pixel plane is hashed in 64x16 pixel blocks
+#define BLOCK_HASH_LINES 16
+#define BLOCK_HASH_BYTES 64
+
+/*! Hashing of picture planes by blocks, used to detect which regions of a
+    picture changed from the previous one. Planes are accessed through their
+    strides, so they can be regions of bigger pictures. */
+
+namespace blockhash
+{
+    /**
+    * Hashes the blocks of a plane, appending one hash per block in raster order
+    * @param plane first byte of the plane
+    * @param stride bytes between plane lines
+    * @param lineBytes bytes of each line to hash
+    * @param lines number of lines of the plane
+    * @param hashes vector where the block hashes are appended
+    */
+    void hashPlane(const unsigned char *plane, int stride, int lineBytes, int lines,
+                   std::vector<uint64_t> &hashes);
+}
+
+#endif
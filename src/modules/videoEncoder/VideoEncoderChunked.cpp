@@ -0,0 +1,591 @@
+/*
+ *  VideoEncoderChunked - GOP-parallel offline X264 video encoder
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "VideoEncoderChunked.hh"
+#include "../../SlicedVideoFrameQueue.hh"
+
+#include <string.h>
+
+VideoEncoderChunked::VideoEncoderChunked() :
+OneToOneFilter(SERVER, true), currentChunk(NULL), activeWorkers(0), bufferedSize(0),
+stopWorkers(false), inPixFmt(P_NONE), inWidth(0), inHeight(0), needsConfig(false), bitrate(0),
+chunkFrames(0), workers(0), threads(0), fps(0), maxBufferSize(0), encodedChunks(0), encodedFrames(0)
+{
+    fType = VIDEO_ENCODER_CHUNKED;
+    outputStreamInfo = new StreamInfo(VIDEO);
+    outputStreamInfo->video.codec = H264;
+    outputStreamInfo->video.h264or5.annexb = true;
+    lastInput = std::chrono::system_clock::now();
+    setIdleTime(std::chrono::milliseconds(CHUNK_POLL_TIME));
+    initializeEventMap();
+    configure0(DEFAULT_BITRATE, DEFAULT_CHUNK_FRAMES, DEFAULT_CHUNK_WORKERS, DEFAULT_CHUNK_THREADS,
+               0, DEFAULT_PRESET, DEFAULT_CHUNK_BUFFER_SIZE);
+}
+
+VideoEncoderChunked::~VideoEncoderChunked()
+{
+    {
+        std::lock_guard<std::mutex> guard(pendingMtx);
+        stopWorkers = true;
+    }
+
+    pendingCheck.notify_all();
+
+    //NOTE: workers finish the chunk they are encoding, pending ones are discarded
+    for (auto &encoder : encoders){
+        encoder.join();
+    }
+
+    for (auto chunk : chunks){
+        freeChunk(chunk);
+    }
+
+    chunks.clear();
+
+    if (currentChunk){
+        freeChunk(currentChunk);
+    }
+
+    delete outputStreamInfo;
+}
+
+FrameQueue* VideoEncoderChunked::allocQueue(ConnectionData cData)
+{
+    return SlicedVideoFrameQueue::createNew(cData, outputStreamInfo, DEFAULT_VIDEO_FRAMES, MAX_H264_OR_5_NAL_SIZE);
+}
+
+bool VideoEncoderChunked::doProcessFrame(Frame *org, Frame *dst)
+{
+    InterleavedVideoFrame *rawFrame;
+    SlicedVideoFrame *codedFrame;
+    std::chrono::system_clock::time_point now;
+
+    rawFrame = dynamic_cast<InterleavedVideoFrame*>(org);
+    codedFrame = dynamic_cast<SlicedVideoFrame*>(dst);
+
+    if ((org && !rawFrame) || !codedFrame){
+        utils::errorMsg("[VideoEncoderChunked] Origin frame MUST be an InterleavedVideoFrame and destination a SlicedVideoFrame");
+        return false;
+    }
+
+    now = std::chrono::system_clock::now();
+
+    //NOTE: as a server filter it also runs without new input, origin frames are new only when consumed
+    //and there is no origin frame once the reader has been disconnected (i.e. end of file) or while
+    //the input is paused
+    if (!org){
+        if (!isInputPaused()){
+            dispatchChunk();
+        }
+    } else if (org->getConsumed()){
+        lastInput = now;
+
+        if (!appendFrame(rawFrame)){
+            utils::warningMsg("[VideoEncoderChunked] Input frame discarded");
+        }
+    } else if (currentChunk && now - lastInput > std::chrono::milliseconds(CHUNK_FLUSH_TIMEOUT)){
+        dispatchChunk();
+    }
+
+    //NOTE: runs producing output are scheduled again right away, so encoded chunks
+    //are drained one frame per run without waiting for the idle time
+    if (outputFrame(codedFrame)){
+        dst->setConsumed(true);
+        return true;
+    }
+
+    return false;
+}
+
+bool VideoEncoderChunked::appendFrame(InterleavedVideoFrame *orgFrame)
+{
+    unsigned char *planes[MAX_PLANES];
+    int strides[MAX_PLANES];
+    int step[MAX_PLANES];
+    int xShift[MAX_PLANES];
+    int yShift[MAX_PLANES];
+    int planesNum;
+    size_t pictureSize = 0;
+    x264_picture_t picture;
+    FrameTimeParams frameTP;
+
+    if (!reconfigure(orgFrame)){
+        utils::errorMsg("[VideoEncoderChunked] Reconfiguration failed");
+        return false;
+    }
+
+    planesNum = orgFrame->getPlanes(planes, strides);
+
+    if (planesNum == 0 || orgFrame->getPlanesLayout(step, xShift, yShift) != planesNum){
+        utils::errorMsg("[VideoEncoderChunked] Could not get input picture planes");
+        return false;
+    }
+
+    if (x264_picture_alloc(&picture, xparams.i_csp, inWidth, inHeight) < 0){
+        utils::errorMsg("[VideoEncoderChunked] Could not allocate picture");
+        return false;
+    }
+
+    //NOTE: input frames are reused by the previous filter, chunks keep their own copy
+    for (int p = 0; p < planesNum; p++){
+        int lineBytes = (-((-inWidth) >> xShift[p])) * step[p];
+        int lines = -((-inHeight) >> yShift[p]);
+
+        for (int y = 0; y < lines; y++){
+            memcpy(picture.img.plane[p] + y * picture.img.i_stride[p], planes[p] + y * strides[p], lineBytes);
+        }
+
+        pictureSize += lineBytes * lines;
+    }
+
+    if (!currentChunk){
+        currentChunk = new Chunk();
+        currentChunk->xparams = xparams;
+        currentChunk->width = inWidth;
+        currentChunk->height = inHeight;
+        currentChunk->size = 0;
+        currentChunk->encoded = false;
+        currentChunk->nextFrame = 0;
+    }
+
+    frameTP.pTime = orgFrame->getPresentationTime();
+    frameTP.oTime = orgFrame->getOriginTime();
+    frameTP.seqNum = orgFrame->getSequenceNumber();
+
+    currentChunk->pictures.push_back(picture);
+    currentChunk->timeParams.push_back(frameTP);
+    currentChunk->size += pictureSize;
+    bufferedSize += pictureSize;
+
+    if (currentChunk->pictures.size() >= chunkFrames){
+        dispatchChunk();
+    }
+
+    return true;
+}
+
+void VideoEncoderChunked::dispatchChunk()
+{
+    if (!currentChunk){
+        return;
+    }
+
+    if (currentChunk->pictures.empty()){
+        freeChunk(currentChunk);
+        currentChunk = NULL;
+        return;
+    }
+
+    startWorkers();
+    chunks.push_back(currentChunk);
+
+    {
+        std::lock_guard<std::mutex> guard(pendingMtx);
+        pendingChunks.push_back(currentChunk);
+    }
+
+    //NOTE: idle workers over 'workers' are also woken up, so all of them are notified
+    pendingCheck.notify_all();
+    currentChunk = NULL;
+}
+
+bool VideoEncoderChunked::isInputPaused()
+{
+    size_t filling = currentChunk ? currentChunk->size : 0;
+
+    //NOTE: the chunk being filled cannot be encoded until it is complete, so it never pauses the input alone
+    return bufferedSize >= maxBufferSize && bufferedSize > filling;
+}
+
+void VideoEncoderChunked::startWorkers()
+{
+    activeWorkers = workers;
+
+    for (unsigned i = encoders.size(); i < workers; i++){
+        encoders.push_back(std::thread(&VideoEncoderChunked::work, this, i));
+    }
+}
+
+void VideoEncoderChunked::work(unsigned index)
+{
+    Chunk *chunk;
+
+    while (true){
+        {
+            std::unique_lock<std::mutex> guard(pendingMtx);
+
+            pendingCheck.wait(guard, [&](){
+                return stopWorkers || (index < activeWorkers && !pendingChunks.empty());
+            });
+
+            if (stopWorkers){
+                return;
+            }
+
+            chunk = pendingChunks.front();
+            pendingChunks.pop_front();
+        }
+
+        encodeChunk(chunk);
+
+        //NOTE: the chunk may be freed once it is marked as encoded
+        bufferedSize -= chunk->size;
+        chunk->encoded = true;
+    }
+}
+
+void VideoEncoderChunked::encodeChunk(Chunk *chunk)
+{
+    x264_t *encoder;
+    x264_nal_t *nals;
+    x264_picture_t picOut;
+    int piNal;
+    int success;
+
+    auto storeFrame = [&](){
+        EncodedFrame frame;
+
+        if (success <= 0 || picOut.i_pts < 0 || picOut.i_pts >= (int64_t) chunk->timeParams.size()){
+            return;
+        }
+
+        for (int i = 0; i < piNal; i++){
+            frame.nals.push_back(std::vector<unsigned char>(nals[i].p_payload, nals[i].p_payload + nals[i].i_payload));
+        }
+
+        frame.timeParams = chunk->timeParams[picOut.i_pts];
+        chunk->frames.push_back(frame);
+    };
+
+    encoder = x264_encoder_open(&chunk->xparams);
+
+    if (!encoder){
+        utils::errorMsg("[VideoEncoderChunked] Could not open the encoder of a chunk");
+    }
+
+    for (size_t i = 0; encoder && i < chunk->pictures.size(); i++){
+        x264_picture_init(&picOut);
+        chunk->pictures[i].i_pts = i;
+        chunk->pictures[i].i_type = i == 0 ? X264_TYPE_IDR : X264_TYPE_AUTO;
+        success = x264_encoder_encode(encoder, &nals, &piNal, &chunk->pictures[i], &picOut);
+
+        if (success < 0){
+            utils::errorMsg("[VideoEncoderChunked] Could not encode video frame");
+            break;
+        }
+
+        storeFrame();
+    }
+
+    //NOTE: frames delayed by the lookahead are output at the end of the chunk
+    while (encoder && x264_encoder_delayed_frames(encoder) > 0){
+        x264_picture_init(&picOut);
+        success = x264_encoder_encode(encoder, &nals, &piNal, NULL, &picOut);
+
+        if (success < 0){
+            break;
+        }
+
+        storeFrame();
+    }
+
+    if (encoder){
+        x264_encoder_close(encoder);
+    }
+
+    for (auto &picture : chunk->pictures){
+        x264_picture_clean(&picture);
+    }
+
+    chunk->pictures.clear();
+}
+
+bool VideoEncoderChunked::outputFrame(SlicedVideoFrame *dst)
+{
+    Chunk *chunk;
+
+    while (!chunks.empty()){
+        chunk = chunks.front();
+
+        if (!chunk->encoded){
+            return false;
+        }
+
+        if (chunk->nextFrame < chunk->frames.size()){
+            break;
+        }
+
+        //NOTE: slices of the last output frame are copied by the queue before the next run
+        freeChunk(chunk);
+        chunks.pop_front();
+        encodedChunks++;
+    }
+
+    if (chunks.empty()){
+        return false;
+    }
+
+    EncodedFrame &frame = chunk->frames[chunk->nextFrame++];
+
+    for (auto &nal : frame.nals){
+        if (!dst->setSlice(nal.data(), nal.size())){
+            utils::errorMsg("[VideoEncoderChunked] Too many NALs for one slicedFrame");
+            return false;
+        }
+    }
+
+    dst->setSize(chunk->width, chunk->height);
+    dst->setPresentationTime(frame.timeParams.pTime);
+    dst->setDecodeTime(frame.timeParams.pTime);
+    dst->setOriginTime(frame.timeParams.oTime);
+    dst->setSequenceNumber(frame.timeParams.seqNum);
+    encodedFrames++;
+
+    return true;
+}
+
+void VideoEncoderChunked::freeChunk(Chunk *chunk)
+{
+    for (auto &picture : chunk->pictures){
+        x264_picture_clean(&picture);
+    }
+
+    delete chunk;
+}
+
+bool VideoEncoderChunked::reconfigure(InterleavedVideoFrame *orgFrame)
+{
+    int colorspace;
+    std::string profile;
+    x264_t *encoder;
+    x264_nal_t *nals;
+    int piNal;
+    int encodeSize;
+
+    if (!needsConfig && orgFrame->getWidth() == inWidth && orgFrame->getHeight() == inHeight &&
+            orgFrame->getPixelFormat() == inPixFmt){
+        return true;
+    }
+
+    switch (orgFrame->getPixelFormat()) {
+        case YUV420P:
+            colorspace = X264_CSP_I420;
+            profile = "high";
+            break;
+        case YUV422P:
+            colorspace = X264_CSP_I422;
+            profile = "high422";
+            break;
+        case YUV444P:
+            colorspace = X264_CSP_I444;
+            profile = "high444";
+            break;
+        default:
+            utils::errorMsg("[VideoEncoderChunked] Uncompatible input pixel format");
+            return false;
+    }
+
+    //NOTE: frames already buffered are encoded with the previous configuration
+    dispatchChunk();
+
+    x264_param_default_preset(&xparams, preset.c_str(), NULL);
+    x264_param_apply_profile(&xparams, profile.c_str());
+
+    //NOTE: each chunk is a closed GOP starting with an IDR
+    x264_param_parse(&xparams, "keyint", std::to_string(chunkFrames).c_str());
+    x264_param_parse(&xparams, "min-keyint", std::to_string(chunkFrames).c_str());
+    x264_param_parse(&xparams, "fps", std::to_string(fps > 0 ? fps : VIDEO_DEFAULT_FRAMERATE).c_str());
+    x264_param_parse(&xparams, "threads", std::to_string(threads).c_str());
+    x264_param_parse(&xparams, "aud", std::to_string(1).c_str());
+    x264_param_parse(&xparams, "bitrate", std::to_string(bitrate).c_str());
+    x264_param_parse(&xparams, "bframes", std::to_string(0).c_str());
+    x264_param_parse(&xparams, "repeat-headers", std::to_string(1).c_str());
+    x264_param_parse(&xparams, "annexb", std::to_string(1).c_str());
+    x264_param_parse(&xparams, "vbv-maxrate", std::to_string(bitrate*1.05).c_str());
+    x264_param_parse(&xparams, "vbv-bufsize", std::to_string(bitrate*2).c_str());
+    x264_param_parse(&xparams, "scenecut", std::to_string(0).c_str());
+
+    xparams.i_width = orgFrame->getWidth();
+    xparams.i_height = orgFrame->getHeight();
+    xparams.i_csp = colorspace;
+
+    //NOTE: all the chunks share the headers, which are taken from a throwaway encoder
+    encoder = x264_encoder_open(&xparams);
+
+    if (!encoder){
+        utils::errorMsg("[VideoEncoderChunked] Could not open the encoder");
+        return false;
+    }
+
+    encodeSize = x264_encoder_headers(encoder, &nals, &piNal);
+
+    if (encodeSize < 0){
+        utils::errorMsg("[VideoEncoderChunked] Could not encode headers");
+        x264_encoder_close(encoder);
+        return false;
+    }
+
+    outputStreamInfo->setExtraData(nals[0].p_payload, encodeSize);
+    x264_encoder_close(encoder);
+
+    inPixFmt = orgFrame->getPixelFormat();
+    inWidth = orgFrame->getWidth();
+    inHeight = orgFrame->getHeight();
+    needsConfig = false;
+
+    return true;
+}
+
+bool VideoEncoderChunked::configure0(unsigned bitrate_, unsigned chunkFrames_, unsigned workers_,
+                                     unsigned threads_, unsigned fps_, std::string preset_,
+                                     unsigned bufferSize_)
+{
+    if (bitrate_ <= 0 || chunkFrames_ <= 0 || threads_ <= 0 || preset_.empty() || bufferSize_ <= 0) {
+        utils::errorMsg("[VideoEncoderChunked] Error configuring: invalid configuration values");
+        return false;
+    }
+
+    bitrate = bitrate_;
+    chunkFrames = chunkFrames_;
+    threads = threads_;
+    fps = fps_;
+    preset = preset_;
+    workers = workers_;
+    maxBufferSize = (size_t) bufferSize_ * 1024 * 1024;
+
+    if (workers == 0) {
+        workers = DEFAULT_CHUNK_WORKERS;
+    }
+
+    needsConfig = true;
+    return true;
+}
+
+bool VideoEncoderChunked::configEvent(Jzon::Node* params)
+{
+    int tmpBitrate = bitrate;
+    int tmpChunkFrames = chunkFrames;
+    int tmpWorkers = workers;
+    int tmpThreads = threads;
+    int tmpFps = fps;
+    int tmpBufferSize = maxBufferSize / (1024 * 1024);
+    std::string tmpPreset = preset;
+
+    if (!params) {
+        return false;
+    }
+
+    if (params->Has("bitrate")) {
+        tmpBitrate = params->Get("bitrate").ToInt();
+    }
+
+    if (params->Has("chunkFrames")) {
+        tmpChunkFrames = params->Get("chunkFrames").ToInt();
+    }
+
+    if (params->Has("workers")) {
+        tmpWorkers = params->Get("workers").ToInt();
+    }
+
+    if (params->Has("threads")) {
+        tmpThreads = params->Get("threads").ToInt();
+    }
+
+    if (params->Has("fps")) {
+        tmpFps = params->Get("fps").ToInt();
+    }
+
+    if (params->Has("preset")) {
+        tmpPreset = params->Get("preset").ToString();
+    }
+
+    if (params->Has("bufferSize")) {
+        tmpBufferSize = params->Get("bufferSize").ToInt();
+    }
+
+    if (tmpBitrate <= 0 || tmpChunkFrames <= 0 || tmpWorkers < 0 || tmpThreads <= 0 || tmpFps < 0 ||
+            tmpBufferSize <= 0) {
+        utils::errorMsg("[VideoEncoderChunked] Error configuring: invalid configuration values");
+        return false;
+    }
+
+    return configure0(tmpBitrate, tmpChunkFrames, tmpWorkers, tmpThreads, tmpFps, tmpPreset, tmpBufferSize);
+}
+
+bool VideoEncoderChunked::flushEvent(Jzon::Node* /*params*/)
+{
+    dispatchChunk();
+    return true;
+}
+
+void VideoEncoderChunked::initializeEventMap()
+{
+    eventMap["configure"] = std::bind(&VideoEncoderChunked::configEvent, this, std::placeholders::_1);
+    eventMap["flush"] = std::bind(&VideoEncoderChunked::flushEvent, this, std::placeholders::_1);
+}
+
+void VideoEncoderChunked::doGetState(Jzon::Object &filterNode)
+{
+    filterNode.Add("bitrate", (int) bitrate);
+    filterNode.Add("chunkFrames", (int) chunkFrames);
+    filterNode.Add("workers", (int) workers);
+    filterNode.Add("threads", (int) threads);
+    filterNode.Add("fps", (int) fps);
+    filterNode.Add("preset", preset);
+    filterNode.Add("bufferSize", (int) (maxBufferSize / (1024 * 1024)));
+    filterNode.Add("bufferedSize", (int) (bufferedSize / (1024 * 1024)));
+    filterNode.Add("inputPaused", isInputPaused());
+    filterNode.Add("pendingChunks", (int) chunks.size());
+    filterNode.Add("encodedChunks", (int) encodedChunks);
+    filterNode.Add("encodedFrames", (int) encodedFrames);
+}
+
+bool VideoEncoderChunked::configure(int bitrate, int chunkFrames, int workers, int threads,
+                                    int fps, std::string preset, int bufferSize)
+{
+    Jzon::Object root, params;
+
+    root.Add("action", "configure");
+    params.Add("bitrate", bitrate);
+    params.Add("chunkFrames", chunkFrames);
+    params.Add("workers", workers);
+    params.Add("threads", threads);
+    params.Add("fps", fps);
+    params.Add("preset", preset);
+    params.Add("bufferSize", bufferSize);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e);
+    return true;
+}
+
+bool VideoEncoderChunked::flush()
+{
+    Jzon::Object root, params;
+
+    root.Add("action", "flush");
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e);
+    return true;
+}
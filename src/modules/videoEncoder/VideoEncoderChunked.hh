@@ -0,0 +1,185 @@
+/*
+ *  VideoEncoderChunked - GOP-parallel offline X264 video encoder
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _VIDEO_ENCODER_CHUNKED_HH
+#define _VIDEO_ENCODER_CHUNKED_HH
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../../Utils.hh"
+#include "../../VideoFrame.hh"
+#include "../../Filter.hh"
+#include "../../FrameQueue.hh"
+#include "../../Types.hh"
+#include "../../StreamInfo.hh"
+#include "VideoEncoderX264or5.hh"
+
+extern "C" {
+    #include <x264.h>
+}
+
+#define DEFAULT_CHUNK_FRAMES 250
+#define DEFAULT_CHUNK_THREADS 1
+#define DEFAULT_CHUNK_WORKERS 2
+//NOTE: raw pictures buffered by the chunks waiting to be encoded, about 2 chunks at 1080p
+#define DEFAULT_CHUNK_BUFFER_SIZE 1536 //MB
+//NOTE: input idle time after which the last incomplete chunk is encoded (i.e. end of file)
+#define CHUNK_FLUSH_TIMEOUT 1000 //ms
+//NOTE: delay between runs while waiting for chunks being encoded, the worker thread is not blocked
+#define CHUNK_POLL_TIME 5 //ms
+
+/*! Offline H264 encoder for file transcoding (i.e. HeadDemuxerLibav inputs).
+    The input is split in chunks of chunkFrames frames, each one encoded as a
+    closed GOP by its own x264 instance, and up to 'workers' chunks are encoded
+    concurrently by persistent threads. Chunks are output in order, so downstream
+    filters (i.e. Dasher or a file sink) receive a regular stream with an IDR every
+    chunkFrames frames. Once the raw pictures waiting to be encoded reach the
+    buffer size the input is paused, neither dropped nor waited for, and it is
+    resumed when the encoded chunks release them. The last incomplete chunk is
+    encoded when the reader is disconnected, when flush is called or once the
+    input has been idle for CHUNK_FLUSH_TIMEOUT. */
+
+class VideoEncoderChunked : public OneToOneFilter {
+
+public:
+    /**
+    * Class constructor
+    */
+    VideoEncoderChunked();
+
+    /**
+    * Class destructor
+    */
+    ~VideoEncoderChunked();
+
+    /**
+    * Configures the encoder, changes apply from the next chunk
+    * @param bitrate in kbps
+    * @param chunkFrames frames of each chunk, which is also the GOP size
+    * @param workers chunks encoded concurrently, 0 uses DEFAULT_CHUNK_WORKERS
+    * @param threads encoding threads of each chunk
+    * @param fps frame rate used by the rate control, 0 uses the default
+    * @param preset x264 preset
+    * @param bufferSize raw pictures buffered before pausing the input, in MB.
+    * A chunk being filled is never paused, so at least one chunk is buffered
+    */
+    bool configure(int bitrate = DEFAULT_BITRATE, int chunkFrames = DEFAULT_CHUNK_FRAMES,
+                   int workers = DEFAULT_CHUNK_WORKERS, int threads = DEFAULT_CHUNK_THREADS,
+                   int fps = 0, std::string preset = DEFAULT_PRESET,
+                   int bufferSize = DEFAULT_CHUNK_BUFFER_SIZE);
+
+    /**
+    * Encodes the frames buffered in the last incomplete chunk (i.e. at the end of the input)
+    */
+    bool flush();
+
+protected:
+    bool doProcessFrame(Frame *org, Frame *dst);
+    bool isInputPaused();
+    bool configure0(unsigned bitrate_, unsigned chunkFrames_, unsigned workers_,
+                    unsigned threads_, unsigned fps_, std::string preset_,
+                    unsigned bufferSize_ = DEFAULT_CHUNK_BUFFER_SIZE);
+    bool flushEvent(Jzon::Node* params);
+
+    struct FrameTimeParams {
+        std::chrono::microseconds pTime;
+        std::chrono::system_clock::time_point oTime;
+        size_t seqNum;
+    };
+
+    struct EncodedFrame {
+        std::vector<std::vector<unsigned char>> nals;
+        FrameTimeParams timeParams;
+    };
+
+    struct Chunk {
+        x264_param_t xparams;
+        int width;
+        int height;
+        std::vector<x264_picture_t> pictures;
+        std::vector<FrameTimeParams> timeParams;
+        std::vector<EncodedFrame> frames;
+        size_t size;
+        std::atomic<bool> encoded;
+        size_t nextFrame;
+    };
+
+    FrameQueue *allocQueue(ConnectionData cData);
+    void initializeEventMap();
+    void doGetState(Jzon::Object &filterNode);
+    bool configEvent(Jzon::Node* params);
+
+    bool reconfigure(InterleavedVideoFrame *orgFrame);
+    bool appendFrame(InterleavedVideoFrame *orgFrame);
+    void dispatchChunk();
+    bool outputFrame(SlicedVideoFrame *dst);
+    void freeChunk(Chunk *chunk);
+    void startWorkers();
+    void work(unsigned index);
+    static void encodeChunk(Chunk *chunk);
+
+    //There is no need of specific reader/writer configuration
+    bool specificReaderConfig(int /*readerID*/, FrameQueue* /*queue*/) {return true;};
+    bool specificReaderDelete(int /*readerID*/) {return true;};
+    bool specificWriterConfig(int /*writerID*/) {return true;};
+    bool specificWriterDelete(int /*writerID*/) {return true;};
+
+    StreamInfo *outputStreamInfo;
+    x264_param_t xparams;
+
+    //NOTE: chunks being encoded or output, in input order
+    std::deque<Chunk*> chunks;
+    Chunk *currentChunk;
+    std::chrono::system_clock::time_point lastInput;
+
+    //NOTE: worker threads are only added, the ones over 'workers' stay idle
+    std::vector<std::thread> encoders;
+    std::deque<Chunk*> pendingChunks;
+    std::mutex pendingMtx;
+    std::condition_variable pendingCheck;
+    std::atomic<unsigned> activeWorkers;
+    std::atomic<size_t> bufferedSize;
+    bool stopWorkers;
+
+    PixType inPixFmt;
+    int inWidth;
+    int inHeight;
+    bool needsConfig;
+
+    unsigned bitrate;
+    unsigned chunkFrames;
+    unsigned workers;
+    unsigned threads;
+    unsigned fps;
+    std::string preset;
+    size_t maxBufferSize;
+
+    unsigned encodedChunks;
+    unsigned encodedFrames;
+};
+
+#endif
@@ -0,0 +1,679 @@
+/*
+ *  VideoEncoderLadder - Multi-rendition X264 video encoder
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "VideoEncoderLadder.hh"
+#include "../../SlicedVideoFrameQueue.hh"
+
+#include <algorithm>
+#include <future>
+
+//NOTE: x264 buffers as many frames as its lookahead and threads, older time params are stale
+#define MAX_PENDING_TIME_PARAMS 256
+
+VideoEncoderLadder::VideoEncoderLadder() :
+OneToManyFilter(MAX_LADDER_RENDITIONS), libavInPixFmt(AV_PIX_FMT_NONE), inPixFmt(P_NONE),
+inWidth(0), inHeight(0), pts(0), intra(false), needsConfig(false), fps(0), gop(0),
+lookahead(0), threads(0)
+{
+    fType = VIDEO_ENCODER_LADDER;
+    inPicture = av_frame_alloc();
+    initializeEventMap();
+    configure0(std::vector<LadderRung>(), 0, DEFAULT_GOP, DEFAULT_LOOKAHEAD,
+               DEFAULT_LADDER_THREADS, DEFAULT_PRESET);
+}
+
+VideoEncoderLadder::~VideoEncoderLadder()
+{
+    renditionWorkers.stop();
+
+    for (auto it : renditions){
+        freeRendition(it.second);
+    }
+
+    renditions.clear();
+    cascade.clear();
+
+    if (inPicture){
+        av_frame_free(&inPicture);
+    }
+}
+
+FrameQueue* VideoEncoderLadder::allocQueue(ConnectionData cData)
+{
+    if (renditions.count(cData.writerId) <= 0){
+        return NULL;
+    }
+
+    return SlicedVideoFrameQueue::createNew(cData, renditions[cData.writerId]->streamInfo,
+                                            DEFAULT_VIDEO_FRAMES, MAX_H264_OR_5_NAL_SIZE);
+}
+
+bool VideoEncoderLadder::doProcessFrame(Frame *org, std::map<int, Frame *> &dstFrames)
+{
+    InterleavedVideoFrame *rawFrame;
+    FrameTimeParams frameTP;
+    std::vector<std::promise<bool>> scaled;
+    std::vector<std::future<bool>> scaledFutures;
+    std::vector<Frame*> dsts;
+    std::vector<int> results;
+    unsigned char *planes[MAX_PLANES];
+    int strides[MAX_PLANES];
+    bool processed = false;
+
+    rawFrame = dynamic_cast<InterleavedVideoFrame*>(org);
+
+    if (!rawFrame){
+        utils::errorMsg("[VideoEncoderLadder] Origin frame MUST be an InterleavedVideoFrame");
+        return false;
+    }
+
+    for (auto it : dstFrames){
+        it.second->setConsumed(false);
+    }
+
+    if (!reconfigure(rawFrame)){
+        utils::errorMsg("[VideoEncoderLadder] Reconfiguration failed");
+        return false;
+    }
+
+    if (cascade.empty()){
+        return false;
+    }
+
+    //NOTE: views (i.e. splitter crops or aligned decoder buffers) are scaled through their strides
+    if (rawFrame->getPlanes(planes, strides) == 0){
+        utils::errorMsg("[VideoEncoderLadder] Could not get input picture planes");
+        return false;
+    }
+
+    for (int i = 0; i < MAX_PLANES; i++){
+        inPicture->data[i] = planes[i];
+        inPicture->linesize[i] = strides[i];
+    }
+
+    frameTP.pTime = org->getPresentationTime();
+    frameTP.oTime = org->getOriginTime();
+    frameTP.seqNum = org->getSequenceNumber();
+
+    scaled.resize(cascade.size());
+    results.resize(cascade.size(), 0);
+
+    for (unsigned i = 0; i < cascade.size(); i++){
+        auto dst = dstFrames.find(cascade[i]->config.id);
+        dsts.push_back(dst != dstFrames.end() ? dst->second : NULL);
+        scaledFutures.push_back(scaled[i].get_future());
+        cascade[i]->timeParams[pts] = frameTP;
+    }
+
+    //NOTE: each rendition waits for the picture it is scaled from, then the
+    //encoders of all the renditions run concurrently
+    auto processRendition = [&](unsigned i){
+        Rendition *r = cascade[i];
+        AVFrame *source = i == 0 ? inPicture : cascade[i - 1]->picture;
+        bool ready = i == 0 ? true : scaledFutures[i - 1].get();
+
+        ready = ready && scaleRendition(r, source);
+        scaled[i].set_value(ready);
+
+        if (ready && dsts[i]){
+            results[i] = encodeRendition(r, dsts[i]);
+        }
+    };
+
+    renditionWorkers.run(cascade.size(), processRendition);
+
+    pts++;
+    intra = false;
+
+    for (unsigned i = 0; i < cascade.size(); i++){
+        if (results[i]){
+            dsts[i]->setConsumed(true);
+            processed = true;
+        }
+    }
+
+    return processed;
+}
+
+bool VideoEncoderLadder::scaleRendition(Rendition *r, AVFrame *source)
+{
+    if (!r->scaler){
+        for (int i = 0; i < AV_NUM_DATA_POINTERS; i++){
+            r->picture->data[i] = source->data[i];
+            r->picture->linesize[i] = source->linesize[i];
+        }
+
+        return true;
+    }
+
+    return sws_scale(r->scaler, source->data, source->linesize, 0, source->height,
+                     r->picture->data, r->picture->linesize) > 0;
+}
+
+bool VideoEncoderLadder::encodeRendition(Rendition *r, Frame *dst)
+{
+    int success;
+    int piNal;
+    x264_nal_t* nals;
+    SlicedVideoFrame* slicedFrame;
+
+    slicedFrame = dynamic_cast<SlicedVideoFrame*> (dst);
+
+    if (!slicedFrame || !r->encoder){
+        utils::errorMsg("[VideoEncoderLadder] Could not encode rendition. Target frame or encoder are NULL");
+        return false;
+    }
+
+    for (int i = 0; i < MAX_PLANES; i++){
+        r->picIn.img.plane[i] = r->picture->data[i];
+        r->picIn.img.i_stride[i] = r->picture->linesize[i];
+    }
+
+    r->picIn.i_type = intra ? X264_TYPE_IDR : X264_TYPE_AUTO;
+    r->picIn.i_pts = pts;
+
+    success = x264_encoder_encode(r->encoder, &nals, &piNal, &r->picIn, &r->picOut);
+
+    if (success < 0){
+        utils::errorMsg("[VideoEncoderLadder] Could not encode rendition " + std::to_string(r->config.id));
+        return false;
+    }
+
+    if (success == 0){
+        return false;
+    }
+
+    for (int i = 0; i < piNal; i++){
+        if (!slicedFrame->setSlice(nals[i].p_payload, nals[i].i_payload)){
+            utils::errorMsg("[VideoEncoderLadder] Too many NALs for one slicedFrame");
+            return false;
+        }
+    }
+
+    auto tp = r->timeParams.find(r->picOut.i_pts);
+
+    if (tp != r->timeParams.end()){
+        dst->setPresentationTime(tp->second.pTime);
+        dst->setOriginTime(tp->second.oTime);
+        dst->setSequenceNumber(tp->second.seqNum);
+        r->timeParams.erase(r->timeParams.begin(), ++tp);
+    }
+
+    while (r->timeParams.size() > MAX_PENDING_TIME_PARAMS){
+        r->timeParams.erase(r->timeParams.begin());
+    }
+
+    dynamic_cast<VideoFrame*>(dst)->setSize(r->config.width, r->config.height);
+    r->encodedFrames++;
+
+    return true;
+}
+
+bool VideoEncoderLadder::reconfigure(InterleavedVideoFrame *orgFrame)
+{
+    AVFrame *source;
+
+    if (!needsConfig && orgFrame->getWidth() == inWidth && orgFrame->getHeight() == inHeight &&
+            orgFrame->getPixelFormat() == inPixFmt){
+        return true;
+    }
+
+    switch (orgFrame->getPixelFormat()) {
+        case YUV420P:
+            libavInPixFmt = AV_PIX_FMT_YUV420P;
+            break;
+        case YUV422P:
+            libavInPixFmt = AV_PIX_FMT_YUV422P;
+            break;
+        case YUV444P:
+            libavInPixFmt = AV_PIX_FMT_YUV444P;
+            break;
+        default:
+            utils::errorMsg("[VideoEncoderLadder] Uncompatible input pixel format");
+            return false;
+    }
+
+    if (orgFrame->getPixelFormat() != inPixFmt){
+        for (auto it : renditions){
+            it.second->needsConfig = true;
+        }
+    }
+
+    inPixFmt = orgFrame->getPixelFormat();
+    inWidth = orgFrame->getWidth();
+    inHeight = orgFrame->getHeight();
+    inPicture->width = inWidth;
+    inPicture->height = inHeight;
+    inPicture->format = libavInPixFmt;
+
+    cascade.clear();
+
+    for (auto it : renditions){
+        if (it.second->enabled){
+            cascade.push_back(it.second);
+        } else {
+            closeRendition(it.second);
+        }
+    }
+
+    std::stable_sort(cascade.begin(), cascade.end(), [](const Rendition *a, const Rendition *b){
+        return a->config.width * a->config.height > b->config.width * b->config.height;
+    });
+
+    source = inPicture;
+
+    for (auto r : cascade){
+        if (!configScaler(r, source)){
+            utils::errorMsg("[VideoEncoderLadder] Could not configure the scaler of rendition " +
+                            std::to_string(r->config.id));
+            cascade.clear();
+            return false;
+        }
+
+        if (r->needsConfig && !openEncoder(r)){
+            utils::errorMsg("[VideoEncoderLadder] Could not open the encoder of rendition " +
+                            std::to_string(r->config.id));
+            cascade.clear();
+            return false;
+        }
+
+        source = r->picture;
+    }
+
+    //NOTE: one persistent thread per rendition, started here instead of per frame
+    renditionWorkers.start(cascade.size());
+    needsConfig = false;
+    return true;
+}
+
+bool VideoEncoderLadder::configScaler(Rendition *r, AVFrame *source)
+{
+    if (r->scaler){
+        sws_freeContext(r->scaler);
+        r->scaler = NULL;
+        av_freep(&r->picture->data[0]);
+    }
+
+    r->picture->width = r->config.width;
+    r->picture->height = r->config.height;
+    r->picture->format = libavInPixFmt;
+
+    //NOTE: renditions with the size of its source share its picture
+    if (source->width == r->config.width && source->height == r->config.height){
+        return true;
+    }
+
+    r->scaler = sws_getContext(source->width, source->height, libavInPixFmt,
+                               r->config.width, r->config.height, libavInPixFmt,
+                               SWS_BILINEAR, 0, 0, 0);
+
+    if (!r->scaler){
+        return false;
+    }
+
+    if (av_image_alloc(r->picture->data, r->picture->linesize, r->config.width,
+                       r->config.height, libavInPixFmt, 32) < 0){
+        sws_freeContext(r->scaler);
+        r->scaler = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool VideoEncoderLadder::openEncoder(Rendition *r)
+{
+    int colorspace;
+    int encodeSize;
+    int piNal;
+    x264_nal_t* nals;
+
+    switch (inPixFmt) {
+        case YUV422P:
+            colorspace = X264_CSP_I422;
+            break;
+        case YUV444P:
+            colorspace = X264_CSP_I444;
+            break;
+        default:
+            colorspace = X264_CSP_I420;
+            break;
+    }
+
+    if (r->encoder){
+        x264_encoder_close(r->encoder);
+        r->encoder = NULL;
+    }
+
+    x264_picture_init(&r->picIn);
+    x264_picture_init(&r->picOut);
+    r->picIn.img.i_csp = colorspace;
+    r->picIn.img.i_plane = 3;
+
+    x264_param_default_preset(&r->xparams, preset.c_str(), NULL);
+    x264_param_apply_profile(&r->xparams, "high");
+
+    //NOTE: same GOP and no scenecut keep the IDR frames of all the renditions aligned
+    x264_param_parse(&r->xparams, "keyint", std::to_string(gop).c_str());
+    x264_param_parse(&r->xparams, "min-keyint", std::to_string(gop).c_str());
+    x264_param_parse(&r->xparams, "fps", std::to_string(fps > 0 ? fps : VIDEO_DEFAULT_FRAMERATE).c_str());
+    x264_param_parse(&r->xparams, "intra-refresh", std::to_string(0).c_str());
+    x264_param_parse(&r->xparams, "threads", std::to_string(threads).c_str());
+    x264_param_parse(&r->xparams, "aud", std::to_string(1).c_str());
+    x264_param_parse(&r->xparams, "bitrate", std::to_string(r->config.bitrate).c_str());
+    x264_param_parse(&r->xparams, "bframes", std::to_string(0).c_str());
+    x264_param_parse(&r->xparams, "repeat-headers", std::to_string(1).c_str());
+    x264_param_parse(&r->xparams, "annexb", std::to_string(1).c_str());
+    x264_param_parse(&r->xparams, "vbv-maxrate", std::to_string(r->config.bitrate*1.05).c_str());
+    x264_param_parse(&r->xparams, "vbv-bufsize", std::to_string(r->config.bitrate*2).c_str());
+    x264_param_parse(&r->xparams, "rc-lookahead", std::to_string(lookahead).c_str());
+    x264_param_parse(&r->xparams, "scenecut", std::to_string(0).c_str());
+
+    r->xparams.i_width = r->config.width;
+    r->xparams.i_height = r->config.height;
+    r->xparams.i_csp = colorspace;
+
+    r->encoder = x264_encoder_open(&r->xparams);
+
+    if (!r->encoder){
+        return false;
+    }
+
+    encodeSize = x264_encoder_headers(r->encoder, &nals, &piNal);
+
+    if (encodeSize < 0){
+        utils::errorMsg("[VideoEncoderLadder] Could not encode headers");
+        return false;
+    }
+
+    r->streamInfo->setExtraData(nals[0].p_payload, encodeSize);
+    r->timeParams.clear();
+    r->needsConfig = false;
+
+    return true;
+}
+
+void VideoEncoderLadder::closeRendition(Rendition *r)
+{
+    if (r->encoder){
+        x264_encoder_close(r->encoder);
+        r->encoder = NULL;
+    }
+
+    if (r->scaler){
+        sws_freeContext(r->scaler);
+        r->scaler = NULL;
+        av_freep(&r->picture->data[0]);
+    }
+
+    r->timeParams.clear();
+    r->needsConfig = true;
+}
+
+void VideoEncoderLadder::freeRendition(Rendition *r)
+{
+    closeRendition(r);
+    av_frame_free(&r->picture);
+    delete r->streamInfo;
+    delete r;
+}
+
+bool VideoEncoderLadder::specificWriterConfig(int writerID)
+{
+    Rendition *r;
+
+    //NOTE: renditions may be configured before connecting their writers
+    if (renditions.count(writerID) > 0){
+        return true;
+    }
+
+    if (renditions.size() >= MAX_LADDER_RENDITIONS){
+        utils::errorMsg("[VideoEncoderLadder] Too many renditions");
+        return false;
+    }
+
+    r = new Rendition();
+    r->config.id = writerID;
+    r->config.width = 0;
+    r->config.height = 0;
+    r->config.bitrate = 0;
+    r->enabled = false;
+    r->needsConfig = true;
+    r->streamInfo = new StreamInfo(VIDEO);
+    r->streamInfo->video.codec = H264;
+    r->streamInfo->video.h264or5.annexb = true;
+    r->encoder = NULL;
+    r->scaler = NULL;
+    r->picture = av_frame_alloc();
+    r->encodedFrames = 0;
+
+    renditions[writerID] = r;
+    return true;
+}
+
+bool VideoEncoderLadder::specificWriterDelete(int writerID)
+{
+    if (renditions.count(writerID) <= 0){
+        utils::errorMsg("[VideoEncoderLadder] Unknown rendition " + std::to_string(writerID));
+        return false;
+    }
+
+    freeRendition(renditions[writerID]);
+    renditions.erase(writerID);
+    needsConfig = true;
+
+    return true;
+}
+
+bool VideoEncoderLadder::configure0(std::vector<LadderRung> rungs, unsigned fps_, unsigned gop_,
+                                    unsigned lookahead_, unsigned threads_, std::string preset_)
+{
+    std::vector<int> ids;
+
+    if (gop_ <= 0 || threads_ <= 0 || preset_.empty() || rungs.size() > MAX_LADDER_RENDITIONS) {
+        utils::errorMsg("[VideoEncoderLadder] Error configuring: invalid configuration values");
+        return false;
+    }
+
+    for (auto rung : rungs){
+        if (rung.width <= 0 || rung.height <= 0 || rung.width % 2 != 0 || rung.height % 2 != 0 ||
+                rung.bitrate <= 0 || std::count(ids.begin(), ids.end(), rung.id) > 0){
+            utils::errorMsg("[VideoEncoderLadder] Error configuring: invalid rendition " +
+                            std::to_string(rung.id));
+            return false;
+        }
+
+        ids.push_back(rung.id);
+    }
+
+    for (auto it : renditions){
+        it.second->enabled = false;
+    }
+
+    for (auto rung : rungs){
+        if (!specificWriterConfig(rung.id)){
+            return false;
+        }
+
+        renditions[rung.id]->config = rung;
+        renditions[rung.id]->enabled = true;
+    }
+
+    gop = gop_;
+    lookahead = lookahead_;
+    threads = threads_;
+    preset = preset_;
+    fps = fps_;
+
+    if (fps > 0) {
+        setFrameTime(std::chrono::microseconds(std::micro::den/fps));
+    } else {
+        setFrameTime(std::chrono::microseconds(0));
+    }
+
+    for (auto it : renditions){
+        it.second->needsConfig = true;
+    }
+
+    needsConfig = true;
+    return true;
+}
+
+bool VideoEncoderLadder::configEvent(Jzon::Node* params)
+{
+    std::vector<LadderRung> rungs;
+    int tmpFps = fps;
+    int tmpGop = gop;
+    int tmpLookahead = lookahead;
+    int tmpThreads = threads;
+    std::string tmpPreset = preset;
+
+    if (!params) {
+        return false;
+    }
+
+    if (params->Has("renditions") && params->Get("renditions").IsArray()) {
+        Jzon::Array jsonRenditions = params->Get("renditions").AsArray();
+
+        for (Jzon::Array::iterator it = jsonRenditions.begin(); it != jsonRenditions.end(); ++it) {
+            LadderRung rung;
+
+            if (!(*it).Has("id") || !(*it).Has("width") || !(*it).Has("height") || !(*it).Has("bitrate")) {
+                utils::errorMsg("[VideoEncoderLadder] Renditions need id, width, height and bitrate");
+                return false;
+            }
+
+            rung.id = (*it).Get("id").ToInt();
+            rung.width = (*it).Get("width").ToInt();
+            rung.height = (*it).Get("height").ToInt();
+            rung.bitrate = (*it).Get("bitrate").ToInt();
+            rungs.push_back(rung);
+        }
+    } else {
+        for (auto it : renditions){
+            if (it.second->enabled){
+                rungs.push_back(it.second->config);
+            }
+        }
+    }
+
+    if (params->Has("fps")) {
+        tmpFps = params->Get("fps").ToInt();
+    }
+
+    if (params->Has("gop")) {
+        tmpGop = params->Get("gop").ToInt();
+    }
+
+    if (params->Has("lookahead")) {
+        tmpLookahead = params->Get("lookahead").ToInt();
+    }
+
+    if (params->Has("threads")) {
+        tmpThreads = params->Get("threads").ToInt();
+    }
+
+    if (params->Has("preset")) {
+        tmpPreset = params->Get("preset").ToString();
+    }
+
+    if (tmpFps < 0 || tmpGop <= 0 || tmpLookahead < 0 || tmpThreads <= 0) {
+        utils::errorMsg("[VideoEncoderLadder] Error configuring: invalid configuration values");
+        return false;
+    }
+
+    return configure0(rungs, tmpFps, tmpGop, tmpLookahead, tmpThreads, tmpPreset);
+}
+
+bool VideoEncoderLadder::forceIntraEvent(Jzon::Node*)
+{
+    intra = true;
+    return true;
+}
+
+void VideoEncoderLadder::initializeEventMap()
+{
+    eventMap["configure"] = std::bind(&VideoEncoderLadder::configEvent, this, std::placeholders::_1);
+    eventMap["forceIntra"] = std::bind(&VideoEncoderLadder::forceIntraEvent, this, std::placeholders::_1);
+}
+
+void VideoEncoderLadder::doGetState(Jzon::Object &filterNode)
+{
+    Jzon::Array jsonRenditions;
+
+    for (auto it : renditions){
+        Jzon::Object rendition;
+        rendition.Add("id", it.first);
+        rendition.Add("width", it.second->config.width);
+        rendition.Add("height", it.second->config.height);
+        rendition.Add("bitrate", it.second->config.bitrate);
+        rendition.Add("enabled", it.second->enabled);
+        rendition.Add("encodedFrames", (int) it.second->encodedFrames);
+        jsonRenditions.Add(rendition);
+    }
+
+    filterNode.Add("fps", (int) fps);
+    filterNode.Add("gop", (int) gop);
+    filterNode.Add("lookahead", (int) lookahead);
+    filterNode.Add("threads", (int) threads);
+    filterNode.Add("preset", preset);
+    filterNode.Add("renditions", jsonRenditions);
+}
+
+bool VideoEncoderLadder::configure(std::vector<LadderRung> rungs, int fps, int gop, int lookahead,
+                                   int threads, std::string preset)
+{
+    Jzon::Object root, params;
+    Jzon::Array jsonRenditions;
+
+    for (auto rung : rungs){
+        Jzon::Object rendition;
+        rendition.Add("id", rung.id);
+        rendition.Add("width", rung.width);
+        rendition.Add("height", rung.height);
+        rendition.Add("bitrate", rung.bitrate);
+        jsonRenditions.Add(rendition);
+    }
+
+    root.Add("action", "configure");
+    params.Add("renditions", jsonRenditions);
+    params.Add("fps", fps);
+    params.Add("gop", gop);
+    params.Add("lookahead", lookahead);
+    params.Add("threads", threads);
+    params.Add("preset", preset);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e);
+    return true;
+}
+
+bool VideoEncoderLadder::forceIntra()
+{
+    Jzon::Object root, params;
+    root.Add("action", "forceIntra");
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e);
+    return true;
+}
@@ -0,0 +1,163 @@
+/*
+ *  VideoEncoderLadder - Multi-rendition X264 video encoder
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _VIDEO_ENCODER_LADDER_HH
+#define _VIDEO_ENCODER_LADDER_HH
+
+#include <stdint.h>
+#include <chrono>
+#include <map>
+#include <vector>
+#include "../../Utils.hh"
+#include "../../VideoFrame.hh"
+#include "../../Filter.hh"
+#include "../../FrameQueue.hh"
+#include "../../Types.hh"
+#include "../../StreamInfo.hh"
+#include "../../ParallelWorkers.hh"
+#include "VideoEncoderX264or5.hh"
+
+extern "C" {
+    #include <x264.h>
+    #include <libswscale/swscale.h>
+    #include <libavutil/imgutils.h>
+}
+
+#define MAX_LADDER_RENDITIONS 8
+#define DEFAULT_LADDER_THREADS 2
+
+/*! Rendition of the ladder. Its id is the id of the writer which outputs it */
+struct LadderRung {
+    int id;
+    int width;
+    int height;
+    int bitrate;
+};
+
+/*! H264 encoder producing a bitrate/resolution ladder from a single input.
+    Renditions are sorted by size and each one is downscaled from the previous
+    (bigger) one, so 1080p->720p->480p scales a 720p picture for the 480p
+    rendition. Renditions run concurrently: a rendition starts scaling as soon
+    as the one it is scaled from has its picture ready and all encoders work
+    in parallel, each rendition on its own persistent thread. Each rendition
+    is output through the writer with its id. */
+
+class VideoEncoderLadder : public OneToManyFilter {
+
+public:
+    /**
+    * Class constructor
+    */
+    VideoEncoderLadder();
+
+    /**
+    * Class destructor
+    */
+    ~VideoEncoderLadder();
+
+    /**
+    * Configures the whole ladder. Listed renditions are created or reconfigured,
+    * the others are disabled.
+    * @param rungs renditions of the ladder, ids are the writer ids
+    * @param fps output frame rate, 0 uses the input timing
+    * @param gop GOP size, shared by all the renditions so they switch at the same frames
+    * @param lookahead rate control lookahead of each rendition
+    * @param threads encoding threads of each rendition
+    * @param preset x264 preset
+    */
+    bool configure(std::vector<LadderRung> rungs, int fps = 0, int gop = DEFAULT_GOP,
+                   int lookahead = DEFAULT_LOOKAHEAD, int threads = DEFAULT_LADDER_THREADS,
+                   std::string preset = DEFAULT_PRESET);
+
+    /**
+    * Forces an intra frame in all the renditions
+    */
+    bool forceIntra();
+
+protected:
+    struct FrameTimeParams {
+        std::chrono::microseconds pTime;
+        std::chrono::system_clock::time_point oTime;
+        size_t seqNum;
+    };
+
+    struct Rendition {
+        LadderRung config;
+        bool enabled;
+        bool needsConfig;
+        StreamInfo *streamInfo;
+        x264_t *encoder;
+        x264_param_t xparams;
+        x264_picture_t picIn;
+        x264_picture_t picOut;
+        struct SwsContext *scaler;
+        //NOTE: picture owns its planes only when the rendition is scaled
+        AVFrame *picture;
+        std::map<int64_t, FrameTimeParams> timeParams;
+        unsigned encodedFrames;
+    };
+
+    FrameQueue *allocQueue(ConnectionData cData);
+    bool doProcessFrame(Frame *org, std::map<int, Frame *> &dstFrames);
+    void initializeEventMap();
+    void doGetState(Jzon::Object &filterNode);
+    bool configEvent(Jzon::Node* params);
+    bool forceIntraEvent(Jzon::Node* params);
+    bool configure0(std::vector<LadderRung> rungs, unsigned fps_, unsigned gop_,
+                    unsigned lookahead_, unsigned threads_, std::string preset_);
+
+    bool reconfigure(InterleavedVideoFrame *orgFrame);
+    bool configScaler(Rendition *r, AVFrame *source);
+    bool openEncoder(Rendition *r);
+    bool scaleRendition(Rendition *r, AVFrame *source);
+    bool encodeRendition(Rendition *r, Frame *dst);
+    void freeRendition(Rendition *r);
+    void closeRendition(Rendition *r);
+
+    bool specificWriterConfig(int writerID);
+    bool specificWriterDelete(int writerID);
+
+    //There is no need of specific reader configuration
+    bool specificReaderConfig(int /*readerID*/, FrameQueue* /*queue*/)  {return true;};
+    bool specificReaderDelete(int /*readerID*/) {return true;};
+
+    std::map<int, Rendition*> renditions;
+    //NOTE: enabled renditions sorted by decreasing size, each one is scaled from the previous
+    std::vector<Rendition*> cascade;
+    ParallelWorkers renditionWorkers;
+
+    AVFrame *inPicture;
+    AVPixelFormat libavInPixFmt;
+    PixType inPixFmt;
+    int inWidth;
+    int inHeight;
+    int64_t pts;
+    bool intra;
+    bool needsConfig;
+
+    unsigned fps;
+    unsigned gop;
+    unsigned lookahead;
+    unsigned threads;
+    std::string preset;
+};
+
+#endif
@@ -28,16 +28,24 @@
 #define MAX_PLANES_PER_PICTURE 4
 
 VideoEncoderX264::VideoEncoderX264() :
-VideoEncoderX264or5(), encoder(NULL)
+VideoEncoderX264or5(), encoder(NULL), nextEncoder(NULL), nextEncoderReady(false), drainingEncoder(NULL), 
+lowLatency(false), slices(0), slicedOutput(NULL), nextMb(0)
 {
-    pts = 0;
     outputStreamInfo->video.codec = H264;
     x264_picture_init(&picIn);
     x264_picture_init(&picOut);
+    initializeEventMap();
 }
 
 VideoEncoderX264::~VideoEncoderX264()
 {
+    discardNextEncoder();
+
+    if (drainingEncoder != NULL){
+        x264_encoder_close(drainingEncoder);
+        drainingEncoder = NULL;
+    }
+
     if (encoder != NULL){
         x264_encoder_close(encoder);
         encoder = NULL;
@@ -68,22 +76,60 @@ bool VideoEncoderX264::encodeFrame(VideoFrame* codedFrame)
         return false;
     }
 
-    if (forceIntra) {
+    switchEncoder();
+
+    picIn.i_type = X264_TYPE_AUTO;
+
+    if (forceIntra && intraRefresh) {
+        x264_encoder_intra_refresh(encoder);
+    } else if (forceIntra) {
         picIn.i_type = X264_TYPE_I;
-        forceIntra = false;
-    } else {
-        picIn.i_type = X264_TYPE_AUTO;
     }
 
+    forceIntra = false;
+
+    picIn.i_qpplus1 = skipFrame ? SKIP_FRAME_QP + 1 : X264_QP_AUTO;
     picIn.i_pts = pts;
+    picIn.opaque = this;
+    slicedOutput = slicedFrame;
+    
     success = x264_encoder_encode(encoder, &nals, &piNal, &picIn, &picOut);
 
-    pts++;
+    if (lowLatency) {
+        //NOTE: NALs have already been output by naluProcess
+        flushPendingSlices();
+        slicedOutput = NULL;
+        return success > 0 && setOutputTimes(slicedFrame, picOut.i_pts, picOut.i_dts);
+    }
+
+    if (success < 0) {
+        utils::errorMsg("X264 Encoder: Could not encode video frame");
+        return false;
+    }
+
+    //NOTE: frames of the new encoder wait until the previous one is drained, the 
+    //new encoder lookahead covers most of this delay
+    if (drainingEncoder || hasQueuedOutputs()) {
+        if (success > 0) {
+            EncodedOutput output;
+
+            for (int i = 0; i < piNal; i++) {
+                output.nals.push_back(std::vector<unsigned char>(nals[i].p_payload, nals[i].p_payload + nals[i].i_payload));
+            }
+
+            output.pts = picOut.i_pts;
+            output.dts = picOut.i_dts;
+            queueOutput(output);
+        }
+
+        return drainEncoder(slicedFrame);
+    }
 
     if (success == 0) {
         return false;
-    } else if (success < 0) {
-        utils::errorMsg("X264 Encoder: Could not encode video frame");
+    }
+
+    if (!setOutputTimes(slicedFrame, picOut.i_pts, picOut.i_dts)) {
         return false;
     }
 
@@ -98,7 +144,172 @@ bool VideoEncoderX264::encodeFrame(VideoFrame* codedFrame)
     return true;
 }
 
-bool VideoEncoderX264::encodeHeadersFrame()
+bool VideoEncoderX264::drainEncoder(SlicedVideoFrame* slicedFrame)
+{
+    int success;
+    int piNal;
+    x264_nal_t* nals;
+    x264_picture_t drainOut;
+
+    //NOTE: NALs of the last drained frame are valid until the next call, so it is closed here
+    if (drainingEncoder && x264_encoder_delayed_frames(drainingEncoder) <= 0) {
+        x264_encoder_close(drainingEncoder);
+        drainingEncoder = NULL;
+    }
+
+    if (!drainingEncoder) {
+        return outputQueued(slicedFrame);
+    }
+
+    x264_picture_init(&drainOut);
+    success = x264_encoder_encode(drainingEncoder, &nals, &piNal, NULL, &drainOut);
+
+    if (success <= 0) {
+        return outputQueued(slicedFrame);
+    }
+
+    if (!setOutputTimes(slicedFrame, drainOut.i_pts, drainOut.i_dts)) {
+        return false;
+    }
+
+    for (int i = 0; i < piNal; i++) {
+        if (!slicedFrame->setSlice(nals[i].p_payload, nals[i].i_payload)) {
+            utils::errorMsg("X264 Encoder: too many NALs for one slicedFrame");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void VideoEncoderX264::startNextEncoder(x264_param_t &params)
+{
+    discardNextEncoder();
+
+    nextParams = params;
+    nextEncoderThread = std::thread([this](){
+        nextEncoder = x264_encoder_open(&nextParams);
+        nextEncoderReady = true;
+    });
+}
+
+void VideoEncoderX264::discardNextEncoder()
+{
+    if (nextEncoderThread.joinable()) {
+        nextEncoderThread.join();
+    }
+
+    if (nextEncoder) {
+        x264_encoder_close(nextEncoder);
+        nextEncoder = NULL;
+    }
+
+    nextEncoderReady = false;
+}
+
+void VideoEncoderX264::switchEncoder()
+{
+    if (!nextEncoderReady || !atGopBoundary()) {
+        return;
+    }
+
+    nextEncoderThread.join();
+    nextEncoderReady = false;
+
+    if (!nextEncoder) {
+        utils::errorMsg("Could not open the reconfigured x264 encoder, keeping the current one");
+        return;
+    }
+
+    if (drainingEncoder) {
+        x264_encoder_close(drainingEncoder);
+    }
+
+    //NOTE: the previous encoder is fed no more frames, its delayed ones are output
+    //while the new encoder fills its own lookahead
+    drainingEncoder = encoder;
+    encoder = nextEncoder;
+    nextEncoder = NULL;
+    xparams = nextParams;
+    encoderSwitches++;
+
+    if (x264_encoder_delayed_frames(drainingEncoder) <= 0) {
+        x264_encoder_close(drainingEncoder);
+        drainingEncoder = NULL;
+    }
+
+    encodeHeadersFrame(drainingEncoder != NULL || hasQueuedOutputs());
+}
+
+bool VideoEncoderX264::hasPendingOutput()
+{
+    //NOTE: once the previous encoder is empty the frames queued meanwhile are output at once
+    return hasQueuedOutputs() && (!drainingEncoder || x264_encoder_delayed_frames(drainingEncoder) <= 0);
+}
+
+void VideoEncoderX264::naluProcess(x264_t *h, x264_nal_t *nal, void *opaque)
+{
+    VideoEncoderX264 *x264Encoder = static_cast<VideoEncoderX264*>(opaque);
+
+    if (x264Encoder) {
+        x264Encoder->outputNal(h, nal);
+    }
+}
+
+void VideoEncoderX264::outputNal(x264_t *h, x264_nal_t *nal)
+{
+    std::lock_guard<std::mutex> guard(slicesMtx);
+
+    //NOTE: x264 requires this buffer size to escape and prefix the NAL
+    nalBuffer.resize(nal->i_payload * 3 / 2 + 5 + 64);
+    x264_nal_encode(h, nalBuffer.data(), nal);
+
+    if (nal->i_type != NAL_SLICE && nal->i_type != NAL_SLICE_IDR) {
+        outputSlice(nal->p_payload, nal->i_payload);
+        return;
+    }
+
+    if (nal->i_first_mb != nextMb) {
+        pendingSlices[nal->i_first_mb].first = nal->i_last_mb;
+        pendingSlices[nal->i_first_mb].second.assign(nal->p_payload, nal->p_payload + nal->i_payload);
+        return;
+    }
+
+    outputSlice(nal->p_payload, nal->i_payload);
+    nextMb = nal->i_last_mb + 1;
+
+    for (auto it = pendingSlices.find(nextMb); it != pendingSlices.end(); it = pendingSlices.find(nextMb)) {
+        outputSlice(it->second.second.data(), it->second.second.size());
+        nextMb = it->second.first + 1;
+        pendingSlices.erase(it);
+    }
+}
+
+void VideoEncoderX264::outputSlice(unsigned char *data, unsigned size)
+{
+    if (!slicedOutput) {
+        return;
+    }
+
+    if (!slicedOutput->setSlice(data, size) || !slicedOutput->flushSlices()) {
+        utils::errorMsg("X264 Encoder: could not output slice");
+        slicedOutput->clear();
+    }
+}
+
+void VideoEncoderX264::flushPendingSlices()
+{
+    std::lock_guard<std::mutex> guard(slicesMtx);
+
+    for (auto &it : pendingSlices) {
+        outputSlice(it.second.second.data(), it.second.second.size());
+    }
+
+    pendingSlices.clear();
+    nextMb = 0;
+}
+
+bool VideoEncoderX264::encodeHeadersFrame(bool withNextOutput)
 {
     int encodeSize;
     int piNal;
@@ -110,6 +321,11 @@ bool VideoEncoderX264::encodeHeadersFrame()
         utils::errorMsg("Could not encode headers");
         return false;
     }
+
+    if (withNextOutput) {
+        setNextHeaders(nals[0].p_payload, encodeSize);
+        return true;
+    }
        
     outputStreamInfo->setExtraData(nals[0].p_payload, encodeSize);
 
@@ -124,6 +340,8 @@ FrameQueue* VideoEncoderX264::allocQueue(ConnectionData cData)
 bool VideoEncoderX264::reconfigure(VideoFrame* orgFrame, VideoFrame* dstFrame)
 {
     int colorspace;
+    bool rebuild;
+    x264_param_t params;
 
     if (!needsConfig && orgFrame->getWidth() == xparams.i_width &&
         orgFrame->getHeight() == xparams.i_height && orgFrame->getPixelFormat() == inPixFmt) {
@@ -153,52 +371,128 @@ bool VideoEncoderX264::reconfigure(VideoFrame* orgFrame, VideoFrame* dstFrame)
     }
 
     picIn.img.i_csp = colorspace;
-    x264_param_default_preset(&xparams, preset.c_str(), NULL);
-    x264_param_apply_profile(&xparams, "high");
-
-    x264_param_parse(&xparams, "keyint", std::to_string(gop).c_str());
-    x264_param_parse(&xparams, "fps", std::to_string(fps).c_str());
-    x264_param_parse(&xparams, "intra-refresh", std::to_string(0).c_str());
-    x264_param_parse(&xparams, "threads", std::to_string(threads).c_str());
-    x264_param_parse(&xparams, "aud", std::to_string(1).c_str());
-    x264_param_parse(&xparams, "bitrate", std::to_string(bitrate).c_str());
-    x264_param_parse(&xparams, "bframes", std::to_string(0).c_str());
-    x264_param_parse(&xparams, "repeat-headers", std::to_string(0).c_str());
-    x264_param_parse(&xparams, "vbv-maxrate", std::to_string(bitrate*1.05).c_str());
-    x264_param_parse(&xparams, "vbv-bufsize", std::to_string(bitrate*2).c_str());
-    x264_param_parse(&xparams, "rc-lookahead", std::to_string(lookahead).c_str());
-    x264_param_parse(&xparams, "scenecut", std::to_string(0).c_str());
+    fillParams(&params, orgFrame->getWidth(), orgFrame->getHeight(), colorspace);
+    needsConfig = false;
+
+    //NOTE: frames of a new size, pixel format or threading model cannot be fed 
+    //to the current encoder, so it is replaced right away
+    if (!encoder || params.i_width != xparams.i_width || params.i_height != xparams.i_height ||
+        params.i_csp != xparams.i_csp || params.b_sliced_threads != xparams.b_sliced_threads) {
+        discardNextEncoder();
+
+        if (encoder != NULL) {
+            x264_encoder_close(encoder);
+        }
+
+        xparams = params;
+        encoder = x264_encoder_open(&xparams);
+
+        if (!encoder) {
+            utils::errorMsg("Error reconfiguring x264 encoder. At this point encoder should not be NULL...");
+            return false;
+        }
+
+        return encodeHeadersFrame();
+    }
+
+    //NOTE: x264_encoder_reconfig cannot change these, a new encoder is opened in 
+    //background and switched in at the next GOP boundary
+    rebuild = params.i_threads != xparams.i_threads || params.rc.i_lookahead != xparams.rc.i_lookahead ||
+        params.i_bframe != xparams.i_bframe || params.b_intra_refresh != xparams.b_intra_refresh ||
+        params.b_annexb != xparams.b_annexb || params.b_repeat_headers != xparams.b_repeat_headers;
+
+    if (!rebuild && x264_encoder_reconfig(encoder, &params) == 0) {
+        discardNextEncoder();
+        xparams = params;
+        return encodeHeadersFrame();
+    }
+
+    startNextEncoder(params);
+    return true;
+}
+
+void VideoEncoderX264::fillParams(x264_param_t *params, int width, int height, int colorspace)
+{
+    x264_param_default_preset(params, preset.c_str(), NULL);
+    x264_param_apply_profile(params, "high");
+
+    params->i_width = width;
+    params->i_height = height;
+    params->i_csp = colorspace;
+
+    x264_param_parse(params, "keyint", std::to_string(gop).c_str());
+    x264_param_parse(params, "fps", std::to_string(fps).c_str());
+    //NOTE: with intra refresh keyint is the refresh period, only the first frame is an IDR
+    x264_param_parse(params, "intra-refresh", std::to_string(intraRefresh).c_str());
+    x264_param_parse(params, "threads", std::to_string(threads).c_str());
+    x264_param_parse(params, "aud", std::to_string(1).c_str());
+    x264_param_parse(params, "bitrate", std::to_string(bitrate).c_str());
+    x264_param_parse(params, "bframes", std::to_string(bframes).c_str());
+    x264_param_parse(params, "repeat-headers", std::to_string(0).c_str());
+    x264_param_parse(params, "vbv-maxrate", std::to_string(bitrate*1.05).c_str());
+    x264_param_parse(params, "vbv-bufsize", std::to_string(bitrate*2).c_str());
+    x264_param_parse(params, "rc-lookahead", std::to_string(lookahead).c_str());
+    x264_param_parse(params, "scenecut", std::to_string(0).c_str());
 
     if (outputStreamInfo->video.h264or5.annexb) {
-        x264_param_parse(&xparams, "repeat-headers", std::to_string(1).c_str());
-        x264_param_parse(&xparams, "annexb", std::to_string(1).c_str());
+        x264_param_parse(params, "repeat-headers", std::to_string(1).c_str());
+        x264_param_parse(params, "annexb", std::to_string(1).c_str());
     }
 
-    if (orgFrame->getWidth() != xparams.i_width || orgFrame->getHeight() != xparams.i_height) {
-        xparams.i_width = orgFrame->getWidth();
-        xparams.i_height = orgFrame->getHeight();
+    if (lowLatency) {
+        x264_param_parse(params, "sliced-threads", std::to_string(1).c_str());
+        x264_param_parse(params, "sync-lookahead", std::to_string(0).c_str());
+        x264_param_parse(params, "bframes", std::to_string(0).c_str());
+        x264_param_parse(params, "rc-lookahead", std::to_string(0).c_str());
+        x264_param_parse(params, "slices", std::to_string(slices > 0 ? slices : threads).c_str());
+        params->nalu_process = &VideoEncoderX264::naluProcess;
+    }
+}
 
-        if (encoder != NULL){
-            x264_encoder_close(encoder);
-            encoder = NULL;
-        }
+bool VideoEncoderX264::configLowLatency(bool enable, int slices)
+{
+    Jzon::Object root, params;
+    root.Add("action", "lowLatency");
+    params.Add("enable", enable);
+    params.Add("slices", slices);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e);
+    return true;
+}
+
+bool VideoEncoderX264::lowLatencyEvent(Jzon::Node* params)
+{
+    int tmpSlices = slices;
+
+    if (!params || !params->Has("enable")) {
+        return false;
     }
 
-    if (!encoder) {
-        encoder = x264_encoder_open(&xparams);
-    } else if (x264_encoder_reconfig(encoder, &xparams) < 0) {
-        utils::errorMsg("Could not reconfigure x264 encoder, closing and opening again");
-        x264_encoder_close(encoder);
-        encoder = x264_encoder_open(&xparams);
+    if (params->Has("slices")) {
+        tmpSlices = params->Get("slices").ToInt();
     }
 
-    if (!encoder) {
-        utils::errorMsg("Error reconfiguring x264 encoder. At this point encoder should not be NULL...");
+    if (tmpSlices < 0 || tmpSlices > MAX_SLICES) {
+        utils::errorMsg("X264 Encoder: invalid number of slices");
         return false;
     }
 
-    needsConfig = false;
-   
-    return encodeHeadersFrame();
+    lowLatency = params->Get("enable").ToBool();
+    slices = tmpSlices;
+    needsConfig = true;
+    return true;
+}
 
+void VideoEncoderX264::initializeEventMap()
+{
+    eventMap["lowLatency"] = std::bind(&VideoEncoderX264::lowLatencyEvent, this, std::placeholders::_1);
+}
+
+void VideoEncoderX264::doGetState(Jzon::Object &filterNode)
+{
+    VideoEncoderX264or5::doGetState(filterNode);
+    filterNode.Add("lowLatency", lowLatency);
+    filterNode.Add("slices", (int) slices);
 }
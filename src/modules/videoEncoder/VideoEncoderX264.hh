@@ -33,31 +33,85 @@
 #include "../../FrameQueue.hh"
 #include "../../Types.hh"
 
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 extern "C" {
 #include <x264.h>
 }
 
+/*! X264 video encoder. In low latency mode the picture is split in slices encoded 
+    by different threads (x264 sliced threads) and each slice is pushed to the output 
+    queue as soon as it is encoded, so transmitters can packetize the first slices 
+    while the rest of the picture is being encoded. 
+    Parameters that x264_encoder_reconfig cannot change (threads, lookahead, bframes...) 
+    are applied by opening a new encoder in background, which replaces the current 
+    one at the next GOP boundary. The replaced encoder is drained meanwhile, and the frames 
+    of the new one are queued until it is empty. */
+
 class VideoEncoderX264 : public VideoEncoderX264or5 {
 
 public:
     VideoEncoderX264();
     ~VideoEncoderX264();
 
+    /**
+    * Enables or disables low latency sliced output. Lookahead is disabled while enabled.
+    * @param enable low latency mode
+    * @param slices number of slices per picture, 0 uses one slice per thread
+    */
+    bool configLowLatency(bool enable, int slices = 0);
+
+protected:
+    bool hasPendingOutput();
+
 private:
     FrameQueue* allocQueue(ConnectionData cData);
     void initializeEventMap();
+    void doGetState(Jzon::Object &filterNode);
+    bool lowLatencyEvent(Jzon::Node* params);
+
+    static void naluProcess(x264_t *h, x264_nal_t *nal, void *opaque);
+    void outputNal(x264_t *h, x264_nal_t *nal);
+    void outputSlice(unsigned char *data, unsigned size);
+    void flushPendingSlices();
+
+    void fillParams(x264_param_t *params, int width, int height, int colorspace);
+    void startNextEncoder(x264_param_t &params);
+    void discardNextEncoder();
+    void switchEncoder();
+    bool drainEncoder(SlicedVideoFrame* slicedFrame);
 
     x264_picture_t picIn;
     x264_picture_t picOut;
     x264_param_t xparams;
     x264_t* encoder;
 
-    int64_t pts;
+    //NOTE: encoder opened in background with the new parameters
+    x264_t* nextEncoder;
+    x264_param_t nextParams;
+    std::thread nextEncoderThread;
+    std::atomic<bool> nextEncoderReady;
+    //NOTE: replaced encoder whose delayed frames are still being output
+    x264_t* drainingEncoder;
+
+    bool lowLatency;
+    unsigned slices;
+    
+    //NOTE: sliced threads may finish slices out of order, they are output by macroblock order
+    std::mutex slicesMtx;
+    SlicedVideoFrame *slicedOutput;
+    int nextMb;
+    std::vector<unsigned char> nalBuffer;
+    std::map<int, std::pair<int, std::vector<unsigned char>>> pendingSlices;
 
     bool fillPicturePlanes(unsigned char** data, int* linesize);
     bool encodeFrame(VideoFrame* codedFrame);
     bool reconfigure(VideoFrame *orgFrame, VideoFrame* dstFrame);
-    bool encodeHeadersFrame();
+    bool encodeHeadersFrame(bool withNextOutput = false);
 };
 
 #endif
@@ -22,9 +22,15 @@
  */
 
 #include "VideoEncoderX264or5.hh"
+#include "BlockHash.hh"
+
+#include <algorithm>
 
 VideoEncoderX264or5::VideoEncoderX264or5() :
-OneToOneFilter(), inPixFmt(P_NONE), forceIntra(false), fps(0), bitrate(0), gop(0), threads(0), needsConfig(false)
+OneToOneFilter(), inPixFmt(P_NONE), forceIntra(false), intraRefresh(false), skipFrame(false), fps(0), bitrate(0), gop(0), threads(0), bframes(0), needsConfig(false), pts(0), encoderSwitches(0),
+duplicateMode(ENCODE_DUPLICATES), inputFrames(0), duplicateFrames(0), droppedFrames(0),
+consecutiveDrops(0), gopPosition(0), lastDecodeTime(std::chrono::microseconds(0)), outWidth(0), outHeight(0), rateControl(false), minBitrate(0), maxBitrate(0),
+lastLostBlocs(0), rateDecreases(0), rateIncreases(0)
 {
     fType = VIDEO_ENCODER;
     midFrame = av_frame_alloc();
@@ -45,12 +51,26 @@ VideoEncoderX264or5::~VideoEncoderX264or5()
 bool VideoEncoderX264or5::doProcessFrame(Frame *org, Frame *dst)
 {
     FrameTimeParams frameTP;
+    bool encoded;
     
-    if (!(org && dst)) {
-        utils::errorMsg("Error encoding video frame: org or dst are NULL");
+    if (!dst) {
+        utils::errorMsg("Error encoding video frame: dst is NULL");
         return false;
     }
 
+    //NOTE: runs without input frame write the outputs queued while switching encoders
+    if (!org) {
+        SlicedVideoFrame* slicedFrame = dynamic_cast<SlicedVideoFrame*> (dst);
+
+        if (!slicedFrame || !outputQueued(slicedFrame)) {
+            return false;
+        }
+
+        slicedFrame->setSize(outWidth, outHeight);
+        dst->setConsumed(true);
+        return true;
+    }
+
     VideoFrame* rawFrame = dynamic_cast<VideoFrame*> (org);
     VideoFrame* codedFrame = dynamic_cast<VideoFrame*> (dst);
 
@@ -64,41 +84,190 @@ bool VideoEncoderX264or5::doProcessFrame(Frame *org, Frame *dst)
         return false;
     }
 
+    inputFrames++;
+    skipFrame = false;
+    outWidth = rawFrame->getWidth();
+    outHeight = rawFrame->getHeight();
+
+    if (duplicateMode != ENCODE_DUPLICATES && isDuplicate(rawFrame)) {
+        duplicateFrames++;
+        //NOTE: forced intra and GOP start frames are never skipped, they must be decodable on their own
+        skipFrame = duplicateMode == SKIP_DUPLICATES && !forceIntra && (gop == 0 || !atGopBoundary());
+
+        //NOTE: one frame per GOP keeps receivers and segmenters going
+        if (duplicateMode == DROP_DUPLICATES && !forceIntra && consecutiveDrops + 1 < gop) {
+            consecutiveDrops++;
+            droppedFrames++;
+            return false;
+        }
+    }
+
+    consecutiveDrops = 0;
+
     if (!fill_x264or5_picture(rawFrame)){
         utils::errorMsg("Could not fill x264_picture_t from frame");
         return false;
     }
     
-    /*NOTE: lookahead is multiplied by 2 beacuse the buffered frames might be 
-    * higher than lookahead plus the threads number depending on the configuration. 
-    */
-    if (qFTP.size() == 0 || qFTP.size() <= (lookahead + threads)* 2){
-        frameTP.pTime = org->getPresentationTime();
-        frameTP.oTime = org->getOriginTime();
-        frameTP.seqNum = org->getSequenceNumber();
-        qFTP.push(frameTP);
+    frameTP.pTime = org->getPresentationTime();
+    frameTP.oTime = org->getOriginTime();
+    frameTP.seqNum = org->getSequenceNumber();
+    timeParams[pts] = frameTP;
+
+    //NOTE: frames dropped when reopening the encoder are never output
+    if (timeParams.size() > MAX_ENCODING_DELAY) {
+        timeParams.erase(timeParams.begin());
     }
+
+    //NOTE: low latency encoders may output slices before encodeFrame returns, 
+    //they have no delay so output timing is the input one
+    codedFrame->setSize(rawFrame->getWidth(), rawFrame->getHeight());
+    dst->setPresentationTime(frameTP.pTime);
+    dst->setDecodeTime(frameTP.pTime);
+    dst->setOriginTime(frameTP.oTime);
+    dst->setSequenceNumber(frameTP.seqNum);
     
-    if (!encodeFrame(codedFrame)) {
+    if (forceIntra) {
+        gopPosition = 0;
+    }
+
+    encoded = encodeFrame(codedFrame);
+    pts++;
+    gopPosition = gop > 0 ? (gopPosition + 1) % gop : 0;
+
+    if (!encoded) {
         utils::warningMsg("Could not encode video frame");
         return false;
     }
 
-    codedFrame->setSize(rawFrame->getWidth(), rawFrame->getHeight());
-    
     dst->setConsumed(true);
-    dst->setPresentationTime(qFTP.front().pTime);
-    dst->setOriginTime(qFTP.front().oTime);
-    dst->setSequenceNumber(qFTP.front().seqNum);
-    
-    qFTP.pop();
     
     return true;
 }
 
+bool VideoEncoderX264or5::isDuplicate(VideoFrame* frame)
+{
+    InterleavedVideoFrame* interleavedFrame = dynamic_cast<InterleavedVideoFrame*>(frame);
+    unsigned char *planes[MAX_PLANES];
+    int strides[MAX_PLANES];
+    int step[MAX_PLANES];
+    int xShift[MAX_PLANES];
+    int yShift[MAX_PLANES];
+    int planesNum = 0;
+    bool duplicate;
+
+    if (interleavedFrame) {
+        planesNum = interleavedFrame->getPlanes(planes, strides);
+    }
+
+    if (planesNum == 0 || interleavedFrame->getPlanesLayout(step, xShift, yShift) != planesNum) {
+        prevBlockHashes.clear();
+        return false;
+    }
+
+    //NOTE: size and format are hashed too, so pictures of different layouts never match
+    blockHashes.clear();
+    blockHashes.push_back(((uint64_t) frame->getWidth() << 32) | 
+                          ((uint64_t) frame->getHeight() << 8) | frame->getPixelFormat());
+
+    for (int p = 0; p < planesNum; p++) {
+        blockhash::hashPlane(planes[p], strides[p], (-((-frame->getWidth()) >> xShift[p])) * step[p],
+                             -((-frame->getHeight()) >> yShift[p]), blockHashes);
+    }
+
+    duplicate = blockHashes == prevBlockHashes;
+    std::swap(blockHashes, prevBlockHashes);
+
+    return duplicate;
+}
+
+void VideoEncoderX264or5::queueOutput(EncodedOutput &output)
+{
+    output.headers.swap(nextHeaders);
+    nextHeaders.clear();
+    queuedOutputs.push_back(output);
+}
+
+bool VideoEncoderX264or5::outputQueued(SlicedVideoFrame *dst)
+{
+    if (queuedOutputs.empty()) {
+        return false;
+    }
+
+    lastOutput = queuedOutputs.front();
+    queuedOutputs.pop_front();
+
+    if (!lastOutput.headers.empty()) {
+        outputStreamInfo->setExtraData(lastOutput.headers.data(), lastOutput.headers.size());
+    }
+
+    for (auto &nal : lastOutput.nals) {
+        if (!dst->setSlice(nal.data(), nal.size())) {
+            utils::errorMsg("Too many NALs for one slicedFrame");
+            return false;
+        }
+    }
+
+    return setOutputTimes(dst, lastOutput.pts, lastOutput.dts);
+}
+
+bool VideoEncoderX264or5::setOutputTimes(Frame *dst, int64_t outPts, int64_t outDts)
+{
+    std::chrono::microseconds frameDuration(std::micro::den/(fps > 0 ? fps : VIDEO_DEFAULT_FRAMERATE));
+    auto tp = timeParams.find(outPts);
+    auto dtp = timeParams.find(outDts);
+    std::chrono::microseconds decodeTime;
+
+    if (tp == timeParams.end()) {
+        utils::warningMsg("Timing of the encoded frame not found");
+        return false;
+    }
+
+    dst->setPresentationTime(tp->second.pTime);
+    dst->setOriginTime(tp->second.oTime);
+    dst->setSequenceNumber(tp->second.seqNum);
+
+    //NOTE: with B-frames the first frames are decoded before the first input frame time
+    if (dtp != timeParams.end()) {
+        decodeTime = dtp->second.pTime;
+    } else {
+        decodeTime = tp->second.pTime - frameDuration*(outPts - outDts);
+    }
+
+    //NOTE: an encoder switched in with more B-frames starts decoding before the last 
+    //frames of the previous one, its first frames are spaced just after them
+    if (lastDecodeTime.count() > 0 && decodeTime <= lastDecodeTime) {
+        decodeTime = std::min(lastDecodeTime + frameDuration / (bframes + 2), tp->second.pTime);
+    }
+
+    dst->setDecodeTime(decodeTime);
+    lastDecodeTime = decodeTime;
+
+    //NOTE: next output frames have higher decoding times and their 
+    //presentation times are not lower than their decoding times
+    timeParams.erase(timeParams.begin(), timeParams.lower_bound(std::min(outPts, outDts)));
+
+    return true;
+}
+
 bool VideoEncoderX264or5::fill_x264or5_picture(VideoFrame* videoFrame)
 {
-    if (av_image_fill_arrays(midFrame->data, midFrame->linesize, videoFrame->getDataBuf(),
+    InterleavedVideoFrame* interleavedFrame = dynamic_cast<InterleavedVideoFrame*>(videoFrame);
+    unsigned char *planes[MAX_PLANES];
+    int strides[MAX_PLANES];
+
+    //NOTE: views of a bigger picture (i.e. splitter crops) are encoded using its strides
+    if (interleavedFrame && interleavedFrame->isView()){
+        if (interleavedFrame->getPlanes(planes, strides) == 0){
+            utils::errorMsg("Could not feed AVFrame");
+            return false;
+        }
+
+        for (int i = 0; i < AV_NUM_DATA_POINTERS; i++){
+            midFrame->data[i] = i < MAX_PLANES ? planes[i] : NULL;
+            midFrame->linesize[i] = i < MAX_PLANES ? strides[i] : 0;
+        }
+    } else if (av_image_fill_arrays(midFrame->data, midFrame->linesize, videoFrame->getDataBuf(),
             (AVPixelFormat) libavInPixFmt, videoFrame->getWidth(),
             videoFrame->getHeight(), 1) <= 0){
         utils::errorMsg("Could not feed AVFrame");
@@ -113,7 +282,7 @@ bool VideoEncoderX264or5::fill_x264or5_picture(VideoFrame* videoFrame)
     return true;
 }
 
-bool VideoEncoderX264or5::configure0(unsigned bitrate_, unsigned fps_, unsigned gop_, unsigned lookahead_, unsigned threads_, bool annexB_, std::string preset_)
+bool VideoEncoderX264or5::configure0(unsigned bitrate_, unsigned fps_, unsigned gop_, unsigned lookahead_, unsigned threads_, bool annexB_, std::string preset_, unsigned bframes_)
 {
     if (bitrate_ <= 0 || gop_ <= 0 || lookahead_ < 0 || threads_ <= 0 || preset_.empty()) {
         utils::errorMsg("Error configuring VideoEncoderX264or5: invalid configuration values");
@@ -124,6 +293,7 @@ bool VideoEncoderX264or5::configure0(unsigned bitrate_, unsigned fps_, unsigned
     gop = gop_;
     lookahead = lookahead_;
     threads = threads_;
+    bframes = bframes_;
 
     outputStreamInfo->video.h264or5.annexb = annexB_;
     preset = preset_;
@@ -149,6 +319,7 @@ bool VideoEncoderX264or5::configEvent(Jzon::Node* params)
     unsigned tmpThreads;
     bool tmpAnnexB;
     std::string tmpPreset;
+    int tmpBframes;
 
     if (!params) {
         return false;
@@ -161,6 +332,7 @@ bool VideoEncoderX264or5::configEvent(Jzon::Node* params)
     tmpThreads = threads;
     tmpAnnexB = outputStreamInfo->video.h264or5.annexb;
     tmpPreset = preset;
+    tmpBframes = bframes;
 
     if (params->Has("bitrate")) {
         tmpBitrate = params->Get("bitrate").ToInt();
@@ -190,7 +362,16 @@ bool VideoEncoderX264or5::configEvent(Jzon::Node* params)
         tmpPreset = params->Get("preset").ToString();
     }
 
-    return configure0(tmpBitrate, tmpFps, tmpGop, tmpLookahead, tmpThreads, tmpAnnexB, tmpPreset);
+    if (params->Has("bframes")) {
+        tmpBframes = params->Get("bframes").ToInt();
+    }
+
+    if (tmpBframes < 0) {
+        utils::errorMsg("Error configuring VideoEncoderX264or5: invalid number of B-frames");
+        return false;
+    }
+
+    return configure0(tmpBitrate, tmpFps, tmpGop, tmpLookahead, tmpThreads, tmpAnnexB, tmpPreset, tmpBframes);
 }
 
 bool VideoEncoderX264or5::forceIntraEvent(Jzon::Node*)
@@ -199,10 +380,178 @@ bool VideoEncoderX264or5::forceIntraEvent(Jzon::Node*)
     return true;
 }
 
+bool VideoEncoderX264or5::intraRefreshEvent(Jzon::Node* params)
+{
+    if (!params || !params->Has("enable")) {
+        return false;
+    }
+
+    intraRefresh = params->Get("enable").ToBool();
+    needsConfig = true;
+    return true;
+}
+
+bool VideoEncoderX264or5::duplicateFramesEvent(Jzon::Node* params)
+{
+    std::string mode;
+
+    if (!params || !params->Has("mode")) {
+        return false;
+    }
+
+    mode = params->Get("mode").ToString();
+
+    if (mode.compare("encode") == 0) {
+        duplicateMode = ENCODE_DUPLICATES;
+    } else if (mode.compare("skip") == 0) {
+        duplicateMode = SKIP_DUPLICATES;
+    } else if (mode.compare("drop") == 0) {
+        duplicateMode = DROP_DUPLICATES;
+    } else {
+        utils::errorMsg("Error configuring duplicate frames: unknown mode " + mode);
+        return false;
+    }
+
+    prevBlockHashes.clear();
+    consecutiveDrops = 0;
+    return true;
+}
+
+bool VideoEncoderX264or5::configRateControl(bool enable, int minBitrate, int maxBitrate)
+{
+    Jzon::Object root, params;
+    root.Add("action", "rateControl");
+    params.Add("enable", enable);
+    params.Add("minBitrate", minBitrate);
+    params.Add("maxBitrate", maxBitrate);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e);
+    return true;
+}
+
+bool VideoEncoderX264or5::congestionFeedback(double loss, unsigned queueElements, size_t lostBlocs)
+{
+    Jzon::Object root, params;
+    root.Add("action", "congestion");
+    params.Add("loss", loss);
+    params.Add("queueElements", (int) queueElements);
+    params.Add("lostBlocs", (int) lostBlocs);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e);
+    return true;
+}
+
+bool VideoEncoderX264or5::rateControlEvent(Jzon::Node* params)
+{
+    int tmpMin;
+    int tmpMax;
+
+    if (!params || !params->Has("enable")) {
+        return false;
+    }
+
+    if (!params->Get("enable").ToBool()) {
+        rateControl = false;
+        return true;
+    }
+
+    tmpMin = params->Has("minBitrate") ? params->Get("minBitrate").ToInt() : 0;
+    tmpMax = params->Has("maxBitrate") ? params->Get("maxBitrate").ToInt() : 0;
+
+    if (tmpMax <= 0) {
+        tmpMax = bitrate;
+    }
+
+    if (tmpMin <= 0 || tmpMin > tmpMax) {
+        utils::errorMsg("Error configuring rate control: invalid bitrate limits");
+        return false;
+    }
+
+    minBitrate = tmpMin;
+    maxBitrate = tmpMax;
+    rateControl = true;
+    lastRateChange = std::chrono::system_clock::now();
+
+    if (bitrate < minBitrate || bitrate > maxBitrate) {
+        bitrate = std::min(std::max(bitrate, minBitrate), maxBitrate);
+        needsConfig = true;
+    }
+
+    return true;
+}
+
+bool VideoEncoderX264or5::congestionEvent(Jzon::Node* params)
+{
+    double loss;
+    unsigned queueElements;
+    size_t lostBlocs;
+    bool newLostBlocs;
+    unsigned newBitrate;
+    std::chrono::milliseconds sinceChange;
+    std::chrono::system_clock::time_point now;
+
+    if (!params || !params->Has("loss") || !params->Has("queueElements") || !params->Has("lostBlocs")) {
+        return false;
+    }
+
+    loss = params->Get("loss").ToDouble();
+    queueElements = params->Get("queueElements").ToInt();
+    lostBlocs = params->Get("lostBlocs").ToInt();
+
+    newLostBlocs = lostBlocs > lastLostBlocs;
+    lastLostBlocs = lostBlocs;
+
+    if (!rateControl) {
+        return true;
+    }
+
+    now = std::chrono::system_clock::now();
+    sinceChange = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastRateChange);
+    newBitrate = bitrate;
+
+    //NOTE: decreases react fast to avoid flushing queues, increases probe slowly
+    if (loss > RATE_CONTROL_LOSS_HIGH || queueElements > RATE_CONTROL_QUEUE_HIGH || newLostBlocs) {
+        if (sinceChange.count() >= RATE_CONTROL_DECREASE_TIME) {
+            newBitrate = std::max((unsigned) (bitrate * RATE_CONTROL_DECREASE), minBitrate);
+        }
+    } else if (loss < RATE_CONTROL_LOSS_LOW && queueElements <= RATE_CONTROL_QUEUE_LOW) {
+        if (sinceChange.count() >= RATE_CONTROL_INCREASE_TIME) {
+            newBitrate = std::min(bitrate + std::max((unsigned) (maxBitrate * RATE_CONTROL_INCREASE_STEP), 1U), maxBitrate);
+        }
+    } else {
+        //NOTE: neither congested nor clear, the increase waits for a clear period
+        lastRateChange = now;
+    }
+
+    if (newBitrate == bitrate) {
+        return true;
+    }
+
+    if (newBitrate < bitrate) {
+        rateDecreases++;
+    } else {
+        rateIncreases++;
+    }
+
+    //NOTE: VBV settings are derived from the bitrate, both are reconfigured in place
+    bitrate = newBitrate;
+    lastRateChange = now;
+    needsConfig = true;
+    return true;
+}
+
 void VideoEncoderX264or5::initializeEventMap()
 {
     eventMap["forceIntra"] = std::bind(&VideoEncoderX264or5::forceIntraEvent, this, std::placeholders::_1);
     eventMap["configure"] = std::bind(&VideoEncoderX264or5::configEvent, this, std::placeholders::_1);
+    eventMap["intraRefresh"] = std::bind(&VideoEncoderX264or5::intraRefreshEvent, this, std::placeholders::_1);
+    eventMap["duplicateFrames"] = std::bind(&VideoEncoderX264or5::duplicateFramesEvent, this, std::placeholders::_1);
+    eventMap["rateControl"] = std::bind(&VideoEncoderX264or5::rateControlEvent, this, std::placeholders::_1);
+    eventMap["congestion"] = std::bind(&VideoEncoderX264or5::congestionEvent, this, std::placeholders::_1);
 }
 
 void VideoEncoderX264or5::doGetState(Jzon::Object &filterNode)
@@ -214,9 +563,21 @@ void VideoEncoderX264or5::doGetState(Jzon::Object &filterNode)
     filterNode.Add("threads", std::to_string(threads));
     filterNode.Add("annexb", std::to_string(outputStreamInfo->video.h264or5.annexb));
     filterNode.Add("preset", preset);
+    filterNode.Add("bframes", std::to_string(bframes));
+    filterNode.Add("intraRefresh", std::to_string(intraRefresh));
+    filterNode.Add("duplicateMode", std::to_string(duplicateMode));
+    filterNode.Add("duplicateFrames", std::to_string(duplicateFrames));
+    filterNode.Add("droppedFrames", std::to_string(droppedFrames));
+    filterNode.Add("encoderSwitches", std::to_string(encoderSwitches));
+    filterNode.Add("rateControl", std::to_string(rateControl));
+    filterNode.Add("minBitrate", std::to_string(minBitrate));
+    filterNode.Add("maxBitrate", std::to_string(maxBitrate));
+    filterNode.Add("rateDecreases", std::to_string(rateDecreases));
+    filterNode.Add("rateIncreases", std::to_string(rateIncreases));
+    filterNode.Add("duplicateRatio", std::to_string(inputFrames > 0 ? (double) duplicateFrames/inputFrames : 0));
 }
 
-bool VideoEncoderX264or5::configure(int bitrate, int fps, int gop, int lookahead, int threads, bool annexB, std::string preset)
+bool VideoEncoderX264or5::configure(int bitrate, int fps, int gop, int lookahead, int threads, bool annexB, std::string preset, int bframes)
 {
     Jzon::Object root, params;
     root.Add("action", "configure");
@@ -227,6 +588,7 @@ bool VideoEncoderX264or5::configure(int bitrate, int fps, int gop, int lookahead
     params.Add("threads", threads);
     params.Add("annexb", annexB);
     params.Add("preset", preset);
+    params.Add("bframes", bframes);
     root.Add("params", params);
 
     Event e(root, std::chrono::system_clock::now(), 0);
@@ -234,3 +596,38 @@ bool VideoEncoderX264or5::configure(int bitrate, int fps, int gop, int lookahead
     return true;
 }
 
+bool VideoEncoderX264or5::configIntraRefresh(bool enable)
+{
+    Jzon::Object root, params;
+    root.Add("action", "intraRefresh");
+    params.Add("enable", enable);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e); 
+    return true;
+}
+
+bool VideoEncoderX264or5::configDuplicateFrames(DuplicateMode mode)
+{
+    Jzon::Object root, params;
+    root.Add("action", "duplicateFrames");
+
+    switch (mode) {
+        case SKIP_DUPLICATES:
+            params.Add("mode", "skip");
+            break;
+        case DROP_DUPLICATES:
+            params.Add("mode", "drop");
+            break;
+        default:
+            params.Add("mode", "encode");
+            break;
+    }
+
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e); 
+    return true;
+}
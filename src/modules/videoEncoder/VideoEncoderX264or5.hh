@@ -26,6 +26,9 @@
 
 #include <stdint.h>
 #include <chrono>
+#include <deque>
+#include <map>
+#include <vector>
 #include "../../Utils.hh"
 #include "../../VideoFrame.hh"
 #include "../../Filter.hh"
@@ -44,12 +47,31 @@ extern "C" {
 #define DEFAULT_THREADS 4
 #define DEFAULT_ANNEXB true
 #define DEFAULT_PRESET "ultrafast"
+#define MAX_ENCODING_DELAY 512
+//NOTE: highest H264/H265 8 bit quantizer, duplicate frames encoded with it only have skip blocks
+#define SKIP_FRAME_QP 51
+//NOTE: rate control thresholds, loss in percentage and queue depth in frames
+#define RATE_CONTROL_LOSS_HIGH 5
+#define RATE_CONTROL_LOSS_LOW 1
+#define RATE_CONTROL_QUEUE_HIGH 10
+#define RATE_CONTROL_QUEUE_LOW 2
+#define RATE_CONTROL_DECREASE 0.8
+#define RATE_CONTROL_INCREASE_STEP 0.05
+#define RATE_CONTROL_DECREASE_TIME 500 //ms
+#define RATE_CONTROL_INCREASE_TIME 2000 //ms
 
 /*! Base class for VideoEncoderX264 and VideoEncoderX265. It implements common methods, basically configure and doProcessFrame */
 
 class VideoEncoderX264or5 : public OneToOneFilter {
     
 public:
+    /*! Handling of input frames identical to the previous one (i.e. slides or screen
+        sharing). ENCODE_DUPLICATES encodes them as any other frame, SKIP_DUPLICATES
+        encodes them at the highest quantizer, which produces skip blocks only (but
+        for forced intra and GOP start frames, which are encoded as usual), and
+        DROP_DUPLICATES does not output them, for receivers allowing variable frame rate. */
+    enum DuplicateMode {ENCODE_DUPLICATES, SKIP_DUPLICATES, DROP_DUPLICATES};
+
     /**
     * Class constructor
     */
@@ -60,7 +82,51 @@ public:
     */
     virtual ~VideoEncoderX264or5();
 
-    bool configure(int bitrate, int fps, int gop, int lookahead, int threads, bool annexB, std::string preset);
+    /**
+    * Configures the encoder
+    * @param bitrate in kbps
+    * @param fps output frame rate, 0 uses the input timing
+    * @param gop GOP size
+    * @param lookahead rate control lookahead in frames
+    * @param threads encoding threads
+    * @param annexB output NALs with start codes
+    * @param preset encoder preset
+    * @param bframes consecutive B-frames, output frames carry their decoding time when enabled
+    */
+    bool configure(int bitrate, int fps, int gop, int lookahead, int threads, bool annexB, std::string preset, int bframes = 0);
+
+    /**
+    * Enables or disables periodic intra refresh. Instead of starting each GOP with an IDR frame, 
+    * a column of intra blocks sweeps the picture once every GOP, spreading the intra cost over 
+    * all the frames. While enabled, forceIntra starts a new refresh wave instead of an IDR.
+    * @param enable intra refresh mode
+    */
+    bool configIntraRefresh(bool enable);
+
+    /**
+    * Configures how input frames identical to the previous one are encoded. At
+    * least one frame every GOP is encoded when dropping them.
+    * @param mode see DuplicateMode
+    */
+    bool configDuplicateFrames(DuplicateMode mode);
+
+    /**
+    * Enables or disables the bitrate adaptation to the network feedback. The bitrate is
+    * decreased multiplicatively while the output path is congested and increased
+    * additively once it is clear, always within the given limits.
+    * @param enable rate control
+    * @param minBitrate lowest bitrate in kbps
+    * @param maxBitrate highest bitrate in kbps, 0 uses the current bitrate
+    */
+    bool configRateControl(bool enable, int minBitrate, int maxBitrate = 0);
+
+    /**
+    * Feeds the congestion signals of the output path to the rate control
+    * @param loss packet loss reported by the receivers in percentage
+    * @param queueElements frames waiting in the transmission queue
+    * @param lostBlocs accumulated flushes of the path queues
+    */
+    bool congestionFeedback(double loss, unsigned queueElements, size_t lostBlocs);
     
 protected:
     AVPixelFormat libavInPixFmt;
@@ -68,12 +134,17 @@ protected:
     
     PixType inPixFmt;
     bool forceIntra;
+    bool intraRefresh;
+    //NOTE: the frame being encoded is a duplicate to be encoded as cheap as possible
+    bool skipFrame;
     unsigned fps;
     unsigned bitrate;
     unsigned gop;
     unsigned threads;
     unsigned lookahead;
+    unsigned bframes;
     bool needsConfig;
+    int64_t pts;
     std::string preset;
 
     StreamInfo *outputStreamInfo;
@@ -86,12 +157,37 @@ protected:
     void setIntra(){forceIntra = true;};
     bool fill_x264or5_picture(VideoFrame* videoFrame);
 
-    bool configure0(unsigned bitrate_, unsigned fps_, unsigned gop_, unsigned lookahead_, unsigned threads_, bool annexB_, std::string preset_);
+    bool configure0(unsigned bitrate_, unsigned fps_, unsigned gop_, unsigned lookahead_, unsigned threads_, bool annexB_, std::string preset_, unsigned bframes_ = 0);
+    bool duplicateFramesEvent(Jzon::Node* params);
+    bool setOutputTimes(Frame *dst, int64_t outPts, int64_t outDts);
+    void doGetState(Jzon::Object &filterNode);
+
+    /*! Encoded frame kept while the previous encoder of a reconfiguration is drained */
+    struct EncodedOutput {
+        std::vector<std::vector<unsigned char>> nals;
+        int64_t pts;
+        int64_t dts;
+        //NOTE: headers of the new encoder, set when its first frame is output
+        std::vector<unsigned char> headers;
+    };
+
+    void queueOutput(EncodedOutput &output);
+    bool hasQueuedOutputs() const {return !queuedOutputs.empty();};
+    bool outputQueued(SlicedVideoFrame *dst);
+    //NOTE: headers of a switched in encoder, the delayed frames of the previous one keep the current ones
+    void setNextHeaders(unsigned char *data, int size) {nextHeaders.assign(data, data + size);};
+    //NOTE: the frame to be encoded starts a GOP, new encoders are switched in at this point
+    bool atGopBoundary() const {return gopPosition == 0;};
+
+    unsigned encoderSwitches;
     
 private:
     bool forceIntraEvent(Jzon::Node* params);
     bool configEvent(Jzon::Node* params);
-    void doGetState(Jzon::Object &filterNode);
+    bool intraRefreshEvent(Jzon::Node* params);
+    bool rateControlEvent(Jzon::Node* params);
+    bool congestionEvent(Jzon::Node* params);
+    bool isDuplicate(VideoFrame* frame);
     
     //There is no need of specific reader configuration
     bool specificReaderConfig(int /*readerID*/, FrameQueue* /*queue*/)  {return true;};
@@ -107,7 +203,33 @@ private:
         size_t seqNum;
     };
     
-    std::queue<FrameTimeParams> qFTP;
+    //NOTE: timing of the frames being encoded, indexed by the pts given to the encoder
+    std::map<int64_t, FrameTimeParams> timeParams;
+
+    DuplicateMode duplicateMode;
+    std::vector<uint64_t> blockHashes;
+    std::vector<uint64_t> prevBlockHashes;
+    unsigned inputFrames;
+    unsigned duplicateFrames;
+    unsigned droppedFrames;
+    unsigned consecutiveDrops;
+
+    std::deque<EncodedOutput> queuedOutputs;
+    std::vector<unsigned char> nextHeaders;
+    //NOTE: slices of the last queued output are copied by the queue after doProcessFrame
+    EncodedOutput lastOutput;
+    unsigned gopPosition;
+    std::chrono::microseconds lastDecodeTime;
+    int outWidth;
+    int outHeight;
+
+    bool rateControl;
+    unsigned minBitrate;
+    unsigned maxBitrate;
+    size_t lastLostBlocs;
+    std::chrono::system_clock::time_point lastRateChange;
+    unsigned rateDecreases;
+    unsigned rateIncreases;
 };
 
 #endif
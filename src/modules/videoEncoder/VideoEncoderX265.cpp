@@ -29,9 +29,9 @@
 #define MAX_PLANES_PER_PICTURE 3
 
 VideoEncoderX265::VideoEncoderX265() :
-VideoEncoderX264or5(), encoder(NULL)
+VideoEncoderX264or5(), encoder(NULL), nextParams(NULL), nextEncoder(NULL), nextEncoderReady(false), 
+drainingEncoder(NULL)
 {
-    pts = 0;
     outputStreamInfo->video.codec = H265;
     xparams = x265_param_alloc();
     picIn = x265_picture_alloc();
@@ -40,6 +40,13 @@ VideoEncoderX264or5(), encoder(NULL)
 
 VideoEncoderX265::~VideoEncoderX265()
 {
+    discardNextEncoder();
+
+    if (drainingEncoder != NULL){
+        x265_encoder_close(drainingEncoder);
+        drainingEncoder = NULL;
+    }
+
     if (encoder != NULL){
         x265_encoder_close(encoder);
         encoder = NULL;
@@ -72,26 +79,54 @@ bool VideoEncoderX265::encodeFrame(VideoFrame* codedFrame)
         return false;
     }
 
-    if (forceIntra) {
+    switchEncoder();
+
+    picIn->sliceType = X265_TYPE_AUTO;
+
+    if (forceIntra && intraRefresh) {
+        x265_encoder_intra_refresh(encoder);
+    } else if (forceIntra) {
         picIn->sliceType = X265_TYPE_I;
-        forceIntra = false;
-    } else {
-        picIn->sliceType = X265_TYPE_AUTO;
     }
 
+    forceIntra = false;
+
+    //NOTE: 0 lets the rate control choose the quantizer
+    picIn->forceqp = skipFrame ? SKIP_FRAME_QP + 1 : 0;
     picIn->pts = pts;
     success = x265_encoder_encode(encoder, &nals, &piNal, picIn, picOut);
 
-    pts++;
-
     if (success < 0) {
         utils::errorMsg("X265 Encoder: Could not encode video frame");
         return false;
-    } else if (success == 0) {
+    }
+
+    //NOTE: frames of the new encoder wait until the previous one is drained
+    if (drainingEncoder || hasQueuedOutputs()) {
+        if (success > 0) {
+            EncodedOutput output;
+
+            for (unsigned i = 0; i < piNal; i++) {
+                output.nals.push_back(std::vector<unsigned char>(nals[i].payload, nals[i].payload + nals[i].sizeBytes));
+            }
+
+            output.pts = picOut->pts;
+            output.dts = picOut->dts;
+            queueOutput(output);
+        }
+
+        return drainEncoder(slicedFrame);
+    }
+
+    if (success == 0) {
         utils::debugMsg("X265 Encoder: NAL not retrieved after encoding");
         return false;
     }
 
+    if (!setOutputTimes(slicedFrame, picOut->pts, picOut->dts)) {
+        return false;
+    }
+
     for (unsigned i = 0; i < piNal; i++) {
         if (!slicedFrame->setSlice(nals[i].payload, nals[i].sizeBytes)) {
             utils::errorMsg("X265 Encoder: too many NALs for one slicedFrame");
@@ -102,7 +137,121 @@ bool VideoEncoderX265::encodeFrame(VideoFrame* codedFrame)
     return true;
 }
 
-bool VideoEncoderX265::encodeHeadersFrame()
+bool VideoEncoderX265::drainEncoder(SlicedVideoFrame* slicedFrame)
+{
+    int success;
+    unsigned piNal;
+    x265_nal* nals;
+
+    if (!drainingEncoder) {
+        return outputQueued(slicedFrame);
+    }
+
+    //NOTE: encoding a NULL picture flushes the encoder, it returns 0 once it is empty
+    success = x265_encoder_encode(drainingEncoder, &nals, &piNal, NULL, picOut);
+
+    if (success <= 0) {
+        x265_encoder_close(drainingEncoder);
+        drainingEncoder = NULL;
+        return outputQueued(slicedFrame);
+    }
+
+    if (!setOutputTimes(slicedFrame, picOut->pts, picOut->dts)) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < piNal; i++) {
+        if (!slicedFrame->setSlice(nals[i].payload, nals[i].sizeBytes)) {
+            utils::errorMsg("X265 Encoder: too many NALs for one slicedFrame");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void VideoEncoderX265::startNextEncoder(x265_param *params)
+{
+    discardNextEncoder();
+
+    nextParams = params;
+    nextEncoderThread = std::thread([this](){
+        nextEncoder = x265_encoder_open(nextParams);
+        nextEncoderReady = true;
+    });
+}
+
+void VideoEncoderX265::discardNextEncoder()
+{
+    if (nextEncoderThread.joinable()) {
+        nextEncoderThread.join();
+    }
+
+    if (nextEncoder) {
+        x265_encoder_close(nextEncoder);
+        nextEncoder = NULL;
+    }
+
+    if (nextParams) {
+        x265_param_free(nextParams);
+        nextParams = NULL;
+    }
+
+    nextEncoderReady = false;
+}
+
+void VideoEncoderX265::switchEncoder()
+{
+    x265_picture current;
+
+    if (!nextEncoderReady || !atGopBoundary()) {
+        return;
+    }
+
+    nextEncoderThread.join();
+    nextEncoderReady = false;
+
+    if (!nextEncoder) {
+        utils::errorMsg("Could not open the reconfigured x265 encoder, keeping the current one");
+        x265_param_free(nextParams);
+        nextParams = NULL;
+        return;
+    }
+
+    if (drainingEncoder) {
+        x265_encoder_close(drainingEncoder);
+    }
+
+    //NOTE: the previous encoder is fed no more frames, its delayed ones are output
+    //while the new encoder fills its own lookahead
+    drainingEncoder = encoder;
+    encoder = nextEncoder;
+    nextEncoder = NULL;
+    x265_param_free(xparams);
+    xparams = nextParams;
+    nextParams = NULL;
+    encoderSwitches++;
+
+    //NOTE: pictures are initialized for the new parameters, keeping the planes of the frame to encode
+    current = *picIn;
+    x265_picture_init(xparams, picIn);
+    x265_picture_init(xparams, picOut);
+
+    for (int i = 0; i < MAX_PLANES_PER_PICTURE; i++) {
+        picIn->planes[i] = current.planes[i];
+        picIn->stride[i] = current.stride[i];
+    }
+
+    encodeHeadersFrame(true);
+}
+
+bool VideoEncoderX265::hasPendingOutput()
+{
+    //NOTE: once the previous encoder is empty the frames queued meanwhile are output at once
+    return !drainingEncoder && hasQueuedOutputs();
+}
+
+bool VideoEncoderX265::encodeHeadersFrame(bool withNextOutput)
 {
     int encodeSize;
     unsigned piNal;
@@ -114,6 +263,11 @@ bool VideoEncoderX265::encodeHeadersFrame()
         utils::errorMsg("Could not encode headers");
         return false;
     }
+
+    if (withNextOutput) {
+        setNextHeaders(nals[0].payload, encodeSize);
+        return true;
+    }
        
     outputStreamInfo->setExtraData(nals[0].payload, encodeSize);
         
@@ -128,6 +282,8 @@ FrameQueue* VideoEncoderX265::allocQueue(ConnectionData cData)
 bool VideoEncoderX265::reconfigure(VideoFrame* orgFrame, VideoFrame* dstFrame)
 {
     int colorspace;
+    bool rebuild;
+    x265_param *params;
 
     if (!needsConfig && orgFrame->getWidth() == xparams->sourceWidth &&
         orgFrame->getHeight() == xparams->sourceHeight && orgFrame->getPixelFormat() == inPixFmt) {
@@ -159,50 +315,82 @@ bool VideoEncoderX265::reconfigure(VideoFrame* orgFrame, VideoFrame* dstFrame)
     }
 
     picIn->colorSpace = colorspace;
-    x265_param_default_preset(xparams, preset.c_str(), NULL);
-    /*TODO check with NULL profile*/
-    x265_param_apply_profile(xparams, "main");
+    params = x265_param_alloc();
+    fillParams(params, orgFrame->getWidth(), orgFrame->getHeight(), colorspace);
+    needsConfig = false;
 
-    x265_param_parse(xparams, "keyint", std::to_string(gop).c_str());
-    x265_param_parse(xparams, "fps", std::to_string(fps).c_str());
-    x265_param_parse(xparams, "input-res", (std::to_string(orgFrame->getWidth()) + 'x' + std::to_string(orgFrame->getHeight())).c_str());
+    //NOTE: frames of a new size or pixel format cannot be fed to the current 
+    //encoder, so it is replaced right away
+    if (!encoder || params->sourceWidth != xparams->sourceWidth || 
+        params->sourceHeight != xparams->sourceHeight || params->internalCsp != xparams->internalCsp) {
+        discardNextEncoder();
 
-    //TODO check same management for intra-refresh like x264
-    //x265_param_parse(xparams, "intra-refresh", std::to_string(0).c_str());
+        if (encoder != NULL) {
+            x265_encoder_close(encoder);
+        }
 
-    x265_param_parse(xparams, "frame-threads", std::to_string(threads).c_str());
-    x265_param_parse(xparams, "aud", std::to_string(1).c_str());
-    x265_param_parse(xparams, "bitrate", std::to_string(bitrate).c_str());
-    x265_param_parse(xparams, "bframes", std::to_string(0).c_str());
-    x265_param_parse(xparams, "repeat-headers", std::to_string(0).c_str());
-    x265_param_parse(xparams, "vbv-maxrate", std::to_string(bitrate*1.05).c_str());
-    x265_param_parse(xparams, "vbv-bufsize", std::to_string(bitrate*2).c_str());
-    x265_param_parse(xparams, "rc-lookahead", std::to_string(lookahead).c_str());
-    x265_param_parse(xparams, "annexb", std::to_string(1).c_str());
-    x265_param_parse(xparams, "scenecut", std::to_string(0).c_str());
+        x265_param_free(xparams);
+        xparams = params;
+        encoder = x265_encoder_open(xparams);
 
+        if (!encoder) {
+            utils::errorMsg("Error reconfiguring x265 encoder. At this point encoder should not be NULL...");
+            return false;
+        }
 
-    if (outputStreamInfo->video.h264or5.annexb) {
-        x265_param_parse(xparams, "repeat-headers", std::to_string(1).c_str());
-    }
+        x265_picture_init(xparams, picIn);
+        x265_picture_init(xparams, picOut);
 
-    if (!encoder) {
-        encoder = x265_encoder_open(xparams);
-    } else {
-        /*TODO reimplement it when a reconfigure method appear*/
-        x265_encoder_close(encoder);
-        encoder = x265_encoder_open(xparams);
+        return encodeHeadersFrame();
     }
 
-    if (!encoder) {
-        utils::errorMsg("Error reconfiguring x265 encoder. At this point encoder should not be NULL...");
-        return false;
+    //NOTE: x265_encoder_reconfig only applies rate control and analysis changes (i.e. the 
+    //bitrate steps of the rate control), a new encoder is opened in background for the rest 
+    //and switched in at the next GOP boundary
+    rebuild = params->frameNumThreads != xparams->frameNumThreads || params->lookaheadDepth != xparams->lookaheadDepth ||
+        params->bframes != xparams->bframes || params->bIntraRefresh != xparams->bIntraRefresh ||
+        params->keyframeMax != xparams->keyframeMax || params->fpsNum != xparams->fpsNum ||
+        params->fpsDenom != xparams->fpsDenom || params->bAnnexB != xparams->bAnnexB || 
+        params->bRepeatHeaders != xparams->bRepeatHeaders;
+
+    if (!rebuild && x265_encoder_reconfig(encoder, params) == 0) {
+        discardNextEncoder();
+        x265_param_free(xparams);
+        xparams = params;
+        return encodeHeadersFrame();
     }
 
-    x265_picture_init(xparams, picIn);
-    x265_picture_init(xparams, picOut);
+    startNextEncoder(params);
+    return true;
+}
 
-    needsConfig = false;
+void VideoEncoderX265::fillParams(x265_param *params, int width, int height, int colorspace)
+{
+    x265_param_default_preset(params, preset.c_str(), NULL);
+    /*TODO check with NULL profile*/
+    x265_param_apply_profile(params, "main");
 
-    return encodeHeadersFrame();
+    params->internalCsp = colorspace;
+
+    x265_param_parse(params, "keyint", std::to_string(gop).c_str());
+    x265_param_parse(params, "fps", std::to_string(fps).c_str());
+    x265_param_parse(params, "input-res", (std::to_string(width) + 'x' + std::to_string(height)).c_str());
+
+    //NOTE: with intra refresh keyint is the refresh period, only the first frame is an IDR
+    x265_param_parse(params, "intra-refresh", std::to_string(intraRefresh).c_str());
+
+    x265_param_parse(params, "frame-threads", std::to_string(threads).c_str());
+    x265_param_parse(params, "aud", std::to_string(1).c_str());
+    x265_param_parse(params, "bitrate", std::to_string(bitrate).c_str());
+    x265_param_parse(params, "bframes", std::to_string(bframes).c_str());
+    x265_param_parse(params, "repeat-headers", std::to_string(0).c_str());
+    x265_param_parse(params, "vbv-maxrate", std::to_string(bitrate*1.05).c_str());
+    x265_param_parse(params, "vbv-bufsize", std::to_string(bitrate*2).c_str());
+    x265_param_parse(params, "rc-lookahead", std::to_string(lookahead).c_str());
+    x265_param_parse(params, "annexb", std::to_string(1).c_str());
+    x265_param_parse(params, "scenecut", std::to_string(0).c_str());
+
+    if (outputStreamInfo->video.h264or5.annexb) {
+        x265_param_parse(params, "repeat-headers", std::to_string(1).c_str());
+    }
 }
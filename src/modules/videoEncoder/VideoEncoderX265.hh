@@ -33,31 +33,55 @@
 #include "../../FrameQueue.hh"
 #include "../../Types.hh"
 
+#include <atomic>
+#include <thread>
+
 extern "C" {
 #include <x265.h>
 }
 
+/*! X265 video encoder. Rate control parameters are reconfigured in place, the rest 
+    are applied by opening a new encoder in background, which replaces the current one 
+    at the next GOP boundary. The replaced encoder is flushed meanwhile, and the frames 
+    of the new one are queued until it is empty. */
+
 class VideoEncoderX265 : public VideoEncoderX264or5 {
 
 public:
     VideoEncoderX265();
     ~VideoEncoderX265();
 
+protected:
+    bool hasPendingOutput();
+
 private:
     FrameQueue* allocQueue(ConnectionData cData);
     void initializeEventMap();
 
+    void fillParams(x265_param *params, int width, int height, int colorspace);
+    void startNextEncoder(x265_param *params);
+    void discardNextEncoder();
+    void switchEncoder();
+    bool drainEncoder(SlicedVideoFrame* slicedFrame);
+
     x265_picture    *picIn;
     x265_picture    *picOut;
     x265_param      *xparams;
     x265_encoder*   encoder;
 
-    int64_t         pts;
+    //NOTE: encoder opened in background with the new parameters
+    x265_param      *nextParams;
+    x265_encoder*   nextEncoder;
+    std::thread     nextEncoderThread;
+    std::atomic<bool> nextEncoderReady;
+    //NOTE: replaced encoder whose delayed frames are still being output
+    x265_encoder*   drainingEncoder;
+
 
     bool fillPicturePlanes(unsigned char** data, int* linesize);
     bool encodeFrame(VideoFrame* codedFrame);
     bool reconfigure(VideoFrame *orgFrame, VideoFrame* dstFrame);
-    bool encodeHeadersFrame();
+    bool encodeHeadersFrame(bool withNextOutput = false);
 };
 
 #endif
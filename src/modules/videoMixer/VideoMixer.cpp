@@ -207,7 +207,16 @@ bool VideoMixer::configure0(int width, int height, int fps)
 void VideoMixer::pasteToLayout(int frameID, VideoFrame* vFrame)
 {
     ChannelConfig* chConfig = channelsConfig[frameID];
-    cv::Mat img(vFrame->getHeight(), vFrame->getWidth(), CV_8UC3, vFrame->getDataBuf());
+    InterleavedVideoFrame* iFrame = dynamic_cast<InterleavedVideoFrame*>(vFrame);
+    unsigned char *planes[MAX_PLANES];
+    int strides[MAX_PLANES];
+    
+    if (!iFrame || iFrame->getPlanes(planes, strides) == 0){
+        return;
+    }
+    
+    //NOTE: the frame may be a view of a bigger picture, so its stride is used
+    cv::Mat img(vFrame->getHeight(), vFrame->getWidth(), CV_8UC3, planes[0], strides[0]);
 
     cv::Size sz(chConfig->getWidth()*outputWidth, chConfig->getHeight()*outputHeight);
 
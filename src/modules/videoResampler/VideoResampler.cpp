@@ -25,6 +25,8 @@
 #include "../../AVFramedQueue.hh"
 #include "../../Utils.hh"
 
+#include <algorithm>
+
 AVPixelFormat getLibavPixFmt(PixType pixType);
 
 VideoResampler::VideoResampler() : OneToOneFilter()
@@ -34,12 +36,18 @@ VideoResampler::VideoResampler() : OneToOneFilter()
     inFrame = av_frame_alloc();
     outFrame = av_frame_alloc();
 
-    imgConvertCtx = NULL;
-
     outputWidth = 0;
     outputHeight = 0;
+    inputWidth = 0;
+    inputHeight = 0;
+    cropX = cropY = cropWidth = cropHeight = 0;
+    winX = winY = winWidth = winHeight = 0;
+    mode = SCALE;
     discartPeriod = 0;
     discartCount = 1;
+    threads = DEFAULT_RESAMPLER_THREADS;
+    inPixFmt = P_NONE;
+    outPixFmt = RGB24;
     libavOutPixFmt = getLibavPixFmt(outPixFmt);
 
     needsConfig = false;
@@ -53,9 +61,10 @@ VideoResampler::VideoResampler() : OneToOneFilter()
 
 VideoResampler::~VideoResampler()
 {
+    sliceWorkers.stop();
     av_free(inFrame);
     av_free(outFrame);
-    sws_freeContext(imgConvertCtx);
+    freeSlices();
 
     delete outputStreamInfo;
 }
@@ -67,9 +76,9 @@ FrameQueue* VideoResampler::allocQueue(ConnectionData cData)
 
 bool VideoResampler::reconfigure(VideoFrame* orgFrame)
 {      
-    if (!imgConvertCtx || needsConfig || 
-        orgFrame->getWidth() != inFrame->width ||
-        orgFrame->getHeight() != inFrame->height ||
+    if (needsConfig || 
+        orgFrame->getWidth() != inputWidth ||
+        orgFrame->getHeight() != inputHeight ||
         orgFrame->getPixelFormat() != inPixFmt)
     {
         inPixFmt = orgFrame->getPixelFormat();
@@ -79,26 +88,43 @@ bool VideoResampler::reconfigure(VideoFrame* orgFrame)
             return false;
         }
         
+        inputWidth = orgFrame->getWidth();
+        inputHeight = orgFrame->getHeight();
+
+        if (!configWindow()){
+            utils::errorMsg("[Resampler] Crop window out of the input picture");
+            return false;
+        }
+        
         int outWidth, outHeight;
         if (outputWidth == 0){
-            outWidth = orgFrame->getWidth();
+            outWidth = winWidth;
         } else {
             outWidth = outputWidth;
         }
         
         if (outputHeight == 0){
-            outHeight = orgFrame->getHeight();
+            outHeight = winHeight;
         } else {
             outHeight = outputHeight;
         }
         
-        imgConvertCtx = sws_getContext(orgFrame->getWidth(), orgFrame->getHeight(), 
-                                       libavInPixFmt, outWidth, outHeight,
-                                       libavOutPixFmt, SWS_FAST_BILINEAR, 0, 0, 0);
-
-        if (!imgConvertCtx){
-            utils::errorMsg("Could not get the swscale context");
-            return false;
+        //NOTE: YUV420P and YUVJ420P share memory layout but not range, so swscale converts the levels
+        bool sameFormat = libavInPixFmt == libavOutPixFmt;
+        
+        if (sameFormat && outWidth == winWidth && outHeight == winHeight){
+            freeSlices();
+            if (winWidth == inputWidth && winHeight == inputHeight){
+                mode = PASSTHROUGH;
+            } else {
+                mode = CROP_VIEW;
+            }
+        } else {
+            mode = SCALE;
+            if (!configSlices(winWidth, winHeight, outWidth, outHeight)){
+                utils::errorMsg("Could not get the swscale context");
+                return false;
+            }
         }
 
         needsConfig = false;
@@ -106,57 +132,237 @@ bool VideoResampler::reconfigure(VideoFrame* orgFrame)
     return true;
 }
 
-bool VideoResampler::doProcessFrame(Frame *org, Frame *dst)
+bool VideoResampler::configWindow()
 {
-    int outWidth, outHeight;
-    int height;
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(libavInPixFmt);
+    
+    if (!desc){
+        return false;
+    }
+    
+    //NOTE: the window origin is aligned to the chroma subsampling
+    winX = cropX >> desc->log2_chroma_w << desc->log2_chroma_w;
+    winY = cropY >> desc->log2_chroma_h << desc->log2_chroma_h;
+    winWidth = cropWidth > 0 ? cropWidth : inputWidth - winX;
+    winHeight = cropHeight > 0 ? cropHeight : inputHeight - winY;
+    
+    return winWidth > 0 && winHeight > 0 && 
+        winX + winWidth <= inputWidth && winY + winHeight <= inputHeight;
+}
 
-    VideoFrame* dstFrame = dynamic_cast<VideoFrame*>(dst);
-    VideoFrame* orgFrame = dynamic_cast<VideoFrame*>(org);
+void VideoResampler::cropAVFrame(AVFrame *aFrame)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat) aFrame->format);
+    int steps[4];
+    bool planar;
+    
+    if (winX == 0 && winY == 0 && winWidth == aFrame->width && winHeight == aFrame->height){
+        return;
+    }
+    
+    av_image_fill_max_pixsteps(steps, NULL, desc);
+    planar = desc->flags & AV_PIX_FMT_FLAG_PLANAR;
+    
+    for (int p = 0; p < 4; p++){
+        if (!aFrame->data[p]){
+            continue;
+        }
+        
+        bool chroma = p == 1 || p == 2;
+        int xShift = planar && !chroma ? 0 : desc->log2_chroma_w;
+        int yShift = planar && chroma ? desc->log2_chroma_h : 0;
+        
+        aFrame->data[p] += (winY >> yShift) * aFrame->linesize[p] + (winX >> xShift) * steps[p];
+    }
+    
+    aFrame->width = winWidth;
+    aFrame->height = winHeight;
+}
 
-    if (!reconfigure(orgFrame)){
+bool VideoResampler::shareFrame(Frame *org, Frame *dst)
+{
+    InterleavedVideoFrame* orgFrame = dynamic_cast<InterleavedVideoFrame*>(org);
+    InterleavedVideoFrame* dstFrame = dynamic_cast<InterleavedVideoFrame*>(dst);
+    
+    if (!orgFrame || !dstFrame){
+        utils::errorMsg("[Resampler] Frames cannot be forwarded by reference");
         return false;
     }
     
-    if (discartPeriod != 0 && discartCount < discartPeriod){
-        discartCount++;
-    } else if (discartPeriod != 0 && discartCount == discartPeriod){
-        discartCount = 1;
+    if (!dstFrame->shareBuffer(orgFrame, winX, winY, winWidth, winHeight)){
+        utils::errorMsg("[Resampler] Crop window cannot be forwarded by reference");
         return false;
     }
+    
+    dstFrame->setPixelFormat(outPixFmt);
+    
+    return true;
+}
+
+bool VideoResampler::configSlices(int inWidth, int inHeight, int outWidth, int outHeight)
+{
+    const AVPixFmtDescriptor *inDesc = av_pix_fmt_desc_get(libavInPixFmt);
+    const AVPixFmtDescriptor *outDesc = av_pix_fmt_desc_get(libavOutPixFmt);
+    int inAlign, outAlign, prevOutY, prevInY;
+    unsigned slicesNum;
 
-    if (!setAVFrame(inFrame, orgFrame, libavInPixFmt)){
+    freeSlices();
+
+    if (!inDesc || !outDesc){
         return false;
     }
 
-    if (outputWidth == 0){
-        outWidth = orgFrame->getWidth();
-    } else {
-        outWidth = outputWidth;
+    inAlign = 1 << inDesc->log2_chroma_h;
+    outAlign = 1 << outDesc->log2_chroma_h;
+    
+    slicesNum = std::min(threads, (unsigned) std::max(1, outHeight / (MIN_HEIGHT * outAlign)));
+    slicesNum = std::min(slicesNum, (unsigned) std::max(1, inHeight / (MIN_HEIGHT * inAlign)));
+
+    prevOutY = 0;
+    prevInY = 0;
+    
+    for (unsigned i = 1; i <= slicesNum; i++){
+        ScaleSlice slice;
+        int outY, inY;
+        
+        if (i == slicesNum){
+            outY = outHeight;
+            inY = inHeight;
+        } else {
+            outY = (int64_t) outHeight * i / slicesNum / outAlign * outAlign;
+            inY = (int64_t) outY * inHeight / outHeight / inAlign * inAlign;
+        }
+
+        slice.inY = prevInY;
+        slice.inHeight = inY - prevInY;
+        slice.outY = prevOutY;
+        slice.outHeight = outY - prevOutY;
+        slice.ctx = sws_getContext(inWidth, slice.inHeight, libavInPixFmt, 
+                                   outWidth, slice.outHeight, libavOutPixFmt, 
+                                   SWS_FAST_BILINEAR, 0, 0, 0);
+        
+        if (!slice.ctx){
+            freeSlices();
+            return false;
+        }
+        
+        slices.push_back(slice);
+        prevOutY = outY;
+        prevInY = inY;
+    }
+
+    return true;
+}
+
+void VideoResampler::freeSlices()
+{
+    for (auto slice : slices){
+        sws_freeContext(slice.ctx);
     }
     
-    if (outputHeight == 0){
-        outHeight = orgFrame->getHeight();
-    } else {
-        outHeight = outputHeight;
+    slices.clear();
+}
+
+int VideoResampler::scaleSlice(unsigned slice)
+{
+    const AVPixFmtDescriptor *inDesc = av_pix_fmt_desc_get(libavInPixFmt);
+    const AVPixFmtDescriptor *outDesc = av_pix_fmt_desc_get(libavOutPixFmt);
+    const uint8_t *src[AV_NUM_DATA_POINTERS] = {NULL};
+    uint8_t *dst[AV_NUM_DATA_POINTERS] = {NULL};
+    ScaleSlice &s = slices[slice];
+    
+    for (int p = 0; p < AV_NUM_DATA_POINTERS; p++){
+        //NOTE: chroma planes of planar formats are vertically subsampled
+        if (inFrame->data[p]){
+            src[p] = inFrame->data[p] + inFrame->linesize[p] * 
+                ((p == 1 || p == 2) ? s.inY >> inDesc->log2_chroma_h : s.inY);
+        }
+        
+        if (outFrame->data[p]){
+            dst[p] = outFrame->data[p] + outFrame->linesize[p] * 
+                ((p == 1 || p == 2) ? s.outY >> outDesc->log2_chroma_h : s.outY);
+        }
     }
     
-    dstFrame->setLength(av_image_get_buffer_size(libavOutPixFmt, outWidth, outHeight, 1));
-    dstFrame->setSize(outWidth, outHeight);
-    dstFrame->setPixelFormat(outPixFmt);
+    return sws_scale(s.ctx, src, inFrame->linesize, 0, s.inHeight, dst, outFrame->linesize);
+}
 
-    if (!setAVFrame(outFrame, dstFrame, libavOutPixFmt)){
-        return false;
+bool VideoResampler::scaleSlices()
+{
+    std::vector<int> heights(slices.size(), 0);
+    
+    sliceWorkers.run(slices.size(), [this, &heights](unsigned j){
+        heights[j] = scaleSlice(j);
+    });
+    
+    for (auto height : heights){
+        if (height <= 0){
+            return false;
+        }
     }
     
-    height = sws_scale(imgConvertCtx, inFrame->data, inFrame->linesize, 0, 
-              inFrame->height, outFrame->data, outFrame->linesize);
+    return true;
+}
+
+bool VideoResampler::doProcessFrame(Frame *org, Frame *dst)
+{
+    int outWidth, outHeight;
+
+    InterleavedVideoFrame* dstFrame = dynamic_cast<InterleavedVideoFrame*>(dst);
+    InterleavedVideoFrame* orgFrame = dynamic_cast<InterleavedVideoFrame*>(org);
+
+    if (!dstFrame || !orgFrame){
+        return false;
+    }
+
+    if (!reconfigure(orgFrame)){
+        return false;
+    }
     
-    if (height <= 0){
-        utils::errorMsg("Could not convert image");
+    if (discartPeriod != 0 && discartCount < discartPeriod){
+        discartCount++;
+    } else if (discartPeriod != 0 && discartCount == discartPeriod){
+        discartCount = 1;
         return false;
     }
 
+    if (mode == PASSTHROUGH || mode == CROP_VIEW){
+        if (!shareFrame(org, dst)){
+            return false;
+        }
+    } else {
+        if (!setAVFrame(inFrame, orgFrame, libavInPixFmt)){
+            return false;
+        }
+        
+        cropAVFrame(inFrame);
+
+        if (outputWidth == 0){
+            outWidth = winWidth;
+        } else {
+            outWidth = outputWidth;
+        }
+        
+        if (outputHeight == 0){
+            outHeight = winHeight;
+        } else {
+            outHeight = outputHeight;
+        }
+        
+        dstFrame->setLength(av_image_get_buffer_size(libavOutPixFmt, outWidth, outHeight, 1));
+        dstFrame->setSize(outWidth, outHeight);
+        dstFrame->setPixelFormat(outPixFmt);
+
+        if (!setAVFrame(outFrame, dstFrame, libavOutPixFmt)){
+            return false;
+        }
+        
+        if (!scaleSlices()){
+            utils::errorMsg("Could not convert image");
+            return false;
+        }
+    }
+
     dst->setConsumed(true);
     dst->setPresentationTime(org->getPresentationTime());
     dst->setOriginTime(org->getOriginTime());
@@ -166,12 +372,19 @@ bool VideoResampler::doProcessFrame(Frame *org, Frame *dst)
 }
 
 
-bool VideoResampler::configure0(int width, int height, int period, PixType pixelFormat) 
+bool VideoResampler::configure0(int width, int height, int period, PixType pixelFormat, int threads_) 
 {
+    if (threads_ <= 0 || threads_ > MAX_RESAMPLER_THREADS){
+        utils::errorMsg("[Resampler] Invalid number of threads");
+        return false;
+    }
+    
     outputWidth = width;
     outputHeight = height;
     outPixFmt = pixelFormat;
     discartPeriod = period;
+    threads = threads_;
+    sliceWorkers.start(threads);
     
     libavOutPixFmt = getLibavPixFmt(outPixFmt);
     needsConfig = true;
@@ -183,9 +396,25 @@ bool VideoResampler::configure0(int width, int height, int period, PixType pixel
     return true;
 }
 
+bool VideoResampler::configCrop0(int x, int y, int width, int height)
+{
+    if (x < 0 || y < 0 || width < 0 || height < 0){
+        utils::errorMsg("[Resampler] Invalid crop window");
+        return false;
+    }
+    
+    cropX = x;
+    cropY = y;
+    cropWidth = width;
+    cropHeight = height;
+    needsConfig = true;
+    
+    return true;
+}
+
 bool VideoResampler::configEvent(Jzon::Node* params)
 {
-    int width, height, period;
+    int width, height, period, threadsNum;
     PixType pixelType;
        
     if (!params) {
@@ -196,6 +425,7 @@ bool VideoResampler::configEvent(Jzon::Node* params)
     height = outputHeight;
     period = discartPeriod;
     pixelType = outPixFmt;
+    threadsNum = threads;
     
     if (params->Has("width")){
         width = params->Get("width").ToInt();
@@ -211,13 +441,29 @@ bool VideoResampler::configEvent(Jzon::Node* params)
     
     if (params->Has("pixelFormat")){
         int pixel = params->Get("pixelFormat").ToInt();
-        if ((pixel < P_NONE) || (pixel > YUYV422)) {
+        if ((pixel < P_NONE) || (pixel > YUVJ420P)) {
             return false;
         }
         pixelType = static_cast<PixType> (pixel);
     }
+    
+    if (params->Has("threads")){
+        threadsNum = params->Get("threads").ToInt();
+    }
+    
+    if (params->Has("cropX") || params->Has("cropY") || 
+        params->Has("cropWidth") || params->Has("cropHeight")){
+        int x = params->Has("cropX") ? params->Get("cropX").ToInt() : cropX;
+        int y = params->Has("cropY") ? params->Get("cropY").ToInt() : cropY;
+        int w = params->Has("cropWidth") ? params->Get("cropWidth").ToInt() : cropWidth;
+        int h = params->Has("cropHeight") ? params->Get("cropHeight").ToInt() : cropHeight;
+        
+        if (!configCrop0(x, y, w, h)){
+            return false;
+        }
+    }
 
-    return configure0(width, height, period, pixelType);
+    return configure0(width, height, period, pixelType, threadsNum);
 }
 
 void VideoResampler::initializeEventMap()
@@ -227,7 +473,28 @@ void VideoResampler::initializeEventMap()
 
 void VideoResampler::doGetState(Jzon::Object &filterNode)
 {
-    //TODO:
+    filterNode.Add("width", outputWidth);
+    filterNode.Add("height", outputHeight);
+    filterNode.Add("discartPeriod", discartPeriod);
+    filterNode.Add("pixelFormat", utils::getPixTypeAsString(outPixFmt));
+    filterNode.Add("threads", (int) threads);
+    filterNode.Add("slices", (int) slices.size());
+    filterNode.Add("cropX", cropX);
+    filterNode.Add("cropY", cropY);
+    filterNode.Add("cropWidth", cropWidth);
+    filterNode.Add("cropHeight", cropHeight);
+    
+    switch (mode){
+        case PASSTHROUGH:
+            filterNode.Add("mode", "passthrough");
+            break;
+        case CROP_VIEW:
+            filterNode.Add("mode", "cropView");
+            break;
+        default:
+            filterNode.Add("mode", "scale");
+            break;
+    }
 }
 
 AVPixelFormat getLibavPixFmt(PixType pixType)
@@ -262,15 +529,22 @@ AVPixelFormat getLibavPixFmt(PixType pixType)
     return AV_PIX_FMT_NONE;
 }
 
-bool VideoResampler::setAVFrame(AVFrame *aFrame, VideoFrame* vFrame, AVPixelFormat format)
+bool VideoResampler::setAVFrame(AVFrame *aFrame, InterleavedVideoFrame* vFrame, AVPixelFormat format)
 {      
-    if (av_image_fill_arrays(aFrame->data, aFrame->linesize, vFrame->getDataBuf(), 
-            format, vFrame->getWidth(), 
-            vFrame->getHeight(), 1) <= 0){
+    unsigned char *planes[MAX_PLANES];
+    int strides[MAX_PLANES];
+    
+    //NOTE: input frames may be views of a bigger picture, planes keep its strides
+    if (vFrame->getPlanes(planes, strides) == 0){
         utils::errorMsg("Could not feed AVFrame");
         return false;
     }
     
+    for (int p = 0; p < AV_NUM_DATA_POINTERS; p++){
+        aFrame->data[p] = p < MAX_PLANES ? planes[p] : NULL;
+        aFrame->linesize[p] = p < MAX_PLANES ? strides[p] : 0;
+    }
+    
     aFrame->width = vFrame->getWidth();
     aFrame->height = vFrame->getHeight();
     aFrame->format = format;
@@ -278,13 +552,14 @@ bool VideoResampler::setAVFrame(AVFrame *aFrame, VideoFrame* vFrame, AVPixelForm
     return true;
 }
 
-bool VideoResampler::configure(int width, int height, int period, PixType pixelFormat) 
+bool VideoResampler::configure(int width, int height, int period, PixType pixelFormat, int threads) 
 {
     Jzon::Object root, params;
     root.Add("action", "configure");
     params.Add("width", width);
     params.Add("height", height);
     params.Add("pixelFormat", pixelFormat);
+    params.Add("threads", threads);
     root.Add("params", params);
 
     Event e(root, std::chrono::system_clock::now(), 0);
@@ -293,3 +568,18 @@ bool VideoResampler::configure(int width, int height, int period, PixType pixelF
 }
 
 
+
+bool VideoResampler::configCrop(int x, int y, int width, int height) 
+{
+    Jzon::Object root, params;
+    root.Add("action", "configure");
+    params.Add("cropX", x);
+    params.Add("cropY", y);
+    params.Add("cropWidth", width);
+    params.Add("cropHeight", height);
+    root.Add("params", params);
+
+    Event e(root, std::chrono::system_clock::now(), 0);
+    pushEvent(e); 
+    return true;
+}
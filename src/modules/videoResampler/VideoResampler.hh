@@ -28,29 +28,67 @@ extern "C" {
     #include <libswscale/swscale.h>
     #include <libavcodec/avcodec.h>
     #include <libavutil/imgutils.h>
+    #include <libavutil/pixdesc.h>
 }
 
+#include <vector>
+
 #include "../../VideoFrame.hh"
 #include "../../FrameQueue.hh"
 #include "../../Filter.hh"
 #include "../../StreamInfo.hh"
+#include "../../ParallelWorkers.hh"
+
+#define DEFAULT_RESAMPLER_THREADS 1
+#define MAX_RESAMPLER_THREADS 16
 
 class VideoResampler : public OneToOneFilter {
 
     public:
         VideoResampler();
         ~VideoResampler();
-        bool configure(int width, int height, int period, PixType pixelFormat);
+        /**
+        * Configures the output of the resampler
+        * @param width output width, 0 keeps the input one
+        * @param height output height, 0 keeps the input one
+        * @param period frame discarting period, 0 disables discarting
+        * @param pixelFormat output pixel format
+        * @param threads number of horizontal slices scaled concurrently
+        */
+        bool configure(int width, int height, int period, PixType pixelFormat, int threads = DEFAULT_RESAMPLER_THREADS);
+        /**
+        * Configures the input window to be resampled. Zero width or height extend the window
+        * up to the picture edge. When the window size matches the output size and no pixel
+        * conversion is needed the window is just copied, avoiding the scaler.
+        * @param x window upper left corner X position
+        * @param y window upper left corner Y position
+        * @param width window width
+        * @param height window height
+        */
+        bool configCrop(int x, int y, int width, int height);
         
     private:
-        bool configure0(int width, int height, int period, PixType pixelFormat);
+        /*! SCALE runs swscale, PASSTHROUGH forwards the input buffer by reference 
+            and CROP_VIEW forwards a strided view of the configured window. Both
+            views need the input pixel format, range changes included */
+        enum ResamplingMode {SCALE, PASSTHROUGH, CROP_VIEW};
+
+        bool configCrop0(int x, int y, int width, int height);
+        bool configure0(int width, int height, int period, PixType pixelFormat, int threads);
         bool doProcessFrame(Frame *org, Frame *dst);
         FrameQueue* allocQueue(ConnectionData cData);
         void initializeEventMap();
         bool configEvent(Jzon::Node* params);
         void doGetState(Jzon::Object &filterNode);
         bool reconfigure(VideoFrame* orgFrame);
-        bool setAVFrame(AVFrame *aFrame, VideoFrame* vFrame, AVPixelFormat format);
+        bool setAVFrame(AVFrame *aFrame, InterleavedVideoFrame* vFrame, AVPixelFormat format);
+        bool configWindow();
+        void cropAVFrame(AVFrame *aFrame);
+        bool shareFrame(Frame *org, Frame *dst);
+        bool configSlices(int inWidth, int inHeight, int outWidth, int outHeight);
+        void freeSlices();
+        bool scaleSlices();
+        int scaleSlice(unsigned slice);
         
         //NOTE: There is no need of specific reader configuration
         bool specificReaderConfig(int /*readerID*/, FrameQueue* /*queue*/)  {return true;};
@@ -60,16 +98,36 @@ class VideoResampler : public OneToOneFilter {
         bool specificWriterConfig(int /*writerID*/) {return true;};
         bool specificWriterDelete(int /*writerID*/) {return true;};
         
-        struct SwsContext   *imgConvertCtx;
         AVFrame             *inFrame, *outFrame;
+
+        /*! Each slice is an independent band of rows with its own swscale context,
+            so bands can be scaled concurrently. Band boundaries are aligned to the
+            chroma subsampling of both input and output formats. */
+        struct ScaleSlice {
+            struct SwsContext   *ctx;
+            int                 inY;
+            int                 inHeight;
+            int                 outY;
+            int                 outHeight;
+        };
+
+        std::vector<ScaleSlice> slices;
+        ParallelWorkers     sliceWorkers;
+
         AVPixelFormat       libavInPixFmt, libavOutPixFmt;
 
         StreamInfo          *outputStreamInfo;
 
         int                 outputWidth;
         int                 outputHeight;
+        int                 inputWidth;
+        int                 inputHeight;
+        int                 cropX, cropY, cropWidth, cropHeight;
+        int                 winX, winY, winWidth, winHeight;
+        ResamplingMode      mode;
         int                 discartCount;
         int                 discartPeriod;
+        unsigned            threads;
         PixType             inPixFmt, outPixFmt;
         bool                needsConfig;
 };
@@ -0,0 +1,296 @@
+/*
+ *  Rotation.cpp - Picture plane rotation kernels
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Rotation.hh"
+
+#include <cmath>
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static inline void copyPixel(unsigned char *dst, const unsigned char *src, int step)
+{
+    for (int i = 0; i < step; i++){
+        dst[i] = src[i];
+    }
+}
+
+#ifdef __SSE2__
+
+/*! 8x8 tile of 1 byte pixels. Source rows are loaded bottom-up for clockwise
+    rotations, then columns are stored as destination rows. */
+static inline void rotateTile8x8(const unsigned char *src, int srcStride,
+                                 unsigned char *dst, int dstStride, bool clockwise)
+{
+    __m128i a[8], b[4], c[4], d[4];
+
+    for (int i = 0; i < 8; i++){
+        a[i] = _mm_loadl_epi64((const __m128i*) (src + (clockwise ? 7 - i : i) * srcStride));
+    }
+
+    for (int i = 0; i < 4; i++){
+        b[i] = _mm_unpacklo_epi8(a[2*i], a[2*i + 1]);
+    }
+
+    c[0] = _mm_unpacklo_epi16(b[0], b[1]);
+    c[1] = _mm_unpackhi_epi16(b[0], b[1]);
+    c[2] = _mm_unpacklo_epi16(b[2], b[3]);
+    c[3] = _mm_unpackhi_epi16(b[2], b[3]);
+
+    d[0] = _mm_unpacklo_epi32(c[0], c[2]);
+    d[1] = _mm_unpackhi_epi32(c[0], c[2]);
+    d[2] = _mm_unpacklo_epi32(c[1], c[3]);
+    d[3] = _mm_unpackhi_epi32(c[1], c[3]);
+
+    for (int k = 0; k < 8; k++){
+        __m128i col = k % 2 ? _mm_srli_si128(d[k/2], 8) : d[k/2];
+        _mm_storel_epi64((__m128i*) (dst + (clockwise ? k : 7 - k) * dstStride), col);
+    }
+}
+
+/*! 4x4 tile of 4 byte pixels */
+static inline void rotateTile4x4(const unsigned char *src, int srcStride,
+                                 unsigned char *dst, int dstStride, bool clockwise)
+{
+    __m128i r[4], t[4], col[4];
+
+    for (int i = 0; i < 4; i++){
+        r[i] = _mm_loadu_si128((const __m128i*) (src + (clockwise ? 3 - i : i) * srcStride));
+    }
+
+    t[0] = _mm_unpacklo_epi32(r[0], r[1]);
+    t[1] = _mm_unpacklo_epi32(r[2], r[3]);
+    t[2] = _mm_unpackhi_epi32(r[0], r[1]);
+    t[3] = _mm_unpackhi_epi32(r[2], r[3]);
+
+    col[0] = _mm_unpacklo_epi64(t[0], t[1]);
+    col[1] = _mm_unpackhi_epi64(t[0], t[1]);
+    col[2] = _mm_unpacklo_epi64(t[2], t[3]);
+    col[3] = _mm_unpackhi_epi64(t[2], t[3]);
+
+    for (int k = 0; k < 4; k++){
+        _mm_storeu_si128((__m128i*) (dst + (clockwise ? k : 3 - k) * dstStride), col[k]);
+    }
+}
+
+#endif
+
+/*! Rotates by 90 (clockwise) or 270 the block of the plane starting at (x0, y0).
+    Source pixel (x, y) goes to (height - 1 - y, x) clockwise and to (y, width - 1 - x)
+    otherwise. */
+static void rotateBlock(const unsigned char *src, int srcStride, int width, int height, int step,
+                        unsigned char *dst, int dstStride, bool clockwise,
+                        int x0, int y0, int bWidth, int bHeight)
+{
+    int tile = 0;
+    int tiledWidth = 0;
+    int tiledHeight = 0;
+
+#ifdef __SSE2__
+    if (step == 1){
+        tile = 8;
+    } else if (step == 4){
+        tile = 4;
+    }
+
+    if (tile > 0){
+        tiledWidth = bWidth / tile * tile;
+        tiledHeight = bHeight / tile * tile;
+    }
+
+    for (int ty = 0; ty < tiledHeight; ty += tile){
+        for (int tx = 0; tx < tiledWidth; tx += tile){
+            int x = x0 + tx;
+            int y = y0 + ty;
+            int dx = clockwise ? height - tile - y : y;
+            int dy = clockwise ? x : width - tile - x;
+            const unsigned char *s = src + y * srcStride + x * step;
+            unsigned char *d = dst + dy * dstStride + dx * step;
+
+            if (tile == 8){
+                rotateTile8x8(s, srcStride, d, dstStride, clockwise);
+            } else {
+                rotateTile4x4(s, srcStride, d, dstStride, clockwise);
+            }
+        }
+    }
+#endif
+
+    for (int by = 0; by < bHeight; by++){
+        for (int bx = 0; bx < bWidth; bx++){
+            if (by < tiledHeight && bx < tiledWidth){
+                bx = tiledWidth - 1;
+                continue;
+            }
+
+            int x = x0 + bx;
+            int y = y0 + by;
+            int dx = clockwise ? height - 1 - y : y;
+            int dy = clockwise ? x : width - 1 - x;
+
+            copyPixel(dst + dy * dstStride + dx * step, src + y * srcStride + x * step, step);
+        }
+    }
+}
+
+static void rotateRow180(const unsigned char *src, int width, int step, unsigned char *dst)
+{
+    int x = 0;
+
+#ifdef __SSE2__
+    if (step == 1){
+        for (; x + 16 <= width; x += 16){
+            __m128i v = _mm_loadu_si128((const __m128i*) (src + x));
+            v = _mm_shuffle_epi32(v, 0x1B);
+            v = _mm_shufflelo_epi16(v, 0xB1);
+            v = _mm_shufflehi_epi16(v, 0xB1);
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            _mm_storeu_si128((__m128i*) (dst + width - x - 16), v);
+        }
+    } else if (step == 4){
+        for (; x + 4 <= width; x += 4){
+            __m128i v = _mm_loadu_si128((const __m128i*) (src + x * 4));
+            _mm_storeu_si128((__m128i*) (dst + (width - x - 4) * 4), _mm_shuffle_epi32(v, 0x1B));
+        }
+    }
+#endif
+
+    for (; x < width; x++){
+        copyPixel(dst + (width - 1 - x) * step, src + x * step, step);
+    }
+}
+
+namespace rotation
+{
+    int normalizeDegree(int degree)
+    {
+        return ((degree % 360) + 360) % 360;
+    }
+
+    void getRotatedSize(int width, int height, int degree, int &rWidth, int &rHeight)
+    {
+        double rad;
+
+        degree = normalizeDegree(degree);
+
+        if (degree == 0 || degree == 180){
+            rWidth = width;
+            rHeight = height;
+            return;
+        }
+
+        if (degree == 90 || degree == 270){
+            rWidth = height;
+            rHeight = width;
+            return;
+        }
+
+        rad = degree * M_PI / 180;
+        rWidth = (int) (std::fabs(width * std::cos(rad)) + std::fabs(height * std::sin(rad)) + 0.5);
+        rHeight = (int) (std::fabs(width * std::sin(rad)) + std::fabs(height * std::cos(rad)) + 0.5);
+    }
+
+    bool rotatePlane(const unsigned char *src, int srcStride, int width, int height, int step,
+                     unsigned char *dst, int dstStride, int degree)
+    {
+        degree = normalizeDegree(degree);
+
+        switch (degree){
+            case 0:
+                for (int y = 0; y < height; y++){
+                    memcpy(dst + y * dstStride, src + y * srcStride, width * step);
+                }
+                break;
+            case 180:
+                for (int y = 0; y < height; y++){
+                    rotateRow180(src + y * srcStride, width, step, dst + (height - 1 - y) * dstStride);
+                }
+                break;
+            case 90:
+            case 270:
+                for (int y = 0; y < height; y += ROTATION_BLOCK){
+                    for (int x = 0; x < width; x += ROTATION_BLOCK){
+                        rotateBlock(src, srcStride, width, height, step, dst, dstStride, degree == 90,
+                                    x, y, std::min(ROTATION_BLOCK, width - x), std::min(ROTATION_BLOCK, height - y));
+                    }
+                }
+                break;
+            default:
+                return false;
+        }
+
+        return true;
+    }
+
+    void rotatePlaneBilinear(const unsigned char *src, int srcStride, int width, int height, int step,
+                             unsigned char *dst, int dstStride, int dstWidth, int dstHeight,
+                             int degree, unsigned char fill)
+    {
+        const int64_t one = 1 << 16;
+        const int64_t maxX = (int64_t) (width - 1) << 16;
+        const int64_t maxY = (int64_t) (height - 1) << 16;
+        double rad = normalizeDegree(degree) * M_PI / 180;
+        double cosA = std::cos(rad);
+        double sinA = std::sin(rad);
+        double dstCX = (dstWidth - 1) / 2.0;
+        double dstCY = (dstHeight - 1) / 2.0;
+        double srcCX = (width - 1) / 2.0;
+        double srcCY = (height - 1) / 2.0;
+        int64_t stepX = std::llround(cosA * one);
+        int64_t stepY = std::llround(-sinA * one);
+
+        //NOTE: destination pixels are mapped back to the source with the inverse
+        //rotation, walking each row in 16.16 fixed point
+        for (int y = 0; y < dstHeight; y++){
+            unsigned char *d = dst + y * dstStride;
+            int64_t fx = std::llround((-dstCX * cosA + (y - dstCY) * sinA + srcCX) * one);
+            int64_t fy = std::llround((dstCX * sinA + (y - dstCY) * cosA + srcCY) * one);
+
+            for (int x = 0; x < dstWidth; x++, d += step, fx += stepX, fy += stepY){
+                if (fx < -one/2 || fy < -one/2 || fx > maxX + one/2 || fy > maxY + one/2){
+                    memset(d, fill, step);
+                    continue;
+                }
+
+                int64_t cx = std::min(std::max(fx, (int64_t) 0), maxX);
+                int64_t cy = std::min(std::max(fy, (int64_t) 0), maxY);
+                int x0 = cx >> 16;
+                int y0 = cy >> 16;
+                int wx = (cx >> 8) & 0xFF;
+                int wy = (cy >> 8) & 0xFF;
+                const unsigned char *p00 = src + y0 * srcStride + x0 * step;
+                const unsigned char *p01 = p00 + (x0 + 1 < width ? step : 0);
+                const unsigned char *p10 = p00 + (y0 + 1 < height ? srcStride : 0);
+                const unsigned char *p11 = p10 + (x0 + 1 < width ? step : 0);
+
+                for (int b = 0; b < step; b++){
+                    int top = p00[b] * (256 - wx) + p01[b] * wx;
+                    int bottom = p10[b] * (256 - wx) + p11[b] * wx;
+                    d[b] = (top * (256 - wy) + bottom * wy + (1 << 15)) >> 16;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ *  Rotation.hh - Picture plane rotation kernels
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This file is part of media-streamer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _ROTATION_HH
+#define _ROTATION_HH
+
+//NOTE: side in pixels of the square tiles rotated at once, a tile of
+//the source and its rotated destination fit in L1 cache
+#define ROTATION_BLOCK 32
+
+/*! Rotation of picture planes. Pixels are 'step' bytes long and degrees are
+    clockwise. Planes are accessed through their strides, so they can be regions
+    of bigger pictures. */
+
+namespace rotation
+{
+    /**
+    * Normalizes an angle to [0, 360)
+    * @param degree angle in degrees
+    * @return normalized angle
+    */
+    int normalizeDegree(int degree);
+
+    /**
+    * Computes the size of a rotated picture, which is the bounding box of the
+    * rotated rectangle for angles other than multiples of 90
+    * @param width of the picture
+    * @param height of the picture
+    * @param degree clockwise angle in degrees
+    * @param rWidth width of the rotated picture
+    * @param rHeight height of the rotated picture
+    */
+    void getRotatedSize(int width, int height, int degree, int &rWidth, int &rHeight);
+
+    /**
+    * Rotates a plane by a multiple of 90 degrees, using cache blocked transposes
+    * @param src first pixel of the source plane
+    * @param srcStride bytes between source lines
+    * @param width of the source plane
+    * @param height of the source plane
+    * @param step bytes per pixel
+    * @param dst first pixel of the destination plane, of getRotatedSize size
+    * @param dstStride bytes between destination lines
+    * @param degree 90, 180 or 270
+    * @return false if degree is not a multiple of 90
+    */
+    bool rotatePlane(const unsigned char *src, int srcStride, int width, int height, int step,
+                     unsigned char *dst, int dstStride, int degree);
+
+    /**
+    * Rotates a plane by any angle around its center using bilinear sampling.
+    * Destination pixels falling out of the source are set to fill value.
+    * @param src first pixel of the source plane
+    * @param srcStride bytes between source lines
+    * @param width of the source plane
+    * @param height of the source plane
+    * @param step bytes per pixel
+    * @param dst first pixel of the destination plane
+    * @param dstStride bytes between destination lines
+    * @param dstWidth width of the destination plane
+    * @param dstHeight height of the destination plane
+    * @param degree clockwise angle in degrees
+    * @param fill value for uncovered destination bytes
+    */
+    void rotatePlaneBilinear(const unsigned char *src, int srcStride, int width, int height, int step,
+                             unsigned char *dst, int dstStride, int dstWidth, int dstHeight,
+                             int degree, unsigned char fill);
+}
+
+#endif
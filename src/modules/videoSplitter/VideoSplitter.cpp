@@ -21,6 +21,7 @@
  */
 
 #include "VideoSplitter.hh"
+#include "Rotation.hh"
 #include "../../AVFramedQueue.hh"
 #include <iostream>
 #include <chrono> 
@@ -41,9 +42,6 @@ void CropConfig::config(int width, int height, int x, int y, int degree)
     this->x = x;
     this->y = y;
     this->degree = degree;
-    cv::Mat img(height, width, CV_8UC3);
-    img.copyTo(this->crop);
-
 }
 
 ///////////////////////////////////////////////////
@@ -120,34 +118,31 @@ FrameQueue* VideoSplitter::allocQueue(ConnectionData cData)
 bool VideoSplitter::doProcessFrame(Frame *org, std::map<int, Frame *> &dstFrames)
 {
 	bool processFrame = false;
-	int xROI = -1;
-	int yROI = -1;
-	int widthROI = 0;
-	int heightROI = 0;
-	VideoFrame *vFrame;
-	VideoFrame *vFrameDst;
-
-	vFrame = dynamic_cast<VideoFrame*>(org);
+	bool processed;
+	CropConfig *crop;
+	InterleavedVideoFrame *vFrame;
+	InterleavedVideoFrame *vFrameDst;
+
+	vFrame = dynamic_cast<InterleavedVideoFrame*>(org);
 	
 	if(!vFrame){
 		utils::errorMsg("[VideoSplitter] No origin frame");
 		return false;
 	}
 	
-	cv::Mat orgFrame(vFrame->getHeight(), vFrame->getWidth(), CV_8UC3, vFrame->getDataBuf());
-	
 	for (auto it : dstFrames){
-		xROI = cropsConfig[it.first]->getX();
-		yROI = cropsConfig[it.first]->getY();
-		widthROI = cropsConfig[it.first]->getWidth();
-		heightROI = cropsConfig[it.first]->getHeight();
-
-		if((xROI >= 0 || yROI >= 0 || widthROI > 0 || heightROI > 0) && xROI+widthROI <= vFrame->getWidth() && yROI+heightROI <= vFrame->getHeight()){
-			vFrameDst = dynamic_cast<VideoFrame*>(it.second);
-			cropsConfig[it.first]->getCrop()->data = vFrameDst->getDataBuf();
-			vFrameDst->setLength(widthROI * heightROI);
-    		vFrameDst->setSize(widthROI, heightROI);
-    		orgFrame(cv::Rect(xROI, yROI, widthROI, heightROI)).copyTo(cropsConfig[it.first]->getCropRect(0, 0, widthROI, heightROI));
+		crop = cropsConfig[it.first];
+		vFrameDst = dynamic_cast<InterleavedVideoFrame*>(it.second);
+
+		if(!vFrameDst || crop->getWidth() <= 0 || crop->getHeight() <= 0){
+			processed = false;
+		} else if (rotation::normalizeDegree(crop->getDegree()) == 0){
+			processed = vFrameDst->shareBuffer(vFrame, crop->getX(), crop->getY(), crop->getWidth(), crop->getHeight());
+		} else {
+			processed = rotateCrop(vFrame, crop, vFrameDst);
+		}
+
+		if(processed){
 			it.second->setConsumed(true);
 			it.second->setPresentationTime(org->getPresentationTime());
 			it.second->setOriginTime(org->getOriginTime());
@@ -164,6 +159,68 @@ bool VideoSplitter::doProcessFrame(Frame *org, std::map<int, Frame *> &dstFrames
 	return processFrame;
 }
 
+bool VideoSplitter::rotateCrop(InterleavedVideoFrame *org, CropConfig *crop, InterleavedVideoFrame *dst)
+{
+	int step[MAX_PLANES], xShift[MAX_PLANES], yShift[MAX_PLANES];
+	unsigned char *orgPlanes[MAX_PLANES], *dstPlanes[MAX_PLANES];
+	int orgStrides[MAX_PLANES], dstStrides[MAX_PLANES];
+	int planesNum, degree, rWidth, rHeight;
+	unsigned length = 0;
+
+	if (crop->getX() + crop->getWidth() > org->getWidth() || crop->getY() + crop->getHeight() > org->getHeight()){
+		return false;
+	}
+
+	degree = rotation::normalizeDegree(crop->getDegree());
+	rotation::getRotatedSize(crop->getWidth(), crop->getHeight(), degree, rWidth, rHeight);
+	planesNum = org->getPlanesLayout(step, xShift, yShift);
+
+	if (planesNum == 0){
+		return false;
+	}
+
+	//NOTE: planes are rotated independently, so they must be equally subsampled in 
+	//both directions and the crop must start at a chroma sample
+	for (int p = 0; p < planesNum; p++){
+		if (xShift[p] != yShift[p] || (crop->getX() >> xShift[p]) << xShift[p] != crop->getX() ||
+				(crop->getY() >> yShift[p]) << yShift[p] != crop->getY()){
+			utils::errorMsg("[VideoSplitter] Rotation not supported for pixel format " + 
+							utils::getPixTypeAsString(org->getPixelFormat()) + " at this crop position");
+			return false;
+		}
+
+		length += (-((-rWidth) >> xShift[p])) * step[p] * (-((-rHeight) >> yShift[p]));
+	}
+
+	if (length > dst->getMaxLength()){
+		return false;
+	}
+
+	dst->setPixelFormat(org->getPixelFormat());
+	dst->setSize(rWidth, rHeight);
+	dst->setLength(length);
+
+	org->getPlanes(orgPlanes, orgStrides);
+	dst->getPlanes(dstPlanes, dstStrides);
+
+	for (int p = 0; p < planesNum; p++){
+		const unsigned char *src = orgPlanes[p] + (crop->getY() >> yShift[p]) * orgStrides[p] + 
+									(crop->getX() >> xShift[p]) * step[p];
+		int width = -((-crop->getWidth()) >> xShift[p]);
+		int height = -((-crop->getHeight()) >> yShift[p]);
+
+		if (degree % 90 == 0){
+			rotation::rotatePlane(src, orgStrides[p], width, height, step[p], dstPlanes[p], dstStrides[p], degree);
+		} else {
+			//NOTE: uncovered chroma samples of planar YUV are set to neutral grey
+			rotation::rotatePlaneBilinear(src, orgStrides[p], width, height, step[p], dstPlanes[p], dstStrides[p],
+									  -((-rWidth) >> xShift[p]), -((-rHeight) >> yShift[p]), degree, p > 0 ? 128 : 0);
+		}
+	}
+
+	return true;
+}
+
 void VideoSplitter::doGetState(Jzon::Object &filterNode)
 {
 	Jzon::Array jsonCropsConfigs;
@@ -26,7 +26,6 @@
 #include "../../VideoFrame.hh"
 #include "../../Filter.hh"
 #include "../../StreamInfo.hh"
-#include <opencv/cv.hpp>
 
 
 
@@ -43,7 +42,8 @@ class CropConfig {
 	    * @param height Channel
 	    * @param x Upper left corner X position
 	    * @param y Upper left corner Y position
-	    * @param degree [-360º,360º] rotate image
+	    * @param degree [-360º,360º] clockwise rotation of the crop, multiples of 90
+	    * are exact and other angles are bilinear interpolated
 	    */
 		void config(int width, int height, int x, int y, int degree = 0);
 
@@ -77,32 +77,18 @@ class CropConfig {
 	    */
 	    int getDegree() {return degree;};
 
-	    /**
-	    * Class constructor.
-	    * @return Crop
-	    */
-	    cv::Mat *getCrop() {return &crop;};
-
-	    /**
-	    * Class constructor.
-	    * @param x Upper left corner X position
-	    * @param y Upper left corner Y position
-	    * @param w width Channel
-	    * @param h height Channel 
-	    * @return Crop based on params
-	    */
-	    cv::Mat getCropRect(int x, int y, int w, int h) { return crop(cv::Rect(x,y,w,h)); };
 	private:
 		int width;
 	    int height;
 	    int x;
 	    int y;
 	    int degree;
-	    cv::Mat crop;
 };
 
 /*
-* 	Video Splitter
+* 	Video Splitter. Crops are not copied, each output frame is a view of the 
+*	region of the input frame buffer it refers to. Rotated crops are rotated 
+*	while copying them to the output frame.
 */
 
 class VideoSplitter : public OneToManyFilter {
@@ -151,6 +137,7 @@ class VideoSplitter : public OneToManyFilter {
         bool specificWriterDelete(int writerID);
 
 	private:
+		bool rotateCrop(InterleavedVideoFrame *org, CropConfig *crop, InterleavedVideoFrame *dst);
 		void initializeEventMap();
         bool configCropEvent(Jzon::Node* params);
         bool configureEvent(Jzon::Node* params);
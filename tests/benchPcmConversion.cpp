@@ -0,0 +1,135 @@
+#include "../src/PcmKernels.hh"
+#include "../src/AudioFrame.hh"
+#include "../src/Utils.hh"
+
+extern "C" {
+    #include <libavutil/channel_layout.h>
+    #include <libswresample/swresample.h>
+}
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define DEFAULT_ITERATIONS 20000
+#define BENCH_SAMPLES 1024
+
+struct Conversion {
+    SampleFmt srcFmt;
+    SampleFmt dstFmt;
+    AVSampleFormat srcLibavFmt;
+    AVSampleFormat dstLibavFmt;
+};
+
+static const Conversion conversions[] = {
+    {S16, FLTP, AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_FLTP},
+    {FLTP, S16, AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16},
+    {S16P, FLTP, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_FLTP},
+    {FLTP, S16P, AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16P},
+    {S16, S16P, AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S16P},
+    {S16P, S16, AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S16},
+    {FLT, FLTP, AV_SAMPLE_FMT_FLT, AV_SAMPLE_FMT_FLTP},
+    {FLTP, FLT, AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_FLT}
+};
+
+void usage() {
+    utils::infoMsg("Usage:\n"
+        "-c <channels, default 2>\n"
+        "-i <iterations, default " + std::to_string(DEFAULT_ITERATIONS) + ">\n"
+        "\n"
+        "benchpcm converts blocks of " + std::to_string(BENCH_SAMPLES) + " samples between sample formats\n"
+        "and layouts at the same rate with libswresample and with the PCM kernels used by\n"
+        "the audio decoder and encoder, and outputs the time per sample of both.\n");
+}
+
+static void setPlanes(std::vector<std::vector<unsigned char>> &buffers, SampleFmt fmt, unsigned channels,
+                      std::vector<unsigned char*> &planes)
+{
+    bool planar = fmt == U8P || fmt == S16P || fmt == FLTP;
+
+    planes.clear();
+
+    for (unsigned c = 0; c < (planar ? channels : 1); c++) {
+        planes.push_back(buffers[c].data());
+    }
+}
+
+int main (int argc, char *argv[]) {
+    unsigned channels = DEFAULT_CHANNELS;
+    unsigned iterations = DEFAULT_ITERATIONS;
+    std::vector<std::vector<unsigned char>> src;
+    std::vector<std::vector<unsigned char>> dst;
+    std::vector<unsigned char*> srcPlanes;
+    std::vector<unsigned char*> dstPlanes;
+    std::chrono::system_clock::time_point start;
+    std::chrono::nanoseconds swrTime;
+    std::chrono::nanoseconds kernelTime;
+    SwrContext *swrCtx;
+    int64_t layout;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i],"-c")==0 && i + 1 < argc) {
+            channels = std::stoi(argv[++i]);
+        } else if (strcmp(argv[i],"-i")==0 && i + 1 < argc) {
+            iterations = std::stoi(argv[++i]);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (channels == 0 || channels > MAX_CHANNELS || iterations == 0) {
+        usage();
+        return 1;
+    }
+
+    layout = av_get_default_channel_layout(channels);
+    src.assign(channels, std::vector<unsigned char>(BENCH_SAMPLES * channels * 4));
+    dst.assign(channels, std::vector<unsigned char>(BENCH_SAMPLES * channels * 4));
+
+    for (auto &plane : src) {
+        for (unsigned i = 0; i < plane.size() / 4; i++) {
+            ((float*) plane.data())[i] = (rand() / (float) RAND_MAX) * 2 - 1;
+        }
+    }
+
+    for (auto &conv : conversions) {
+        setPlanes(src, conv.srcFmt, channels, srcPlanes);
+        setPlanes(dst, conv.dstFmt, channels, dstPlanes);
+
+        swrCtx = swr_alloc_set_opts(NULL, layout, conv.dstLibavFmt, DEFAULT_SAMPLE_RATE,
+                                    layout, conv.srcLibavFmt, DEFAULT_SAMPLE_RATE, 0, NULL);
+
+        if (!swrCtx || swr_init(swrCtx) < 0) {
+            utils::errorMsg("Cannot initialize resample context");
+            return 1;
+        }
+
+        start = std::chrono::system_clock::now();
+
+        for (unsigned i = 0; i < iterations; i++) {
+            swr_convert(swrCtx, dstPlanes.data(), BENCH_SAMPLES, (const uint8_t**) srcPlanes.data(), BENCH_SAMPLES);
+        }
+
+        swrTime = std::chrono::system_clock::now() - start;
+        swr_free(&swrCtx);
+
+        start = std::chrono::system_clock::now();
+
+        for (unsigned i = 0; i < iterations; i++) {
+            pcmkernels::convert(srcPlanes.data(), conv.srcFmt, dstPlanes.data(), conv.dstFmt, channels, BENCH_SAMPLES);
+        }
+
+        kernelTime = std::chrono::system_clock::now() - start;
+
+        utils::infoMsg(utils::getSampleFormatAsString(conv.srcFmt) + " -> " +
+            utils::getSampleFormatAsString(conv.dstFmt) + ": swresample " +
+            std::to_string(swrTime.count() / (double) (iterations * BENCH_SAMPLES)) + " ns/sample, kernels " +
+            std::to_string(kernelTime.count() / (double) (iterations * BENCH_SAMPLES)) + " ns/sample (x" +
+            std::to_string(swrTime.count() / (double) std::max(kernelTime.count(), (int64_t) 1)) + ")");
+    }
+
+    return 0;
+}
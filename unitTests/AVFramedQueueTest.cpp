@@ -32,6 +32,7 @@
 #include <cppunit/XmlOutputter.h>
 
 #include "AVFramedQueue.hh"
+#include "VideoFrame.hh"
 #include "FilterMockup.hh"
 #include "Utils.hh"
 #include "StreamInfo.hh"
@@ -177,7 +178,133 @@ void AVFramedQueueTest::forceGetFrontTest()
     CPPUNIT_ASSERT(frame->getSequenceNumber() == seq - 1);
 }
 
+class VideoFrameQueueTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(VideoFrameQueueTest);
+    CPPUNIT_TEST(sharedBufferTest);
+    CPPUNIT_TEST(bufferViewTest);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+protected:
+    void sharedBufferTest();
+    void bufferViewTest();
+
+    ConnectionData cData;
+    ReaderData reader;
+    StreamInfo *si;
+
+    VideoFrameQueue* orgQ;
+    VideoFrameQueue* dstQ;
+};
+
+void VideoFrameQueueTest::setUp()
+{
+    cData.readers.push_back(reader);
+    si = new StreamInfo(VIDEO);
+    si->video.codec = RAW;
+    si->video.pixelFormat = RGB24;
+    orgQ = VideoFrameQueue::createNew(cData, si, 2);
+    dstQ = VideoFrameQueue::createNew(cData, si, 2);
+}
+
+void VideoFrameQueueTest::tearDown()
+{
+    delete orgQ;
+    delete dstQ;
+    delete si;
+}
+
+void VideoFrameQueueTest::sharedBufferTest()
+{
+    InterleavedVideoFrame *orgFrame, *dstFrame, *frame;
+    unsigned char *sharedBuf;
+
+    orgFrame = dynamic_cast<InterleavedVideoFrame*>(orgQ->getRear());
+    CPPUNIT_ASSERT(orgFrame);
+    memset(orgFrame->getDataBuf(), 1, orgFrame->getMaxLength());
+    orgFrame->setLength(orgFrame->getMaxLength());
+    orgQ->addFrame();
+
+    dstFrame = dynamic_cast<InterleavedVideoFrame*>(dstQ->getRear());
+    CPPUNIT_ASSERT(dstFrame);
+    dstFrame->shareBuffer(orgFrame);
+    dstQ->addFrame();
+
+    sharedBuf = orgFrame->getDataBuf();
+    CPPUNIT_ASSERT(dstFrame->getDataBuf() == sharedBuf);
+    CPPUNIT_ASSERT(dstFrame->getLength() == orgFrame->getLength());
+    CPPUNIT_ASSERT(orgFrame->isBufferShared() && dstFrame->isBufferShared());
+
+    // The writer gets the original frame back while the buffer is still referenced downstream
+    for (unsigned i = 0; i < 2; i++) {
+        CPPUNIT_ASSERT(orgQ->removeFrame() >= -1);
+        frame = dynamic_cast<InterleavedVideoFrame*>(orgQ->getRear());
+        CPPUNIT_ASSERT(frame);
+        orgQ->addFrame();
+    }
+
+    CPPUNIT_ASSERT(frame == orgFrame);
+    CPPUNIT_ASSERT(orgFrame->getDataBuf() != sharedBuf);
+    CPPUNIT_ASSERT(!orgFrame->isBufferShared());
+
+    memset(orgFrame->getDataBuf(), 2, orgFrame->getMaxLength());
+    CPPUNIT_ASSERT(dstFrame->getDataBuf() == sharedBuf);
+    CPPUNIT_ASSERT(dstFrame->getDataBuf()[0] == 1);
+    CPPUNIT_ASSERT(!dstFrame->isBufferShared());
+}
+
+void VideoFrameQueueTest::bufferViewTest()
+{
+    InterleavedVideoFrame *orgFrame, *dstFrame;
+    unsigned char *planes[MAX_PLANES];
+    int strides[MAX_PLANES];
+    unsigned char picture[2*2*3];
+
+    orgFrame = dynamic_cast<InterleavedVideoFrame*>(orgQ->getRear());
+    CPPUNIT_ASSERT(orgFrame);
+    orgFrame->setSize(4, 4);
+    orgFrame->setLength(4*4*3);
+    for (unsigned i = 0; i < 4*4*3; i++) {
+        orgFrame->getDataBuf()[i] = i;
+    }
+    orgQ->addFrame();
+
+    dstFrame = dynamic_cast<InterleavedVideoFrame*>(dstQ->getRear());
+    CPPUNIT_ASSERT(dstFrame);
+    CPPUNIT_ASSERT(!dstFrame->shareBuffer(orgFrame, 3, 3, 2, 2));
+    CPPUNIT_ASSERT(dstFrame->shareBuffer(orgFrame, 1, 2, 2, 2));
+
+    CPPUNIT_ASSERT(dstFrame->isView());
+    CPPUNIT_ASSERT(dstFrame->getWidth() == 2 && dstFrame->getHeight() == 2);
+    CPPUNIT_ASSERT(dstFrame->getLength() == 2*2*3);
+    CPPUNIT_ASSERT(dstFrame->getPlanes(planes, strides) == 1);
+    CPPUNIT_ASSERT(strides[0] == 4*3);
+    CPPUNIT_ASSERT(planes[0] == orgFrame->getDataBuf() + 2*4*3 + 1*3);
+
+    CPPUNIT_ASSERT(dstFrame->copyPicture(picture));
+    CPPUNIT_ASSERT(memcmp(picture, orgFrame->getDataBuf() + 2*4*3 + 3, 2*3) == 0);
+    CPPUNIT_ASSERT(memcmp(picture + 2*3, orgFrame->getDataBuf() + 3*4*3 + 3, 2*3) == 0);
+
+    dstFrame->setPixelFormat(YUV420P);
+    orgFrame->setPixelFormat(YUV420P);
+    CPPUNIT_ASSERT(!dstFrame->shareBuffer(orgFrame, 1, 2, 2, 2));
+    CPPUNIT_ASSERT(dstFrame->shareBuffer(orgFrame, 2, 2, 2, 2));
+    CPPUNIT_ASSERT(dstFrame->getPlanes(planes, strides) == 3);
+    CPPUNIT_ASSERT(strides[0] == 4 && strides[1] == 2 && strides[2] == 2);
+    CPPUNIT_ASSERT(planes[0] == orgFrame->getDataBuf() + 2*4 + 2);
+    CPPUNIT_ASSERT(planes[1] == orgFrame->getDataBuf() + 4*4 + 1*2 + 1);
+    CPPUNIT_ASSERT(planes[2] == orgFrame->getDataBuf() + 4*4 + 2*2 + 1*2 + 1);
+
+    dstFrame->detachBuffer();
+    CPPUNIT_ASSERT(!dstFrame->isView());
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(AVFramedQueueTest);
+CPPUNIT_TEST_SUITE_REGISTRATION(VideoFrameQueueTest);
 
 int main(int argc, char* argv[])
 {
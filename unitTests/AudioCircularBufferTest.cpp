@@ -47,6 +47,11 @@ class AudioCircularBufferTest : public CppUnit::TestFixture
     CPPUNIT_TEST(timestampGap);
     CPPUNIT_TEST(timestampOverlapping);
     CPPUNIT_TEST(flushBecauseOfDeviation);
+    CPPUNIT_TEST(levelMetering);
+    CPPUNIT_TEST(ringWrapAround);
+    CPPUNIT_TEST(multichannel);
+    CPPUNIT_TEST(zeroCopyRear);
+    CPPUNIT_TEST(adaptiveAlignment);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -59,6 +64,11 @@ protected:
     void timestampGap();
     void timestampOverlapping();
     void flushBecauseOfDeviation();
+    void levelMetering();
+    void ringWrapAround();
+    void multichannel();
+    void zeroCopyRear();
+    void adaptiveAlignment();
 
     struct ConnectionData cData;
 
@@ -326,6 +336,236 @@ void AudioCircularBufferTest::flushBecauseOfDeviation()
     buffer->removeFrame();
 }
 
+void AudioCircularBufferTest::levelMetering()
+{
+    AudioFrame* aFrame;
+    AudioFrame* outFrame;
+    unsigned samplesPerFrame = 40;
+
+    buffer->setOutputFrameSamples(samplesPerFrame);
+
+    aFrame = dynamic_cast<AudioFrame*>(buffer->getRear());
+    aFrame->fillWithValue(2);
+    aFrame->setSamples(samplesPerFrame);
+    aFrame->setPresentationTime(std::chrono::microseconds(0));
+    buffer->addFrame();
+
+    outFrame = dynamic_cast<AudioFrame*>(buffer->getFront());
+    CPPUNIT_ASSERT(outFrame);
+    CPPUNIT_ASSERT(outFrame->getLevel() < 0);
+    buffer->removeFrame();
+
+    buffer->setLevelMetering(true);
+
+    aFrame = dynamic_cast<AudioFrame*>(buffer->getRear());
+    aFrame->fillWithValue(2);
+    aFrame->setSamples(samplesPerFrame);
+    aFrame->setPresentationTime(std::chrono::microseconds(samplesPerFrame*std::micro::den/sampleRate));
+    buffer->addFrame();
+
+    //NOTE: every S16 sample is 0x0202
+    outFrame = dynamic_cast<AudioFrame*>(buffer->getFront());
+    CPPUNIT_ASSERT(outFrame);
+    CPPUNIT_ASSERT(outFrame->getLevel() == 0x0202/32768.0f);
+}
+
+void AudioCircularBufferTest::ringWrapAround()
+{
+    AudioFrame* aFrame;
+    Frame* outFrame;
+    int16_t* samples;
+    const unsigned samplesPerFrame = 1000;
+    const unsigned outputSamples = 768;
+    unsigned inSample = 0;
+    unsigned outSample = 0;
+    bool wrongSample = false;
+
+    buffer->setOutputFrameSamples(outputSamples);
+
+    //NOTE: several times the ring length, so frames are read across its end
+    for (unsigned f = 0; f < 100; f++) {
+        aFrame = dynamic_cast<AudioFrame*>(buffer->getRear());
+
+        for (unsigned c = 0; c < channels; c++) {
+            samples = (int16_t*) aFrame->getPlanarDataBuf()[c];
+
+            for (unsigned i = 0; i < samplesPerFrame; i++) {
+                samples[i] = (int16_t) ((inSample + i + c) & 0x7FFF);
+            }
+        }
+
+        aFrame->setSamples(samplesPerFrame);
+        aFrame->setPresentationTime(std::chrono::microseconds(inSample*std::micro::den/sampleRate));
+        buffer->addFrame();
+        inSample += samplesPerFrame;
+
+        while ((outFrame = buffer->getFront())) {
+            CPPUNIT_ASSERT(outFrame->getPresentationTime() == std::chrono::microseconds(outSample*std::micro::den/sampleRate));
+
+            for (unsigned c = 0; c < channels; c++) {
+                samples = (int16_t*) outFrame->getPlanarDataBuf()[c];
+
+                for (unsigned i = 0; i < outputSamples; i++) {
+                    wrongSample |= samples[i] != (int16_t) ((outSample + i + c) & 0x7FFF);
+                }
+            }
+
+            buffer->removeFrame();
+            outSample += outputSamples;
+        }
+    }
+
+    CPPUNIT_ASSERT(!wrongSample);
+    CPPUNIT_ASSERT(outSample > buffer->getChannelMaxSamples()*(sampleRate/1000));
+    CPPUNIT_ASSERT(buffer->getElements() == 0);
+}
+
+void AudioCircularBufferTest::multichannel()
+{
+    const unsigned surroundChannels = 6;
+    const unsigned samplesPerFrame = 40;
+    AudioCircularBuffer* surroundBuffer;
+    AudioFrame* aFrame;
+    Frame* outFrame;
+
+    CPPUNIT_ASSERT(!AudioCircularBuffer::createNew(cData, MAX_CHANNELS + 1, sampleRate, maxSamples, format));
+
+    surroundBuffer = AudioCircularBuffer::createNew(cData, surroundChannels, sampleRate, maxSamples, format);
+    CPPUNIT_ASSERT(surroundBuffer);
+    surroundBuffer->setOutputFrameSamples(samplesPerFrame);
+
+    aFrame = dynamic_cast<AudioFrame*>(surroundBuffer->getRear());
+    CPPUNIT_ASSERT(aFrame->getChannels() == surroundChannels);
+
+    for (unsigned c = 0; c < surroundChannels; c++) {
+        memset(aFrame->getPlanarDataBuf()[c], c, samplesPerFrame*bytesPerSample);
+    }
+
+    aFrame->setSamples(samplesPerFrame);
+    aFrame->setPresentationTime(std::chrono::microseconds(0));
+    surroundBuffer->addFrame();
+
+    outFrame = surroundBuffer->getFront();
+    CPPUNIT_ASSERT(outFrame);
+
+    for (unsigned c = 0; c < surroundChannels; c++) {
+        CPPUNIT_ASSERT(outFrame->getPlanarDataBuf()[c][0] == c);
+        CPPUNIT_ASSERT(outFrame->getPlanarDataBuf()[c][samplesPerFrame*bytesPerSample - 1] == c);
+    }
+
+    surroundBuffer->removeFrame();
+    delete surroundBuffer;
+}
+
+void AudioCircularBufferTest::zeroCopyRear()
+{
+    PlanarAudioFrame* aFrame;
+    Frame* outFrame;
+    unsigned char *first[MAX_CHANNELS];
+    unsigned char *second[MAX_CHANNELS];
+    unsigned firstSamples;
+    const unsigned samplesPerFrame = 40;
+
+    buffer->setOutputFrameSamples(samplesPerFrame);
+
+    aFrame = dynamic_cast<PlanarAudioFrame*>(buffer->getRear());
+    CPPUNIT_ASSERT(aFrame);
+    CPPUNIT_ASSERT(!aFrame->ownsPlanes());
+
+    //NOTE: the rear frame is the reserved ring space
+    CPPUNIT_ASSERT(buffer->reserveRear(samplesPerFrame, first, firstSamples, second));
+    CPPUNIT_ASSERT(firstSamples == samplesPerFrame);
+
+    for (unsigned c = 0; c < channels; c++) {
+        CPPUNIT_ASSERT(aFrame->getPlanarDataBuf()[c] == first[c]);
+        memset(aFrame->getPlanarDataBuf()[c], c + 1, samplesPerFrame*bytesPerSample);
+    }
+
+    //NOTE: the view only has planes for the buffer channels
+    aFrame->setChannels(channels + 1);
+    CPPUNIT_ASSERT(aFrame->getChannels() == channels);
+    CPPUNIT_ASSERT(!aFrame->ownsPlanes());
+    aFrame->setChannels(channels);
+    CPPUNIT_ASSERT(aFrame->getPlanarDataBuf()[0] == first[0]);
+
+    aFrame->setSamples(samplesPerFrame);
+    aFrame->setPresentationTime(std::chrono::microseconds(0));
+    CPPUNIT_ASSERT(buffer->getElements() == 0);
+    buffer->addFrame();
+    CPPUNIT_ASSERT(buffer->getElements() == 1);
+
+    outFrame = buffer->getFront();
+    CPPUNIT_ASSERT(outFrame);
+
+    for (unsigned c = 0; c < channels; c++) {
+        CPPUNIT_ASSERT(outFrame->getPlanarDataBuf()[c] == first[c]);
+        CPPUNIT_ASSERT(outFrame->getPlanarDataBuf()[c][samplesPerFrame*bytesPerSample - 1] == c + 1);
+    }
+
+    buffer->removeFrame();
+    CPPUNIT_ASSERT(buffer->getElements() == 0);
+}
+
+void AudioCircularBufferTest::adaptiveAlignment()
+{
+    AudioFrame* aFrame;
+    const unsigned samplesPerFrame = 480;
+    const std::chrono::microseconds frameTime(samplesPerFrame*std::micro::den/sampleRate);
+    const std::chrono::microseconds jitter(2000);
+    std::chrono::system_clock::time_point arrival(std::chrono::seconds(1));
+    std::chrono::microseconds pts(0);
+    int freeSamples;
+
+    buffer->setAdaptiveAlignment(true);
+    buffer->setOutputFrameSamples(samplesPerFrame);
+
+    //NOTE: frames arrive 2ms early or late, the reader consumes them as they are ready
+    for (unsigned f = 0; f < 100; f++) {
+        aFrame = dynamic_cast<AudioFrame*>(buffer->getRear());
+        aFrame->setSamples(samplesPerFrame);
+        aFrame->setPresentationTime(pts);
+        aFrame->setOriginTime(arrival + (f % 2 ? jitter : -jitter));
+        buffer->addFrame();
+        pts += frameTime;
+        arrival += frameTime;
+
+        while (buffer->getFront()) {
+            buffer->removeFrame();
+        }
+    }
+
+    //NOTE: 4ms interarrival deviation (192 samples) times JITTER_TARGET_FACTOR
+    CPPUNIT_ASSERT(buffer->getTargetSamples() > 600 && buffer->getTargetSamples() <= 768);
+
+    //NOTE: a timestamp deviation above MAX_DEVIATION_SAMPLES but below the jitter is absorbed
+    freeSamples = buffer->getFreeSamples();
+    aFrame = dynamic_cast<AudioFrame*>(buffer->getRear());
+    aFrame->setSamples(samplesPerFrame);
+    aFrame->setPresentationTime(pts + std::chrono::microseconds(3000));
+    aFrame->setOriginTime(arrival);
+    buffer->addFrame();
+    pts += frameTime;
+    arrival += frameTime;
+    CPPUNIT_ASSERT(freeSamples - buffer->getFreeSamples() < (int) samplesPerFrame*101/100);
+
+    //NOTE: the reader stops, so the fill goes above the target and input frames are shortened
+    freeSamples = buffer->getFreeSamples();
+
+    for (unsigned f = 0; f < 20; f++) {
+        aFrame = dynamic_cast<AudioFrame*>(buffer->getRear());
+        aFrame->setSamples(samplesPerFrame);
+        aFrame->setPresentationTime(pts);
+        aFrame->setOriginTime(arrival);
+        buffer->addFrame();
+        pts += frameTime;
+        arrival += frameTime;
+    }
+
+    freeSamples -= buffer->getFreeSamples();
+    CPPUNIT_ASSERT(freeSamples < (int) (20*samplesPerFrame));
+    CPPUNIT_ASSERT(freeSamples >= (int) (20*samplesPerFrame*(1 - MAX_DRIFT_CORRECTION)));
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(AudioCircularBufferTest);
 
 int main(int argc, char* argv[])
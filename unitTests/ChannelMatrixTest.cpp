@@ -0,0 +1,206 @@
+/*
+ *  ChannelMatrixTest.cpp - Channel matrices test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cmath>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "ChannelMatrix.hh"
+#include "Utils.hh"
+
+#define MINUS_3DB 0.7071068f
+#define EPSILON 1e-5
+
+//NOTE: libav channel order of the default layouts
+#define FL 0
+#define FR 1
+#define FC 2
+#define LFE 3
+#define SL_51 4
+#define SR_51 5
+#define BL_71 4
+#define BR_71 5
+#define SL_71 6
+#define SR_71 7
+
+class ChannelMatrixTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(ChannelMatrixTest);
+    CPPUNIT_TEST(invalidChannelsTest);
+    CPPUNIT_TEST(identityTest);
+    CPPUNIT_TEST(downmixTest);
+    CPPUNIT_TEST(upmixTest);
+    CPPUNIT_TEST(noClippingTest);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void invalidChannelsTest();
+    void identityTest();
+    void downmixTest();
+    void upmixTest();
+    void noClippingTest();
+
+    float coef(unsigned out, unsigned in) {return matrix[out*inChannels + in];};
+    void getMatrix(unsigned in, unsigned out);
+
+    std::vector<float> matrix;
+    unsigned inChannels;
+};
+
+void ChannelMatrixTest::getMatrix(unsigned in, unsigned out)
+{
+    inChannels = in;
+    CPPUNIT_ASSERT(channelmatrix::getMatrix(in, out, matrix));
+    CPPUNIT_ASSERT(matrix.size() == in*out);
+}
+
+void ChannelMatrixTest::invalidChannelsTest()
+{
+    CPPUNIT_ASSERT(!channelmatrix::getMatrix(0, 2, matrix));
+    CPPUNIT_ASSERT(!channelmatrix::getMatrix(2, 0, matrix));
+}
+
+void ChannelMatrixTest::identityTest()
+{
+    unsigned channels[] = {1, 2, 3, 6, 8};
+
+    //NOTE: default and unknown layouts are passed through as they are
+    for (unsigned ch : channels) {
+        getMatrix(ch, ch);
+
+        for (unsigned o = 0; o < ch; o++) {
+            for (unsigned i = 0; i < ch; i++) {
+                CPPUNIT_ASSERT(coef(o, i) == (o == i ? 1 : 0));
+            }
+        }
+    }
+
+    //NOTE: unknown layouts map each channel to the same index
+    getMatrix(3, 4);
+
+    for (unsigned o = 0; o < 4; o++) {
+        for (unsigned i = 0; i < 3; i++) {
+            CPPUNIT_ASSERT(coef(o, i) == (o == i ? 1 : 0));
+        }
+    }
+}
+
+void ChannelMatrixTest::downmixTest()
+{
+    float norm = 1 + 2*MINUS_3DB;
+
+    getMatrix(2, 1);
+    CPPUNIT_ASSERT(std::fabs(coef(0, FL) - 0.5) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(0, FR) - 0.5) < EPSILON);
+
+    //NOTE: centre and surrounds are folded into the fronts at -3dB, LFE is dropped
+    getMatrix(6, 2);
+    CPPUNIT_ASSERT(std::fabs(coef(FL, FL) - 1/norm) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(FL, FC) - MINUS_3DB/norm) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(FL, SL_51) - MINUS_3DB/norm) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(FR, FR) - 1/norm) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(FR, FC) - MINUS_3DB/norm) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(FR, SR_51) - MINUS_3DB/norm) < EPSILON);
+    CPPUNIT_ASSERT(coef(FL, FR) == 0 && coef(FL, SR_51) == 0);
+    CPPUNIT_ASSERT(coef(FR, FL) == 0 && coef(FR, SL_51) == 0);
+    CPPUNIT_ASSERT(coef(FL, LFE) == 0 && coef(FR, LFE) == 0);
+
+    //NOTE: backs are folded into the sides of the same side
+    getMatrix(8, 6);
+    CPPUNIT_ASSERT(std::fabs(coef(SL_51, BL_71) - 0.5) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(SL_51, SL_71) - 0.5) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(SR_51, BR_71) - 0.5) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(SR_51, SR_71) - 0.5) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(LFE, LFE) - 0.5) < EPSILON);
+    CPPUNIT_ASSERT(coef(SL_51, BR_71) == 0 && coef(SR_51, BL_71) == 0);
+}
+
+void ChannelMatrixTest::upmixTest()
+{
+    getMatrix(1, 2);
+    CPPUNIT_ASSERT(std::fabs(coef(FL, 0) - MINUS_3DB) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(FR, 0) - MINUS_3DB) < EPSILON);
+
+    //NOTE: stereo fronts feed the surrounds, centre and LFE stay silent
+    getMatrix(2, 6);
+    CPPUNIT_ASSERT(coef(FL, FL) == 1 && coef(FR, FR) == 1);
+    CPPUNIT_ASSERT(coef(FL, FR) == 0 && coef(FR, FL) == 0);
+    CPPUNIT_ASSERT(coef(FC, FL) == 0 && coef(FC, FR) == 0);
+    CPPUNIT_ASSERT(coef(LFE, FL) == 0 && coef(LFE, FR) == 0);
+    CPPUNIT_ASSERT(std::fabs(coef(SL_51, FL) - MINUS_3DB) < EPSILON && coef(SL_51, FR) == 0);
+    CPPUNIT_ASSERT(std::fabs(coef(SR_51, FR) - MINUS_3DB) < EPSILON && coef(SR_51, FL) == 0);
+
+    //NOTE: two surrounds per side share the power of the front
+    getMatrix(2, 8);
+    CPPUNIT_ASSERT(std::fabs(coef(BL_71, FL) - 0.5) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(SL_71, FL) - 0.5) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(BR_71, FR) - 0.5) < EPSILON);
+    CPPUNIT_ASSERT(std::fabs(coef(SR_71, FR) - 0.5) < EPSILON);
+}
+
+void ChannelMatrixTest::noClippingTest()
+{
+    unsigned channels[] = {1, 2, 6, 8};
+    float sum;
+
+    for (unsigned in : channels) {
+        for (unsigned out : channels) {
+            getMatrix(in, out);
+
+            //NOTE: every input channel at full scale and in phase does not clip any output
+            for (unsigned o = 0; o < out; o++) {
+                sum = 0;
+
+                for (unsigned i = 0; i < in; i++) {
+                    CPPUNIT_ASSERT(coef(o, i) >= 0);
+                    sum += coef(o, i);
+                }
+
+                CPPUNIT_ASSERT(sum <= 1 + EPSILON);
+            }
+        }
+    }
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ChannelMatrixTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("ChannelMatrixTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
@@ -37,6 +37,7 @@
 
 #define VIDEO_FRAMES    1000
 #define BITS_X_BYTE     8
+#define FRAME_THREADS   4
 
 class VideoEncoderDecoderFunctionalTest : public CppUnit::TestFixture
 {
@@ -44,6 +45,7 @@ class VideoEncoderDecoderFunctionalTest : public CppUnit::TestFixture
     CPPUNIT_TEST(test500);
     CPPUNIT_TEST(test2000);
     CPPUNIT_TEST(test4000);
+    CPPUNIT_TEST(frameThreadingTest);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -54,6 +56,7 @@ protected:
     void test500();
     void test2000();
     void test4000();
+    void frameThreadingTest();
 
     OneToOneVideoScenarioMockup *x264encodingSce, *x265encodingSce, *x264decodingSce, *x265decodingSce;
     VideoEncoderX264or5* x264encoder;
@@ -317,6 +320,41 @@ void VideoEncoderDecoderFunctionalTest::test4000()
     CPPUNIT_ASSERT(milestone);
 }
 
+void VideoEncoderDecoderFunctionalTest::frameThreadingTest()
+{
+    InterleavedVideoFrame *frame = NULL;
+    unsigned codedFrames = 0;
+    unsigned decodedFrames = 0;
+    int ret;
+
+    CPPUNIT_ASSERT(x264decoder->configure(FRAME_THREADS, true));
+    CPPUNIT_ASSERT(reader->openFile("testsData/videoVectorTest.h264", H264));
+
+    while((frame = reader->getFrame())!=NULL){
+        codedFrames++;
+        x264decodingSce->processFrame(frame);
+        while (x264decodingSce->extractFrame()){
+            decodedFrames++;
+        }
+    }
+
+    reader->close();
+
+    //NOTE: reopening the decoder drains the pictures held by its threads, which are
+    //output without new input
+    CPPUNIT_ASSERT(x264decoder->configure(DEFAULT_DECODER_THREADS, false));
+
+    for (unsigned i = 0; i <= FRAME_THREADS; i++){
+        x264decoder->processFrame(ret);
+        while (x264decodingSce->extractFrame()){
+            decodedFrames++;
+        }
+    }
+
+    CPPUNIT_ASSERT(codedFrames > 0);
+    CPPUNIT_ASSERT(decodedFrames == codedFrames);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(VideoEncoderDecoderFunctionalTest);
 
 int main(int argc, char* argv[])
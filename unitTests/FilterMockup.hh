@@ -445,7 +445,11 @@ protected:
                                                           DEFAULT_WIDTH, DEFAULT_HEIGHT, orgFrame->getPixelFormat());
             }
             
-            memmove(oFrame->getDataBuf(), orgFrame->getDataBuf(), sizeof(unsigned char)*orgFrame->getLength());
+            if (orgFrame->isView()){
+                orgFrame->copyPicture(oFrame->getDataBuf());
+            } else {
+                memmove(oFrame->getDataBuf(), orgFrame->getDataBuf(), sizeof(unsigned char)*orgFrame->getLength());
+            }
             
             oFrame->setLength(orgFrame->getLength());
             oFrame->setSize(orgFrame->getWidth(), orgFrame->getHeight());
@@ -0,0 +1,189 @@
+/*
+ *  ParallelWorkersTest.cpp - ParallelWorkers class test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "ParallelWorkers.hh"
+#include "Utils.hh"
+
+#define TASKS 4
+#define RUNS 200
+
+class ParallelWorkersTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(ParallelWorkersTest);
+    CPPUNIT_TEST(singleTaskTest);
+    CPPUNIT_TEST(concurrentTasksTest);
+    CPPUNIT_TEST(repeatedRunsTest);
+    CPPUNIT_TEST(moreTasksTest);
+    CPPUNIT_TEST(runAfterStopTest);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+protected:
+    void singleTaskTest();
+    void concurrentTasksTest();
+    void repeatedRunsTest();
+    void moreTasksTest();
+    void runAfterStopTest();
+
+    //NOTE: runs the tasks once, recording the thread of each one
+    void runTasks(unsigned tasks);
+
+    ParallelWorkers* workers;
+    std::vector<std::thread::id> threads;
+    std::vector<unsigned> calls;
+};
+
+void ParallelWorkersTest::setUp()
+{
+    workers = new ParallelWorkers();
+}
+
+void ParallelWorkersTest::tearDown()
+{
+    delete workers;
+}
+
+void ParallelWorkersTest::runTasks(unsigned tasks)
+{
+    threads.assign(tasks, std::thread::id());
+    calls.assign(tasks, 0);
+
+    workers->run(tasks, [this](unsigned i){
+        threads[i] = std::this_thread::get_id();
+        calls[i]++;
+    });
+
+    for (unsigned i = 0; i < tasks; i++) {
+        CPPUNIT_ASSERT(calls[i] == 1);
+    }
+}
+
+void ParallelWorkersTest::singleTaskTest()
+{
+    workers->run(0, [this](unsigned){calls.push_back(0);});
+    CPPUNIT_ASSERT(calls.empty());
+
+    //NOTE: a single task runs on the caller thread without starting workers
+    runTasks(1);
+    CPPUNIT_ASSERT(threads[0] == std::this_thread::get_id());
+    CPPUNIT_ASSERT(workers->getThreads() == 0);
+}
+
+void ParallelWorkersTest::concurrentTasksTest()
+{
+    std::atomic<unsigned> started(0);
+
+    runTasks(TASKS);
+    CPPUNIT_ASSERT(workers->getThreads() == TASKS - 1);
+    CPPUNIT_ASSERT(threads[0] == std::this_thread::get_id());
+
+    for (unsigned i = 1; i < TASKS; i++) {
+        CPPUNIT_ASSERT(threads[i] != threads[0]);
+        CPPUNIT_ASSERT(std::count(threads.begin(), threads.end(), threads[i]) == 1);
+    }
+
+    //NOTE: each task waits for all the others to start, so it only ends if they run at once
+    workers->run(TASKS, [&started](unsigned){
+        started++;
+
+        while (started < TASKS) {
+            std::this_thread::yield();
+        }
+    });
+
+    CPPUNIT_ASSERT(started == TASKS);
+}
+
+void ParallelWorkersTest::repeatedRunsTest()
+{
+    std::vector<std::thread::id> firstThreads;
+
+    runTasks(TASKS);
+    firstThreads = threads;
+
+    //NOTE: threads are kept between runs, and task i always runs on the same one
+    for (unsigned r = 0; r < RUNS; r++) {
+        runTasks(r % 2 == 0 ? TASKS : 2);
+        CPPUNIT_ASSERT(std::equal(threads.begin(), threads.end(), firstThreads.begin()));
+    }
+
+    CPPUNIT_ASSERT(workers->getThreads() == TASKS - 1);
+}
+
+void ParallelWorkersTest::moreTasksTest()
+{
+    runTasks(2);
+    CPPUNIT_ASSERT(workers->getThreads() == 1);
+
+    runTasks(TASKS * 2);
+    CPPUNIT_ASSERT(workers->getThreads() == TASKS * 2 - 1);
+}
+
+void ParallelWorkersTest::runAfterStopTest()
+{
+    runTasks(TASKS);
+    workers->stop();
+    CPPUNIT_ASSERT(workers->getThreads() == 0);
+
+    //NOTE: tasks run on the caller thread instead of waiting for stopped workers
+    runTasks(TASKS);
+    CPPUNIT_ASSERT(workers->getThreads() == 0);
+
+    for (unsigned i = 0; i < TASKS; i++) {
+        CPPUNIT_ASSERT(threads[i] == std::this_thread::get_id());
+    }
+
+    workers->stop();
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ParallelWorkersTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("ParallelWorkersTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
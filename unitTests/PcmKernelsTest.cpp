@@ -0,0 +1,275 @@
+/*
+ *  PcmKernelsTest.cpp - PcmKernels test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "PcmKernels.hh"
+#include "AudioFrame.hh"
+#include "Utils.hh"
+
+//NOTE: mono and the vectorized stereo, plus channel counts only handled by scalar loops
+static const unsigned channelsList[] = {1, 2, 3, 6};
+//NOTE: tails of the 4 and 8 samples vectors and of the 256 samples conversion blocks
+static const unsigned samplesList[] = {1, 7, 9, 255, 257, 300};
+static const SampleFmt formats[] = {U8, S16, FLT, U8P, S16P, FLTP};
+
+static unsigned sampleBytes(SampleFmt fmt)
+{
+    return (fmt == U8 || fmt == U8P) ? 1 : ((fmt == S16 || fmt == S16P) ? 2 : 4);
+}
+
+static bool isPlanar(SampleFmt fmt)
+{
+    return fmt == U8P || fmt == S16P || fmt == FLTP;
+}
+
+/*! Planes of a format, interleaved formats use the first one only */
+struct Planes {
+    Planes(SampleFmt fmt_, unsigned channels_, unsigned samples_) :
+        fmt(fmt_), channels(channels_), samples(samples_),
+        data(channels_, std::vector<unsigned char>(samples_ * channels_ * 4 + 1)) {
+        for (unsigned c = 0; c < channels; c++) {
+            //NOTE: planes start one byte after the allocation, so loads and stores are unaligned
+            planes.push_back(data[c].data() + 1);
+        }
+    };
+
+    unsigned char *sample(unsigned c, unsigned i) {
+        return isPlanar(fmt) ? planes[c] + i * sampleBytes(fmt) :
+                               planes[0] + (i * channels + c) * sampleBytes(fmt);
+    };
+
+    int16_t getS16(unsigned c, unsigned i) {
+        int16_t s;
+        memcpy(&s, sample(c, i), sizeof(s));
+        return s;
+    };
+
+    float getFlt(unsigned c, unsigned i) {
+        float s;
+        memcpy(&s, sample(c, i), sizeof(s));
+        return s;
+    };
+
+    void setS16(unsigned c, unsigned i, int16_t s) {memcpy(sample(c, i), &s, sizeof(s));};
+    void setFlt(unsigned c, unsigned i, float s) {memcpy(sample(c, i), &s, sizeof(s));};
+
+    SampleFmt fmt;
+    unsigned channels;
+    unsigned samples;
+    std::vector<std::vector<unsigned char>> data;
+    std::vector<unsigned char*> planes;
+};
+
+class PcmKernelsTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(PcmKernelsTest);
+    CPPUNIT_TEST(supportedTest);
+    CPPUNIT_TEST(s16ToFltTest);
+    CPPUNIT_TEST(fltClippingTest);
+    CPPUNIT_TEST(s16RoundingTest);
+    CPPUNIT_TEST(s16RoundTripTest);
+    CPPUNIT_TEST(layoutTest);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void supportedTest();
+    void s16ToFltTest();
+    void fltClippingTest();
+    void s16RoundingTest();
+    void s16RoundTripTest();
+    void layoutTest();
+
+    bool convert(Planes &src, Planes &dst);
+};
+
+bool PcmKernelsTest::convert(Planes &src, Planes &dst)
+{
+    std::vector<const unsigned char*> srcPlanes(src.planes.begin(), src.planes.end());
+
+    return pcmkernels::convert(srcPlanes.data(), src.fmt, dst.planes.data(), dst.fmt,
+                               src.channels, src.samples);
+}
+
+void PcmKernelsTest::supportedTest()
+{
+    Planes src(S16, 2, 8);
+    Planes dst(FLTP, 2, 8);
+
+    for (auto srcFmt : formats) {
+        for (auto dstFmt : formats) {
+            CPPUNIT_ASSERT(pcmkernels::isSupported(srcFmt, dstFmt));
+        }
+    }
+
+    CPPUNIT_ASSERT(!pcmkernels::isSupported(S_NONE, S16));
+    CPPUNIT_ASSERT(!pcmkernels::isSupported(FLTP, S_NONE));
+    CPPUNIT_ASSERT(!pcmkernels::convert(NULL, S_NONE, dst.planes.data(), FLTP, 2, 8));
+
+    src.channels = 0;
+    CPPUNIT_ASSERT(!convert(src, dst));
+    src.channels = MAX_CHANNELS + 1;
+    CPPUNIT_ASSERT(!convert(src, dst));
+}
+
+void PcmKernelsTest::s16ToFltTest()
+{
+    //NOTE: decoder output (interleaved S16) to the mixer format (FLTP), left and right differ in sign
+    int16_t values[] = {0, 1, -1, 16384, -16384, 32767, -32768, 100, 12345, -12345, 7};
+    unsigned samples = sizeof(values) / sizeof(int16_t);
+    Planes src(S16, 2, samples);
+    Planes dst(FLTP, 2, samples);
+
+    for (unsigned i = 0; i < samples; i++) {
+        src.setS16(0, i, values[i]);
+        src.setS16(1, i, values[i] == -32768 ? 32767 : -values[i]);
+    }
+
+    CPPUNIT_ASSERT(convert(src, dst));
+
+    for (unsigned i = 0; i < samples; i++) {
+        CPPUNIT_ASSERT(dst.getFlt(0, i) == values[i] / 32768.0f);
+        CPPUNIT_ASSERT(dst.getFlt(1, i) == (values[i] == -32768 ? 32767 : -values[i]) / 32768.0f);
+    }
+}
+
+void PcmKernelsTest::fltClippingTest()
+{
+    float values[] = {0.0f, 0.5f, -0.5f, 1.0f, -1.0f, 1.5f, -1.5f, 100.0f, -100.0f, 2.0f, -2.0f};
+    int16_t expectedS16[] = {0, 16384, -16384, 32767, -32768, 32767, -32768, 32767, -32768, 32767, -32768};
+    unsigned char expectedU8[] = {128, 192, 64, 255, 0, 255, 0, 255, 0, 255, 0};
+    unsigned samples = sizeof(values) / sizeof(float);
+    Planes src(FLTP, 1, samples);
+    Planes s16(S16, 1, samples);
+    Planes u8(U8P, 1, samples);
+
+    for (unsigned i = 0; i < samples; i++) {
+        src.setFlt(0, i, values[i]);
+    }
+
+    //NOTE: samples out of [-1, 1] saturate instead of wrapping around
+    CPPUNIT_ASSERT(convert(src, s16));
+    CPPUNIT_ASSERT(convert(src, u8));
+
+    for (unsigned i = 0; i < samples; i++) {
+        CPPUNIT_ASSERT(s16.getS16(0, i) == expectedS16[i]);
+        CPPUNIT_ASSERT(*u8.sample(0, i) == expectedU8[i]);
+    }
+}
+
+void PcmKernelsTest::s16RoundingTest()
+{
+    //NOTE: halves round to even, the first 8 samples go through the vector path
+    float values[] = {0.4f, 0.5f, 0.6f, 1.5f, 2.5f, -0.5f, -0.6f, -1.5f, 32767.6f, -32768.6f, 0.6f};
+    int16_t expected[] = {0, 0, 1, 2, 2, 0, -1, -2, 32767, -32768, 1};
+    unsigned samples = sizeof(values) / sizeof(float);
+    Planes src(FLTP, 1, samples);
+    Planes dst(S16P, 1, samples);
+
+    for (unsigned i = 0; i < samples; i++) {
+        src.setFlt(0, i, values[i] / 32768.0f);
+    }
+
+    CPPUNIT_ASSERT(convert(src, dst));
+
+    for (unsigned i = 0; i < samples; i++) {
+        CPPUNIT_ASSERT(dst.getS16(0, i) == expected[i]);
+    }
+}
+
+void PcmKernelsTest::s16RoundTripTest()
+{
+    //NOTE: every S16 value, so decoding to the mixer format and encoding back is lossless
+    unsigned samples = 65536 / 2;
+    Planes src(S16, 2, samples);
+    Planes flt(FLTP, 2, samples);
+    Planes dst(S16, 2, samples);
+
+    for (unsigned i = 0; i < samples; i++) {
+        src.setS16(0, i, (int16_t) (i * 2 - 32768));
+        src.setS16(1, i, (int16_t) (i * 2 + 1 - 32768));
+    }
+
+    CPPUNIT_ASSERT(convert(src, flt));
+    CPPUNIT_ASSERT(convert(flt, dst));
+    CPPUNIT_ASSERT(dst.data == src.data);
+}
+
+void PcmKernelsTest::layoutTest()
+{
+    //NOTE: interleaving changes keep each sample in its channel and position
+    for (auto fmt : {U8, S16, FLT}) {
+        SampleFmt planarFmt = fmt == U8 ? U8P : (fmt == S16 ? S16P : FLTP);
+
+        for (auto channels : channelsList) {
+            for (auto samples : samplesList) {
+                Planes src(fmt, channels, samples);
+                Planes planar(planarFmt, channels, samples);
+                Planes dst(fmt, channels, samples);
+
+                for (unsigned c = 0; c < channels; c++) {
+                    for (unsigned i = 0; i < samples; i++) {
+                        memset(src.sample(c, i), c * 16 + i % 16, sampleBytes(fmt));
+                    }
+                }
+
+                CPPUNIT_ASSERT(convert(src, planar));
+
+                for (unsigned c = 0; c < channels; c++) {
+                    for (unsigned i = 0; i < samples; i++) {
+                        CPPUNIT_ASSERT(memcmp(planar.sample(c, i), src.sample(c, i), sampleBytes(fmt)) == 0);
+                    }
+                }
+
+                CPPUNIT_ASSERT(convert(planar, dst));
+                CPPUNIT_ASSERT(dst.data == src.data);
+            }
+        }
+    }
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(PcmKernelsTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("PcmKernelsTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
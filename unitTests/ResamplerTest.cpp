@@ -0,0 +1,279 @@
+/*
+ *  ResamplerTest.cpp - Resampler class test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "Resampler.hh"
+#include "AudioFrame.hh"
+#include "Utils.hh"
+
+#define CHANNELS 2
+#define AMPLITUDE 0.5
+//NOTE: one tone per channel, both in the passband of the 8k output
+#define TONE_0 1000.0
+#define TONE_1 440.0
+#define BLOCKS 50
+#define SINE_TOLERANCE 0.01
+#define OFFSET_TOLERANCE 1
+
+//NOTE: indexed by ResamplerQuality
+static const unsigned qualityTaps[] = {16, 32, 64};
+
+class ResamplerTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(ResamplerTest);
+    CPPUNIT_TEST(createTest);
+    CPPUNIT_TEST(upsample44To48Test);
+    CPPUNIT_TEST(downsample48To44Test);
+    CPPUNIT_TEST(downsample48To8Test);
+    CPPUNIT_TEST(decimationPhaseTest);
+    CPPUNIT_TEST(s16Test);
+    CPPUNIT_TEST(resetTest);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void createTest();
+    void upsample44To48Test();
+    void downsample48To44Test();
+    void downsample48To8Test();
+    void decimationPhaseTest();
+    void s16Test();
+    void resetTest();
+
+    /**
+    * Feeds blocks of a sine tone per channel and checks every output block: its
+    * length, its offset and its samples against the tone at the output instants
+    */
+    void checkTones(unsigned inRate, unsigned outRate, ResamplerQuality quality,
+                    unsigned blockSamples, SampleFmt inFmt, SampleFmt outFmt);
+
+    double tone(unsigned c, double seconds) {
+        return AMPLITUDE * std::sin(2 * M_PI * (c == 0 ? TONE_0 : TONE_1) * seconds);
+    };
+};
+
+void ResamplerTest::createTest()
+{
+    Resampler *resampler;
+
+    CPPUNIT_ASSERT(!Resampler::createNew(0, 44100, 48000));
+    CPPUNIT_ASSERT(!Resampler::createNew(MAX_CHANNELS + 1, 44100, 48000));
+    CPPUNIT_ASSERT(!Resampler::createNew(CHANNELS, 0, 48000));
+    CPPUNIT_ASSERT(!Resampler::createNew(CHANNELS, 44100, 0));
+    //NOTE: coprime rates need more phases than supported
+    CPPUNIT_ASSERT(!Resampler::createNew(CHANNELS, 44101, 48000));
+
+    resampler = Resampler::createNew(CHANNELS, 48000, 8000, RQ_HIGH);
+    CPPUNIT_ASSERT(resampler);
+    CPPUNIT_ASSERT(resampler->getChannels() == CHANNELS);
+    CPPUNIT_ASSERT(resampler->getInputRate() == 48000);
+    CPPUNIT_ASSERT(resampler->getOutputRate() == 8000);
+    CPPUNIT_ASSERT(resampler->getQuality() == RQ_HIGH);
+    CPPUNIT_ASSERT(resampler->getDelay() == std::chrono::microseconds(qualityTaps[RQ_HIGH] / 2 * 1000000 / 48000));
+    delete resampler;
+}
+
+void ResamplerTest::checkTones(unsigned inRate, unsigned outRate, ResamplerQuality quality,
+                               unsigned blockSamples, SampleFmt inFmt, SampleFmt outFmt)
+{
+    Resampler *resampler = Resampler::createNew(CHANNELS, inRate, outRate, quality);
+    unsigned halfTaps = qualityTaps[quality] / 2;
+    unsigned maxOutSamples = blockSamples * outRate / inRate + 2;
+    std::vector<std::vector<float>> inFlt(CHANNELS, std::vector<float>(blockSamples));
+    std::vector<std::vector<float>> outFlt(CHANNELS, std::vector<float>(maxOutSamples));
+    std::vector<int16_t> inS16(blockSamples * CHANNELS);
+    std::vector<int16_t> outS16(maxOutSamples * CHANNELS);
+    const unsigned char *in[CHANNELS];
+    unsigned char *out[CHANNELS];
+    std::chrono::microseconds offset;
+    uint64_t inputSamples = 0;
+    uint64_t outputSamples = 0;
+    uint64_t expectedSamples;
+    double expectedOffset;
+    double expected;
+    double sample;
+    int n;
+
+    CPPUNIT_ASSERT(resampler);
+
+    for (unsigned c = 0; c < CHANNELS; c++) {
+        in[c] = inFmt == FLTP ? (const unsigned char*) inFlt[c].data() : (const unsigned char*) inS16.data();
+        out[c] = outFmt == FLTP ? (unsigned char*) outFlt[c].data() : (unsigned char*) outS16.data();
+    }
+
+    for (unsigned b = 0; b < BLOCKS; b++) {
+        for (unsigned i = 0; i < blockSamples; i++) {
+            for (unsigned c = 0; c < CHANNELS; c++) {
+                sample = tone(c, (double) (inputSamples + i) / inRate);
+                inFlt[c][i] = sample;
+                inS16[i * CHANNELS + c] = (int16_t) lrint(sample * 32767);
+            }
+        }
+
+        n = resampler->process(in, inFmt, blockSamples, out, outFmt, maxOutSamples, offset);
+        CPPUNIT_ASSERT(n >= 0);
+
+        //NOTE: output sample k is at input sample k*inRate/outRate, it is output
+        //once the half window after it has been received
+        inputSamples += blockSamples;
+        expectedSamples = inputSamples > halfTaps ?
+            ((inputSamples - halfTaps) * outRate + inRate - 1) / inRate : 0;
+        CPPUNIT_ASSERT(outputSamples + n == expectedSamples);
+
+        expectedOffset = ((double) outputSamples * inRate / outRate - (inputSamples - blockSamples)) *
+                         std::micro::den / inRate;
+        CPPUNIT_ASSERT(std::fabs(offset.count() - expectedOffset) <= OFFSET_TOLERANCE);
+
+        for (int i = 0; i < n; i++) {
+            //NOTE: the first outputs are filtered with the silence before the first input sample
+            if ((outputSamples + i) * inRate < (uint64_t) halfTaps * outRate) {
+                continue;
+            }
+
+            for (unsigned c = 0; c < CHANNELS; c++) {
+                expected = tone(c, (double) (outputSamples + i) / outRate);
+                sample = outFmt == FLTP ? outFlt[c][i] : outS16[i * CHANNELS + c] / 32768.0;
+                CPPUNIT_ASSERT(std::fabs(sample - expected) <= SINE_TOLERANCE);
+            }
+        }
+
+        outputSamples += n;
+    }
+
+    delete resampler;
+}
+
+void ResamplerTest::upsample44To48Test()
+{
+    checkTones(44100, 48000, RQ_MEDIUM, 441, FLTP, FLTP);
+    //NOTE: blocks that are not a multiple of the rate ratio
+    checkTones(44100, 48000, RQ_HIGH, 1024, FLTP, FLTP);
+}
+
+void ResamplerTest::downsample48To44Test()
+{
+    checkTones(48000, 44100, RQ_MEDIUM, 480, FLTP, FLTP);
+    checkTones(48000, 44100, RQ_HIGH, 1000, FLTP, FLTP);
+}
+
+void ResamplerTest::downsample48To8Test()
+{
+    checkTones(48000, 8000, RQ_MEDIUM, 960, FLTP, FLTP);
+    checkTones(48000, 8000, RQ_HIGH, 1001, FLTP, FLTP);
+}
+
+void ResamplerTest::decimationPhaseTest()
+{
+    //NOTE: consecutive outputs are further apart than the filter taps, and blocks are
+    //shorter than that, so the next output window often starts after the last input sample
+    unsigned inRate = 48000;
+    unsigned outRate = 2000;
+    unsigned blockSamples = 5;
+    unsigned halfTaps = qualityTaps[RQ_LOW] / 2;
+    Resampler *resampler = Resampler::createNew(1, inRate, outRate, RQ_LOW);
+    std::vector<float> samples(blockSamples, 0.25);
+    std::vector<float> outSamples(2);
+    const unsigned char *in[1] = {(const unsigned char*) samples.data()};
+    unsigned char *out[1] = {(unsigned char*) outSamples.data()};
+    std::chrono::microseconds offset;
+    uint64_t inputSamples = 0;
+    uint64_t outputSamples = 0;
+    uint64_t expectedSamples;
+    int n;
+
+    for (unsigned b = 0; b < BLOCKS * 20; b++) {
+        n = resampler->process(in, FLTP, blockSamples, out, FLTP, outSamples.size(), offset);
+        CPPUNIT_ASSERT(n >= 0);
+
+        inputSamples += blockSamples;
+        expectedSamples = inputSamples > halfTaps ?
+            ((inputSamples - halfTaps) * outRate + inRate - 1) / inRate : 0;
+        CPPUNIT_ASSERT(outputSamples + n == expectedSamples);
+
+        for (int i = 0; i < n; i++) {
+            if (outputSamples + i > 0) {
+                CPPUNIT_ASSERT(std::fabs(outSamples[i] - 0.25) <= SINE_TOLERANCE);
+            }
+        }
+
+        outputSamples += n;
+    }
+
+    delete resampler;
+}
+
+void ResamplerTest::s16Test()
+{
+    checkTones(44100, 48000, RQ_MEDIUM, 441, S16, S16);
+    checkTones(48000, 8000, RQ_MEDIUM, 960, S16, FLTP);
+}
+
+void ResamplerTest::resetTest()
+{
+    Resampler *resampler = Resampler::createNew(1, 48000, 8000);
+    std::vector<float> samples(960, 0.25);
+    std::vector<float> outSamples(200);
+    const unsigned char *in[1] = {(const unsigned char*) samples.data()};
+    unsigned char *out[1] = {(unsigned char*) outSamples.data()};
+    std::chrono::microseconds offset;
+    int first;
+
+    first = resampler->process(in, FLTP, samples.size(), out, FLTP, outSamples.size(), offset);
+    CPPUNIT_ASSERT(offset == std::chrono::microseconds(0));
+    CPPUNIT_ASSERT(resampler->process(in, FLTP, samples.size(), out, FLTP, outSamples.size(), offset) > first);
+
+    //NOTE: after a reset it outputs as a new resampler
+    resampler->reset();
+    CPPUNIT_ASSERT(resampler->process(in, FLTP, samples.size(), out, FLTP, outSamples.size(), offset) == first);
+    CPPUNIT_ASSERT(offset == std::chrono::microseconds(0));
+    CPPUNIT_ASSERT(resampler->process(in, S_NONE, samples.size(), out, FLTP, outSamples.size(), offset) == -1);
+
+    delete resampler;
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ResamplerTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("ResamplerTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
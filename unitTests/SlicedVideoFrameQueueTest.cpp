@@ -47,6 +47,7 @@ class SlicedVideoFrameQueueTest : public CppUnit::TestFixture
     CPPUNIT_TEST(create);
     CPPUNIT_TEST(okSliceBehaviour);
     CPPUNIT_TEST(tooManySlices);
+    CPPUNIT_TEST(flushedSlices);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -57,6 +58,7 @@ protected:
     void create();
     void okSliceBehaviour();
     void tooManySlices();
+    void flushedSlices();
 
     SlicedVideoFrameQueue* queue;
     unsigned maxFrames;
@@ -152,6 +154,43 @@ void SlicedVideoFrameQueueTest::okSliceBehaviour()
 }
 
 
+void SlicedVideoFrameQueueTest::flushedSlices()
+{
+    unsigned char firstSlice = 1;
+    unsigned char secondSlice = 2;
+    SlicedVideoFrame* slicedFrame;
+    Frame* outputFrame;
+
+    slicedFrame = dynamic_cast<SlicedVideoFrame*>(queue->getRear());
+    CPPUNIT_ASSERT(slicedFrame);
+
+    slicedFrame->setPresentationTime(std::chrono::microseconds(40000));
+    CPPUNIT_ASSERT(slicedFrame->setSlice(&firstSlice, 1));
+    CPPUNIT_ASSERT(slicedFrame->flushSlices());
+
+    CPPUNIT_ASSERT(slicedFrame->getSliceNum() == 0);
+    CPPUNIT_ASSERT(queue->getElements() == 1);
+
+    outputFrame = queue->getFront();
+    CPPUNIT_ASSERT(outputFrame);
+    CPPUNIT_ASSERT(*outputFrame->getDataBuf() == firstSlice);
+    CPPUNIT_ASSERT(outputFrame->getPresentationTime() == std::chrono::microseconds(40000));
+    CPPUNIT_ASSERT(outputFrame->getDecodeTime() == std::chrono::microseconds(40000));
+    queue->removeFrame();
+
+    slicedFrame->setDecodeTime(std::chrono::microseconds(0));
+    CPPUNIT_ASSERT(slicedFrame->setSlice(&secondSlice, 1));
+    queue->addFrame();
+    CPPUNIT_ASSERT(queue->getElements() == 1);
+
+    outputFrame = queue->getFront();
+    CPPUNIT_ASSERT(outputFrame);
+    CPPUNIT_ASSERT(*outputFrame->getDataBuf() == secondSlice);
+    CPPUNIT_ASSERT(outputFrame->getPresentationTime() == std::chrono::microseconds(40000));
+    CPPUNIT_ASSERT(outputFrame->getDecodeTime() == std::chrono::microseconds(0));
+    queue->removeFrame();
+}
+
 void SlicedVideoFrameQueueTest::tooManySlices()
 {
     unsigned buffersNum = 10;
@@ -0,0 +1,231 @@
+/*
+ *  AudioEncoderLibavTest.cpp - AudioEncoderLibav class test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "modules/audioEncoder/AudioEncoderLibav.hh"
+#include "AudioCircularBuffer.hh"
+
+#define CHANNELS 2
+#define FRAMES 500
+//NOTE: a different constant level per channel
+#define LEVEL_0 4000
+#define LEVEL_1 -12000
+#define LEVEL_TOLERANCE 2
+#define PTS_TOLERANCE 1000
+//NOTE: the first encoded frame holds the filter ramp from the initial silence
+#define WARMUP_FRAMES 1
+
+class AudioEncoderLibavMock : public AudioEncoderLibav
+{
+public:
+    using AudioEncoderLibav::doProcessFrame;
+    using AudioEncoderLibav::configure0;
+    using AudioEncoderLibav::specificReaderConfig;
+    using AudioEncoderLibav::fifoSamples;
+};
+
+class AudioEncoderLibavTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(AudioEncoderLibavTest);
+    CPPUNIT_TEST(sameRateTest);
+    CPPUNIT_TEST(upsampleTest);
+    CPPUNIT_TEST(downsampleTest);
+    CPPUNIT_TEST(inexactFrameSizeTest);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+protected:
+    void sameRateTest();
+    void upsampleTest();
+    void downsampleTest();
+    void inexactFrameSizeTest();
+
+    /**
+    * Pushes 10 ms blocks of constant levels to the input buffer for FRAMES encoded
+    * frames and checks that the encoded frames are full, continuous and in time
+    */
+    void checkEncoding(unsigned inRate, unsigned outRate);
+    void pushBlock(unsigned inRate);
+    void checkCodedFrame(unsigned outRate);
+
+    struct ConnectionData cData;
+
+    AudioEncoderLibavMock* encoder;
+    AudioCircularBuffer* buffer;
+    InterleavedAudioFrame* codedFrame;
+    uint64_t inputSamples;
+    unsigned outputFrames;
+};
+
+void AudioEncoderLibavTest::setUp()
+{
+    encoder = new AudioEncoderLibavMock();
+    buffer = NULL;
+    codedFrame = NULL;
+    inputSamples = 0;
+    outputFrames = 0;
+}
+
+void AudioEncoderLibavTest::tearDown()
+{
+    delete encoder;
+    delete buffer;
+    delete codedFrame;
+}
+
+void AudioEncoderLibavTest::pushBlock(unsigned inRate)
+{
+    unsigned samples = inRate / 100;
+    int16_t levels[] = {LEVEL_0, LEVEL_1};
+    AudioFrame *frame = dynamic_cast<AudioFrame*>(buffer->getRear());
+
+    CPPUNIT_ASSERT(frame);
+
+    for (unsigned c = 0; c < CHANNELS; c++) {
+        for (unsigned i = 0; i < samples; i++) {
+            memcpy(frame->getPlanarDataBuf()[c] + i * sizeof(int16_t), &levels[c], sizeof(int16_t));
+        }
+    }
+
+    frame->setSamples(samples);
+    frame->setLength(samples * sizeof(int16_t));
+    frame->setPresentationTime(std::chrono::microseconds(inputSamples * std::micro::den / inRate));
+    buffer->addFrame();
+    inputSamples += samples;
+}
+
+void AudioEncoderLibavTest::checkCodedFrame(unsigned outRate)
+{
+    unsigned samples = encoder->getSamplesPerFrame();
+    int64_t expectedPts = (int64_t) outputFrames * samples * std::micro::den / outRate;
+    unsigned char *data = codedFrame->getDataBuf();
+    int levels[] = {LEVEL_0, LEVEL_1};
+    int16_t sample;
+
+    CPPUNIT_ASSERT(codedFrame->getSamples() == samples);
+    CPPUNIT_ASSERT(codedFrame->getLength() == samples * CHANNELS * sizeof(int16_t));
+    CPPUNIT_ASSERT(llabs(codedFrame->getPresentationTime().count() - expectedPts) <= PTS_TOLERANCE);
+
+    if (outputFrames < WARMUP_FRAMES) {
+        return;
+    }
+
+    //NOTE: big endian S16, no samples of previous frames or silence in between
+    for (unsigned i = 0; i < samples; i++) {
+        for (unsigned c = 0; c < CHANNELS; c++) {
+            sample = (int16_t) ((data[(i * CHANNELS + c) * 2] << 8) | data[(i * CHANNELS + c) * 2 + 1]);
+            CPPUNIT_ASSERT(abs(sample - levels[c]) <= LEVEL_TOLERANCE);
+        }
+    }
+}
+
+void AudioEncoderLibavTest::checkEncoding(unsigned inRate, unsigned outRate)
+{
+    Frame *frame;
+    unsigned samples;
+    int64_t expectedSamples;
+
+    buffer = AudioCircularBuffer::createNew(cData, CHANNELS, inRate, AudioFrame::getMaxSamples(inRate), S16P);
+    codedFrame = InterleavedAudioFrame::createNew(CHANNELS, outRate, AudioFrame::getMaxSamples(outRate), PCM, S16);
+
+    CPPUNIT_ASSERT(buffer && codedFrame);
+    CPPUNIT_ASSERT(encoder->configure0(PCM, CHANNELS, outRate, 0, RQ_MEDIUM));
+    CPPUNIT_ASSERT(encoder->specificReaderConfig(0, buffer));
+
+    samples = encoder->getSamplesPerFrame();
+    CPPUNIT_ASSERT(samples == (unsigned) AudioFrame::getDefaultSamples(outRate));
+
+    while (outputFrames < FRAMES) {
+        pushBlock(inRate);
+
+        while ((frame = buffer->getFront())) {
+            codedFrame->setLength(0);
+
+            if (encoder->doProcessFrame(frame, codedFrame)) {
+                checkCodedFrame(outRate);
+                outputFrames++;
+            }
+
+            buffer->removeFrame();
+
+            //NOTE: each input frame is encoded in one frame at most, so pending samples do not pile up
+            CPPUNIT_ASSERT(encoder->fifoSamples < samples);
+        }
+    }
+
+    //NOTE: the resampled input is encoded as it arrives, samples are neither accumulated nor lost
+    expectedSamples = inputSamples * outRate / inRate;
+    CPPUNIT_ASSERT(llabs(expectedSamples - (int64_t) outputFrames * samples) <= 2 * samples);
+}
+
+void AudioEncoderLibavTest::sameRateTest()
+{
+    checkEncoding(48000, 48000);
+}
+
+void AudioEncoderLibavTest::upsampleTest()
+{
+    checkEncoding(44100, 48000);
+}
+
+void AudioEncoderLibavTest::downsampleTest()
+{
+    checkEncoding(48000, 44100);
+}
+
+void AudioEncoderLibavTest::inexactFrameSizeTest()
+{
+    //NOTE: 20 ms of 11025 Hz are 220.5 samples, some input frames do not fill an encoded one
+    checkEncoding(11025, 48000);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(AudioEncoderLibavTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("AudioEncoderLibavTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
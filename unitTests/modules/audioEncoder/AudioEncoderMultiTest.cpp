@@ -0,0 +1,405 @@
+/*
+ *  AudioEncoderMultiTest.cpp - AudioEncoderMulti class test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "modules/audioEncoder/AudioEncoderMulti.hh"
+
+#define CHANNELS 2
+#define SAMPLE_RATE 48000
+#define PCM_ID 1
+#define PCMU_ID 2
+#define PCM_COPY_ID 3
+#define FRAMES 10
+
+class AudioEncoderMultiMock : public AudioEncoderMulti
+{
+public:
+    using AudioEncoderMulti::doProcessFrame;
+    using AudioEncoderMulti::doGetState;
+    using AudioEncoderMulti::configure0;
+    using AudioEncoderMulti::specificWriterConfig;
+    using AudioEncoderMulti::specificWriterDelete;
+};
+
+class AudioEncoderMultiTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(AudioEncoderMultiTest);
+    CPPUNIT_TEST(configureTest);
+    CPPUNIT_TEST(routingTest);
+    CPPUNIT_TEST(sharedResamplingTest);
+    CPPUNIT_TEST(addRemoveStreamsTest);
+    CPPUNIT_TEST(unconnectedStreamTest);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+protected:
+    void configureTest();
+    void routingTest();
+    void sharedResamplingTest();
+    void addRemoveStreamsTest();
+    void unconnectedStreamTest();
+
+    AudioEncodingStream stream(int id, ACodecType codec, int channels, int sampleRate);
+    //NOTE: feeds an input frame, output frames are cleared before
+    bool process();
+    //NOTE: PCM streams are big endian S16 of the same samples when they are not converted
+    bool isInputCopy(int id);
+    Jzon::Object getStream(int id);
+    int getState(std::string key);
+
+    AudioEncoderMultiMock* encoder;
+    InterleavedAudioFrame* rawFrame;
+    std::map<int, Frame*> dstFrames;
+    std::chrono::microseconds pts;
+    unsigned inputFrames;
+};
+
+void AudioEncoderMultiTest::setUp()
+{
+    encoder = new AudioEncoderMultiMock();
+    rawFrame = InterleavedAudioFrame::createNew(CHANNELS, SAMPLE_RATE, AudioFrame::getMaxSamples(SAMPLE_RATE), PCM, S16);
+    pts = std::chrono::microseconds(std::micro::den);
+    inputFrames = 0;
+
+    for (int id : {PCM_ID, PCMU_ID, PCM_COPY_ID}) {
+        dstFrames[id] = InterleavedAudioFrame::createNew(CHANNELS, SAMPLE_RATE,
+                                                         AudioFrame::getMaxSamples(SAMPLE_RATE), PCM, S16);
+    }
+}
+
+void AudioEncoderMultiTest::tearDown()
+{
+    delete encoder;
+    delete rawFrame;
+
+    for (auto it : dstFrames) {
+        delete it.second;
+    }
+
+    dstFrames.clear();
+}
+
+AudioEncodingStream AudioEncoderMultiTest::stream(int id, ACodecType codec, int channels, int sampleRate)
+{
+    AudioEncodingStream s;
+
+    s.id = id;
+    s.codec = codec;
+    s.channels = channels;
+    s.sampleRate = sampleRate;
+    s.bitrate = 0;
+
+    return s;
+}
+
+bool AudioEncoderMultiTest::process()
+{
+    unsigned samples = AudioFrame::getDefaultSamples(SAMPLE_RATE);
+    int16_t *data = (int16_t*) rawFrame->getDataBuf();
+
+    //NOTE: a different ramp per channel and frame
+    for (unsigned i = 0; i < samples; i++) {
+        for (unsigned c = 0; c < CHANNELS; c++) {
+            data[i * CHANNELS + c] = (int16_t) ((i * 13 + inputFrames * 7 + c * 1000) % 20000 - 10000);
+        }
+    }
+
+    rawFrame->setSamples(samples);
+    rawFrame->setLength(samples * CHANNELS * sizeof(int16_t));
+    rawFrame->setPresentationTime(pts);
+    pts += std::chrono::microseconds(samples * std::micro::den / SAMPLE_RATE);
+    inputFrames++;
+
+    for (auto it : dstFrames) {
+        dynamic_cast<AudioFrame*>(it.second)->setLength(0);
+        it.second->setConsumed(false);
+    }
+
+    return encoder->doProcessFrame(rawFrame, dstFrames);
+}
+
+bool AudioEncoderMultiTest::isInputCopy(int id)
+{
+    AudioFrame *coded = dynamic_cast<AudioFrame*>(dstFrames[id]);
+    unsigned char *in = rawFrame->getDataBuf();
+    unsigned char *out = coded->getDataBuf();
+
+    if (!coded->getConsumed() || coded->getLength() != rawFrame->getLength() ||
+            coded->getSamples() != rawFrame->getSamples() ||
+            coded->getPresentationTime() != rawFrame->getPresentationTime()) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < rawFrame->getLength(); i += 2) {
+        if (out[i] != in[i + 1] || out[i + 1] != in[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Jzon::Object AudioEncoderMultiTest::getStream(int id)
+{
+    Jzon::Object state;
+
+    encoder->doGetState(state);
+    Jzon::Array &streams = state.Get("streams").AsArray();
+
+    for (Jzon::Array::iterator it = streams.begin(); it != streams.end(); ++it) {
+        if ((*it).Get("id").ToInt() == id) {
+            return (*it).AsObject();
+        }
+    }
+
+    return Jzon::Object();
+}
+
+int AudioEncoderMultiTest::getState(std::string key)
+{
+    Jzon::Object state;
+
+    encoder->doGetState(state);
+
+    if (key == "streams") {
+        return state.Get("streams").GetCount();
+    }
+
+    return state.Get(key).ToInt();
+}
+
+void AudioEncoderMultiTest::configureTest()
+{
+    std::vector<AudioEncodingStream> streams;
+
+    CPPUNIT_ASSERT(!encoder->configure0({stream(PCM_ID, AC_NONE, CHANNELS, SAMPLE_RATE)}, RQ_MEDIUM));
+    CPPUNIT_ASSERT(!encoder->configure0({stream(PCM_ID, PCM, 0, SAMPLE_RATE)}, RQ_MEDIUM));
+    CPPUNIT_ASSERT(!encoder->configure0({stream(PCM_ID, PCM, MAX_CHANNELS + 1, SAMPLE_RATE)}, RQ_MEDIUM));
+    CPPUNIT_ASSERT(!encoder->configure0({stream(PCM_ID, PCM, CHANNELS, 0)}, RQ_MEDIUM));
+    CPPUNIT_ASSERT(!encoder->configure0({stream(PCM_ID, PCM, CHANNELS, SAMPLE_RATE),
+                                         stream(PCM_ID, PCMU, 1, 8000)}, RQ_MEDIUM));
+
+    for (int id = 0; id <= MAX_AUDIO_ENCODER_STREAMS; id++) {
+        streams.push_back(stream(id, PCM, CHANNELS, SAMPLE_RATE));
+    }
+
+    CPPUNIT_ASSERT(!encoder->configure0(streams, RQ_MEDIUM));
+    CPPUNIT_ASSERT(getState("streams") == 0);
+
+    streams.pop_back();
+    CPPUNIT_ASSERT(encoder->configure0(streams, RQ_MEDIUM));
+    CPPUNIT_ASSERT(getState("streams") == MAX_AUDIO_ENCODER_STREAMS);
+    CPPUNIT_ASSERT(!encoder->specificWriterConfig(MAX_AUDIO_ENCODER_STREAMS));
+    //NOTE: writers of configured streams are accepted
+    CPPUNIT_ASSERT(encoder->specificWriterConfig(0));
+}
+
+void AudioEncoderMultiTest::routingTest()
+{
+    unsigned pcmuFrames = 0;
+    std::chrono::microseconds pcmuPts(0);
+    unsigned pcmuSamples = AudioFrame::getDefaultSamples(8000);
+    AudioFrame *pcmu = dynamic_cast<AudioFrame*>(dstFrames[PCMU_ID]);
+
+    CPPUNIT_ASSERT(encoder->configure0({stream(PCM_ID, PCM, CHANNELS, SAMPLE_RATE),
+                                        stream(PCMU_ID, PCMU, 1, 8000)}, RQ_MEDIUM));
+
+    for (unsigned i = 0; i < FRAMES; i++) {
+        CPPUNIT_ASSERT(process());
+        CPPUNIT_ASSERT(isInputCopy(PCM_ID));
+        //NOTE: writers without a stream are not written
+        CPPUNIT_ASSERT(!dstFrames[PCM_COPY_ID]->getConsumed());
+
+        //NOTE: the 8k stream may wait for the delay of its resampler
+        if (!pcmu->getConsumed()) {
+            continue;
+        }
+
+        CPPUNIT_ASSERT(pcmu->getSamples() == pcmuSamples);
+        CPPUNIT_ASSERT(pcmu->getLength() == pcmuSamples);
+        CPPUNIT_ASSERT(pcmuFrames == 0 || pcmu->getPresentationTime() - pcmuPts ==
+                       std::chrono::microseconds(pcmuSamples * std::micro::den / 8000));
+        pcmuPts = pcmu->getPresentationTime();
+        pcmuFrames++;
+    }
+
+    CPPUNIT_ASSERT(pcmuFrames >= FRAMES - 1);
+    CPPUNIT_ASSERT(getStream(PCM_ID).Get("encodedFrames").ToInt() == FRAMES);
+    CPPUNIT_ASSERT(getStream(PCMU_ID).Get("encodedFrames").ToInt() == (int) pcmuFrames);
+    CPPUNIT_ASSERT(getState("conversions") == 2);
+}
+
+void AudioEncoderMultiTest::sharedResamplingTest()
+{
+    unsigned frames = 0;
+    unsigned samples = AudioFrame::getDefaultSamples(SAMPLE_RATE / 2);
+    std::chrono::microseconds lastPts(0);
+    AudioFrame *first = dynamic_cast<AudioFrame*>(dstFrames[PCM_ID]);
+    AudioFrame *second = dynamic_cast<AudioFrame*>(dstFrames[PCM_COPY_ID]);
+
+    //NOTE: both streams are encoded from a single resampling of the input
+    CPPUNIT_ASSERT(encoder->configure0({stream(PCM_ID, PCM, CHANNELS, SAMPLE_RATE / 2),
+                                        stream(PCM_COPY_ID, PCM, CHANNELS, SAMPLE_RATE / 2)}, RQ_MEDIUM));
+
+    for (unsigned i = 0; i < FRAMES; i++) {
+        CPPUNIT_ASSERT(process() == first->getConsumed());
+        CPPUNIT_ASSERT(first->getConsumed() == second->getConsumed());
+
+        if (!first->getConsumed()) {
+            continue;
+        }
+
+        CPPUNIT_ASSERT(first->getSamples() == samples && second->getSamples() == samples);
+        CPPUNIT_ASSERT(first->getLength() == samples * CHANNELS * sizeof(int16_t));
+        CPPUNIT_ASSERT(second->getLength() == first->getLength());
+        CPPUNIT_ASSERT(memcmp(first->getDataBuf(), second->getDataBuf(), first->getLength()) == 0);
+        CPPUNIT_ASSERT(second->getPresentationTime() == first->getPresentationTime());
+        CPPUNIT_ASSERT(frames == 0 || first->getPresentationTime() - lastPts ==
+                       std::chrono::microseconds(samples * std::micro::den / (SAMPLE_RATE / 2)));
+        lastPts = first->getPresentationTime();
+        frames++;
+    }
+
+    CPPUNIT_ASSERT(frames >= FRAMES - 1);
+    CPPUNIT_ASSERT(getState("conversions") == 1);
+}
+
+void AudioEncoderMultiTest::addRemoveStreamsTest()
+{
+    CPPUNIT_ASSERT(encoder->configure0({stream(PCM_ID, PCM, CHANNELS, SAMPLE_RATE),
+                                        stream(PCMU_ID, PCMU, 1, 8000)}, RQ_MEDIUM));
+    CPPUNIT_ASSERT(process());
+
+    //NOTE: a new stream with the format of another one shares its conversion
+    CPPUNIT_ASSERT(encoder->configure0({stream(PCM_ID, PCM, CHANNELS, SAMPLE_RATE),
+                                        stream(PCMU_ID, PCMU, 1, 8000),
+                                        stream(PCM_COPY_ID, PCM, CHANNELS, SAMPLE_RATE)}, RQ_MEDIUM));
+    CPPUNIT_ASSERT(getState("streams") == 3);
+
+    for (unsigned i = 0; i < FRAMES; i++) {
+        CPPUNIT_ASSERT(process());
+        CPPUNIT_ASSERT(isInputCopy(PCM_ID));
+        CPPUNIT_ASSERT(isInputCopy(PCM_COPY_ID));
+    }
+
+    CPPUNIT_ASSERT(getState("conversions") == 2);
+    CPPUNIT_ASSERT(dstFrames[PCMU_ID]->getConsumed());
+
+    //NOTE: streams not listed are disabled, their writers are kept
+    CPPUNIT_ASSERT(encoder->configure0({stream(PCM_COPY_ID, PCM, CHANNELS, SAMPLE_RATE)}, RQ_MEDIUM));
+    CPPUNIT_ASSERT(getState("streams") == 3);
+    CPPUNIT_ASSERT(!getStream(PCM_ID).Get("enabled").ToBool());
+    CPPUNIT_ASSERT(!getStream(PCMU_ID).Get("enabled").ToBool());
+    CPPUNIT_ASSERT(getStream(PCM_COPY_ID).Get("enabled").ToBool());
+
+    for (unsigned i = 0; i < FRAMES; i++) {
+        CPPUNIT_ASSERT(process());
+        CPPUNIT_ASSERT(isInputCopy(PCM_COPY_ID));
+        CPPUNIT_ASSERT(!dstFrames[PCM_ID]->getConsumed());
+        CPPUNIT_ASSERT(!dstFrames[PCMU_ID]->getConsumed());
+    }
+
+    CPPUNIT_ASSERT(getState("conversions") == 1);
+
+    //NOTE: deleting a writer deletes its stream, the rest are still output
+    CPPUNIT_ASSERT(encoder->specificWriterDelete(PCMU_ID));
+    CPPUNIT_ASSERT(!encoder->specificWriterDelete(PCMU_ID));
+    CPPUNIT_ASSERT(getState("streams") == 2);
+    CPPUNIT_ASSERT(getStream(PCMU_ID).GetCount() == 0);
+
+    CPPUNIT_ASSERT(process());
+    CPPUNIT_ASSERT(isInputCopy(PCM_COPY_ID));
+    CPPUNIT_ASSERT(!dstFrames[PCMU_ID]->getConsumed());
+
+    //NOTE: a deleted stream can be configured again
+    CPPUNIT_ASSERT(encoder->configure0({stream(PCMU_ID, PCMU, 1, 8000),
+                                        stream(PCM_COPY_ID, PCM, CHANNELS, SAMPLE_RATE)}, RQ_MEDIUM));
+
+    for (unsigned i = 0; i < FRAMES; i++) {
+        CPPUNIT_ASSERT(process());
+        CPPUNIT_ASSERT(isInputCopy(PCM_COPY_ID));
+    }
+
+    CPPUNIT_ASSERT(dstFrames[PCMU_ID]->getConsumed());
+    CPPUNIT_ASSERT(!dstFrames[PCM_ID]->getConsumed());
+}
+
+void AudioEncoderMultiTest::unconnectedStreamTest()
+{
+    std::map<int, Frame*> unconnected;
+
+    CPPUNIT_ASSERT(encoder->configure0({stream(PCM_ID, PCM, CHANNELS, SAMPLE_RATE),
+                                        stream(PCMU_ID, PCMU, 1, 8000)}, RQ_MEDIUM));
+
+    //NOTE: a stream without destination frame does not stop the others
+    unconnected[PCMU_ID] = dstFrames[PCMU_ID];
+    dstFrames.erase(PCMU_ID);
+
+    for (unsigned i = 0; i < FRAMES; i++) {
+        CPPUNIT_ASSERT(process());
+        CPPUNIT_ASSERT(isInputCopy(PCM_ID));
+    }
+
+    CPPUNIT_ASSERT(getStream(PCMU_ID).Get("encodedFrames").ToInt() == 0);
+    dstFrames.insert(unconnected.begin(), unconnected.end());
+
+    //NOTE: the samples it fell behind are dropped, so it outputs one frame per input one again
+    for (unsigned i = 0; i < FRAMES; i++) {
+        CPPUNIT_ASSERT(process());
+        CPPUNIT_ASSERT(isInputCopy(PCM_ID));
+        CPPUNIT_ASSERT(dstFrames[PCMU_ID]->getConsumed());
+    }
+
+    CPPUNIT_ASSERT(getStream(PCMU_ID).Get("encodedFrames").ToInt() == FRAMES);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(AudioEncoderMultiTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("AudioEncoderMultiTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+/*
+ *  MixKernelsTest.cpp - MixKernels test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "modules/audioMixer/MixKernels.hh"
+#include "Utils.hh"
+
+//NOTE: lengths cover empty spans, the vector bodies and every tail length
+#define MAX_SAMPLES 37
+#define CEILING 0.9f
+
+class MixKernelsTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(MixKernelsTest);
+    CPPUNIT_TEST(mixSourcesTest);
+    CPPUNIT_TEST(channelPeaksTest);
+    CPPUNIT_TEST(applyGainsTest);
+    CPPUNIT_TEST(toS16Test);
+    CPPUNIT_TEST(toS16RoundingTest);
+    CPPUNIT_TEST(toFltTest);
+    CPPUNIT_TEST(limitedMixTest);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void mixSourcesTest();
+    void channelPeaksTest();
+    void applyGainsTest();
+    void toS16Test();
+    void toS16RoundingTest();
+    void toFltTest();
+    void limitedMixTest();
+
+    //NOTE: sources are written one byte after the start of the buffer, so they are unaligned
+    void writeS16(std::vector<unsigned char> &b, unsigned samples, int16_t value);
+    void writeFlt(std::vector<unsigned char> &b, unsigned samples, float value);
+    int16_t readS16(const unsigned char *b) {return (int16_t) (b[0] | b[1] << 8);};
+};
+
+void MixKernelsTest::writeS16(std::vector<unsigned char> &b, unsigned samples, int16_t value)
+{
+    b.assign(samples * sizeof(int16_t) + 1, 0);
+
+    for (unsigned i = 0; i < samples; i++) {
+        b[1 + i * 2] = value & 0xFF;
+        b[1 + i * 2 + 1] = (value >> 8) & 0xFF;
+    }
+}
+
+void MixKernelsTest::writeFlt(std::vector<unsigned char> &b, unsigned samples, float value)
+{
+    b.assign(samples * sizeof(float) + 1, 0);
+
+    for (unsigned i = 0; i < samples; i++) {
+        memcpy(b.data() + 1 + i * sizeof(float), &value, sizeof(float));
+    }
+}
+
+void MixKernelsTest::mixSourcesTest()
+{
+    std::vector<unsigned char> loud, quiet, flt;
+
+    for (unsigned samples = 0; samples <= MAX_SAMPLES; samples++) {
+        //NOTE: one extra sample on each side of the mixed span must not be touched
+        std::vector<float> mix(samples + 3, 0);
+
+        writeS16(loud, samples, 16384);
+        writeS16(quiet, samples, -8192);
+        writeFlt(flt, samples, 0.25);
+
+        mixkernels::mixS16(loud.data() + 1, mix.data() + 1, samples, 1);
+        mixkernels::mixS16(quiet.data() + 1, mix.data() + 1, samples, 0.5);
+        mixkernels::mixFlt(flt.data() + 1, mix.data() + 1, samples, 2);
+
+        //NOTE: 0.5 - 0.125 + 0.5, all of them exact in float
+        CPPUNIT_ASSERT(mix[0] == 0);
+
+        for (unsigned i = 1; i <= samples; i++) {
+            CPPUNIT_ASSERT(mix[i] == 0.875f);
+        }
+
+        CPPUNIT_ASSERT(mix[samples + 1] == 0 && mix[samples + 2] == 0);
+    }
+}
+
+void MixKernelsTest::channelPeaksTest()
+{
+    std::vector<float> left(MAX_SAMPLES);
+    std::vector<float> right(MAX_SAMPLES);
+    std::vector<float> peaks(MAX_SAMPLES + 1, 0);
+
+    //NOTE: the loudest channel alternates and the sign does not matter
+    for (unsigned i = 0; i < MAX_SAMPLES; i++) {
+        left[i] = i % 2 == 0 ? -0.5f : 0.25f;
+        right[i] = i % 2 == 0 ? 0.125f : -0.75f;
+    }
+
+    peaks[MAX_SAMPLES] = 3;
+    mixkernels::peaks(left.data(), peaks.data(), MAX_SAMPLES);
+    mixkernels::peaks(right.data(), peaks.data(), MAX_SAMPLES);
+
+    for (unsigned i = 0; i < MAX_SAMPLES; i++) {
+        CPPUNIT_ASSERT(peaks[i] == (i % 2 == 0 ? 0.5f : 0.75f));
+    }
+
+    CPPUNIT_ASSERT(peaks[MAX_SAMPLES] == 3);
+}
+
+void MixKernelsTest::applyGainsTest()
+{
+    float values[] = {2.0f, -2.0f, 0.5f, -0.5f, 1.0f, 0.0f, 3.0f, -0.4f, 1.8f, -1.9f, 0.9f};
+    float gains[] = {0.5f, 0.5f, 1.0f, 2.0f, 1.0f, 4.0f, 0.25f, 1.0f, 0.5f, 0.5f, 1.0f};
+    float expected[] = {0.9f, -0.9f, 0.5f, -0.9f, 0.9f, 0.0f, 0.75f, -0.4f, 0.9f, -0.9f, 0.9f};
+    unsigned samples = sizeof(values) / sizeof(float);
+
+    //NOTE: attenuated samples above the ceiling are clipped to it
+    mixkernels::applyGains(values, gains, samples, CEILING);
+
+    for (unsigned i = 0; i < samples; i++) {
+        CPPUNIT_ASSERT(values[i] == expected[i]);
+    }
+}
+
+void MixKernelsTest::toS16Test()
+{
+    float values[] = {0.0f, 0.5f, -0.5f, 1.0f, -1.0f, 1.5f, -1.5f, 0.25f, -0.25f, 4.0f, -4.0f};
+    int16_t expected[] = {0, 16384, -16384, 32767, -32768, 32767, -32768, 8192, -8192, 32767, -32768};
+    unsigned samples = sizeof(values) / sizeof(float);
+    std::vector<unsigned char> out(samples * sizeof(int16_t) + 1, 0);
+
+    //NOTE: out of range samples are clipped, little endian output at an odd address
+    mixkernels::toS16(values, out.data() + 1, samples);
+
+    for (unsigned i = 0; i < samples; i++) {
+        CPPUNIT_ASSERT(readS16(out.data() + 1 + i * 2) == expected[i]);
+    }
+
+    CPPUNIT_ASSERT(out[0] == 0);
+}
+
+void MixKernelsTest::toS16RoundingTest()
+{
+    //NOTE: halves round to even, values just below a half are not truncated
+    float values[] = {0.4f, 0.5f, 0.6f, 1.5f, 2.5f, -0.4f, -0.5f, -0.6f, -1.5f, -2.5f, 99.7f, -99.7f};
+    int16_t expected[] = {0, 0, 1, 2, 2, 0, 0, -1, -2, -2, 100, -100};
+    unsigned samples = sizeof(values) / sizeof(float);
+    unsigned char out[sizeof(values) / sizeof(float) * 2];
+
+    //NOTE: the first 8 samples go through the vector path, the rest through the scalar one
+    for (unsigned i = 0; i < samples; i++) {
+        values[i] /= 32768.0f;
+    }
+
+    mixkernels::toS16(values, out, samples);
+
+    for (unsigned i = 0; i < samples; i++) {
+        CPPUNIT_ASSERT(readS16(out + i * 2) == expected[i]);
+    }
+}
+
+void MixKernelsTest::toFltTest()
+{
+    std::vector<float> mix(MAX_SAMPLES);
+    std::vector<unsigned char> out(MAX_SAMPLES * sizeof(float) + 1, 0);
+    float sample;
+
+    //NOTE: float output is not clipped, the limiter already applied the ceiling
+    for (unsigned i = 0; i < MAX_SAMPLES; i++) {
+        mix[i] = (i - 18.0f) / 8;
+    }
+
+    mixkernels::toFlt(mix.data(), out.data() + 1, MAX_SAMPLES);
+
+    for (unsigned i = 0; i < MAX_SAMPLES; i++) {
+        memcpy(&sample, out.data() + 1 + i * sizeof(float), sizeof(float));
+        CPPUNIT_ASSERT(sample == mix[i]);
+    }
+}
+
+void MixKernelsTest::limitedMixTest()
+{
+    std::vector<unsigned char> source;
+    std::vector<float> left(MAX_SAMPLES, 0);
+    std::vector<float> right(MAX_SAMPLES, 0);
+    std::vector<float> peaks(MAX_SAMPLES, 0);
+    std::vector<float> gains(MAX_SAMPLES);
+    std::vector<unsigned char> out(MAX_SAMPLES * sizeof(int16_t));
+
+    //NOTE: two full scale sources on the left and one at half scale on the right, as the
+    //mixer does, both channels get the gain that brings the loudest one to the ceiling
+    writeS16(source, MAX_SAMPLES, 32767);
+    mixkernels::mixS16(source.data() + 1, left.data(), MAX_SAMPLES, 1);
+    mixkernels::mixS16(source.data() + 1, left.data(), MAX_SAMPLES, 1);
+    mixkernels::mixS16(source.data() + 1, right.data(), MAX_SAMPLES, 0.5);
+
+    mixkernels::peaks(left.data(), peaks.data(), MAX_SAMPLES);
+    mixkernels::peaks(right.data(), peaks.data(), MAX_SAMPLES);
+
+    for (unsigned i = 0; i < MAX_SAMPLES; i++) {
+        gains[i] = CEILING / peaks[i];
+    }
+
+    mixkernels::applyGains(left.data(), gains.data(), MAX_SAMPLES, CEILING);
+    mixkernels::applyGains(right.data(), gains.data(), MAX_SAMPLES, CEILING);
+
+    mixkernels::toS16(left.data(), out.data(), MAX_SAMPLES);
+
+    for (unsigned i = 0; i < MAX_SAMPLES; i++) {
+        CPPUNIT_ASSERT(std::abs(readS16(out.data() + i * 2) - lrintf(CEILING * 32768)) <= 1);
+    }
+
+    mixkernels::toS16(right.data(), out.data(), MAX_SAMPLES);
+
+    for (unsigned i = 0; i < MAX_SAMPLES; i++) {
+        CPPUNIT_ASSERT(std::abs(readS16(out.data() + i * 2) - lrintf(CEILING * 32768 / 4)) <= 1);
+    }
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MixKernelsTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("MixKernelsTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
@@ -59,6 +59,29 @@ size_t readFile(char const* fileName, char* dstBuffer)
     return inputDataSize;
 }
 
+/*
+*   Returns the 64 bit big endian value found at offset bytes from the type of the first box of boxType
+*/
+uint64_t readBoxUint64(unsigned char* data, size_t length, const char* boxType, size_t offset)
+{
+    uint64_t value = 0;
+
+    for (size_t i = 0; i + 4 + offset + 8 <= length; i++) {
+        if (memcmp(data + i, boxType, 4) != 0) {
+            continue;
+        }
+
+        for (size_t j = 0; j < 8; j++) {
+            value = (value << 8) | data[i + offset + j];
+        }
+
+        return value;
+    }
+
+    CPPUNIT_FAIL(std::string("Box ") + boxType + " not found\n");
+    return value;
+}
+
 /*
 *   AVC Test
 */
@@ -72,6 +95,7 @@ class DashVideoSegmenterAVCTest : public CppUnit::TestFixture
     CPPUNIT_TEST(generateInitSegment);
     CPPUNIT_TEST(appendFrameToDashSegment);
     CPPUNIT_TEST(generateSegment);
+    CPPUNIT_TEST(generateSegmentWithBFrames);
     CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -86,6 +110,7 @@ protected:
     void generateInitSegment();
     void appendFrameToDashSegment();
     void generateSegment();
+    void generateSegmentWithBFrames();
 
     DashVideoSegmenterAVC* segmenter;
     AudioFrame* aFrame;
@@ -358,6 +383,62 @@ void DashVideoSegmenterAVCTest::generateSegment()
     CPPUNIT_ASSERT(segmentModelLength == segment->getDataLength());
 }
 
+void DashVideoSegmenterAVCTest::generateSegmentWithBFrames()
+{
+    DashSegment* segment = new DashSegment();
+    Frame* frame = NULL;
+    std::chrono::microseconds ts(1000);
+    std::chrono::microseconds firstPts(-1);
+    std::chrono::microseconds firstDts(-1);
+    size_t nalCounter = 0;
+    size_t dataLength = 0;
+    size_t timeBase = segmenter->getTimeBase();
+    std::string strName;
+
+    dummyNal->setSize(WIDTH, HEIGHT);
+
+    //NOTE: reordered streams are presented some frames after being decoded
+    while (true) {
+        strName = "testsData/modules/dasher/dashVideoSegmenterAVCTest/nalModels/nal_" + std::to_string(nalCounter);
+        dataLength = readFile(strName.c_str(), (char*)dummyNal->getDataBuf());
+        dummyNal->setLength(dataLength);
+        dummyNal->setPresentationTime(ts + frameTime*2);
+        dummyNal->setDecodeTime(ts);
+        frame = segmenter->manageFrame(dummyNal);
+        nalCounter++;
+
+        if (!frame) {
+            continue;
+        }
+
+        ts += frameTime;
+
+        CPPUNIT_ASSERT(frame->getPresentationTime() - frame->getDecodeTime() == frameTime*2);
+
+        if (segmenter->generateSegment(segment, frame)) {
+            break;
+        }
+
+        if (firstDts.count() < 0) {
+            firstPts = frame->getPresentationTime();
+            firstDts = frame->getDecodeTime();
+        }
+
+        if(!segmenter->appendFrameToDashSegment(frame)) {
+            CPPUNIT_FAIL("Segmenter appendFrameToDashSegment failed when testing B-frames workflow\n");
+        }
+    }
+
+    //NOTE: sidx earliest_presentation_time follows type, version, reference id and timescale
+    CPPUNIT_ASSERT(readBoxUint64(segment->getDataBuffer(), segment->getDataLength(), "sidx", 16) ==
+                   firstPts.count()*timeBase/std::micro::den);
+    //NOTE: tfdt baseMediaDecodeTime follows type and version
+    CPPUNIT_ASSERT(readBoxUint64(segment->getDataBuffer(), segment->getDataLength(), "tfdt", 8) ==
+                   firstDts.count()*timeBase/std::micro::den);
+
+    delete segment;
+}
+
 /*
 *   HEVC Test
 */
@@ -0,0 +1,289 @@
+/*
+ *  NalUnitsTest.cpp - Coded video frames parsing test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <stdint.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "modules/videoDecoder/NalUnits.hh"
+#include "Utils.hh"
+
+//NOTE: NAL unit headers, H264 nal_ref_idc is 3 for IDR and 2 for reference slices
+#define H264_IDR_HEADER 0x65
+#define H264_REF_SLICE_HEADER 0x41
+#define H264_NON_REF_SLICE_HEADER 0x01
+#define H264_SPS_HEADER 0x67
+#define H264_PPS_HEADER 0x68
+
+class NalUnitsTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(NalUnitsTest);
+    CPPUNIT_TEST(expGolombTest);
+    CPPUNIT_TEST(malformedExpGolombTest);
+    CPPUNIT_TEST(splitNalsTest);
+    CPPUNIT_TEST(h264SliceTypesTest);
+    CPPUNIT_TEST(h264FrameTest);
+    CPPUNIT_TEST(h265Test);
+    CPPUNIT_TEST(otherCodecsTest);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void expGolombTest();
+    void malformedExpGolombTest();
+    void splitNalsTest();
+    void h264SliceTypesTest();
+    void h264FrameTest();
+    void h265Test();
+    void otherCodecsTest();
+
+    //NOTE: packs a string of '0' and '1' in bytes, padding the last one with zeros
+    std::vector<unsigned char> bits(const std::string &str);
+    //NOTE: H264 slice NAL unit with the given header, first_mb_in_slice and slice_type
+    std::vector<unsigned char> h264Slice(unsigned char header, const std::string &firstMb,
+                                         const std::string &sliceType);
+    std::vector<unsigned char> h265Nal(unsigned char type);
+};
+
+std::vector<unsigned char> NalUnitsTest::bits(const std::string &str)
+{
+    std::vector<unsigned char> data((str.size() + 7) / 8, 0);
+
+    for (unsigned i = 0; i < str.size(); i++) {
+        if (str[i] == '1') {
+            data[i / 8] |= 0x80 >> (i % 8);
+        }
+    }
+
+    return data;
+}
+
+std::vector<unsigned char> NalUnitsTest::h264Slice(unsigned char header, const std::string &firstMb,
+                                                   const std::string &sliceType)
+{
+    std::vector<unsigned char> nal = bits(firstMb + sliceType + "1");
+
+    nal.insert(nal.begin(), header);
+    return nal;
+}
+
+std::vector<unsigned char> NalUnitsTest::h265Nal(unsigned char type)
+{
+    std::vector<unsigned char> nal = {(unsigned char) (type << 1), 0x01, 0xAF};
+    return nal;
+}
+
+void NalUnitsTest::expGolombTest()
+{
+    std::vector<unsigned char> data;
+    unsigned bit = 0;
+
+    //NOTE: 0, 1, 2, 3 and 7 one after the other
+    data = bits("1" "010" "011" "00100" "0001000");
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == 0 && bit == 1);
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == 1 && bit == 4);
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == 2 && bit == 7);
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == 3 && bit == 12);
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == 7 && bit == 19);
+
+    //NOTE: biggest value, 31 leading zeros
+    data = bits(std::string(31, '0') + std::string(32, '1'));
+    bit = 0;
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == UINT32_MAX - 1);
+    CPPUNIT_ASSERT(bit == 63);
+
+    data = bits(std::string(31, '0') + "1" + std::string(31, '0'));
+    bit = 0;
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == (1u << 31) - 1);
+}
+
+void NalUnitsTest::malformedExpGolombTest()
+{
+    std::vector<unsigned char> data;
+    unsigned bit = 0;
+
+    //NOTE: 32 leading zeros do not fit in 32 bits
+    data = bits(std::string(32, '0') + "1" + std::string(32, '0'));
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == 0);
+
+    //NOTE: codes cut by the end of the data, in the value bits or before its first one
+    data = bits("0000001");
+    bit = 0;
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == 0);
+    CPPUNIT_ASSERT(bit == 8);
+
+    data = bits("00000000");
+    bit = 0;
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == 0);
+    CPPUNIT_ASSERT(bit == 8);
+
+    //NOTE: the last code of the data
+    data = bits("1" "0001000");
+    bit = 1;
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), data.size(), bit) == 7);
+    CPPUNIT_ASSERT(bit == 8);
+
+    bit = 0;
+    CPPUNIT_ASSERT(nalunits::readExpGolomb(data.data(), 0, bit) == 0);
+}
+
+void NalUnitsTest::splitNalsTest()
+{
+    std::vector<unsigned char> frame = {0x00, 0x00, 0x00, 0x01, H264_SPS_HEADER, 0x42,
+                                        0x00, 0x00, 0x01, H264_PPS_HEADER,
+                                        0x00, 0x00, 0x01, H264_IDR_HEADER, 0x88, 0x84};
+    std::vector<std::pair<unsigned char*, unsigned>> nals;
+
+    nals = nalunits::splitNals(frame.data(), frame.size());
+    CPPUNIT_ASSERT(nals.size() == 3);
+    CPPUNIT_ASSERT(nals[0].first == frame.data() + 4 && nals[0].second == 2);
+    CPPUNIT_ASSERT(nals[1].first == frame.data() + 9 && nals[1].second == 1);
+    CPPUNIT_ASSERT(nals[2].first == frame.data() + 13 && nals[2].second == 3);
+
+    //NOTE: frames without start code hold a single NAL unit
+    nals = nalunits::splitNals(frame.data() + 13, 3);
+    CPPUNIT_ASSERT(nals.size() == 1);
+    CPPUNIT_ASSERT(nals[0].first == frame.data() + 13 && nals[0].second == 3);
+
+    CPPUNIT_ASSERT(nalunits::splitNals(frame.data(), 0).empty());
+}
+
+void NalUnitsTest::h264SliceTypesTest()
+{
+    //NOTE: slice_type values 5 to 9 mean all the slices of the picture share the type
+    const char *sliceTypes[] = {"1", "010", "011", "00100", "00101",
+                                "00110", "00111", "0001000", "0001001", "0001010"};
+    std::vector<unsigned char> nal;
+    nalunits::PacketContent content;
+
+    for (unsigned type = 0; type < 10; type++) {
+        nal = h264Slice(H264_REF_SLICE_HEADER, "1", sliceTypes[type]);
+        content = nalunits::getPacketContent(H264, nal.data(), nal.size());
+
+        CPPUNIT_ASSERT(content.vcl);
+        CPPUNIT_ASSERT(content.reference);
+        //NOTE: I and SI slices
+        CPPUNIT_ASSERT(content.intra == (type % 5 == 2 || type % 5 == 4));
+    }
+
+    //NOTE: slice_type follows first_mb_in_slice, whatever its length
+    nal = h264Slice(H264_REF_SLICE_HEADER, "0001010", sliceTypes[2]);
+    CPPUNIT_ASSERT(nalunits::getPacketContent(H264, nal.data(), nal.size()).intra);
+    nal = h264Slice(H264_REF_SLICE_HEADER, "0001010", sliceTypes[0]);
+    CPPUNIT_ASSERT(!nalunits::getPacketContent(H264, nal.data(), nal.size()).intra);
+}
+
+void NalUnitsTest::h264FrameTest()
+{
+    std::vector<unsigned char> startCode = {0x00, 0x00, 0x01};
+    std::vector<unsigned char> frame = {0x00, 0x00, 0x00, 0x01, H264_SPS_HEADER, 0x42,
+                                        0x00, 0x00, 0x01, H264_PPS_HEADER, 0xCE};
+    std::vector<unsigned char> nal;
+    nalunits::PacketContent content;
+
+    //NOTE: parameter sets only
+    content = nalunits::getPacketContent(H264, frame.data(), frame.size());
+    CPPUNIT_ASSERT(!content.vcl);
+
+    //NOTE: IDR pictures are intra whatever their slice_type
+    nal = h264Slice(H264_IDR_HEADER, "1", "00110");
+    frame.insert(frame.end(), startCode.begin(), startCode.end());
+    frame.insert(frame.end(), nal.begin(), nal.end());
+    content = nalunits::getPacketContent(H264, frame.data(), frame.size());
+    CPPUNIT_ASSERT(content.vcl && content.intra && content.reference);
+
+    //NOTE: non reference B slice
+    nal = h264Slice(H264_NON_REF_SLICE_HEADER, "1", "010");
+    content = nalunits::getPacketContent(H264, nal.data(), nal.size());
+    CPPUNIT_ASSERT(content.vcl && !content.intra && !content.reference);
+
+    //NOTE: a picture is intra or reference if any of its slices is
+    frame.assign(startCode.begin(), startCode.end());
+    frame.insert(frame.end(), nal.begin(), nal.end());
+    nal = h264Slice(H264_REF_SLICE_HEADER, "0001010", "011");
+    frame.insert(frame.end(), startCode.begin(), startCode.end());
+    frame.insert(frame.end(), nal.begin(), nal.end());
+    content = nalunits::getPacketContent(H264, frame.data(), frame.size());
+    CPPUNIT_ASSERT(content.vcl && content.intra && content.reference);
+}
+
+void NalUnitsTest::h265Test()
+{
+    std::vector<unsigned char> nal;
+    nalunits::PacketContent content;
+
+    //NOTE: TRAIL_N, TRAIL_R, RASL_N, RSV_VCL_N14, BLA_W_LP, IDR_W_RADL, CRA_NUT and VPS
+    const unsigned char types[] = {0, 1, 8, 14, 16, 19, 21, 32};
+    const bool intra[] = {false, false, false, false, true, true, true, false};
+    const bool reference[] = {false, true, false, false, true, true, true, false};
+
+    for (unsigned i = 0; i < sizeof(types); i++) {
+        nal = h265Nal(types[i]);
+        content = nalunits::getPacketContent(H265, nal.data(), nal.size());
+
+        CPPUNIT_ASSERT(content.vcl == (types[i] < 32));
+        CPPUNIT_ASSERT(content.intra == intra[i]);
+        CPPUNIT_ASSERT(content.reference == reference[i]);
+    }
+}
+
+void NalUnitsTest::otherCodecsTest()
+{
+    unsigned char vp8Key[] = {0x50, 0x42, 0x00};
+    unsigned char vp8Inter[] = {0x51, 0x42, 0x00};
+    unsigned char jpeg[] = {0xFF, 0xD8};
+    nalunits::PacketContent content;
+
+    content = nalunits::getPacketContent(VP8, vp8Key, sizeof(vp8Key));
+    CPPUNIT_ASSERT(content.vcl && content.intra && content.reference);
+
+    content = nalunits::getPacketContent(VP8, vp8Inter, sizeof(vp8Inter));
+    CPPUNIT_ASSERT(content.vcl && !content.intra);
+
+    CPPUNIT_ASSERT(!nalunits::getPacketContent(VP8, vp8Key, 0).vcl);
+
+    content = nalunits::getPacketContent(MJPEG, jpeg, sizeof(jpeg));
+    CPPUNIT_ASSERT(content.vcl && content.intra && content.reference);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(NalUnitsTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("NalUnitsTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
@@ -0,0 +1,301 @@
+/*
+ *  VideoDecoderLibavTest.cpp - VideoDecoderLibav class test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <string.h>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "modules/videoDecoder/VideoDecoderLibav.hh"
+#include "Utils.hh"
+
+#define POOL_WIDTH 1280
+#define POOL_HEIGHT 720
+#define PIC_WIDTH 640
+#define PIC_HEIGHT 360
+#define PACKETS 4
+#define FRAME_TIME std::chrono::microseconds(40000)
+
+class VideoDecoderLibavMock : public VideoDecoderLibav {
+public:
+    using VideoDecoderLibav::DirectBuffer;
+    using VideoDecoderLibav::getBuffer;
+    using VideoDecoderLibav::getDirectBuffer;
+    using VideoDecoderLibav::attachDecodedBuffer;
+    using VideoDecoderLibav::frame;
+    using VideoDecoderLibav::outputPool;
+    using VideoDecoderLibav::directBuffers;
+    using VideoDecoderLibav::PendingPacket;
+    using VideoDecoderLibav::pushPendingPacket;
+    using VideoDecoderLibav::popPendingPacket;
+    using VideoDecoderLibav::queuePicture;
+    using VideoDecoderLibav::hasPendingOutput;
+    using VideoDecoderLibav::doProcessFrame;
+    using VideoDecoderLibav::pkt;
+    using VideoDecoderLibav::pendingPackets;
+};
+
+class VideoDecoderLibavTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(VideoDecoderLibavTest);
+    CPPUNIT_TEST(directBufferTest);
+    CPPUNIT_TEST(unsupportedPictureTest);
+    CPPUNIT_TEST(copiedPictureTest);
+    CPPUNIT_TEST(pendingPacketsTest);
+    CPPUNIT_TEST(queuedPicturesTest);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+protected:
+    void directBufferTest();
+    void unsupportedPictureTest();
+    void copiedPictureTest();
+    void pendingPacketsTest();
+    void queuedPicturesTest();
+
+    VideoDecoderLibavMock* decoder;
+    InterleavedVideoFrame* outFrame;
+    AVCodecContext* ctx;
+    AVFrame* pic;
+};
+
+void VideoDecoderLibavTest::setUp()
+{
+    decoder = new VideoDecoderLibavMock();
+    outFrame = InterleavedVideoFrame::createNew(RAW, POOL_WIDTH, POOL_HEIGHT, YUV420P);
+    decoder->outputPool = outFrame->getBufferPool();
+
+    ctx = avcodec_alloc_context3(avcodec_find_decoder(AV_CODEC_ID_H264));
+    ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    ctx->opaque = decoder;
+
+    pic = av_frame_alloc();
+    pic->format = AV_PIX_FMT_YUV420P;
+    pic->width = PIC_WIDTH;
+    pic->height = PIC_HEIGHT;
+}
+
+void VideoDecoderLibavTest::tearDown()
+{
+    av_frame_free(&pic);
+    avcodec_close(ctx);
+    av_free(ctx);
+    delete outFrame;
+    delete decoder;
+}
+
+void VideoDecoderLibavTest::directBufferTest()
+{
+    VideoDecoderLibavMock::DirectBuffer *dBuffer;
+    unsigned char *planes[MAX_PLANES];
+    int strides[MAX_PLANES];
+
+    CPPUNIT_ASSERT(VideoDecoderLibavMock::getBuffer(ctx, pic, 0) == 0);
+    CPPUNIT_ASSERT(pic->buf[0]);
+
+    dBuffer = (VideoDecoderLibavMock::DirectBuffer*) av_buffer_get_opaque(pic->buf[0]);
+    CPPUNIT_ASSERT(decoder->directBuffers.count(dBuffer) == 1);
+    CPPUNIT_ASSERT(dBuffer->width >= PIC_WIDTH && dBuffer->width % DECODER_WIDTH_ALIGN == 0);
+    CPPUNIT_ASSERT(dBuffer->height >= PIC_HEIGHT);
+
+    //NOTE: planes are laid out contiguously in the pool buffer with the strides of the aligned width
+    CPPUNIT_ASSERT(pic->data[0] == dBuffer->buffer.get());
+    CPPUNIT_ASSERT(pic->linesize[0] == dBuffer->width && pic->linesize[1] == dBuffer->width / 2);
+    CPPUNIT_ASSERT(pic->data[1] == pic->data[0] + dBuffer->width * dBuffer->height);
+
+    //NOTE: libavcodec outputs a new reference to the decoded picture and keeps its own
+    CPPUNIT_ASSERT(av_frame_ref(decoder->frame, pic) == 0);
+    CPPUNIT_ASSERT(decoder->attachDecodedBuffer(outFrame));
+    CPPUNIT_ASSERT(outFrame->getDataBuf() == pic->data[0]);
+    CPPUNIT_ASSERT(outFrame->getWidth() == PIC_WIDTH && outFrame->getHeight() == PIC_HEIGHT);
+    CPPUNIT_ASSERT(outFrame->getPixelFormat() == YUV420P);
+    CPPUNIT_ASSERT(outFrame->isView());
+
+    CPPUNIT_ASSERT(outFrame->getPlanes(planes, strides) == 3);
+    for (int p = 0; p < 3; p++) {
+        CPPUNIT_ASSERT(planes[p] == pic->data[p]);
+        CPPUNIT_ASSERT(strides[p] == pic->linesize[p]);
+    }
+
+    //NOTE: once libavcodec drops its references the buffer only belongs to the output frame
+    av_frame_unref(pic);
+    CPPUNIT_ASSERT(decoder->directBuffers.size() == 1);
+    av_frame_unref(decoder->frame);
+    CPPUNIT_ASSERT(decoder->directBuffers.empty());
+    CPPUNIT_ASSERT(outFrame->getDataBuf() == planes[0]);
+    CPPUNIT_ASSERT(!outFrame->isBufferShared());
+}
+
+void VideoDecoderLibavTest::unsupportedPictureTest()
+{
+    //NOTE: pixel formats the pipeline does not handle
+    pic->format = AV_PIX_FMT_BGR24;
+    CPPUNIT_ASSERT(!decoder->getDirectBuffer(ctx, pic));
+
+    //NOTE: pictures bigger than the pool buffers
+    pic->format = AV_PIX_FMT_YUV420P;
+    pic->width = POOL_WIDTH * 2;
+    pic->height = POOL_HEIGHT * 2;
+    CPPUNIT_ASSERT(!decoder->getDirectBuffer(ctx, pic));
+
+    //NOTE: destination frames without pool
+    pic->width = PIC_WIDTH;
+    pic->height = PIC_HEIGHT;
+    decoder->outputPool = NULL;
+    CPPUNIT_ASSERT(!decoder->getDirectBuffer(ctx, pic));
+    CPPUNIT_ASSERT(decoder->directBuffers.empty());
+
+    //NOTE: libavcodec allocates its own buffer instead
+    CPPUNIT_ASSERT(VideoDecoderLibavMock::getBuffer(ctx, pic, 0) == 0);
+    CPPUNIT_ASSERT(pic->buf[0] && pic->data[0]);
+    CPPUNIT_ASSERT(decoder->directBuffers.empty());
+}
+
+void VideoDecoderLibavTest::copiedPictureTest()
+{
+    unsigned char *data = outFrame->getDataBuf();
+
+    //NOTE: pictures in libavcodec buffers are not attached, so they are copied
+    CPPUNIT_ASSERT(av_frame_get_buffer(pic, 32) == 0);
+    CPPUNIT_ASSERT(av_frame_ref(decoder->frame, pic) == 0);
+    CPPUNIT_ASSERT(!decoder->attachDecodedBuffer(outFrame));
+    CPPUNIT_ASSERT(outFrame->getDataBuf() == data);
+    av_frame_unref(decoder->frame);
+    av_frame_unref(pic);
+
+    //NOTE: neither are cropped pictures, which do not start at the beginning of the buffer
+    pic->format = AV_PIX_FMT_YUV420P;
+    pic->width = PIC_WIDTH;
+    pic->height = PIC_HEIGHT;
+    CPPUNIT_ASSERT(decoder->getDirectBuffer(ctx, pic));
+    CPPUNIT_ASSERT(av_frame_ref(decoder->frame, pic) == 0);
+    decoder->frame->data[0] += decoder->frame->linesize[0];
+    CPPUNIT_ASSERT(!decoder->attachDecodedBuffer(outFrame));
+    CPPUNIT_ASSERT(outFrame->getDataBuf() == data);
+
+    av_frame_unref(decoder->frame);
+    av_frame_unref(pic);
+    CPPUNIT_ASSERT(decoder->directBuffers.empty());
+}
+
+void VideoDecoderLibavTest::pendingPacketsTest()
+{
+    InterleavedVideoFrame *codedFrame = InterleavedVideoFrame::createNew(H264, PIC_WIDTH * PIC_HEIGHT);
+    VideoDecoderLibavMock::PendingPacket packet;
+
+    for (unsigned i = 0; i < PACKETS; i++) {
+        codedFrame->setPresentationTime(FRAME_TIME * i);
+        codedFrame->setSequenceNumber(i);
+        decoder->pushPendingPacket(codedFrame);
+        CPPUNIT_ASSERT(decoder->pkt.pts == i);
+    }
+
+    //NOTE: pictures come out reordered, each one with the timing of its own packet
+    for (int64_t pts : {0, 2, 1, 3}) {
+        decoder->frame->pkt_pts = pts;
+        CPPUNIT_ASSERT(decoder->popPendingPacket(packet));
+        CPPUNIT_ASSERT(packet.pTime == FRAME_TIME * pts);
+        CPPUNIT_ASSERT(packet.seqNum == (size_t) pts);
+    }
+
+    //NOTE: each timing is used once and pictures without packet are not mapped
+    decoder->frame->pkt_pts = 1;
+    CPPUNIT_ASSERT(!decoder->popPendingPacket(packet));
+    decoder->frame->pkt_pts = AV_NOPTS_VALUE;
+    CPPUNIT_ASSERT(!decoder->popPendingPacket(packet));
+    CPPUNIT_ASSERT(decoder->pendingPackets.empty());
+
+    //NOTE: the oldest packets are dropped when their pictures never come out
+    for (unsigned i = 0; i < MAX_PENDING_PACKETS + 2; i++) {
+        decoder->pushPendingPacket(codedFrame);
+    }
+
+    CPPUNIT_ASSERT(decoder->pendingPackets.size() == MAX_PENDING_PACKETS);
+    decoder->frame->pkt_pts = PACKETS + 1;
+    CPPUNIT_ASSERT(!decoder->popPendingPacket(packet));
+    decoder->frame->pkt_pts = PACKETS + 2;
+    CPPUNIT_ASSERT(decoder->popPendingPacket(packet));
+
+    delete codedFrame;
+}
+
+void VideoDecoderLibavTest::queuedPicturesTest()
+{
+    VideoDecoderLibavMock::PendingPacket timing;
+
+    CPPUNIT_ASSERT(!decoder->hasPendingOutput());
+
+    for (unsigned i = 0; i < PACKETS; i++) {
+        CPPUNIT_ASSERT(av_frame_get_buffer(pic, 32) == 0);
+        memset(pic->data[0], i, pic->linesize[0] * pic->height);
+        CPPUNIT_ASSERT(av_frame_ref(decoder->frame, pic) == 0);
+        av_frame_unref(pic);
+        pic->format = AV_PIX_FMT_YUV420P;
+        pic->width = PIC_WIDTH;
+        pic->height = PIC_HEIGHT;
+
+        timing.pTime = FRAME_TIME * i;
+        timing.seqNum = i;
+        decoder->queuePicture(timing);
+        av_frame_unref(decoder->frame);
+    }
+
+    //NOTE: runs without input write the queued pictures in order with their own timing
+    for (unsigned i = 0; i < PACKETS; i++) {
+        CPPUNIT_ASSERT(decoder->hasPendingOutput());
+        outFrame->setConsumed(false);
+        CPPUNIT_ASSERT(decoder->doProcessFrame(NULL, outFrame));
+        CPPUNIT_ASSERT(outFrame->getConsumed());
+        CPPUNIT_ASSERT(outFrame->getPresentationTime() == FRAME_TIME * i);
+        CPPUNIT_ASSERT(outFrame->getSequenceNumber() == i);
+        CPPUNIT_ASSERT(outFrame->getWidth() == PIC_WIDTH && outFrame->getHeight() == PIC_HEIGHT);
+        CPPUNIT_ASSERT(outFrame->getDataBuf()[0] == i);
+    }
+
+    CPPUNIT_ASSERT(!decoder->hasPendingOutput());
+    CPPUNIT_ASSERT(!decoder->doProcessFrame(NULL, outFrame));
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(VideoDecoderLibavTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("VideoDecoderLibavTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+/*
+ *  BlockHashTest.cpp - BlockHash kernels test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "modules/videoEncoder/BlockHash.hh"
+#include "Utils.hh"
+
+class BlockHashTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(BlockHashTest);
+    CPPUNIT_TEST(layoutTest);
+    CPPUNIT_TEST(paddingTest);
+    CPPUNIT_TEST(changedBlockTest);
+    CPPUNIT_TEST_SUITE_END();
+
+protected:
+    void layoutTest();
+    void paddingTest();
+    void changedBlockTest();
+
+    void fillPlane(int stride, int lines);
+
+    std::vector<unsigned char> plane;
+};
+
+void BlockHashTest::fillPlane(int stride, int lines)
+{
+    plane.resize(stride * lines);
+
+    for (size_t i = 0; i < plane.size(); i++){
+        plane[i] = (i * 131 + (i >> 7)) & 0xff;
+    }
+}
+
+void BlockHashTest::layoutTest()
+{
+    int widths[] = {1, 15, 16, 17, 65, 191};
+    int lines[] = {1, 16, 17};
+
+    for (int w : widths){
+        for (int h : lines){
+            std::vector<unsigned char> moved((w + 5) * h + 1);
+            std::vector<uint64_t> hashes;
+            std::vector<uint64_t> movedHashes;
+
+            fillPlane(w, h);
+
+            //NOTE: the same picture at an odd address and with another stride has the same hashes
+            for (int y = 0; y < h; y++){
+                memcpy(moved.data() + 1 + y * (w + 5), plane.data() + y * w, w);
+            }
+
+            blockhash::hashPlane(plane.data(), w, w, h, hashes);
+            blockhash::hashPlane(moved.data() + 1, w + 5, w, h, movedHashes);
+            CPPUNIT_ASSERT(hashes == movedHashes);
+            CPPUNIT_ASSERT(hashes.size() == (size_t) (((w + BLOCK_HASH_BYTES - 1) / BLOCK_HASH_BYTES) *
+                                                      ((h + BLOCK_HASH_LINES - 1) / BLOCK_HASH_LINES)));
+        }
+    }
+}
+
+void BlockHashTest::paddingTest()
+{
+    int width = 77;
+    int stride = 83;
+    int lines = 21;
+    std::vector<uint64_t> hashes;
+    std::vector<uint64_t> paddedHashes;
+
+    fillPlane(stride, lines);
+    blockhash::hashPlane(plane.data(), stride, width, lines, hashes);
+
+    for (int y = 0; y < lines; y++){
+        memset(plane.data() + y * stride + width, y, stride - width);
+    }
+
+    blockhash::hashPlane(plane.data(), stride, width, lines, paddedHashes);
+    CPPUNIT_ASSERT(hashes == paddedHashes);
+}
+
+void BlockHashTest::changedBlockTest()
+{
+    int width = 131;
+    int stride = 137;
+    int lines = 35;
+    std::vector<uint64_t> hashes;
+    std::vector<uint64_t> changedHashes;
+
+    fillPlane(stride, lines);
+    blockhash::hashPlane(plane.data(), stride, width, lines, hashes);
+
+    //NOTE: second block column of the second block row, in its vector part
+    plane[(BLOCK_HASH_LINES + 3) * stride + BLOCK_HASH_BYTES + 5] ^= 0x10;
+    //NOTE: last block column of the last block row, in its tail part
+    plane[(lines - 1) * stride + width - 1] ^= 0x01;
+
+    blockhash::hashPlane(plane.data(), stride, width, lines, changedHashes);
+    CPPUNIT_ASSERT(hashes.size() == 9 && changedHashes.size() == 9);
+
+    for (size_t i = 0; i < hashes.size(); i++){
+        CPPUNIT_ASSERT((hashes[i] != changedHashes[i]) == (i == 4 || i == 8));
+    }
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(BlockHashTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("BlockHashTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
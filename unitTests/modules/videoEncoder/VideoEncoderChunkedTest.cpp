@@ -0,0 +1,245 @@
+/*
+ *  VideoEncoderChunkedTest.cpp - VideoEncoderChunked class test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <thread>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "modules/videoEncoder/VideoEncoderChunked.hh"
+
+#define WIDTH 64
+#define HEIGHT 48
+#define CHUNK_FRAMES 10
+#define FRAME_TIME 40000
+
+class VideoEncoderChunkedMock : public VideoEncoderChunked
+{
+public:
+    using VideoEncoderChunked::doProcessFrame;
+    using VideoEncoderChunked::configure0;
+    using VideoEncoderChunked::flushEvent;
+    using VideoEncoderChunked::isInputPaused;
+    using VideoEncoderChunked::encoders;
+    using VideoEncoderChunked::bufferedSize;
+    using VideoEncoderChunked::maxBufferSize;
+};
+
+class VideoEncoderChunkedTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(VideoEncoderChunkedTest);
+    CPPUNIT_TEST(configureTest);
+    CPPUNIT_TEST(incompleteChunkTest);
+    CPPUNIT_TEST(flushOnInputEndTest);
+    CPPUNIT_TEST(flushEventTest);
+    CPPUNIT_TEST(persistentWorkersTest);
+    CPPUNIT_TEST(pausedInputTest);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+protected:
+    void configureTest();
+    void incompleteChunkTest();
+    void flushOnInputEndTest();
+    void flushEventTest();
+    void persistentWorkersTest();
+    void pausedInputTest();
+
+    void pushFrames(unsigned frames);
+    unsigned drain(Frame *org, unsigned expected);
+
+    VideoEncoderChunkedMock* encoder;
+    InterleavedVideoFrame* rawFrame;
+    SlicedVideoFrame* codedFrame;
+    std::chrono::microseconds pts;
+    std::chrono::microseconds lastPts;
+    unsigned outputFrames;
+};
+
+void VideoEncoderChunkedTest::setUp()
+{
+    encoder = new VideoEncoderChunkedMock();
+    rawFrame = InterleavedVideoFrame::createNew(RAW, WIDTH, HEIGHT, YUV420P);
+    codedFrame = SlicedVideoFrame::createNew(H264);
+    pts = std::chrono::microseconds(0);
+    lastPts = std::chrono::microseconds(-1);
+    outputFrames = 0;
+
+    CPPUNIT_ASSERT(encoder->configure0(1000, CHUNK_FRAMES, 2, 1, 25, "ultrafast"));
+}
+
+void VideoEncoderChunkedTest::tearDown()
+{
+    delete encoder;
+    delete rawFrame;
+    delete codedFrame;
+}
+
+void VideoEncoderChunkedTest::pushFrames(unsigned frames)
+{
+    for (unsigned i = 0; i < frames; i++) {
+        rawFrame->setConsumed(true);
+        rawFrame->setPresentationTime(pts);
+        codedFrame->clear();
+
+        if (encoder->doProcessFrame(rawFrame, codedFrame)) {
+            CPPUNIT_ASSERT(codedFrame->getPresentationTime() > lastPts);
+            lastPts = codedFrame->getPresentationTime();
+            outputFrames++;
+        }
+
+        pts += std::chrono::microseconds(FRAME_TIME);
+    }
+}
+
+//NOTE: runs without new input until the expected frames are output, bounded below the idle flush timeout
+unsigned VideoEncoderChunkedTest::drain(Frame *org, unsigned expected)
+{
+    std::chrono::system_clock::time_point deadline = std::chrono::system_clock::now() +
+        std::chrono::milliseconds(CHUNK_FLUSH_TIMEOUT/2);
+
+    if (org) {
+        org->setConsumed(false);
+    }
+
+    while (outputFrames < expected && std::chrono::system_clock::now() < deadline) {
+        codedFrame->clear();
+
+        if (encoder->doProcessFrame(org, codedFrame)) {
+            CPPUNIT_ASSERT(codedFrame->getSliceNum() > 0);
+            CPPUNIT_ASSERT(codedFrame->getPresentationTime() > lastPts);
+            lastPts = codedFrame->getPresentationTime();
+            outputFrames++;
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(CHUNK_POLL_TIME));
+        }
+    }
+
+    return outputFrames;
+}
+
+void VideoEncoderChunkedTest::configureTest()
+{
+    CPPUNIT_ASSERT(!encoder->configure0(0, CHUNK_FRAMES, 2, 1, 25, "ultrafast"));
+    CPPUNIT_ASSERT(!encoder->configure0(1000, 0, 2, 1, 25, "ultrafast"));
+    CPPUNIT_ASSERT(!encoder->configure0(1000, CHUNK_FRAMES, 2, 0, 25, "ultrafast"));
+    CPPUNIT_ASSERT(!encoder->configure0(1000, CHUNK_FRAMES, 2, 1, 25, ""));
+    CPPUNIT_ASSERT(!encoder->configure0(1000, CHUNK_FRAMES, 2, 1, 25, "ultrafast", 0));
+    CPPUNIT_ASSERT(encoder->configure0(1000, CHUNK_FRAMES, 0, 1, 0, "ultrafast"));
+}
+
+void VideoEncoderChunkedTest::incompleteChunkTest()
+{
+    pushFrames(CHUNK_FRAMES - 1);
+    CPPUNIT_ASSERT(outputFrames == 0);
+
+    //NOTE: the incomplete chunk is kept while the input is connected and not idle
+    CPPUNIT_ASSERT(drain(rawFrame, 1) == 0);
+}
+
+void VideoEncoderChunkedTest::flushOnInputEndTest()
+{
+    unsigned frames = CHUNK_FRAMES*2 + CHUNK_FRAMES/2;
+
+    pushFrames(frames);
+
+    //NOTE: a NULL origin frame means that the reader has been disconnected
+    CPPUNIT_ASSERT(drain(NULL, frames) == frames);
+
+    codedFrame->clear();
+    CPPUNIT_ASSERT(!encoder->doProcessFrame(NULL, codedFrame));
+}
+
+void VideoEncoderChunkedTest::flushEventTest()
+{
+    unsigned frames = CHUNK_FRAMES/2;
+
+    pushFrames(frames);
+    CPPUNIT_ASSERT(outputFrames == 0);
+
+    CPPUNIT_ASSERT(encoder->flushEvent(NULL));
+    CPPUNIT_ASSERT(drain(rawFrame, frames) == frames);
+}
+
+void VideoEncoderChunkedTest::persistentWorkersTest()
+{
+    unsigned frames = CHUNK_FRAMES*6;
+
+    pushFrames(frames);
+    CPPUNIT_ASSERT(drain(rawFrame, frames) == frames);
+
+    //NOTE: chunks are encoded by the same 2 threads instead of one thread per chunk
+    CPPUNIT_ASSERT(encoder->encoders.size() == 2);
+    CPPUNIT_ASSERT(encoder->bufferedSize == 0);
+}
+
+void VideoEncoderChunkedTest::pausedInputTest()
+{
+    std::chrono::system_clock::time_point deadline;
+
+    encoder->maxBufferSize = 1;
+
+    //NOTE: the chunk being filled alone does not pause the input
+    pushFrames(CHUNK_FRAMES - 1);
+    CPPUNIT_ASSERT(encoder->bufferedSize == (CHUNK_FRAMES - 1) * WIDTH * HEIGHT * 3 / 2);
+    CPPUNIT_ASSERT(!encoder->isInputPaused());
+
+    //NOTE: the complete chunk pauses the input until it is encoded, runs without input
+    //neither block nor dispatch a new chunk meanwhile
+    pushFrames(1);
+    deadline = std::chrono::system_clock::now() + std::chrono::milliseconds(CHUNK_FLUSH_TIMEOUT/2);
+
+    while (encoder->isInputPaused() && std::chrono::system_clock::now() < deadline) {
+        codedFrame->clear();
+        CPPUNIT_ASSERT(!encoder->doProcessFrame(NULL, codedFrame));
+        std::this_thread::sleep_for(std::chrono::milliseconds(CHUNK_POLL_TIME));
+    }
+
+    CPPUNIT_ASSERT(!encoder->isInputPaused());
+    CPPUNIT_ASSERT(encoder->bufferedSize == 0);
+    CPPUNIT_ASSERT(drain(rawFrame, CHUNK_FRAMES) == CHUNK_FRAMES);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(VideoEncoderChunkedTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("VideoEncoderChunkedTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+/*
+ *  VideoEncoderLadderTest.cpp - VideoEncoderLadder class test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstdlib>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "modules/videoEncoder/VideoEncoderLadder.hh"
+
+#define WIDTH 128
+#define HEIGHT 96
+#define FPS 25
+#define GOP 10
+#define LOOKAHEAD 0
+#define Y_VALUE 100
+#define U_VALUE 50
+#define V_VALUE 200
+
+class VideoEncoderLadderMock : public VideoEncoderLadder
+{
+public:
+    using VideoEncoderLadder::doProcessFrame;
+    using VideoEncoderLadder::configure0;
+    using VideoEncoderLadder::Rendition;
+    using VideoEncoderLadder::renditions;
+    using VideoEncoderLadder::cascade;
+    using VideoEncoderLadder::inPicture;
+};
+
+class VideoEncoderLadderTest : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(VideoEncoderLadderTest);
+    CPPUNIT_TEST(rungsSortTest);
+    CPPUNIT_TEST(scaleSourceTest);
+    CPPUNIT_TEST(disabledRungTest);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+protected:
+    void rungsSortTest();
+    void scaleSourceTest();
+    void disabledRungTest();
+
+    void configure(std::vector<LadderRung> rungs);
+    void processFrame();
+    std::vector<int> getCascadeIds();
+    //NOTE: checks the value of the central pixel of each plane
+    void checkPicture(AVFrame *picture);
+
+    VideoEncoderLadderMock* encoder;
+    InterleavedVideoFrame* rawFrame;
+    std::map<int, Frame*> dstFrames;
+    std::vector<LadderRung> rungs;
+};
+
+void VideoEncoderLadderTest::setUp()
+{
+    unsigned char *planes[MAX_PLANES];
+    int strides[MAX_PLANES];
+
+    encoder = new VideoEncoderLadderMock();
+    rawFrame = InterleavedVideoFrame::createNew(RAW, WIDTH, HEIGHT, YUV420P);
+
+    CPPUNIT_ASSERT(rawFrame->getPlanes(planes, strides) > 0);
+    memset(planes[0], Y_VALUE, strides[0] * HEIGHT);
+    memset(planes[1], U_VALUE, strides[1] * HEIGHT / 2);
+    memset(planes[2], V_VALUE, strides[2] * HEIGHT / 2);
+
+    //NOTE: listed unsorted, 3 and 4 have the same size
+    rungs = {{1, WIDTH / 4, HEIGHT / 4, 100}, {2, WIDTH, HEIGHT, 800},
+             {3, WIDTH / 2, HEIGHT / 2, 400}, {4, WIDTH / 2, HEIGHT / 2, 300}};
+
+    for (auto rung : rungs) {
+        dstFrames[rung.id] = SlicedVideoFrame::createNew(H264);
+    }
+}
+
+void VideoEncoderLadderTest::tearDown()
+{
+    delete encoder;
+    delete rawFrame;
+
+    for (auto it : dstFrames) {
+        delete it.second;
+    }
+
+    dstFrames.clear();
+}
+
+void VideoEncoderLadderTest::configure(std::vector<LadderRung> rungs)
+{
+    CPPUNIT_ASSERT(encoder->configure0(rungs, FPS, GOP, LOOKAHEAD, DEFAULT_LADDER_THREADS, DEFAULT_PRESET));
+}
+
+void VideoEncoderLadderTest::processFrame()
+{
+    encoder->doProcessFrame(rawFrame, dstFrames);
+    CPPUNIT_ASSERT(!encoder->cascade.empty());
+}
+
+std::vector<int> VideoEncoderLadderTest::getCascadeIds()
+{
+    std::vector<int> ids;
+
+    for (auto r : encoder->cascade) {
+        ids.push_back(r->config.id);
+    }
+
+    return ids;
+}
+
+void VideoEncoderLadderTest::checkPicture(AVFrame *picture)
+{
+    int values[] = {Y_VALUE, U_VALUE, V_VALUE};
+
+    for (int i = 0; i < 3; i++) {
+        int x = (i == 0 ? picture->width : picture->width / 2) / 2;
+        int y = (i == 0 ? picture->height : picture->height / 2) / 2;
+
+        CPPUNIT_ASSERT(abs(picture->data[i][y * picture->linesize[i] + x] - values[i]) <= 2);
+    }
+}
+
+void VideoEncoderLadderTest::rungsSortTest()
+{
+    std::vector<int> expected = {2, 3, 4, 1};
+
+    configure(rungs);
+    processFrame();
+
+    //NOTE: decreasing size, renditions of the same size keep their id order
+    CPPUNIT_ASSERT(getCascadeIds() == expected);
+
+    for (unsigned i = 0; i < expected.size(); i++) {
+        CPPUNIT_ASSERT(encoder->cascade[i] == encoder->renditions[expected[i]]);
+        CPPUNIT_ASSERT(encoder->cascade[i]->picture->width == encoder->cascade[i]->config.width);
+        CPPUNIT_ASSERT(encoder->cascade[i]->picture->height == encoder->cascade[i]->config.height);
+    }
+}
+
+void VideoEncoderLadderTest::scaleSourceTest()
+{
+    VideoEncoderLadderMock::Rendition *full, *half, *sameHalf, *quarter;
+
+    configure(rungs);
+    processFrame();
+
+    full = encoder->renditions[2];
+    half = encoder->renditions[3];
+    sameHalf = encoder->renditions[4];
+    quarter = encoder->renditions[1];
+
+    //NOTE: renditions with the size of their source share its picture instead of scaling it
+    CPPUNIT_ASSERT(!full->scaler);
+    CPPUNIT_ASSERT(full->picture->data[0] == encoder->inPicture->data[0]);
+    CPPUNIT_ASSERT(!sameHalf->scaler);
+    CPPUNIT_ASSERT(sameHalf->picture->data[0] == half->picture->data[0]);
+
+    //NOTE: the others own a picture scaled from the previous rendition
+    CPPUNIT_ASSERT(half->scaler);
+    CPPUNIT_ASSERT(half->picture->data[0] != full->picture->data[0]);
+    CPPUNIT_ASSERT(quarter->scaler);
+    CPPUNIT_ASSERT(quarter->picture->data[0] != sameHalf->picture->data[0]);
+
+    for (auto r : encoder->cascade) {
+        checkPicture(r->picture);
+    }
+}
+
+void VideoEncoderLadderTest::disabledRungTest()
+{
+    std::vector<int> expected = {2, 4, 1};
+
+    configure(rungs);
+    processFrame();
+
+    //NOTE: without rendition 3, rendition 4 becomes the one scaled from the full size picture
+    configure({rungs[0], rungs[1], rungs[3]});
+    processFrame();
+
+    CPPUNIT_ASSERT(getCascadeIds() == expected);
+    CPPUNIT_ASSERT(!encoder->renditions[3]->enabled);
+    CPPUNIT_ASSERT(!encoder->renditions[3]->encoder);
+    CPPUNIT_ASSERT(!encoder->renditions[3]->scaler);
+    CPPUNIT_ASSERT(encoder->renditions[4]->scaler);
+
+    for (auto r : encoder->cascade) {
+        checkPicture(r->picture);
+    }
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(VideoEncoderLadderTest);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("VideoEncoderLadderTest.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+/*
+ *  VideoEncoderX264Test.cpp - VideoEncoderX264 class test
+ *  Copyright (C) 2015  Fundació i2CAT, Internet i Innovació digital a Catalunya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <cppunit/ui/text/TextTestRunner.h>
+#include <cppunit/TestResult.h>
+#include <cppunit/TestResultCollector.h>
+#include <cppunit/XmlOutputter.h>
+
+#include "modules/videoEncoder/VideoEncoderX264.hh"
+
+#define WIDTH 64
+#define HEIGHT 48
+#define GOP 10
+#define FPS 25
+#define LOOKAHEAD 5
+
+class VideoEncoderX264Mock : public VideoEncoderX264
+{
+public:
+    using VideoEncoderX264::doProcessFrame;
+    using VideoEncoderX264::configure0;
+    using VideoEncoderX264::hasPendingOutput;
+    using VideoEncoderX264::hasQueuedOutputs;
+    using VideoEncoderX264::encoderSwitches;
+    using VideoEncoderX264::duplicateFramesEvent;
+    using VideoEncoderX264::setIntra;
+    using VideoEncoderX264::skipFrame;
+
+    std::vector<unsigned char> getHeaders() {
+        return std::vector<unsigned char>(outputStreamInfo->extradata,
+                                          outputStreamInfo->extradata + outputStreamInfo->extradata_size);
+    };
+};
+
+static bool hasIdrSlice(SlicedVideoFrame *frame)
+{
+    Slice *slices = frame->getSlices();
+
+    for (int i = 0; i < frame->getSliceNum(); i++) {
+        unsigned char *data = slices[i].getData();
+        unsigned startCode = data[2] == 1 ? 3 : 4;
+
+        if (slices[i].getDataSize() > startCode && (data[startCode] & 0x1f) == 5) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+class VideoEncoderX264Test : public CppUnit::TestFixture
+{
+    CPPUNIT_TEST_SUITE(VideoEncoderX264Test);
+    CPPUNIT_TEST(switchMoreBFramesTest);
+    CPPUNIT_TEST(switchLessDelayTest);
+    CPPUNIT_TEST(skipDuplicatesTest);
+    CPPUNIT_TEST(dropDuplicatesTest);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void setUp();
+    void tearDown();
+
+protected:
+    void switchMoreBFramesTest();
+    void switchLessDelayTest();
+    void skipDuplicatesTest();
+    void dropDuplicatesTest();
+
+    void pushFrames(unsigned frames);
+    //NOTE: feeds a frame identical to the previous one, returns if it was output
+    bool pushDuplicate();
+    void setDuplicateMode(std::string mode);
+    unsigned getStateValue(std::string key);
+    void checkOutput();
+    //NOTE: feeds frames until the encoder switch, waiting for the new encoder to be opened
+    void pushUntilSwitch(unsigned switches);
+
+    VideoEncoderX264Mock* encoder;
+    InterleavedVideoFrame* rawFrame;
+    SlicedVideoFrame* codedFrame;
+    std::chrono::microseconds pts;
+    std::chrono::microseconds lastDts;
+    std::vector<unsigned char> headers;
+    unsigned inputFrames;
+    unsigned outputFrames;
+    unsigned headerChanges;
+};
+
+void VideoEncoderX264Test::setUp()
+{
+    encoder = new VideoEncoderX264Mock();
+    rawFrame = InterleavedVideoFrame::createNew(RAW, WIDTH, HEIGHT, YUV420P);
+    codedFrame = SlicedVideoFrame::createNew(H264);
+    pts = std::chrono::microseconds(std::micro::den);
+    lastDts = std::chrono::microseconds(0);
+    inputFrames = 0;
+    outputFrames = 0;
+    headerChanges = 0;
+}
+
+void VideoEncoderX264Test::tearDown()
+{
+    delete encoder;
+    delete rawFrame;
+    delete codedFrame;
+}
+
+void VideoEncoderX264Test::checkOutput()
+{
+    std::vector<unsigned char> currentHeaders = encoder->getHeaders();
+
+    CPPUNIT_ASSERT(codedFrame->getSliceNum() > 0);
+    CPPUNIT_ASSERT(codedFrame->getDecodeTime() > lastDts);
+    CPPUNIT_ASSERT(codedFrame->getDecodeTime() <= codedFrame->getPresentationTime());
+    lastDts = codedFrame->getDecodeTime();
+    outputFrames++;
+
+    //NOTE: headers of a new encoder are set with its first frame
+    if (!headers.empty() && currentHeaders != headers) {
+        CPPUNIT_ASSERT(hasIdrSlice(codedFrame));
+        headerChanges++;
+    }
+
+    headers = currentHeaders;
+}
+
+void VideoEncoderX264Test::pushFrames(unsigned frames)
+{
+    for (unsigned i = 0; i < frames; i++) {
+        rawFrame->setConsumed(true);
+        rawFrame->setPresentationTime(pts);
+        rawFrame->getDataBuf()[0] = inputFrames++;
+        codedFrame->clear();
+
+        if (encoder->doProcessFrame(rawFrame, codedFrame)) {
+            checkOutput();
+        }
+
+        while (encoder->hasPendingOutput()) {
+            codedFrame->clear();
+            CPPUNIT_ASSERT(encoder->doProcessFrame(NULL, codedFrame));
+            checkOutput();
+        }
+
+        pts += std::chrono::microseconds(std::micro::den/FPS);
+    }
+}
+
+bool VideoEncoderX264Test::pushDuplicate()
+{
+    bool output;
+
+    rawFrame->setConsumed(true);
+    rawFrame->setPresentationTime(pts);
+    codedFrame->clear();
+    pts += std::chrono::microseconds(std::micro::den/FPS);
+
+    output = encoder->doProcessFrame(rawFrame, codedFrame);
+
+    if (output) {
+        checkOutput();
+    }
+
+    return output;
+}
+
+void VideoEncoderX264Test::setDuplicateMode(std::string mode)
+{
+    Jzon::Object params;
+
+    params.Add("mode", mode);
+    CPPUNIT_ASSERT(encoder->duplicateFramesEvent(&params));
+}
+
+unsigned VideoEncoderX264Test::getStateValue(std::string key)
+{
+    Jzon::Object state;
+
+    encoder->getState(state);
+    return std::stoi(state.Get(key).ToString());
+}
+
+void VideoEncoderX264Test::pushUntilSwitch(unsigned switches)
+{
+    for (unsigned i = 0; i < GOP*10 && encoder->encoderSwitches < switches; i++) {
+        pushFrames(1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    CPPUNIT_ASSERT(encoder->encoderSwitches == switches);
+}
+
+void VideoEncoderX264Test::switchMoreBFramesTest()
+{
+    CPPUNIT_ASSERT(encoder->configure0(1000, FPS, GOP, 0, 1, true, "ultrafast", 0));
+    pushFrames(GOP + 1);
+
+    //NOTE: frames of the new encoder are decoded before the first input frame time
+    CPPUNIT_ASSERT(encoder->configure0(1000, FPS, GOP, LOOKAHEAD, 1, true, "ultrafast", 3));
+    pushUntilSwitch(1);
+    pushFrames(GOP*2);
+
+    CPPUNIT_ASSERT(!encoder->hasQueuedOutputs());
+    CPPUNIT_ASSERT(headerChanges == 1);
+}
+
+void VideoEncoderX264Test::switchLessDelayTest()
+{
+    CPPUNIT_ASSERT(encoder->configure0(1000, FPS, GOP, LOOKAHEAD, 1, true, "ultrafast", 3));
+    pushFrames(GOP + 1);
+
+    //NOTE: the new encoder outputs before the previous one is drained,
+    //these frames are queued and written at once when it is empty
+    CPPUNIT_ASSERT(encoder->configure0(1000, FPS, GOP, 0, 1, true, "ultrafast", 0));
+    pushUntilSwitch(1);
+    pushFrames(GOP);
+
+    CPPUNIT_ASSERT(!encoder->hasQueuedOutputs());
+    CPPUNIT_ASSERT(headerChanges == 1);
+    //NOTE: the new encoder has no delay, so every input frame since the switch is output
+    CPPUNIT_ASSERT(outputFrames >= inputFrames - 1);
+}
+
+void VideoEncoderX264Test::skipDuplicatesTest()
+{
+    CPPUNIT_ASSERT(encoder->configure0(1000, FPS, GOP, 0, 1, true, "ultrafast", 0));
+    setDuplicateMode("skip");
+
+    //NOTE: the first frame has nothing to be compared with
+    pushFrames(1);
+    CPPUNIT_ASSERT(!encoder->skipFrame);
+
+    //NOTE: duplicates are still output, at the skip quantizer but for GOP start frames
+    for (unsigned i = 1; i < GOP*2; i++) {
+        CPPUNIT_ASSERT(pushDuplicate());
+        CPPUNIT_ASSERT(encoder->skipFrame == (i % GOP != 0));
+    }
+
+    encoder->setIntra();
+    CPPUNIT_ASSERT(pushDuplicate());
+    CPPUNIT_ASSERT(!encoder->skipFrame);
+
+    CPPUNIT_ASSERT(pushDuplicate());
+    CPPUNIT_ASSERT(encoder->skipFrame);
+
+    //NOTE: a different frame ends the duplicates
+    pushFrames(1);
+    CPPUNIT_ASSERT(!encoder->skipFrame);
+
+    CPPUNIT_ASSERT(getStateValue("duplicateFrames") == GOP*2 + 1);
+    CPPUNIT_ASSERT(getStateValue("droppedFrames") == 0);
+}
+
+void VideoEncoderX264Test::dropDuplicatesTest()
+{
+    unsigned output = 0;
+
+    CPPUNIT_ASSERT(encoder->configure0(1000, FPS, GOP, 0, 1, true, "ultrafast", 0));
+    setDuplicateMode("drop");
+    pushFrames(1);
+
+    //NOTE: a run of duplicates outputs one frame every GOP
+    for (unsigned i = 0; i < GOP*3; i++) {
+        if (pushDuplicate()) {
+            CPPUNIT_ASSERT(i % GOP == GOP - 1);
+            output++;
+        }
+    }
+
+    CPPUNIT_ASSERT(output == 3);
+    CPPUNIT_ASSERT(getStateValue("droppedFrames") == (GOP - 1)*3);
+
+    //NOTE: forced intra frames are never dropped
+    CPPUNIT_ASSERT(!pushDuplicate());
+    encoder->setIntra();
+    CPPUNIT_ASSERT(pushDuplicate());
+    CPPUNIT_ASSERT(!pushDuplicate());
+
+    //NOTE: dropped frames are not shown as duplicates being encoded
+    CPPUNIT_ASSERT(!encoder->skipFrame);
+    pushFrames(1);
+    CPPUNIT_ASSERT(outputFrames == 1 + 3 + 1 + 1);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(VideoEncoderX264Test);
+
+int main(int argc, char* argv[])
+{
+    std::ofstream xmlout("VideoEncoderX264Test.xml");
+    CPPUNIT_NS::TextTestRunner runner;
+    CPPUNIT_NS::XmlOutputter *outputter = new CPPUNIT_NS::XmlOutputter(&runner.result(), xmlout);
+
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+    runner.run("", false);
+    outputter->write();
+
+    utils::printMood(runner.result().wasSuccessful());
+    delete outputter;
+
+    return runner.result().wasSuccessful() ? 0 : 1;
+}
@@ -21,6 +21,9 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <string.h>
+#include <vector>
+#include <algorithm>
 
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -30,6 +33,7 @@
 #include <cppunit/XmlOutputter.h>
 
 #include "modules/videoSplitter/VideoSplitter.hh"
+#include "modules/videoSplitter/Rotation.hh"
 
 class VideoSplitterMock : public VideoSplitter {
 	public:
@@ -44,11 +48,17 @@ class VideoSplitterTest : public CppUnit::TestFixture {
 	CPPUNIT_TEST_SUITE(VideoSplitterTest);
 	CPPUNIT_TEST(constructorTest);
 	CPPUNIT_TEST(cropConfigTest);
+	CPPUNIT_TEST(rotationTest);
+	CPPUNIT_TEST(rotationStep1Test);
+	CPPUNIT_TEST(rotationStep4Test);
 	CPPUNIT_TEST_SUITE_END();
 
 	protected:
 		void constructorTest();
 		void cropConfigTest();
+		void rotationTest();
+		void rotationStep1Test();
+		void rotationStep4Test();
 };
 
 void VideoSplitterTest::constructorTest(){
@@ -98,6 +108,67 @@ void VideoSplitterTest::cropConfigTest(){
 	delete splitter;
 }
 
+static void checkRotation(int w, int h, int step, int padding)
+{
+	int srcStride = w*step + padding;
+	int dstStride = std::max(w, h)*step + padding;
+	std::vector<unsigned char> src(srcStride*h);
+	std::vector<unsigned char> rot(dstStride*std::max(w, h), 0);
+	std::vector<unsigned char> bil(dstStride*std::max(w, h), 0);
+	int rWidth, rHeight;
+
+	for (unsigned i = 0; i < src.size(); i++){
+		src[i] = i*7;
+	}
+
+	CPPUNIT_ASSERT(!rotation::rotatePlane(src.data(), srcStride, w, h, step, rot.data(), dstStride, 45));
+
+	for (int degree = 90; degree < 360; degree += 90){
+		rotation::getRotatedSize(w, h, degree, rWidth, rHeight);
+		CPPUNIT_ASSERT(rotation::rotatePlane(src.data(), srcStride, w, h, step, rot.data(), dstStride, degree));
+		rotation::rotatePlaneBilinear(src.data(), srcStride, w, h, step, bil.data(), dstStride, rWidth, rHeight, degree, 0);
+
+		for (int y = 0; y < h; y++){
+			for (int x = 0; x < w; x++){
+				int dx = degree == 90 ? h - 1 - y : degree == 180 ? w - 1 - x : y;
+				int dy = degree == 90 ? x : degree == 180 ? h - 1 - y : w - 1 - x;
+				CPPUNIT_ASSERT(memcmp(&rot[dy*dstStride + dx*step], &src[y*srcStride + x*step], step) == 0);
+			}
+		}
+
+		for (int y = 0; y < rHeight; y++){
+			CPPUNIT_ASSERT(memcmp(&rot[y*dstStride], &bil[y*dstStride], rWidth*step) == 0);
+		}
+	}
+}
+
+void VideoSplitterTest::rotationTest(){
+
+	int rWidth, rHeight;
+
+	rotation::getRotatedSize(37, 21, -90, rWidth, rHeight);
+	CPPUNIT_ASSERT(rWidth == 21 && rHeight == 37);
+	rotation::getRotatedSize(37, 21, 180, rWidth, rHeight);
+	CPPUNIT_ASSERT(rWidth == 37 && rHeight == 21);
+
+	checkRotation(37, 21, 3, 0);
+}
+
+//NOTE: sizes which are not multiple of the SSE2 tiles and rows, nor of the cache blocks
+void VideoSplitterTest::rotationStep1Test(){
+
+	checkRotation(37, 21, 1, 0);
+	checkRotation(77, 45, 1, 11);
+	checkRotation(16, 8, 1, 0);
+}
+
+void VideoSplitterTest::rotationStep4Test(){
+
+	checkRotation(37, 21, 4, 0);
+	checkRotation(45, 70, 4, 12);
+	checkRotation(4, 4, 4, 0);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(VideoSplitterTest);
 
 int main(int argc, char* argv[])